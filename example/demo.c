@@ -798,6 +798,22 @@ void drawLines(NVGcontext* vg, float x, float y, float w, float h, float t)
 		}
 	}
 
+	// Degenerate paths, a lone move and sub-paths of one repeated point, draw nothing with any join.
+	for (j = 0; j < 3; j++) {
+		fx = x + s*0.5f + j/9.0f*w + pad;
+		fy = y - s*0.5f + pad;
+		nvgLineJoin(vg, joins[j]);
+		nvgBeginPath(vg);
+		nvgMoveTo(vg, fx, fy);
+		nvgStroke(vg);
+		nvgBeginPath(vg);
+		nvgMoveTo(vg, fx, fy);
+		nvgLineTo(vg, fx, fy);
+		nvgMoveTo(vg, fx+pts[2], fy+pts[3]);
+		nvgLineTo(vg, fx+pts[2], fy+pts[3]);
+		nvgClosePath(vg);
+		nvgStroke(vg);
+	}
 
 	nvgRestore(vg);
 }
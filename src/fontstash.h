@@ -24,6 +24,8 @@
 enum FONSflags {
 	FONS_ZERO_TOPLEFT = 1,
 	FONS_ZERO_BOTTOMLEFT = 2,
+	// Disables kerning, fonts added by the stash do not build their kerning table.
+	FONS_NO_KERNING = 4,
 };
 
 enum FONSalign {
@@ -82,6 +84,7 @@ struct FONStextIter {
 	const char* str;
 	const char* next;
 	const char* end;
+	const char* asciiEnd;
 	unsigned int utf8state;
 	int bitmapOption;
 };
@@ -92,6 +95,9 @@ typedef struct FONScontext FONScontext;
 // Constructor and destructor.
 FONScontext* fonsCreateInternal(FONSparams* params);
 void fonsDeleteInternal(FONScontext* s);
+// Creates a stash which shares fonts, glyphs and the atlas with another stash.
+// The stashes can be used from different threads, each keeps its own state and dirty rect.
+FONScontext* fonsCreateShared(FONSparams* params, FONScontext* other);
 
 void fonsSetErrorCallback(FONScontext* s, void (*callback)(void* uptr, int error, int val), void* uptr);
 // Returns current atlas size.
@@ -100,6 +106,8 @@ void fonsGetAtlasSize(FONScontext* s, int* width, int* height);
 int fonsExpandAtlas(FONScontext* s, int width, int height);
 // Resets the whole stash.
 int fonsResetAtlas(FONScontext* stash, int width, int height);
+// Switches to the atlas of another stash after it was reset or expanded, returns 1 if the atlas changed.
+int fonsSyncAtlas(FONScontext* s);
 
 // Add fonts
 int fonsAddFont(FONScontext* s, const char* name, const char* path, int fontIndex);
@@ -131,10 +139,30 @@ void fonsVertMetrics(FONScontext* s, float* ascender, float* descender, float* l
 // Text iterator
 int fonsTextIterInit(FONScontext* stash, FONStextIter* iter, float x, float y, const char* str, const char* end, int bitmapOption);
 int fonsTextIterNext(FONScontext* stash, FONStextIter* iter, struct FONSquad* quad);
+// Like fonsTextIterNext(), but only computes the position of the quad for measuring text,
+// the texture coordinates are left untouched. Use with FONS_GLYPH_BITMAP_OPTIONAL.
+int fonsTextIterMeasure(FONScontext* stash, FONStextIter* iter, struct FONSquad* quad);
+
+// Thread-safe measurement. The font, size and letter spacing are passed in instead of read from the
+// stash state, blur, dilation and alignment are not applied. The glyph metrics are read from the font
+// data, so neither the stash nor the glyph cache is changed, and the functions can be called from any
+// thread while the stash and the stashes sharing its fonts are in use. Fonts and fallback fonts must not
+// be added or reset at the same time.
+int fonsMeasureIterInit(FONScontext* stash, FONStextIter* iter, int font, float size, float spacing,
+						float x, float y, const char* str, const char* end);
+// Computes the position of the next quad, the texture coordinates are left untouched.
+int fonsMeasureIterNext(FONScontext* stash, FONStextIter* iter, struct FONSquad* quad);
+// Returns the advance of the text starting at x, y on the baseline. If bounds is not NULL,
+// it receives the bounding box of the glyph quads [xmin,ymin, xmax,ymax].
+float fonsMeasureText(FONScontext* stash, int font, float size, float spacing,
+					  float x, float y, const char* str, const char* end, float* bounds);
 
 // Pull texture changes
 const unsigned char* fonsGetTextureData(FONScontext* stash, int* width, int* height);
 int fonsValidateTexture(FONScontext* s, int* dirty);
+// Hold the lock while pulling texture changes from a shared stash.
+void fonsLockTexture(FONScontext* s);
+void fonsUnlockTexture(FONScontext* s);
 
 // Draws the stash texture for debugging
 void fonsDrawDebug(FONScontext* s, float x, float y);
@@ -146,6 +174,25 @@ void fonsDrawDebug(FONScontext* s, float x, float y);
 
 #define FONS_NOTUSED(v)  (void)sizeof(v)
 
+#ifndef FONS_NO_THREADS
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
+// Glyph blur and dilation use SSE2 or NEON when the target has them, define FONS_NO_SIMD to force the scalar code.
+#ifndef FONS_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FONS_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FONS_NEON 1
+#endif
+#endif
+
 #ifdef FONS_USE_FREETYPE
 
 #include <ft2build.h>
@@ -199,6 +246,17 @@ typedef struct FONSttFontImpl FONSttFontImpl;
 #ifndef FONS_MAX_FALLBACKS
 #	define FONS_MAX_FALLBACKS 20
 #endif
+// Kerning between the glyphs of this codepoint range is looked up from a table built when the font is added.
+#ifndef FONS_KERN_FIRST
+#	define FONS_KERN_FIRST 32
+#endif
+#ifndef FONS_KERN_LAST
+#	define FONS_KERN_LAST 126
+#endif
+// Number of glyphs each stash caches locally, must be power of two.
+#ifndef FONS_GLYPH_CACHE_SIZE
+#	define FONS_GLYPH_CACHE_SIZE 256
+#endif
 
 static unsigned int fons__hashint(unsigned int a)
 {
@@ -248,6 +306,17 @@ struct FONSfont
 	int lut[FONS_HASH_LUT_SIZE];
 	int fallbacks[FONS_MAX_FALLBACKS];
 	int nfallbacks;
+	int rangeGlyphs[FONS_KERN_LAST-FONS_KERN_FIRST+1];	// Glyph indices of FONS_KERN_FIRST..FONS_KERN_LAST.
+	short* kern;	// Kerning between the table glyphs in font units, nkern x nkern.
+	int nkern;
+	unsigned short* kernMap;	// Glyph index to kerning table row plus one, zero if not in the table.
+	int nkernMap;
+	// Resolved glyphs per codepoint, see fons__resolveGlyph(). The BMP is kept in pages
+	// of 256 codepoints, codepoints above it in an open addressing hash of codepoint, entry pairs.
+	unsigned int* cmapPages[256];
+	unsigned int* cmapHash;
+	int ncmapHash;
+	int ccmapHash;
 };
 typedef struct FONSfont FONSfont;
 
@@ -277,34 +346,110 @@ struct FONSatlas
 };
 typedef struct FONSatlas FONSatlas;
 
+#ifndef FONS_NO_THREADS
+#ifdef _WIN32
+typedef CRITICAL_SECTION FONSmutex;
+#else
+typedef pthread_mutex_t FONSmutex;
+#endif
+#else
+typedef int FONSmutex;
+#endif
+
+// Texture data of the atlas. Reset creates a new texture and a new generation,
+// the old one is kept alive until all the stashes using it have switched over.
+struct FONStexture
+{
+	unsigned char* data;
+	int width, height;
+	int generation;
+	int refCount;
+};
+typedef struct FONStexture FONStexture;
+
+// Fonts, glyphs and the atlas shared by one or more stashes, guarded by the lock.
+struct FONScache
+{
+	FONSmutex lock;
+	int refCount;
+	FONSfont** fonts;
+	int cfonts;
+	int nfonts;
+	FONSatlas* atlas;
+	FONStexture* tex;
+	int generation;
+	struct FONScontext** stashes;
+	int cstashes;
+	int nstashes;
+	struct FONScontext* user;	// Stash rasterizing glyphs, receives scratch errors.
+	unsigned char* scratch;
+	int nscratch;
+#ifdef FONS_USE_FREETYPE
+	FT_Library ftLibrary;
+#endif
+};
+typedef struct FONScache FONScache;
+
+struct FONSglyphSlot
+{
+	FONSfont* font;
+	int generation;
+	FONSglyph glyph;
+};
+typedef struct FONSglyphSlot FONSglyphSlot;
+
+// Glyphs of the 7-bit ASCII range for the last used font and size, indexed by codepoint.
+struct FONSasciiTable
+{
+	FONSfont* font;
+	int generation;
+	short size, blur, dilate;
+	unsigned char state[128];	// 0 empty, 1 glyph without bitmap, 2 glyph with bitmap in this stash's atlas.
+	FONSglyph glyphs[128];
+};
+typedef struct FONSasciiTable FONSasciiTable;
+
 struct FONScontext
 {
 	FONSparams params;
 	float itw,ith;
-	unsigned char* texData;
+	FONScache* cache;
+	FONStexture* tex;
 	int dirtyRect[4];
-	FONSfont** fonts;
-	FONSatlas* atlas;
-	int cfonts;
-	int nfonts;
+	FONSglyphSlot glyphs[FONS_GLYPH_CACHE_SIZE];
+	FONSasciiTable ascii;
 	float verts[FONS_VERTEX_COUNT*2];
 	float tcoords[FONS_VERTEX_COUNT*2];
 	unsigned int colors[FONS_VERTEX_COUNT];
 	int nverts;
-	unsigned char* scratch;
-	int nscratch;
 	FONSstate states[FONS_MAX_STATES];
 	int nstates;
 	void (*handleError)(void* uptr, int error, int val);
 	void* errorUptr;
-#ifdef FONS_USE_FREETYPE
-	FT_Library ftLibrary;
-#endif
 };
 
+#ifndef FONS_NO_THREADS
+#ifdef _WIN32
+static int fons__mutexInit(FONSmutex* m) { InitializeCriticalSection(m); return 1; }
+static void fons__mutexDelete(FONSmutex* m) { DeleteCriticalSection(m); }
+static void fons__lock(FONScache* cache) { EnterCriticalSection(&cache->lock); }
+static void fons__unlock(FONScache* cache) { LeaveCriticalSection(&cache->lock); }
+#else
+static int fons__mutexInit(FONSmutex* m) { return pthread_mutex_init(m, NULL) == 0; }
+static void fons__mutexDelete(FONSmutex* m) { pthread_mutex_destroy(m); }
+static void fons__lock(FONScache* cache) { pthread_mutex_lock(&cache->lock); }
+static void fons__unlock(FONScache* cache) { pthread_mutex_unlock(&cache->lock); }
+#endif
+#else
+static int fons__mutexInit(FONSmutex* m) { *m = 0; return 1; }
+static void fons__mutexDelete(FONSmutex* m) { FONS_NOTUSED(m); }
+static void fons__lock(FONScache* cache) { FONS_NOTUSED(cache); }
+static void fons__unlock(FONScache* cache) { FONS_NOTUSED(cache); }
+#endif
+
 #ifdef FONS_USE_FREETYPE
 
-int fons__tt_init(FONScontext *context)
+int fons__tt_init(FONScache *context)
 {
 	FT_Error ftError;
 	FONS_NOTUSED(context);
@@ -312,7 +457,7 @@ int fons__tt_init(FONScontext *context)
 	return ftError == 0;
 }
 
-int fons__tt_done(FONScontext *context)
+int fons__tt_done(FONScache *context)
 {
 	FT_Error ftError;
 	FONS_NOTUSED(context);
@@ -320,7 +465,7 @@ int fons__tt_done(FONScontext *context)
 	return ftError == 0;
 }
 
-int fons__tt_loadFont(FONScontext *context, FONSttFontImpl *font, unsigned char *data, int dataSize, int fontIndex)
+int fons__tt_loadFont(FONScache *context, FONSttFontImpl *font, unsigned char *data, int dataSize, int fontIndex)
 {
 	FT_Error ftError;
 	FONS_NOTUSED(context);
@@ -398,19 +543,19 @@ int fons__tt_getGlyphKernAdvance(FONSttFontImpl *font, int glyph1, int glyph2)
 
 #else
 
-int fons__tt_init(FONScontext *context)
+int fons__tt_init(FONScache *context)
 {
 	FONS_NOTUSED(context);
 	return 1;
 }
 
-int fons__tt_done(FONScontext *context)
+int fons__tt_done(FONScache *context)
 {
 	FONS_NOTUSED(context);
 	return 1;
 }
 
-int fons__tt_loadFont(FONScontext *context, FONSttFontImpl *font, unsigned char *data, int dataSize, int fontIndex)
+int fons__tt_loadFont(FONScache *context, FONSttFontImpl *font, unsigned char *data, int dataSize, int fontIndex)
 {
 	int offset, stbError;
 	FONS_NOTUSED(dataSize);
@@ -467,18 +612,18 @@ int fons__tt_getGlyphKernAdvance(FONSttFontImpl *font, int glyph1, int glyph2)
 static void* fons__tmpalloc(size_t size, void* up)
 {
 	unsigned char* ptr;
-	FONScontext* stash = (FONScontext*)up;
+	FONScache* cache = (FONScache*)up;
 
 	// 16-byte align the returned pointer
 	size = (size + 0xf) & ~0xf;
 
-	if (stash->nscratch+(int)size > FONS_SCRATCH_BUF_SIZE) {
-		if (stash->handleError)
-			stash->handleError(stash->errorUptr, FONS_SCRATCH_FULL, stash->nscratch+(int)size);
+	if (cache->nscratch+(int)size > FONS_SCRATCH_BUF_SIZE) {
+		if (cache->user != NULL && cache->user->handleError)
+			cache->user->handleError(cache->user->errorUptr, FONS_SCRATCH_FULL, cache->nscratch+(int)size);
 		return NULL;
 	}
-	ptr = stash->scratch + stash->nscratch;
-	stash->nscratch += (int)size;
+	ptr = cache->scratch + cache->nscratch;
+	cache->nscratch += (int)size;
 	return ptr;
 }
 
@@ -530,6 +675,50 @@ static unsigned int fons__decutf8(unsigned int* state, unsigned int* codep, unsi
 	return *state;
 }
 
+// Returns the number of 7-bit ASCII bytes at the start of str.
+static int fons__asciiRun(const char* str, const char* end)
+{
+	const char* s = str;
+#if defined(FONS_SSE2)
+	while (end - s >= 16 && _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)s)) == 0)
+		s += 16;
+#elif defined(FONS_NEON)
+	while (end - s >= 16) {
+		uint8x16_t v = vld1q_u8((const unsigned char*)s);
+		uint32x2_t m = vreinterpret_u32_u8(vorr_u8(vget_low_u8(v), vget_high_u8(v)));
+		if ((vget_lane_u32(m, 0) | vget_lane_u32(m, 1)) & 0x80808080u) break;
+		s += 16;
+	}
+#else
+	unsigned int word;
+	while (end - s >= 4) {
+		memcpy(&word, s, 4);
+		if (word & 0x80808080u) break;
+		s += 4;
+	}
+#endif
+	while (s != end && *(const unsigned char*)s < 0x80)
+		s++;
+	return (int)(s - str);
+}
+
+// Like fons__decutf8() for the byte at str. Once the decoder is between codepoints, the ASCII run
+// starting at str is measured in bulk and its bytes bypass the decoder until asciiEnd.
+static __inline unsigned int fons__decnext(unsigned int* state, unsigned int* codep, const char* str, const char* end, const char** asciiEnd)
+{
+	unsigned int byte = *(const unsigned char*)str;
+	if (str < *asciiEnd) {
+		*codep = byte;
+		return FONS_UTF8_ACCEPT;
+	}
+	if (*state == FONS_UTF8_ACCEPT && byte < 0x80) {
+		*asciiEnd = str + fons__asciiRun(str, end);
+		*codep = byte;
+		return FONS_UTF8_ACCEPT;
+	}
+	return fons__decutf8(state, codep, byte);
+}
+
 // Atlas based on Skyline Bin Packer by Jukka Jylänki
 
 static void fons__deleteAtlas(FONSatlas* atlas)
@@ -712,30 +901,192 @@ static int fons__atlasAddRect(FONSatlas* atlas, int rw, int rh, int* rx, int* ry
 	return 1;
 }
 
-static void fons__addWhiteRect(FONScontext* stash, int w, int h)
+static int fons__atlasUsedHeight(FONSatlas* atlas)
+{
+	int i, maxy = 0;
+	for (i = 0; i < atlas->nnodes; i++)
+		maxy = fons__maxi(maxy, atlas->nodes[i].y);
+	return maxy;
+}
+
+static FONStexture* fons__allocTexture(int width, int height, int generation)
+{
+	FONStexture* tex = (FONStexture*)malloc(sizeof(FONStexture));
+	if (tex == NULL) return NULL;
+	tex->data = (unsigned char*)malloc(width * height);
+	if (tex->data == NULL) {
+		free(tex);
+		return NULL;
+	}
+	memset(tex->data, 0, width * height);
+	tex->width = width;
+	tex->height = height;
+	tex->generation = generation;
+	tex->refCount = 1;
+	return tex;
+}
+
+static void fons__releaseTexture(FONStexture* tex)
+{
+	if (tex == NULL) return;
+	if (--tex->refCount > 0) return;
+	free(tex->data);
+	free(tex);
+}
+
+static void fons__resetDirty(FONScontext* stash)
+{
+	stash->dirtyRect[0] = stash->params.width;
+	stash->dirtyRect[1] = stash->params.height;
+	stash->dirtyRect[2] = 0;
+	stash->dirtyRect[3] = 0;
+}
+
+// Marks the rect dirty in all stashes using the current texture.
+static void fons__markDirty(FONScache* cache, int x0, int y0, int x1, int y1)
+{
+	int i;
+	for (i = 0; i < cache->nstashes; i++) {
+		FONScontext* stash = cache->stashes[i];
+		if (stash->tex != cache->tex) continue;
+		stash->dirtyRect[0] = fons__mini(stash->dirtyRect[0], x0);
+		stash->dirtyRect[1] = fons__mini(stash->dirtyRect[1], y0);
+		stash->dirtyRect[2] = fons__maxi(stash->dirtyRect[2], x1);
+		stash->dirtyRect[3] = fons__maxi(stash->dirtyRect[3], y1);
+	}
+}
+
+// Switches the stash to the texture, called with the lock held.
+static void fons__useTexture(FONScontext* stash, FONStexture* tex)
+{
+	tex->refCount++;
+	fons__releaseTexture(stash->tex);
+	stash->tex = tex;
+	stash->params.width = tex->width;
+	stash->params.height = tex->height;
+	stash->itw = 1.0f/stash->params.width;
+	stash->ith = 1.0f/stash->params.height;
+}
+
+static void fons__addWhiteRect(FONScache* cache, int w, int h)
 {
 	int x, y, gx, gy;
 	unsigned char* dst;
-	if (fons__atlasAddRect(stash->atlas, w, h, &gx, &gy) == 0)
+	if (fons__atlasAddRect(cache->atlas, w, h, &gx, &gy) == 0)
 		return;
 
 	// Rasterize
-	dst = &stash->texData[gx + gy * stash->params.width];
+	dst = &cache->tex->data[gx + gy * cache->tex->width];
 	for (y = 0; y < h; y++) {
 		for (x = 0; x < w; x++)
 			dst[x] = 0xff;
-		dst += stash->params.width;
+		dst += cache->tex->width;
+	}
+
+	fons__markDirty(cache, gx, gy, gx+w, gy+h);
+}
+
+static void fons__freeFont(FONSfont* font);
+static void fons__clearCmap(FONSfont* font);
+
+static void fons__deleteCache(FONScache* cache)
+{
+	int i;
+	if (cache == NULL) return;
+
+	for (i = 0; i < cache->nfonts; ++i)
+		fons__freeFont(cache->fonts[i]);
+
+	if (cache->atlas) fons__deleteAtlas(cache->atlas);
+	if (cache->fonts) free(cache->fonts);
+	if (cache->stashes) free(cache->stashes);
+	if (cache->scratch) free(cache->scratch);
+	fons__releaseTexture(cache->tex);
+	fons__tt_done(cache);
+	fons__mutexDelete(&cache->lock);
+	free(cache);
+}
+
+static FONScache* fons__createCache(int width, int height)
+{
+	FONScache* cache = (FONScache*)malloc(sizeof(FONScache));
+	if (cache == NULL) return NULL;
+	memset(cache, 0, sizeof(FONScache));
+
+	if (!fons__mutexInit(&cache->lock)) {
+		free(cache);
+		return NULL;
+	}
+
+	// Allocate scratch buffer.
+	cache->scratch = (unsigned char*)malloc(FONS_SCRATCH_BUF_SIZE);
+	if (cache->scratch == NULL) goto error;
+
+	// Initialize implementation library
+	if (!fons__tt_init(cache)) goto error;
+
+	cache->atlas = fons__allocAtlas(width, height, FONS_INIT_ATLAS_NODES);
+	if (cache->atlas == NULL) goto error;
+
+	// Allocate space for fonts.
+	cache->fonts = (FONSfont**)malloc(sizeof(FONSfont*) * FONS_INIT_FONTS);
+	if (cache->fonts == NULL) goto error;
+	memset(cache->fonts, 0, sizeof(FONSfont*) * FONS_INIT_FONTS);
+	cache->cfonts = FONS_INIT_FONTS;
+	cache->nfonts = 0;
+
+	// Create texture for the cache.
+	cache->tex = fons__allocTexture(width, height, 0);
+	if (cache->tex == NULL) goto error;
+
+	// Add white rect at 0,0 for debug drawing.
+	fons__addWhiteRect(cache, 2,2);
+
+	return cache;
+
+error:
+	fons__deleteCache(cache);
+	return NULL;
+}
+
+static int fons__addStash(FONScache* cache, FONScontext* stash)
+{
+	if (cache->nstashes+1 > cache->cstashes) {
+		int cstashes = cache->cstashes == 0 ? 4 : cache->cstashes * 2;
+		FONScontext** stashes = (FONScontext**)realloc(cache->stashes, sizeof(FONScontext*) * cstashes);
+		if (stashes == NULL) return 0;
+		cache->stashes = stashes;
+		cache->cstashes = cstashes;
 	}
+	cache->stashes[cache->nstashes++] = stash;
+	cache->refCount++;
+	return 1;
+}
 
-	stash->dirtyRect[0] = fons__mini(stash->dirtyRect[0], gx);
-	stash->dirtyRect[1] = fons__mini(stash->dirtyRect[1], gy);
-	stash->dirtyRect[2] = fons__maxi(stash->dirtyRect[2], gx+w);
-	stash->dirtyRect[3] = fons__maxi(stash->dirtyRect[3], gy+h);
+// Detaches the stash, returns 1 if it was the last one using the cache.
+static int fons__removeStash(FONScache* cache, FONScontext* stash)
+{
+	int i;
+	for (i = 0; i < cache->nstashes; i++) {
+		if (cache->stashes[i] == stash) {
+			cache->stashes[i] = cache->stashes[--cache->nstashes];
+			break;
+		}
+	}
+	fons__releaseTexture(stash->tex);
+	stash->tex = NULL;
+	return --cache->refCount == 0;
 }
 
 FONScontext* fonsCreateInternal(FONSparams* params)
+{
+	return fonsCreateShared(params, NULL);
+}
+
+FONScontext* fonsCreateShared(FONSparams* params, FONScontext* other)
 {
 	FONScontext* stash = NULL;
+	FONScache* cache = NULL;
 
 	// Allocate memory for the font stash.
 	stash = (FONScontext*)malloc(sizeof(FONScontext));
@@ -744,43 +1095,35 @@ FONScontext* fonsCreateInternal(FONSparams* params)
 
 	stash->params = *params;
 
-	// Allocate scratch buffer.
-	stash->scratch = (unsigned char*)malloc(FONS_SCRATCH_BUF_SIZE);
-	if (stash->scratch == NULL) goto error;
+	if (other != NULL) {
+		cache = other->cache;
+	} else {
+		cache = fons__createCache(params->width, params->height);
+		if (cache == NULL) goto error;
+	}
 
-	// Initialize implementation library
-	if (!fons__tt_init(stash)) goto error;
+	fons__lock(cache);
+	if (!fons__addStash(cache, stash)) {
+		fons__unlock(cache);
+		if (other == NULL)
+			fons__deleteCache(cache);
+		goto error;
+	}
+	stash->cache = cache;
+	fons__useTexture(stash, cache->tex);
+
+	// Existing glyphs in the atlas are dirty for the new stash.
+	stash->dirtyRect[0] = 0;
+	stash->dirtyRect[1] = 0;
+	stash->dirtyRect[2] = stash->params.width;
+	stash->dirtyRect[3] = fons__atlasUsedHeight(cache->atlas);
+	fons__unlock(cache);
 
 	if (stash->params.renderCreate != NULL) {
 		if (stash->params.renderCreate(stash->params.userPtr, stash->params.width, stash->params.height) == 0)
 			goto error;
 	}
 
-	stash->atlas = fons__allocAtlas(stash->params.width, stash->params.height, FONS_INIT_ATLAS_NODES);
-	if (stash->atlas == NULL) goto error;
-
-	// Allocate space for fonts.
-	stash->fonts = (FONSfont**)malloc(sizeof(FONSfont*) * FONS_INIT_FONTS);
-	if (stash->fonts == NULL) goto error;
-	memset(stash->fonts, 0, sizeof(FONSfont*) * FONS_INIT_FONTS);
-	stash->cfonts = FONS_INIT_FONTS;
-	stash->nfonts = 0;
-
-	// Create texture for the cache.
-	stash->itw = 1.0f/stash->params.width;
-	stash->ith = 1.0f/stash->params.height;
-	stash->texData = (unsigned char*)malloc(stash->params.width * stash->params.height);
-	if (stash->texData == NULL) goto error;
-	memset(stash->texData, 0, stash->params.width * stash->params.height);
-
-	stash->dirtyRect[0] = stash->params.width;
-	stash->dirtyRect[1] = stash->params.height;
-	stash->dirtyRect[2] = 0;
-	stash->dirtyRect[3] = 0;
-
-	// Add white rect at 0,0 for debug drawing.
-	fons__addWhiteRect(stash, 2,2);
-
 	fonsPushState(stash);
 	fonsClearState(stash);
 
@@ -796,25 +1139,53 @@ static FONSstate* fons__getState(FONScontext* stash)
 	return &stash->states[stash->nstates-1];
 }
 
+// Returns the font at index, or NULL if it does not exist or has no data.
+static FONSfont* fons__getFont(FONScontext* stash, int idx)
+{
+	FONSfont* font = NULL;
+	fons__lock(stash->cache);
+	if (idx >= 0 && idx < stash->cache->nfonts)
+		font = stash->cache->fonts[idx];
+	fons__unlock(stash->cache);
+	if (font != NULL && font->data == NULL)
+		return NULL;
+	return font;
+}
+
 int fonsAddFallbackFont(FONScontext* stash, int base, int fallback)
 {
-	FONSfont* baseFont = stash->fonts[base];
+	FONSfont* baseFont;
+	int added = 0;
+	fons__lock(stash->cache);
+	baseFont = stash->cache->fonts[base];
 	if (baseFont->nfallbacks < FONS_MAX_FALLBACKS) {
 		baseFont->fallbacks[baseFont->nfallbacks++] = fallback;
-		return 1;
+		// Codepoints missing so far may resolve to the new fallback.
+		fons__clearCmap(baseFont);
+		added = 1;
 	}
-	return 0;
+	fons__unlock(stash->cache);
+	return added;
 }
 
 void fonsResetFallbackFont(FONScontext* stash, int base)
 {
 	int i;
+	FONSfont* baseFont;
 
-	FONSfont* baseFont = stash->fonts[base];
+	fons__lock(stash->cache);
+	baseFont = stash->cache->fonts[base];
 	baseFont->nfallbacks = 0;
 	baseFont->nglyphs = 0;
+	fons__clearCmap(baseFont);
 	for (i = 0; i < FONS_HASH_LUT_SIZE; i++)
 		baseFont->lut[i] = -1;
+	fons__unlock(stash->cache);
+
+	for (i = 0; i < FONS_GLYPH_CACHE_SIZE; i++) {
+		if (stash->glyphs[i].font == baseFont)
+			stash->glyphs[i].font = NULL;
+	}
 }
 
 void fonsSetSize(FONScontext* stash, float size)
@@ -886,21 +1257,37 @@ void fonsClearState(FONScontext* stash)
 	state->align = FONS_ALIGN_LEFT | FONS_ALIGN_BASELINE;
 }
 
+static void fons__clearCmap(FONSfont* font)
+{
+	int i;
+	for (i = 0; i < 256; i++) {
+		if (font->cmapPages[i]) free(font->cmapPages[i]);
+		font->cmapPages[i] = NULL;
+	}
+	if (font->cmapHash) free(font->cmapHash);
+	font->cmapHash = NULL;
+	font->ncmapHash = 0;
+	font->ccmapHash = 0;
+}
+
 static void fons__freeFont(FONSfont* font)
 {
 	if (font == NULL) return;
 	if (font->glyphs) free(font->glyphs);
+	if (font->kern) free(font->kern);
+	if (font->kernMap) free(font->kernMap);
+	fons__clearCmap(font);
 	if (font->freeData && font->data) free(font->data);
 	free(font);
 }
 
-static int fons__allocFont(FONScontext* stash)
+static int fons__allocFont(FONScache* cache)
 {
 	FONSfont* font = NULL;
-	if (stash->nfonts+1 > stash->cfonts) {
-		stash->cfonts = stash->cfonts == 0 ? 8 : stash->cfonts * 2;
-		stash->fonts = (FONSfont**)realloc(stash->fonts, sizeof(FONSfont*) * stash->cfonts);
-		if (stash->fonts == NULL)
+	if (cache->nfonts+1 > cache->cfonts) {
+		cache->cfonts = cache->cfonts == 0 ? 8 : cache->cfonts * 2;
+		cache->fonts = (FONSfont**)realloc(cache->fonts, sizeof(FONSfont*) * cache->cfonts);
+		if (cache->fonts == NULL)
 			return -1;
 	}
 	font = (FONSfont*)malloc(sizeof(FONSfont));
@@ -912,8 +1299,8 @@ static int fons__allocFont(FONScontext* stash)
 	font->cglyphs = FONS_INIT_GLYPHS;
 	font->nglyphs = 0;
 
-	stash->fonts[stash->nfonts++] = font;
-	return stash->nfonts-1;
+	cache->fonts[cache->nfonts++] = font;
+	return cache->nfonts-1;
 
 error:
 	fons__freeFont(font);
@@ -921,6 +1308,44 @@ error:
 	return FONS_INVALID;
 }
 
+#ifndef FONS_USE_FREETYPE
+// Builds the kerning table between the glyphs of FONS_KERN_FIRST..FONS_KERN_LAST,
+// the font works without it if there is not enough memory.
+static void fons__buildKerning(FONSfont* font)
+{
+	int glyphs[FONS_KERN_LAST-FONS_KERN_FIRST+1];
+	int i, j, n = 0, maxGlyph = 0;
+
+	for (i = 0; i <= FONS_KERN_LAST-FONS_KERN_FIRST; i++) {
+		int g = font->rangeGlyphs[i];
+		for (j = 0; j < n; j++)
+			if (glyphs[j] == g) break;
+		if (j < n) continue;
+		glyphs[n++] = g;
+		maxGlyph = fons__maxi(maxGlyph, g);
+	}
+
+	font->kern = (short*)malloc(sizeof(short) * n * n);
+	font->kernMap = (unsigned short*)malloc(sizeof(unsigned short) * (maxGlyph+1));
+	if (font->kern == NULL || font->kernMap == NULL) goto error;
+	memset(font->kernMap, 0, sizeof(unsigned short) * (maxGlyph+1));
+	for (i = 0; i < n; i++) {
+		font->kernMap[glyphs[i]] = (unsigned short)(i+1);
+		for (j = 0; j < n; j++)
+			font->kern[i*n+j] = (short)fons__tt_getGlyphKernAdvance(&font->font, glyphs[i], glyphs[j]);
+	}
+	font->nkern = n;
+	font->nkernMap = maxGlyph+1;
+	return;
+
+error:
+	if (font->kern) free(font->kern);
+	if (font->kernMap) free(font->kernMap);
+	font->kern = NULL;
+	font->kernMap = NULL;
+}
+#endif
+
 int fonsAddFont(FONScontext* stash, const char* name, const char* path, int fontIndex)
 {
 	FILE* fp = 0;
@@ -953,12 +1378,17 @@ int fonsAddFontMem(FONScontext* stash, const char* name, unsigned char* data, in
 {
 	int i, ascent, descent, fh, lineGap;
 	FONSfont* font;
+	FONScache* cache = stash->cache;
+	int idx;
 
-	int idx = fons__allocFont(stash);
-	if (idx == FONS_INVALID)
+	fons__lock(cache);
+	idx = fons__allocFont(cache);
+	if (idx == FONS_INVALID) {
+		fons__unlock(cache);
 		return FONS_INVALID;
+	}
 
-	font = stash->fonts[idx];
+	font = cache->fonts[idx];
 
 	strncpy(font->name, name, sizeof(font->name));
 	font->name[sizeof(font->name)-1] = '\0';
@@ -973,8 +1403,9 @@ int fonsAddFontMem(FONScontext* stash, const char* name, unsigned char* data, in
 	font->freeData = (unsigned char)freeData;
 
 	// Init font
-	stash->nscratch = 0;
-	if (!fons__tt_loadFont(stash, &font->font, data, dataSize, fontIndex)) goto error;
+	cache->nscratch = 0;
+	cache->user = stash;
+	if (!fons__tt_loadFont(cache, &font->font, data, dataSize, fontIndex)) goto error;
 
 	// Store normalized line height. The real line height is got
 	// by multiplying the lineh by font size.
@@ -985,22 +1416,37 @@ int fonsAddFontMem(FONScontext* stash, const char* name, unsigned char* data, in
 	font->descender = (float)descent / (float)fh;
 	font->lineh = font->ascender - font->descender;
 
+	// The tables are not changed after this, measuring without the lock reads them.
+	for (i = FONS_KERN_FIRST; i <= FONS_KERN_LAST; i++)
+		font->rangeGlyphs[i-FONS_KERN_FIRST] = fons__tt_getGlyphIndex(&font->font, i);
+#ifndef FONS_USE_FREETYPE
+	// FreeType kerning depends on the size last set on the face, so it is not tabulated.
+	if (!(stash->params.flags & FONS_NO_KERNING))
+		fons__buildKerning(font);
+#endif
+
+	fons__unlock(cache);
 	return idx;
 
 error:
 	fons__freeFont(font);
-	stash->nfonts--;
+	cache->nfonts--;
+	fons__unlock(cache);
 	return FONS_INVALID;
 }
 
 int fonsGetFontByName(FONScontext* s, const char* name)
 {
-	int i;
-	for (i = 0; i < s->nfonts; i++) {
-		if (strcmp(s->fonts[i]->name, name) == 0)
-			return i;
+	int i, idx = FONS_INVALID;
+	fons__lock(s->cache);
+	for (i = 0; i < s->cache->nfonts; i++) {
+		if (strcmp(s->cache->fonts[i]->name, name) == 0) {
+			idx = i;
+			break;
+		}
 	}
-	return FONS_INVALID;
+	fons__unlock(s->cache);
+	return idx;
 }
 
 
@@ -1041,38 +1487,148 @@ static void fons__blurCols(unsigned char* dst, int w, int h, int dstStride, int
 	}
 }
 
+// The SIMD versions filter 16 columns at a time in 16-bit lanes. The state z stays within
+// [0, 255<<ZPREC], so the products and shifts below give the same bits as the scalar code.
+#if defined(FONS_SSE2)
+static __m128i fons__blurStep(__m128i z, __m128i v, __m128i alpha, __m128i alphaHi)
+{
+	// mulhi is a signed multiply, alphas above 0x7fff wrap negative and are corrected by adding d back.
+	__m128i d = _mm_sub_epi16(_mm_slli_epi16(v, ZPREC), z);
+	return _mm_add_epi16(z, _mm_add_epi16(_mm_mulhi_epi16(d, alpha), _mm_and_si128(d, alphaHi)));
+}
+
+static void fons__blurRows16(unsigned char* dst, int h, int dstStride, int alpha)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i a = _mm_set1_epi16((short)(alpha >= 0x8000 ? alpha - 0x10000 : alpha));
+	const __m128i ahi = _mm_set1_epi16(alpha >= 0x8000 ? -1 : 0);
+	__m128i zlo, zhi, v;
+	int y;
+	zlo = zhi = zero; // force zero border
+	for (y = 1; y < h; y++) {
+		v = _mm_loadu_si128((const __m128i*)&dst[y*dstStride]);
+		zlo = fons__blurStep(zlo, _mm_unpacklo_epi8(v, zero), a, ahi);
+		zhi = fons__blurStep(zhi, _mm_unpackhi_epi8(v, zero), a, ahi);
+		v = _mm_packus_epi16(_mm_srli_epi16(zlo, ZPREC), _mm_srli_epi16(zhi, ZPREC));
+		_mm_storeu_si128((__m128i*)&dst[y*dstStride], v);
+	}
+	_mm_storeu_si128((__m128i*)&dst[(h-1)*dstStride], zero); // force zero border
+	zlo = zhi = zero;
+	for (y = h-2; y >= 0; y--) {
+		v = _mm_loadu_si128((const __m128i*)&dst[y*dstStride]);
+		zlo = fons__blurStep(zlo, _mm_unpacklo_epi8(v, zero), a, ahi);
+		zhi = fons__blurStep(zhi, _mm_unpackhi_epi8(v, zero), a, ahi);
+		v = _mm_packus_epi16(_mm_srli_epi16(zlo, ZPREC), _mm_srli_epi16(zhi, ZPREC));
+		_mm_storeu_si128((__m128i*)&dst[y*dstStride], v);
+	}
+	_mm_storeu_si128((__m128i*)dst, zero); // force zero border
+}
+#elif defined(FONS_NEON)
+static int16x8_t fons__blurStep(int16x8_t z, uint8x8_t v, int32x4_t alpha)
+{
+	int16x8_t d = vsubq_s16(vshlq_n_s16(vreinterpretq_s16_u16(vmovl_u8(v)), ZPREC), z);
+	int32x4_t lo = vmulq_s32(vmovl_s16(vget_low_s16(d)), alpha);
+	int32x4_t hi = vmulq_s32(vmovl_s16(vget_high_s16(d)), alpha);
+	return vaddq_s16(z, vcombine_s16(vshrn_n_s32(lo, APREC), vshrn_n_s32(hi, APREC)));
+}
+
+static void fons__blurRows16(unsigned char* dst, int h, int dstStride, int alpha)
+{
+	const int32x4_t a = vdupq_n_s32(alpha);
+	const uint8x16_t zero = vdupq_n_u8(0);
+	int16x8_t zlo, zhi;
+	uint8x16_t v;
+	int y;
+	zlo = zhi = vdupq_n_s16(0); // force zero border
+	for (y = 1; y < h; y++) {
+		v = vld1q_u8(&dst[y*dstStride]);
+		zlo = fons__blurStep(zlo, vget_low_u8(v), a);
+		zhi = fons__blurStep(zhi, vget_high_u8(v), a);
+		vst1q_u8(&dst[y*dstStride], vcombine_u8(vqshrun_n_s16(zlo, ZPREC), vqshrun_n_s16(zhi, ZPREC)));
+	}
+	vst1q_u8(&dst[(h-1)*dstStride], zero); // force zero border
+	zlo = zhi = vdupq_n_s16(0);
+	for (y = h-2; y >= 0; y--) {
+		v = vld1q_u8(&dst[y*dstStride]);
+		zlo = fons__blurStep(zlo, vget_low_u8(v), a);
+		zhi = fons__blurStep(zhi, vget_high_u8(v), a);
+		vst1q_u8(&dst[y*dstStride], vcombine_u8(vqshrun_n_s16(zlo, ZPREC), vqshrun_n_s16(zhi, ZPREC)));
+	}
+	vst1q_u8(dst, zero); // force zero border
+}
+#endif
+
 static void fons__blurRows(unsigned char* dst, int w, int h, int dstStride, int alpha)
 {
-	int x, y;
-	for (x = 0; x < w; x++) {
+	int x = 0, y;
+#if defined(FONS_SSE2) || defined(FONS_NEON)
+	for (; x+16 <= w; x += 16)
+		fons__blurRows16(&dst[x], h, dstStride, alpha);
+#endif
+	for (; x < w; x++) {
+		unsigned char* col = &dst[x];
 		int z = 0; // force zero border
 		for (y = dstStride; y < h*dstStride; y += dstStride) {
-			z += (alpha * (((int)(dst[y]) << ZPREC) - z)) >> APREC;
-			dst[y] = (unsigned char)(z >> ZPREC);
+			z += (alpha * (((int)(col[y]) << ZPREC) - z)) >> APREC;
+			col[y] = (unsigned char)(z >> ZPREC);
 		}
-		dst[(h-1)*dstStride] = 0; // force zero border
+		col[(h-1)*dstStride] = 0; // force zero border
 		z = 0;
 		for (y = (h-2)*dstStride; y >= 0; y -= dstStride) {
-			z += (alpha * (((int)(dst[y]) << ZPREC) - z)) >> APREC;
-			dst[y] = (unsigned char)(z >> ZPREC);
+			z += (alpha * (((int)(col[y]) << ZPREC) - z)) >> APREC;
+			col[y] = (unsigned char)(z >> ZPREC);
 		}
-		dst[0] = 0; // force zero border
-		dst++;
+		col[0] = 0; // force zero border
 	}
 }
 
+#if defined(FONS_SSE2) || defined(FONS_NEON)
+static void fons__transpose(unsigned char* dst, int dstStride, const unsigned char* src, int w, int h, int srcStride)
+{
+	int x, y, bx, by;
+	// Work in 16x16 tiles so that both sides stay in cache.
+	for (by = 0; by < h; by += 16) {
+		for (bx = 0; bx < w; bx += 16) {
+			int ex = fons__mini(bx+16, w), ey = fons__mini(by+16, h);
+			for (y = by; y < ey; y++)
+				for (x = bx; x < ex; x++)
+					dst[x*dstStride + y] = src[y*srcStride + x];
+		}
+	}
+}
+#endif
 
-static void fons__blur(FONScontext* stash, unsigned char* dst, int w, int h, int dstStride, int blur)
+static void fons__blur(FONScache* cache, unsigned char* dst, int w, int h, int dstStride, int blur)
 {
 	int alpha;
 	float sigma;
-	(void)stash;
+#if defined(FONS_SSE2) || defined(FONS_NEON)
+	unsigned char* tmp;
+	int i;
+#endif
 
 	if (blur < 1)
 		return;
 	// Calculate the alpha such that 90% of the kernel is within the radius. (Kernel extends to infinity)
 	sigma = (float)blur * 0.57735f; // 1 / sqrt(3)
 	alpha = (int)((1<<APREC) * (1.0f - expf(-2.3f / (sigma+1.0f))));
+#if defined(FONS_SSE2) || defined(FONS_NEON)
+	// The horizontal passes run as vertical passes over a transposed copy, so that they vectorize too.
+	tmp = w*h <= FONS_SCRATCH_BUF_SIZE ? cache->scratch : (unsigned char*)malloc(w*h);
+	if (tmp != NULL) {
+		for (i = 0; i < 2; i++) {
+			fons__blurRows(dst, w, h, dstStride, alpha);
+			fons__transpose(tmp, h, dst, w, h, dstStride);
+			fons__blurRows(tmp, h, w, h, alpha);
+			fons__transpose(dst, dstStride, tmp, h, w, h);
+		}
+		if (tmp != cache->scratch)
+			free(tmp);
+		return;
+	}
+#else
+	(void)cache;
+#endif
 	fons__blurRows(dst, w, h, dstStride, alpha);
 	fons__blurCols(dst, w, h, dstStride, alpha);
 	fons__blurRows(dst, w, h, dstStride, alpha);
@@ -1081,149 +1637,179 @@ static void fons__blur(FONScontext* stash, unsigned char* dst, int w, int h, int
 //	fons__blurcols(dst, w, h, dstStride, alpha);
 }
 
-static void fons__maxRows(unsigned char* dst, int w, int h, int dstStride)
+static void fons__maxBytes(unsigned char* dst, const unsigned char* a, const unsigned char* b, int n)
 {
-	int x, y;
-	unsigned char prev, current;
-	unsigned char* ptr;
-	for (x = 0; x < w; x++) {
-		prev=dst[0];
-		for (y = dstStride; y < h*dstStride; y += dstStride) {
-			ptr=&dst[y];
-			current=*ptr;
-			if(prev > current){
-				*ptr=prev;
-			}
-			prev=current;
-		}
-		for (y = (h-2)*dstStride; y >= 0; y -= dstStride) {
-			ptr=&dst[y];
-			current=*ptr;
-			if(prev > current){
-				*ptr=prev;
-			}
-			prev=current;
-		}
-		dst++;
-	}
+	int i = 0;
+#if defined(FONS_SSE2)
+	for (; i+16 <= n; i += 16)
+		_mm_storeu_si128((__m128i*)&dst[i], _mm_max_epu8(_mm_loadu_si128((const __m128i*)&a[i]), _mm_loadu_si128((const __m128i*)&b[i])));
+#elif defined(FONS_NEON)
+	for (; i+16 <= n; i += 16)
+		vst1q_u8(&dst[i], vmaxq_u8(vld1q_u8(&a[i]), vld1q_u8(&b[i])));
+#endif
+	for (; i < n; i++)
+		dst[i] = a[i] > b[i] ? a[i] : b[i];
 }
 
-static void fons__maxCols(unsigned char* dst, int w, int h, int dstStride)
+// Gray level morphological dilation with a disk of radius dilate, in one pass over the disk radius.
+// The disk is split into horizontal spans: a copy of the glyph is widened one pixel at a time,
+// and after reaching half width k it is merged into every output row whose span at that
+// vertical offset is k pixels wide.
+static void fons__dilate(FONScache* cache, unsigned char* dst, int w, int h, int dstStride, int dilate)
 {
-	int x, y;
-	unsigned char prev, current;
-	unsigned char* ptr;
+	int span[32];
+	int y, k, dy;
+	unsigned char *tmp, *src, *row;
+
+	if (dilate < 1 || w < 3 || h < 1)
+		return;
+	if (dilate > 31) dilate = 31;
+	for (dy = 0; dy <= dilate; dy++)
+		span[dy] = (int)sqrtf(((float)dilate+0.5f)*((float)dilate+0.5f) - (float)(dy*dy));
+
+	tmp = w*h+w <= FONS_SCRATCH_BUF_SIZE ? cache->scratch : (unsigned char*)malloc(w*h+w);
+	if (tmp == NULL)
+		return;
+	src = tmp;
+	row = tmp + w*h;
 	for (y = 0; y < h; y++) {
-		prev=dst[0];
-		for (x = 1; x < w; x++) {
-			ptr=&dst[x];
-			current=*ptr;
-			if(prev > current){
-				*ptr=prev;
+		memcpy(&src[y*w], &dst[y*dstStride], w);
+		memset(&dst[y*dstStride], 0, w);
+	}
+
+	for (k = 0; k <= span[0]; k++) {
+		if (k > 0) {
+			for (y = 0; y < h; y++) {
+				unsigned char* s = &src[y*w];
+				row[0] = s[1];
+				fons__maxBytes(&row[1], &s[0], &s[2], w-2);
+				row[w-1] = s[w-2];
+				fons__maxBytes(s, s, row, w);
 			}
-			prev=current;
 		}
-		for (x = w-2; x >= 0; x--) {
-			ptr=&dst[x];
-			current=*ptr;
-			if(prev > current){
-				*ptr=prev;
+		for (dy = 0; dy <= dilate; dy++) {
+			if (span[dy] != k) continue;
+			for (y = 0; y < h; y++) {
+				unsigned char* d = &dst[y*dstStride];
+				if (y+dy < h)
+					fons__maxBytes(d, d, &src[(y+dy)*w], w);
+				if (dy > 0 && y-dy >= 0)
+					fons__maxBytes(d, d, &src[(y-dy)*w], w);
 			}
-			prev=current;
 		}
-		dst += dstStride;
 	}
+
+	if (tmp != cache->scratch)
+		free(tmp);
 }
 
-static void fons__maxDiagUp(unsigned char* dst, int w, int h, int dstStride)
+static FONSglyph* fons__findGlyph(FONSfont* font, unsigned int h, unsigned int codepoint,
+								  short isize, short iblur, short idilate)
 {
-	int t, y;
-	const int a =dstStride-1;
-	const int d=w+h;
-	unsigned char prev, current;
-	unsigned char* ptr;
-	for(t=0;t<d;t++){
-		const int y_min=(t-w<0)?0:t-w;
-		const int y_max=(t<h-1)?t:h-1;
-		prev=dst[t+y_min*a];
-		for(y=y_min;y<=y_max;y++){
-			ptr=&dst[t+y*a];
-			current=*ptr;
-			if(prev > current){
-				*ptr=prev;
-			}
-			prev=current;
-		}
-		for(y=y_max-1;y>=y_min;y--){
-			ptr=&dst[t+y*a];
-			current=*ptr;
-			if(prev > current){
-				*ptr=prev;
-			}
-			prev=current;
+	int i = font->lut[h];
+	while (i != -1) {
+		if (font->glyphs[i].codepoint == codepoint && font->glyphs[i].size == isize
+			&& font->glyphs[i].blur == iblur
+			&& font->glyphs[i].dilate == idilate
+		) {
+			return &font->glyphs[i];
 		}
+		i = font->glyphs[i].next;
 	}
+	return NULL;
 }
 
-static void fons__maxDiagDown(unsigned char* dst, int w, int h, int dstStride)
+// Returns the cmap cache entry of a codepoint, or NULL if there is not enough memory.
+static unsigned int* fons__cmapEntry(FONSfont* font, unsigned int codepoint)
 {
-	int t, y;
-	const int a=(h-1)*dstStride;
-	const int b=dstStride+1;
-	const int d=w+h;
-	unsigned char prev, current;
-	unsigned char* ptr;
-	for(t=0;t<d;t++){
-		const int y_min=(t-w<0)?0:t-w;
-		const int y_max=(t<h-1)?t:h-1;
-		prev=dst[t-y_min*b+a];
-		for(y=y_min;y<=y_max;y++){
-			ptr=&dst[t-y*b+a];
-			current=*ptr;
-			if(prev > current){
-				*ptr=prev;
-			}
-			prev=current;
+	unsigned int i, mask;
+
+	if (codepoint < 0x10000) {
+		unsigned int** page = &font->cmapPages[codepoint >> 8];
+		if (*page == NULL) {
+			*page = (unsigned int*)malloc(sizeof(unsigned int) * 256);
+			if (*page == NULL) return NULL;
+			memset(*page, 0, sizeof(unsigned int) * 256);
 		}
-		for(y=y_max-1;y>=y_min;y--){
-			ptr=&dst[t-y*b+a];
-			current=*ptr;
-			if(prev > current){
-				*ptr=prev;
-			}
-			prev=current;
+		return &(*page)[codepoint & 0xff];
+	}
+
+	// Keep the hash at most half full, codepoint zero marks empty pairs.
+	if ((font->ncmapHash+1)*2 > font->ccmapHash) {
+		int ccmap = font->ccmapHash == 0 ? 64 : font->ccmapHash * 2;
+		unsigned int* cmap = (unsigned int*)malloc(sizeof(unsigned int) * 2 * ccmap);
+		if (cmap == NULL) return NULL;
+		memset(cmap, 0, sizeof(unsigned int) * 2 * ccmap);
+		mask = (unsigned int)ccmap-1;
+		for (i = 0; i < (unsigned int)font->ccmapHash; i++) {
+			unsigned int j = font->cmapHash[i*2];
+			if (j == 0) continue;
+			j = fons__hashint(j) & mask;
+			while (cmap[j*2] != 0)
+				j = (j+1) & mask;
+			cmap[j*2] = font->cmapHash[i*2];
+			cmap[j*2+1] = font->cmapHash[i*2+1];
 		}
+		if (font->cmapHash) free(font->cmapHash);
+		font->cmapHash = cmap;
+		font->ccmapHash = ccmap;
 	}
+	mask = (unsigned int)font->ccmapHash-1;
+	i = fons__hashint(codepoint) & mask;
+	while (font->cmapHash[i*2] != 0 && font->cmapHash[i*2] != codepoint)
+		i = (i+1) & mask;
+	if (font->cmapHash[i*2] == 0) {
+		font->cmapHash[i*2] = codepoint;
+		font->ncmapHash++;
+	}
+	return &font->cmapHash[i*2+1];
 }
 
-// Gray level morphological dilation approximated by convolving with a max stencil along
-// Diagonal convolution overlaps with horizontal & vertical, so we alternate between vertical & horizontal
-// and diagonal directions to prevent the dilation from being too large.
-static void fons__dilate(FONScontext* stash, unsigned char* dst, int w, int h, int dstStride, int dilate)
+// Finds the glyph index of a codepoint and the font it comes from, trying the fallback fonts
+// when the font does not have it. Results are cached per font, the entries store the
+// fallback number plus one (zero for the font itself) above the 16 bit glyph index,
+// and zero until the codepoint is resolved.
+static int fons__resolveGlyph(FONScache* cache, FONSfont* font, unsigned int codepoint, FONSfont** renderFont)
 {
-	(void)stash;
+	unsigned int* entry = fons__cmapEntry(font, codepoint);
+	int i, g, slot = 0;
 
-	for (int iter = 0; iter < dilate; iter++)
-	{
-		if (iter % 2 == 0)
-		{
-			fons__maxRows(dst, w, h, dstStride);
-			fons__maxCols(dst, w, h, dstStride);
-		}
-		else
-		{
-			fons__maxDiagUp(dst, w, h, dstStride);
-			fons__maxDiagDown(dst, w, h, dstStride);
+	if (entry != NULL && *entry != 0) {
+		slot = (int)(*entry >> 16) - 1;
+		*renderFont = slot == 0 ? font : cache->fonts[font->fallbacks[slot-1]];
+		return (int)(*entry & 0xffff);
+	}
+
+	*renderFont = font;
+	g = fons__tt_getGlyphIndex(&font->font, codepoint);
+	// Try to find the glyph in fallback fonts.
+	if (g == 0) {
+		for (i = 0; i < font->nfallbacks; ++i) {
+			FONSfont* fallbackFont = cache->fonts[font->fallbacks[i]];
+			int fallbackIndex = fons__tt_getGlyphIndex(&fallbackFont->font, codepoint);
+			if (fallbackIndex != 0) {
+				g = fallbackIndex;
+				*renderFont = fallbackFont;
+				slot = i+1;
+				break;
+			}
 		}
+		// It is possible that we did not find a fallback glyph.
+		// In that case the glyph index 'g' is 0, and we'll proceed below and cache empty glyph.
 	}
+	if (entry != NULL)
+		*entry = ((unsigned int)(slot+1) << 16) | ((unsigned int)g & 0xffff);
+	return g;
 }
 
-static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned int codepoint,
-								 short isize, short iblur, short idilate, int bitmapOption)
+// Finds or creates the glyph in the shared cache, called with the lock held.
+static FONSglyph* fons__getSharedGlyph(FONScontext* stash, FONSfont* font, unsigned int codepoint,
+									   short isize, short iblur, short idilate, int bitmapOption)
 {
-	int i, g, advance, lsb, x0, y0, x1, y1, gw, gh, gx, gy, x, y;
+	int g, advance, lsb, x0, y0, x1, y1, gw, gh, gx, gy, x, y, stride;
 	float scale;
 	FONSglyph* glyph = NULL;
+	FONScache* cache = stash->cache;
 	unsigned int h;
 	float size = isize/10.0f;
 	int pad, added;
@@ -1231,49 +1817,29 @@ static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned in
 	unsigned char* dst;
 	FONSfont* renderFont = font;
 
-	if (isize < 2) return NULL;
-	if (iblur > 20) iblur = 20;
-	if (idilate > 20) idilate = 20;
 	const int antiAliasBonus = 2;
 	pad = antiAliasBonus + iblur + idilate;
 
+	// Bitmaps can only be added to the current atlas.
+	if (bitmapOption == FONS_GLYPH_BITMAP_REQUIRED && stash->tex != cache->tex)
+		return NULL;
+
 	// Reset allocator.
-	stash->nscratch = 0;
+	cache->nscratch = 0;
+	cache->user = stash;
 
 	// Find code point and size.
 	h = fons__hashint(codepoint) & (FONS_HASH_LUT_SIZE-1);
-	i = font->lut[h];
-	while (i != -1) {
-		if (font->glyphs[i].codepoint == codepoint && font->glyphs[i].size == isize
-			&& font->glyphs[i].blur == iblur
-			&& font->glyphs[i].dilate == idilate
-		) {
-			glyph = &font->glyphs[i];
-			if (bitmapOption == FONS_GLYPH_BITMAP_OPTIONAL || (glyph->x0 >= 0 && glyph->y0 >= 0)) {
-			  return glyph;
-			}
-			// At this point, glyph exists but the bitmap data is not yet created.
-			break;
+	glyph = fons__findGlyph(font, h, codepoint, isize, iblur, idilate);
+	if (glyph != NULL) {
+		if (bitmapOption == FONS_GLYPH_BITMAP_OPTIONAL || (glyph->x0 >= 0 && glyph->y0 >= 0)) {
+		  return glyph;
 		}
-		i = font->glyphs[i].next;
+		// At this point, glyph exists but the bitmap data is not yet created.
 	}
 
 	// Create a new glyph or rasterize bitmap data for a cached glyph.
-	g = fons__tt_getGlyphIndex(&font->font, codepoint);
-	// Try to find the glyph in fallback fonts.
-	if (g == 0) {
-		for (i = 0; i < font->nfallbacks; ++i) {
-			FONSfont* fallbackFont = stash->fonts[font->fallbacks[i]];
-			int fallbackIndex = fons__tt_getGlyphIndex(&fallbackFont->font, codepoint);
-			if (fallbackIndex != 0) {
-				g = fallbackIndex;
-				renderFont = fallbackFont;
-				break;
-			}
-		}
-		// It is possible that we did not find a fallback glyph.
-		// In that case the glyph index 'g' is 0, and we'll proceed below and cache empty glyph.
-	}
+	g = fons__resolveGlyph(cache, font, codepoint, &renderFont);
 	scale = fons__tt_getPixelHeightScale(&renderFont->font, size);
 	fons__tt_buildGlyphBitmap(&renderFont->font, g, size, scale, &advance, &lsb, &x0, &y0, &x1, &y1);
 	gw = x1-x0 + pad*2;
@@ -1282,11 +1848,21 @@ static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned in
 	// Determines the spot to draw glyph in the atlas.
 	if (bitmapOption == FONS_GLYPH_BITMAP_REQUIRED) {
 		// Find free spot for the rect in the atlas
-		added = fons__atlasAddRect(stash->atlas, gw, gh, &gx, &gy);
+		added = fons__atlasAddRect(cache->atlas, gw, gh, &gx, &gy);
 		if (added == 0 && stash->handleError != NULL) {
 			// Atlas is full, let the user to resize the atlas (or not), and try again.
+			// The lock is released so that the callback can expand or reset the atlas.
+			fons__unlock(cache);
 			stash->handleError(stash->errorUptr, FONS_ATLAS_FULL, 0);
-			added = fons__atlasAddRect(stash->atlas, gw, gh, &gx, &gy);
+			fons__lock(cache);
+			if (stash->tex != cache->tex)
+				return NULL;
+			// Another stash may have added the glyph in the meantime.
+			cache->user = stash;
+			glyph = fons__findGlyph(font, h, codepoint, isize, iblur, idilate);
+			if (glyph != NULL && glyph->x0 >= 0 && glyph->y0 >= 0)
+				return glyph;
+			added = fons__atlasAddRect(cache->atlas, gw, gh, &gx, &gy);
 		}
 		if (added == 0) return NULL;
 	} else {
@@ -1322,60 +1898,145 @@ static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned in
 	}
 
 	// Rasterize
-	dst = &stash->texData[(glyph->x0+pad) + (glyph->y0+pad) * stash->params.width];
-	fons__tt_renderGlyphBitmap(&renderFont->font, dst, gw-pad*2,gh-pad*2, stash->params.width, scale, scale, g);
+	stride = cache->tex->width;
+	dst = &cache->tex->data[(glyph->x0+pad) + (glyph->y0+pad) * stride];
+	fons__tt_renderGlyphBitmap(&renderFont->font, dst, gw-pad*2,gh-pad*2, stride, scale, scale, g);
 
 	// Make sure there is one pixel empty border.
-	dst = &stash->texData[glyph->x0 + glyph->y0 * stash->params.width];
+	dst = &cache->tex->data[glyph->x0 + glyph->y0 * stride];
 	for (y = 0; y < gh; y++) {
-		dst[y*stash->params.width] = 0;
-		dst[gw-1 + y*stash->params.width] = 0;
+		dst[y*stride] = 0;
+		dst[gw-1 + y*stride] = 0;
 	}
 	for (x = 0; x < gw; x++) {
 		dst[x] = 0;
-		dst[x + (gh-1)*stash->params.width] = 0;
+		dst[x + (gh-1)*stride] = 0;
 	}
 
 	// Debug code to color the glyph background
-/*	unsigned char* fdst = &stash->texData[glyph->x0 + glyph->y0 * stash->params.width];
+/*	unsigned char* fdst = &cache->tex->data[glyph->x0 + glyph->y0 * stride];
 	for (y = 0; y < gh; y++) {
 		for (x = 0; x < gw; x++) {
-			int a = (int)fdst[x+y*stash->params.width] + 20;
+			int a = (int)fdst[x+y*stride] + 20;
 			if (a > 255) a = 255;
-			fdst[x+y*stash->params.width] = a;
+			fdst[x+y*stride] = a;
 		}
 	}*/
 
 	// Dilate
 	if (idilate > 0) {
-		stash->nscratch = 0;
-		bdst = &stash->texData[glyph->x0 + glyph->y0 * stash->params.width];
-		fons__dilate(stash, bdst, gw, gh, stash->params.width, idilate);
+		cache->nscratch = 0;
+		bdst = &cache->tex->data[glyph->x0 + glyph->y0 * stride];
+		fons__dilate(cache, bdst, gw, gh, stride, idilate);
 	}
 
 	// Blur
 	if (iblur > 0) {
-		stash->nscratch = 0;
-		bdst = &stash->texData[glyph->x0 + glyph->y0 * stash->params.width];
-		fons__blur(stash, bdst, gw, gh, stash->params.width, iblur);
+		cache->nscratch = 0;
+		bdst = &cache->tex->data[glyph->x0 + glyph->y0 * stride];
+		fons__blur(cache, bdst, gw, gh, stride, iblur);
 	}
 
-	stash->dirtyRect[0] = fons__mini(stash->dirtyRect[0], glyph->x0);
-	stash->dirtyRect[1] = fons__mini(stash->dirtyRect[1], glyph->y0);
-	stash->dirtyRect[2] = fons__maxi(stash->dirtyRect[2], glyph->x1);
-	stash->dirtyRect[3] = fons__maxi(stash->dirtyRect[3], glyph->y1);
+	fons__markDirty(cache, glyph->x0, glyph->y0, glyph->x1, glyph->y1);
 
 	return glyph;
 }
 
-static void fons__getQuad(FONScontext* stash, FONSfont* font,
-						   int prevGlyphIndex, FONSglyph* glyph,
-						   float scale, float spacing, float* x, float* y, FONSquad* q)
+static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned int codepoint,
+								 short isize, short iblur, short idilate, int bitmapOption)
+{
+	FONSglyphSlot* slot;
+	FONSglyph* glyph;
+	FONScache* cache = stash->cache;
+	FONSasciiTable* ascii = &stash->ascii;
+	unsigned int h;
+
+	if (isize < 2) return NULL;
+	if (iblur > 20) iblur = 20;
+	if (idilate > 20) idilate = 20;
+
+	// ASCII glyphs of the last used font and size are indexed directly, without hashing.
+	if (codepoint < 128) {
+		if (ascii->font != font || ascii->generation != stash->tex->generation
+			|| ascii->size != isize || ascii->blur != iblur || ascii->dilate != idilate) {
+			ascii->font = font;
+			ascii->generation = stash->tex->generation;
+			ascii->size = isize;
+			ascii->blur = iblur;
+			ascii->dilate = idilate;
+			memset(ascii->state, 0, sizeof(ascii->state));
+		}
+		if (ascii->state[codepoint] == 2 || (ascii->state[codepoint] == 1 && bitmapOption == FONS_GLYPH_BITMAP_OPTIONAL))
+			return &ascii->glyphs[codepoint];
+	}
+
+	// Recently used glyphs are copied to the stash, so that they can be found without taking the lock.
+	h = fons__hashint(codepoint ^ ((unsigned int)isize << 12) ^ ((unsigned int)iblur << 24) ^ ((unsigned int)idilate << 28));
+	slot = &stash->glyphs[h & (FONS_GLYPH_CACHE_SIZE-1)];
+	if (slot->font == font && slot->generation == stash->tex->generation
+		&& slot->glyph.codepoint == codepoint && slot->glyph.size == isize
+		&& slot->glyph.blur == iblur && slot->glyph.dilate == idilate
+		&& (bitmapOption == FONS_GLYPH_BITMAP_OPTIONAL || (slot->glyph.x0 >= 0 && slot->glyph.y0 >= 0))) {
+		glyph = &slot->glyph;
+	} else {
+		fons__lock(cache);
+		glyph = fons__getSharedGlyph(stash, font, codepoint, isize, iblur, idilate, bitmapOption);
+		if (glyph != NULL) {
+			slot->font = font;
+			slot->generation = stash->tex->generation;
+			slot->glyph = *glyph;
+			// The bitmap of a glyph added after the atlas was reset or expanded is not in this stash's texture.
+			if (stash->tex != cache->tex && glyph->x0 >= 0) {
+				slot->glyph.x1 = (short)(glyph->x1 - glyph->x0 - 1);
+				slot->glyph.y1 = (short)(glyph->y1 - glyph->y0 - 1);
+				slot->glyph.x0 = -1;
+				slot->glyph.y0 = -1;
+			}
+			glyph = &slot->glyph;
+		}
+		fons__unlock(cache);
+	}
+
+	if (glyph != NULL && codepoint < 128) {
+		ascii->glyphs[codepoint] = *glyph;
+		ascii->state[codepoint] = (glyph->x0 >= 0 && glyph->y0 >= 0) ? 2 : 1;
+		return &ascii->glyphs[codepoint];
+	}
+	return glyph;
+}
+
+// Returns the kerning between two glyphs in font units.
+static int fons__getKerning(FONScontext* stash, FONSfont* font, int glyph1, int glyph2)
+{
+	int kern;
+
+	if (stash->params.flags & FONS_NO_KERNING)
+		return 0;
+	if (glyph1 < font->nkernMap && glyph2 < font->nkernMap) {
+		int i = font->kernMap[glyph1], j = font->kernMap[glyph2];
+		if (i != 0 && j != 0)
+			return font->kern[(i-1)*font->nkern + (j-1)];
+	}
+#ifdef FONS_USE_FREETYPE
+	// FreeType faces can not be used from several threads at once.
+	fons__lock(stash->cache);
+	kern = fons__tt_getGlyphKernAdvance(&font->font, glyph1, glyph2);
+	fons__unlock(stash->cache);
+#else
+	kern = fons__tt_getGlyphKernAdvance(&font->font, glyph1, glyph2);
+#endif
+	return kern;
+}
+
+// Computes the position of the glyph's quad and moves x past the glyph, the texture coordinates are not touched.
+static void fons__getQuadRect(FONScontext* stash, FONSfont* font,
+							  int prevGlyphIndex, FONSglyph* glyph,
+							  float scale, float spacing, float* x, float* y, FONSquad* q)
 {
 	float rx,ry,xoff,yoff,x0,y0,x1,y1;
 
 	if (prevGlyphIndex != -1) {
-		float adv = fons__tt_getGlyphKernAdvance(&font->font, prevGlyphIndex, glyph->index) * scale;
+		float adv = fons__getKerning(stash, font, prevGlyphIndex, glyph->index) * scale;
 		*x += (int)(adv + spacing + 0.5f);
 	}
 
@@ -1397,11 +2058,6 @@ static void fons__getQuad(FONScontext* stash, FONSfont* font,
 		q->y0 = ry;
 		q->x1 = rx + x1 - x0;
 		q->y1 = ry + y1 - y0;
-
-		q->s0 = x0 * stash->itw;
-		q->t0 = y0 * stash->ith;
-		q->s1 = x1 * stash->itw;
-		q->t1 = y1 * stash->ith;
 	} else {
 		rx = floorf(*x + xoff);
 		ry = floorf(*y - yoff);
@@ -1410,28 +2066,33 @@ static void fons__getQuad(FONScontext* stash, FONSfont* font,
 		q->y0 = ry;
 		q->x1 = rx + x1 - x0;
 		q->y1 = ry - y1 + y0;
-
-		q->s0 = x0 * stash->itw;
-		q->t0 = y0 * stash->ith;
-		q->s1 = x1 * stash->itw;
-		q->t1 = y1 * stash->ith;
 	}
 
 	*x += (int)(glyph->xadv / 10.0f + 0.5f);
 }
 
+static void fons__getQuad(FONScontext* stash, FONSfont* font,
+						   int prevGlyphIndex, FONSglyph* glyph,
+						   float scale, float spacing, float* x, float* y, FONSquad* q)
+{
+	fons__getQuadRect(stash, font, prevGlyphIndex, glyph, scale, spacing, x, y, q);
+	q->s0 = (float)(glyph->x0+1) * stash->itw;
+	q->t0 = (float)(glyph->y0+1) * stash->ith;
+	q->s1 = (float)(glyph->x1-1) * stash->itw;
+	q->t1 = (float)(glyph->y1-1) * stash->ith;
+}
+
 static void fons__flush(FONScontext* stash)
 {
 	// Flush texture
+	fons__lock(stash->cache);
 	if (stash->dirtyRect[0] < stash->dirtyRect[2] && stash->dirtyRect[1] < stash->dirtyRect[3]) {
 		if (stash->params.renderUpdate != NULL)
-			stash->params.renderUpdate(stash->params.userPtr, stash->dirtyRect, stash->texData);
+			stash->params.renderUpdate(stash->params.userPtr, stash->dirtyRect, stash->tex->data);
 		// Reset dirty rect
-		stash->dirtyRect[0] = stash->params.width;
-		stash->dirtyRect[1] = stash->params.height;
-		stash->dirtyRect[2] = 0;
-		stash->dirtyRect[3] = 0;
+		fons__resetDirty(stash);
 	}
+	fons__unlock(stash->cache);
 
 	// Flush triangles
 	if (stash->nverts > 0) {
@@ -1484,6 +2145,7 @@ float fonsDrawText(FONScontext* stash,
 	FONSstate* state = fons__getState(stash);
 	unsigned int codepoint;
 	unsigned int utf8state = 0;
+	const char* asciiEnd;
 	FONSglyph* glyph = NULL;
 	FONSquad q;
 	int prevGlyphIndex = -1;
@@ -1495,14 +2157,17 @@ float fonsDrawText(FONScontext* stash,
 	float width;
 
 	if (stash == NULL) return x;
-	if (state->font < 0 || state->font >= stash->nfonts) return x;
-	font = stash->fonts[state->font];
-	if (font->data == NULL) return x;
+	font = fons__getFont(stash, state->font);
+	if (font == NULL) return x;
+
+	// Pick up the atlas if another stash has reset it.
+	fonsSyncAtlas(stash);
 
 	scale = fons__tt_getPixelHeightScale(&font->font, (float)isize/10.0f);
 
 	if (end == NULL)
 		end = str + strlen(str);
+	asciiEnd = str;
 
 	// Align horizontally
 	if (state->align & FONS_ALIGN_LEFT) {
@@ -1518,7 +2183,7 @@ float fonsDrawText(FONScontext* stash,
 	y += fons__getVertAlign(stash, font, state->align, isize);
 
 	for (; str != end; ++str) {
-		if (fons__decutf8(&utf8state, &codepoint, *(const unsigned char*)str))
+		if (fons__decnext(&utf8state, &codepoint, str, end, &asciiEnd))
 			continue;
 		glyph = fons__getGlyph(stash, font, codepoint, isize, iblur, idilate, FONS_GLYPH_BITMAP_REQUIRED);
 		if (glyph != NULL) {
@@ -1551,9 +2216,8 @@ int fonsTextIterInit(FONScontext* stash, FONStextIter* iter,
 	memset(iter, 0, sizeof(*iter));
 
 	if (stash == NULL) return 0;
-	if (state->font < 0 || state->font >= stash->nfonts) return 0;
-	iter->font = stash->fonts[state->font];
-	if (iter->font->data == NULL) return 0;
+	iter->font = fons__getFont(stash, state->font);
+	if (iter->font == NULL) return 0;
 
 	iter->isize = (short)(state->size*10.0f);
 	iter->iblur = (short)state->blur;
@@ -1582,6 +2246,7 @@ int fonsTextIterInit(FONScontext* stash, FONStextIter* iter,
 	iter->str = str;
 	iter->next = str;
 	iter->end = end;
+	iter->asciiEnd = str;
 	iter->codepoint = 0;
 	iter->prevGlyphIndex = -1;
 	iter->bitmapOption = bitmapOption;
@@ -1589,7 +2254,7 @@ int fonsTextIterInit(FONScontext* stash, FONStextIter* iter,
 	return 1;
 }
 
-int fonsTextIterNext(FONScontext* stash, FONStextIter* iter, FONSquad* quad)
+static int fons__textIterNext(FONScontext* stash, FONStextIter* iter, FONSquad* quad, int measure)
 {
 	FONSglyph* glyph = NULL;
 	const char* str = iter->next;
@@ -1599,7 +2264,7 @@ int fonsTextIterNext(FONScontext* stash, FONStextIter* iter, FONSquad* quad)
 		return 0;
 
 	for (; str != iter->end; str++) {
-		if (fons__decutf8(&iter->utf8state, &iter->codepoint, *(const unsigned char*)str))
+		if (fons__decnext(&iter->utf8state, &iter->codepoint, str, iter->end, &iter->asciiEnd))
 			continue;
 		str++;
 		// Get glyph and quad
@@ -1607,7 +2272,9 @@ int fonsTextIterNext(FONScontext* stash, FONStextIter* iter, FONSquad* quad)
 		iter->y = iter->nexty;
 		glyph = fons__getGlyph(stash, iter->font, iter->codepoint, iter->isize, iter->iblur, iter->idilate, iter->bitmapOption);
 		// If the iterator was initialized with FONS_GLYPH_BITMAP_OPTIONAL, then the UV coordinates of the quad will be invalid.
-		if (glyph != NULL)
+		if (glyph != NULL && measure)
+			fons__getQuadRect(stash, iter->font, iter->prevGlyphIndex, glyph, iter->scale, iter->spacing, &iter->nextx, &iter->nexty, quad);
+		else if (glyph != NULL)
 			fons__getQuad(stash, iter->font, iter->prevGlyphIndex, glyph, iter->scale, iter->spacing, &iter->nextx, &iter->nexty, quad);
 		iter->prevGlyphIndex = glyph != NULL ? glyph->index : -1;
 		break;
@@ -1617,6 +2284,160 @@ int fonsTextIterNext(FONScontext* stash, FONStextIter* iter, FONSquad* quad)
 	return 1;
 }
 
+int fonsTextIterNext(FONScontext* stash, FONStextIter* iter, FONSquad* quad)
+{
+	return fons__textIterNext(stash, iter, quad, 0);
+}
+
+int fonsTextIterMeasure(FONScontext* stash, FONStextIter* iter, FONSquad* quad)
+{
+	return fons__textIterNext(stash, iter, quad, 1);
+}
+
+int fonsMeasureIterInit(FONScontext* stash, FONStextIter* iter, int font, float size, float spacing,
+						float x, float y, const char* str, const char* end)
+{
+	memset(iter, 0, sizeof(*iter));
+
+	if (stash == NULL) return 0;
+	iter->font = fons__getFont(stash, font);
+	if (iter->font == NULL) return 0;
+
+	if (end == NULL)
+		end = str + strlen(str);
+
+	iter->isize = (short)(size*10.0f);
+	iter->scale = fons__tt_getPixelHeightScale(&iter->font->font, (float)iter->isize/10.0f);
+	iter->x = iter->nextx = x;
+	iter->y = iter->nexty = y;
+	iter->spacing = spacing;
+	iter->str = str;
+	iter->next = str;
+	iter->end = end;
+	iter->asciiEnd = str;
+	iter->prevGlyphIndex = -1;
+	iter->bitmapOption = FONS_GLYPH_BITMAP_OPTIONAL;
+
+	return 1;
+}
+
+// Fills in the metrics of a glyph the way fons__getSharedGlyph() does, without adding it to the cache.
+static int fons__measureGlyph(FONScontext* stash, FONSfont* font, unsigned int codepoint, short isize, FONSglyph* glyph)
+{
+	FONSfont* renderFont = font;
+	float size = isize/10.0f;
+	float scale;
+	int i, g, advance, lsb, x0, y0, x1, y1;
+	const int pad = 2;
+
+	if (isize < 2) return 0;
+
+	// The codepoint cache is filled under the lock, look up glyphs from the tables which do not change.
+#ifdef FONS_USE_FREETYPE
+	fons__lock(stash->cache);
+#endif
+	if (codepoint >= FONS_KERN_FIRST && codepoint <= FONS_KERN_LAST)
+		g = font->rangeGlyphs[codepoint-FONS_KERN_FIRST];
+	else
+		g = fons__tt_getGlyphIndex(&font->font, codepoint);
+	if (g == 0) {
+		for (i = 0; i < font->nfallbacks; ++i) {
+			FONSfont* fallbackFont = stash->cache->fonts[font->fallbacks[i]];
+			int fallbackIndex = fons__tt_getGlyphIndex(&fallbackFont->font, codepoint);
+			if (fallbackIndex != 0) {
+				g = fallbackIndex;
+				renderFont = fallbackFont;
+				break;
+			}
+		}
+	}
+	scale = fons__tt_getPixelHeightScale(&renderFont->font, size);
+	fons__tt_buildGlyphBitmap(&renderFont->font, g, size, scale, &advance, &lsb, &x0, &y0, &x1, &y1);
+#ifdef FONS_USE_FREETYPE
+	fons__unlock(stash->cache);
+#endif
+
+	// Same layout as a glyph without bitmap in the cache.
+	glyph->codepoint = codepoint;
+	glyph->index = g;
+	glyph->size = isize;
+	glyph->blur = 0;
+	glyph->dilate = 0;
+	glyph->x0 = -1;
+	glyph->y0 = -1;
+	glyph->x1 = (short)(x1-x0 + pad*2 - 1);
+	glyph->y1 = (short)(y1-y0 + pad*2 - 1);
+	glyph->xadv = (short)(scale * advance * 10.0f);
+	glyph->xoff = (short)(x0 - pad);
+	glyph->yoff = (short)(y0 - pad);
+	return 1;
+}
+
+int fonsMeasureIterNext(FONScontext* stash, FONStextIter* iter, FONSquad* quad)
+{
+	FONSglyph glyph;
+	const char* str = iter->next;
+	iter->str = iter->next;
+
+	if (str == iter->end)
+		return 0;
+
+	for (; str != iter->end; str++) {
+		if (fons__decnext(&iter->utf8state, &iter->codepoint, str, iter->end, &iter->asciiEnd))
+			continue;
+		str++;
+		iter->x = iter->nextx;
+		iter->y = iter->nexty;
+		if (fons__measureGlyph(stash, iter->font, iter->codepoint, iter->isize, &glyph)) {
+			fons__getQuadRect(stash, iter->font, iter->prevGlyphIndex, &glyph, iter->scale, iter->spacing, &iter->nextx, &iter->nexty, quad);
+			iter->prevGlyphIndex = glyph.index;
+		} else {
+			iter->prevGlyphIndex = -1;
+		}
+		break;
+	}
+	iter->next = str;
+
+	return 1;
+}
+
+float fonsMeasureText(FONScontext* stash, int font, float size, float spacing,
+					  float x, float y, const char* str, const char* end, float* bounds)
+{
+	FONStextIter iter;
+	FONSquad q;
+	float minx, miny, maxx, maxy;
+
+	if (!fonsMeasureIterInit(stash, &iter, font, size, spacing, x, y, str, end)) {
+		if (bounds != NULL)
+			bounds[0] = bounds[1] = bounds[2] = bounds[3] = 0.0f;
+		return 0;
+	}
+
+	minx = maxx = x;
+	miny = maxy = y;
+	while (fonsMeasureIterNext(stash, &iter, &q)) {
+		if (iter.prevGlyphIndex == -1) continue;
+		if (q.x0 < minx) minx = q.x0;
+		if (q.x1 > maxx) maxx = q.x1;
+		if (stash->params.flags & FONS_ZERO_TOPLEFT) {
+			if (q.y0 < miny) miny = q.y0;
+			if (q.y1 > maxy) maxy = q.y1;
+		} else {
+			if (q.y1 < miny) miny = q.y1;
+			if (q.y0 > maxy) maxy = q.y0;
+		}
+	}
+
+	if (bounds != NULL) {
+		bounds[0] = minx;
+		bounds[1] = miny;
+		bounds[2] = maxx;
+		bounds[3] = maxy;
+	}
+	return iter.nextx - x;
+}
+
 void fonsDrawDebug(FONScontext* stash, float x, float y)
 {
 	int i;
@@ -1647,11 +2468,17 @@ void fonsDrawDebug(FONScontext* stash, float x, float y)
 	fons__vertex(stash, x+w, y+h, 1, 1, 0xffffffff);
 
 	// Drawbug draw atlas
-	for (i = 0; i < stash->atlas->nnodes; i++) {
-		FONSatlasNode* n = &stash->atlas->nodes[i];
+	fons__lock(stash->cache);
+	for (i = 0; i < stash->cache->atlas->nnodes; i++) {
+		FONSatlasNode* n;
 
-		if (stash->nverts+6 > FONS_VERTEX_COUNT)
+		if (stash->nverts+6 > FONS_VERTEX_COUNT) {
+			fons__unlock(stash->cache);
 			fons__flush(stash);
+			fons__lock(stash->cache);
+			if (i >= stash->cache->atlas->nnodes) break;
+		}
+		n = &stash->cache->atlas->nodes[i];
 
 		fons__vertex(stash, x+n->x+0, y+n->y+0, u, v, 0xc00000ff);
 		fons__vertex(stash, x+n->x+n->width, y+n->y+1, u, v, 0xc00000ff);
@@ -1661,6 +2488,7 @@ void fonsDrawDebug(FONScontext* stash, float x, float y)
 		fons__vertex(stash, x+n->x+0, y+n->y+1, u, v, 0xc00000ff);
 		fons__vertex(stash, x+n->x+n->width, y+n->y+1, u, v, 0xc00000ff);
 	}
+	fons__unlock(stash->cache);
 
 	fons__flush(stash);
 }
@@ -1673,6 +2501,7 @@ float fonsTextBounds(FONScontext* stash,
 	FONSstate* state = fons__getState(stash);
 	unsigned int codepoint;
 	unsigned int utf8state = 0;
+	const char* asciiEnd;
 	FONSquad q;
 	FONSglyph* glyph = NULL;
 	int prevGlyphIndex = -1;
@@ -1685,9 +2514,8 @@ float fonsTextBounds(FONScontext* stash,
 	float minx, miny, maxx, maxy;
 
 	if (stash == NULL) return 0;
-	if (state->font < 0 || state->font >= stash->nfonts) return 0;
-	font = stash->fonts[state->font];
-	if (font->data == NULL) return 0;
+	font = fons__getFont(stash, state->font);
+	if (font == NULL) return 0;
 
 	scale = fons__tt_getPixelHeightScale(&font->font, (float)isize/10.0f);
 
@@ -1700,13 +2528,14 @@ float fonsTextBounds(FONScontext* stash,
 
 	if (end == NULL)
 		end = str + strlen(str);
+	asciiEnd = str;
 
 	for (; str != end; ++str) {
-		if (fons__decutf8(&utf8state, &codepoint, *(const unsigned char*)str))
+		if (fons__decnext(&utf8state, &codepoint, str, end, &asciiEnd))
 			continue;
 		glyph = fons__getGlyph(stash, font, codepoint, isize, iblur, idilate, FONS_GLYPH_BITMAP_OPTIONAL);
 		if (glyph != NULL) {
-			fons__getQuad(stash, font, prevGlyphIndex, glyph, scale, state->spacing, &x, &y, &q);
+			fons__getQuadRect(stash, font, prevGlyphIndex, glyph, scale, state->spacing, &x, &y, &q);
 			if (q.x0 < minx) minx = q.x0;
 			if (q.x1 > maxx) maxx = q.x1;
 			if (stash->params.flags & FONS_ZERO_TOPLEFT) {
@@ -1751,10 +2580,9 @@ void fonsVertMetrics(FONScontext* stash,
 	short isize;
 
 	if (stash == NULL) return;
-	if (state->font < 0 || state->font >= stash->nfonts) return;
-	font = stash->fonts[state->font];
+	font = fons__getFont(stash, state->font);
 	isize = (short)(state->size*10.0f);
-	if (font->data == NULL) return;
+	if (font == NULL) return;
 
 	if (ascender)
 		*ascender = font->ascender*isize/10.0f;
@@ -1771,10 +2599,9 @@ void fonsLineBounds(FONScontext* stash, float y, float* miny, float* maxy)
 	short isize;
 
 	if (stash == NULL) return;
-	if (state->font < 0 || state->font >= stash->nfonts) return;
-	font = stash->fonts[state->font];
+	font = fons__getFont(stash, state->font);
 	isize = (short)(state->size*10.0f);
-	if (font->data == NULL) return;
+	if (font == NULL) return;
 
 	y += fons__getVertAlign(stash, font, state->align, isize);
 
@@ -1793,7 +2620,7 @@ const unsigned char* fonsGetTextureData(FONScontext* stash, int* width, int* hei
 		*width = stash->params.width;
 	if (height != NULL)
 		*height = stash->params.height;
-	return stash->texData;
+	return stash->tex->data;
 }
 
 int fonsValidateTexture(FONScontext* stash, int* dirty)
@@ -1804,31 +2631,37 @@ int fonsValidateTexture(FONScontext* stash, int* dirty)
 		dirty[2] = stash->dirtyRect[2];
 		dirty[3] = stash->dirtyRect[3];
 		// Reset dirty rect
-		stash->dirtyRect[0] = stash->params.width;
-		stash->dirtyRect[1] = stash->params.height;
-		stash->dirtyRect[2] = 0;
-		stash->dirtyRect[3] = 0;
+		fons__resetDirty(stash);
 		return 1;
 	}
 	return 0;
 }
 
+void fonsLockTexture(FONScontext* stash)
+{
+	fons__lock(stash->cache);
+}
+
+void fonsUnlockTexture(FONScontext* stash)
+{
+	fons__unlock(stash->cache);
+}
+
 void fonsDeleteInternal(FONScontext* stash)
 {
-	int i;
+	int last = 0;
 	if (stash == NULL) return;
 
 	if (stash->params.renderDelete)
 		stash->params.renderDelete(stash->params.userPtr);
 
-	for (i = 0; i < stash->nfonts; ++i)
-		fons__freeFont(stash->fonts[i]);
-
-	if (stash->atlas) fons__deleteAtlas(stash->atlas);
-	if (stash->fonts) free(stash->fonts);
-	if (stash->texData) free(stash->texData);
-	if (stash->scratch) free(stash->scratch);
-	fons__tt_done(stash);
+	if (stash->cache != NULL) {
+		fons__lock(stash->cache);
+		last = fons__removeStash(stash->cache, stash);
+		fons__unlock(stash->cache);
+		if (last)
+			fons__deleteCache(stash->cache);
+	}
 	free(stash);
 }
 
@@ -1848,9 +2681,12 @@ void fonsGetAtlasSize(FONScontext* stash, int* width, int* height)
 
 int fonsExpandAtlas(FONScontext* stash, int width, int height)
 {
-	int i, maxy = 0;
-	unsigned char* data = NULL;
+	int i, maxy;
+	FONScache* cache;
+	FONStexture* src;
+	FONStexture* tex;
 	if (stash == NULL) return 0;
+	cache = stash->cache;
 
 	width = fons__maxi(width, stash->params.width);
 	height = fons__maxi(height, stash->params.height);
@@ -1866,38 +2702,36 @@ int fonsExpandAtlas(FONScontext* stash, int width, int height)
 		if (stash->params.renderResize(stash->params.userPtr, width, height) == 0)
 			return 0;
 	}
-	// Copy old texture data over.
-	data = (unsigned char*)malloc(width * height);
-	if (data == NULL)
+
+	fons__lock(cache);
+	src = cache->tex;
+	width = fons__maxi(width, src->width);
+	height = fons__maxi(height, src->height);
+
+	// Copy old texture data over, glyph locations stay valid so the generation is kept.
+	tex = fons__allocTexture(width, height, src->generation);
+	if (tex == NULL) {
+		fons__unlock(cache);
 		return 0;
-	for (i = 0; i < stash->params.height; i++) {
-		unsigned char* dst = &data[i*width];
-		unsigned char* src = &stash->texData[i*stash->params.width];
-		memcpy(dst, src, stash->params.width);
-		if (width > stash->params.width)
-			memset(dst+stash->params.width, 0, width - stash->params.width);
 	}
-	if (height > stash->params.height)
-		memset(&data[stash->params.height * width], 0, (height - stash->params.height) * width);
+	for (i = 0; i < src->height; i++)
+		memcpy(&tex->data[i*width], &src->data[i*src->width], src->width);
 
-	free(stash->texData);
-	stash->texData = data;
+	fons__releaseTexture(cache->tex);
+	cache->tex = tex;
 
 	// Increase atlas size
-	fons__atlasExpand(stash->atlas, width, height);
+	fons__atlasExpand(cache->atlas, width, height);
+
+	fons__useTexture(stash, tex);
 
 	// Add existing data as dirty.
-	for (i = 0; i < stash->atlas->nnodes; i++)
-		maxy = fons__maxi(maxy, stash->atlas->nodes[i].y);
+	maxy = fons__atlasUsedHeight(cache->atlas);
 	stash->dirtyRect[0] = 0;
 	stash->dirtyRect[1] = 0;
-	stash->dirtyRect[2] = stash->params.width;
+	stash->dirtyRect[2] = src->width;
 	stash->dirtyRect[3] = maxy;
-
-	stash->params.width = width;
-	stash->params.height = height;
-	stash->itw = 1.0f/stash->params.width;
-	stash->ith = 1.0f/stash->params.height;
+	fons__unlock(cache);
 
 	return 1;
 }
@@ -1905,7 +2739,10 @@ int fonsExpandAtlas(FONScontext* stash, int width, int height)
 int fonsResetAtlas(FONScontext* stash, int width, int height)
 {
 	int i, j;
+	FONScache* cache;
+	FONStexture* tex;
 	if (stash == NULL) return 0;
+	cache = stash->cache;
 
 	// Flush pending glyphs.
 	fons__flush(stash);
@@ -1916,35 +2753,68 @@ int fonsResetAtlas(FONScontext* stash, int width, int height)
 			return 0;
 	}
 
-	// Reset atlas
-	fons__atlasReset(stash->atlas, width, height);
+	fons__lock(cache);
 
-	// Clear texture data.
-	stash->texData = (unsigned char*)realloc(stash->texData, width * height);
-	if (stash->texData == NULL) return 0;
-	memset(stash->texData, 0, width * height);
+	// Clear texture data. Other stashes keep using the old texture until they sync.
+	tex = fons__allocTexture(width, height, ++cache->generation);
+	if (tex == NULL) {
+		fons__unlock(cache);
+		return 0;
+	}
+	fons__releaseTexture(cache->tex);
+	cache->tex = tex;
 
-	// Reset dirty rect
-	stash->dirtyRect[0] = width;
-	stash->dirtyRect[1] = height;
-	stash->dirtyRect[2] = 0;
-	stash->dirtyRect[3] = 0;
+	// Reset atlas
+	fons__atlasReset(cache->atlas, width, height);
 
 	// Reset cached glyphs
-	for (i = 0; i < stash->nfonts; i++) {
-		FONSfont* font = stash->fonts[i];
+	for (i = 0; i < cache->nfonts; i++) {
+		FONSfont* font = cache->fonts[i];
 		font->nglyphs = 0;
 		for (j = 0; j < FONS_HASH_LUT_SIZE; j++)
 			font->lut[j] = -1;
 	}
 
-	stash->params.width = width;
-	stash->params.height = height;
-	stash->itw = 1.0f/stash->params.width;
-	stash->ith = 1.0f/stash->params.height;
+	fons__useTexture(stash, tex);
+
+	// Reset dirty rect
+	fons__resetDirty(stash);
 
 	// Add white rect at 0,0 for debug drawing.
-	fons__addWhiteRect(stash, 2,2);
+	fons__addWhiteRect(cache, 2,2);
+
+	fons__unlock(cache);
+
+	return 1;
+}
+
+int fonsSyncAtlas(FONScontext* stash)
+{
+	FONScache* cache;
+	int changed;
+	if (stash == NULL) return 0;
+	cache = stash->cache;
+
+	fons__lock(cache);
+	changed = stash->tex != cache->tex;
+	fons__unlock(cache);
+	if (!changed)
+		return 0;
+
+	// Flush pending glyphs.
+	fons__flush(stash);
+
+	fons__lock(cache);
+	fons__useTexture(stash, cache->tex);
+	// The whole atlas needs to be uploaded.
+	stash->dirtyRect[0] = 0;
+	stash->dirtyRect[1] = 0;
+	stash->dirtyRect[2] = stash->params.width;
+	stash->dirtyRect[3] = fons__atlasUsedHeight(cache->atlas);
+	fons__unlock(cache);
+
+	if (stash->params.renderResize != NULL)
+		stash->params.renderResize(stash->params.userPtr, stash->params.width, stash->params.height);
 
 	return 1;
 }
@@ -21,7 +21,29 @@
 #include <math.h>
 #include <memory.h>
 
+#ifndef NVG_NO_THREADS
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#endif
+
+// Segment directions and stroke joins use SSE2 when the target has it, define NVG_NO_SIMD to force the scalar code.
+// The two match within float rounding, fused multiply-adds from the compiler can change the last bits.
+#ifndef NVG_NO_SIMD
+#	if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#		define NVG_SSE2 1
+#		include <emmintrin.h>
+#	endif
+#endif
+
 #include "nanovg.h"
+#ifdef NVG_NO_THREADS
+#define FONS_NO_THREADS
+#endif
 #define FONTSTASH_IMPLEMENTATION
 #include "fontstash.h"
 
@@ -49,7 +71,8 @@
 #	define NVG_MAX_FONTIMAGES 4
 #endif
 
-#define NVG_INIT_COMMANDS_SIZE 256
+#define NVG_INIT_COMMANDS_SIZE 64
+#define NVG_INIT_COMMAND_POINTS_SIZE 128
 #define NVG_INIT_POINTS_SIZE 128
 #define NVG_INIT_PATHS_SIZE 16
 #define NVG_INIT_VERTS_SIZE 256
@@ -58,6 +81,53 @@
 #define NVG_MAX_STATES 32
 #endif
 
+// Max number of lengths in a dash pattern, see nvgLineDash().
+#ifndef NVG_MAX_DASHES
+#define NVG_MAX_DASHES 16
+#endif
+
+// Max number of color stops of a gradient, see nvgLinearGradientStops().
+#ifndef NVG_MAX_GRADIENT_STOPS
+#define NVG_MAX_GRADIENT_STOPS 16
+#endif
+
+// Size of the texture holding the color ramps of multi-stop gradients, one ramp per row.
+#ifndef NVG_GRADIENT_RAMP_WIDTH
+#define NVG_GRADIENT_RAMP_WIDTH 256
+#endif
+#ifndef NVG_GRADIENT_RAMP_ROWS
+#define NVG_GRADIENT_RAMP_ROWS 64
+#endif
+// Number of stops taken out of the ramp texture that are kept, to bake them again for paints kept over frames.
+#ifndef NVG_GRADIENT_RAMP_HISTORY
+#define NVG_GRADIENT_RAMP_HISTORY 256
+#endif
+
+// Minimum size of the per frame arena blocks.
+#ifndef NVG_ARENA_BLOCK_SIZE
+#define NVG_ARENA_BLOCK_SIZE (64*1024)
+#endif
+
+// Max number of threads used for deferred tessellation, including the thread calling nvgEndFrame().
+#ifndef NVG_MAX_TESS_THREADS
+#define NVG_MAX_TESS_THREADS 8
+#endif
+
+// Batches with fewer deferred paths are tessellated on the calling thread.
+#ifndef NVG_MIN_PARALLEL_JOBS
+#define NVG_MIN_PARALLEL_JOBS 16
+#endif
+
+// Max number of threads decoding images for nvgCreateImageAsync().
+#ifndef NVG_MAX_IMAGE_THREADS
+#define NVG_MAX_IMAGE_THREADS 4
+#endif
+
+// Default number of bytes of decoded images uploaded per frame, see nvgImageUploadBudget().
+#ifndef NVG_IMAGE_UPLOAD_BUDGET
+#define NVG_IMAGE_UPLOAD_BUDGET (4*1024*1024)
+#endif
+
 #define NVG_KAPPA90 0.5522847493f	// Length proportional to radius of a cubic bezier handle for 90deg arcs.
 
 #define NVG_COUNTOF(arr) (sizeof(arr) / sizeof(0[arr]))
@@ -88,6 +158,9 @@ struct NVGstate {
 	float miterLimit;
 	int lineJoin;
 	int lineCap;
+	float dashes[NVG_MAX_DASHES];
+	int ndashes;
+	float dashOffset;
 	float alpha;
 	float xform[6];
 	NVGscissor scissor;
@@ -125,15 +198,76 @@ struct NVGpathCache {
 };
 typedef struct NVGpathCache NVGpathCache;
 
+struct NVGarenaBlock {
+	struct NVGarenaBlock* next;
+	size_t size;
+	size_t used;
+};
+typedef struct NVGarenaBlock NVGarenaBlock;
+
+// Bump allocator for data which lives at most until the end of the frame.
+struct NVGarena {
+	NVGarenaBlock* blocks;	// Current block first.
+	size_t used;			// Bytes used in all blocks.
+	size_t peak;			// Max bytes used since last reset.
+};
+typedef struct NVGarena NVGarena;
+
+struct NVGarenaMark {
+	NVGarenaBlock* block;
+	size_t used;
+};
+typedef struct NVGarenaMark NVGarenaMark;
+
+struct NVGgradientStops {
+	int nstops;
+	float offsets[NVG_MAX_GRADIENT_STOPS];
+	NVGcolor colors[NVG_MAX_GRADIENT_STOPS];
+};
+typedef struct NVGgradientStops NVGgradientStops;
+
+struct NVGgradientRow {
+	NVGgradientStops stops;
+	unsigned int hash;
+	int lastUse;			// Frame the row was last used in, -1 if the row is free.
+};
+typedef struct NVGgradientRow NVGgradientRow;
+
+// Color ramps of multi-stop gradients, baked into the rows of a texture and shared by gradients with the same stops.
+struct NVGgradientRamps {
+	int image;
+	NVGgradientRow rows[NVG_GRADIENT_RAMP_ROWS];
+	NVGgradientRow evicted[NVG_GRADIENT_RAMP_HISTORY];	// Ring of the stops of reused rows.
+	int nextEvicted;
+	unsigned char data[NVG_GRADIENT_RAMP_WIDTH*NVG_GRADIENT_RAMP_ROWS*4];
+};
+typedef struct NVGgradientRamps NVGgradientRamps;
+
+struct NVGcommandList;
+struct NVGtessPool;
+struct NVGimageLoader;
+
 struct NVGcontext {
 	NVGparams params;
-	float* commands;
+	NVGcontext* parent;		// Context the command list is submitted to, NULL if not a command list.
+	unsigned char* commands;	// Opcodes of the path, NVG_WINDING is followed by the winding.
 	int ccommands;
 	int ncommands;
+	float* commandPoints;	// Transformed points of the commands, as x,y pairs.
+	int ccommandPoints;
+	int ncommandPoints;
 	float commandx, commandy;
+	NVGshape shape;			// Shape of the path, valid if the path has shapeCommands commands.
+	int shapeCommands;
 	NVGstate states[NVG_MAX_STATES];
 	int nstates;
 	NVGpathCache* cache;
+	NVGarena arena;
+	struct NVGtessPool* tessPool;	// Deferred fills and strokes, NULL if tessellation is not deferred.
+	struct NVGimageLoader* imageLoader;	// Created by the first nvgCreateImageAsync().
+	int imageUploadBudget;
+	NVGgradientRamps* ramps;	// Created by the first multi-stop gradient.
+	int frameCount;
 	float tessTol;
 	float distTol;
 	float fringeWidth;
@@ -178,40 +312,171 @@ static float nvg__normalize(float *x, float* y)
 }
 
 static void nvg__flushTextTexture(NVGcontext* ctx);
+static int nvg__listAddStops(NVGcontext* ctx, const NVGgradientStops* stops);
+static struct NVGtessPool* nvg__createTessPool(NVGcontext* ctx);
+static void nvg__deleteTessPool(struct NVGtessPool* pool);
+static void nvg__flushTessJobs(NVGcontext* ctx);
+static void nvg__clearTessJobs(NVGcontext* ctx);
+static void nvg__deleteImageLoader(struct NVGimageLoader* loader);
+static void nvg__uploadImages(NVGcontext* ctx);
+static void nvg__cancelImageLoad(NVGcontext* ctx, int image);
+
+void* nvgInternalAlloc(const NVGallocator* allocator, size_t size)
+{
+	if (allocator == NULL || allocator->alloc == NULL)
+		return malloc(size);
+	return allocator->alloc(allocator->userPtr, size);
+}
+
+void* nvgInternalRealloc(const NVGallocator* allocator, void* ptr, size_t size)
+{
+	if (allocator == NULL || allocator->alloc == NULL)
+		return realloc(ptr, size);
+	return allocator->realloc(allocator->userPtr, ptr, size);
+}
+
+void nvgInternalFree(const NVGallocator* allocator, void* ptr)
+{
+	if (ptr == NULL) return;
+	if (allocator == NULL || allocator->alloc == NULL)
+		free(ptr);
+	else
+		allocator->free(allocator->userPtr, ptr);
+}
+
+static void* nvg__alloc(NVGcontext* ctx, size_t size) { return nvgInternalAlloc(&ctx->params.allocator, size); }
+static void* nvg__realloc(NVGcontext* ctx, void* ptr, size_t size) { return nvgInternalRealloc(&ctx->params.allocator, ptr, size); }
+static void nvg__free(NVGcontext* ctx, void* ptr) { nvgInternalFree(&ctx->params.allocator, ptr); }
+
+// Size of the block header, keeps the block data 16 byte aligned.
+#define NVG_ARENA_HEADER_SIZE ((sizeof(NVGarenaBlock) + 15) & ~(size_t)15)
+
+static NVGarenaBlock* nvg__arenaAllocBlock(NVGcontext* ctx, size_t size)
+{
+	NVGarenaBlock* block = (NVGarenaBlock*)nvg__alloc(ctx, NVG_ARENA_HEADER_SIZE + size);
+	if (block == NULL) return NULL;
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+static void* nvg__arenaAlloc(NVGcontext* ctx, size_t size)
+{
+	NVGarena* arena = &ctx->arena;
+	NVGarenaBlock* block = arena->blocks;
+	void* ptr;
+
+	size = (size + 15) & ~(size_t)15;
+	if (block == NULL || block->used + size > block->size) {
+		size_t bsize = NVG_ARENA_BLOCK_SIZE;
+		if (block != NULL && block->size > bsize) bsize = block->size;
+		if (bsize < size) bsize = size;
+		block = nvg__arenaAllocBlock(ctx, bsize);
+		if (block == NULL) return NULL;
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	ptr = (unsigned char*)block + NVG_ARENA_HEADER_SIZE + block->used;
+	block->used += size;
+	arena->used += size;
+	if (arena->used > arena->peak)
+		arena->peak = arena->used;
+	return ptr;
+}
+
+static NVGarenaMark nvg__arenaMark(NVGcontext* ctx)
+{
+	NVGarenaMark mark;
+	mark.block = ctx->arena.blocks;
+	mark.used = mark.block != NULL ? mark.block->used : 0;
+	return mark;
+}
+
+// Releases everything allocated from the arena after the mark.
+static void nvg__arenaRewind(NVGcontext* ctx, NVGarenaMark mark)
+{
+	NVGarena* arena = &ctx->arena;
+	while (arena->blocks != NULL && arena->blocks != mark.block) {
+		NVGarenaBlock* block = arena->blocks;
+		arena->used -= block->used;
+		block->used = 0;
+		if (block->next == NULL && mark.block == NULL)
+			return; // Keep the first block for reuse.
+		arena->blocks = block->next;
+		nvg__free(ctx, block);
+	}
+	if (arena->blocks != NULL) {
+		arena->used -= arena->blocks->used - mark.used;
+		arena->blocks->used = mark.used;
+	}
+}
+
+// Releases all allocations. If the previous frames needed more than one block,
+// the blocks are replaced with one large enough block.
+static void nvg__arenaReset(NVGcontext* ctx)
+{
+	NVGarena* arena = &ctx->arena;
+	NVGarenaBlock* block = arena->blocks;
+	if (block != NULL && (block->next != NULL || block->size < arena->peak)) {
+		while (block != NULL) {
+			NVGarenaBlock* next = block->next;
+			nvg__free(ctx, block);
+			block = next;
+		}
+		arena->blocks = nvg__arenaAllocBlock(ctx, (arena->peak + 15) & ~(size_t)15);
+	} else if (block != NULL) {
+		block->used = 0;
+	}
+	arena->used = 0;
+	arena->peak = 0;
+}
+
+static void nvg__arenaDelete(NVGcontext* ctx)
+{
+	NVGarenaBlock* block = ctx->arena.blocks;
+	while (block != NULL) {
+		NVGarenaBlock* next = block->next;
+		nvg__free(ctx, block);
+		block = next;
+	}
+	memset(&ctx->arena, 0, sizeof(ctx->arena));
+}
 
-static void nvg__deletePathCache(NVGpathCache* c)
+static void nvg__deletePathCache(NVGcontext* ctx, NVGpathCache* c)
 {
 	if (c == NULL) return;
-	if (c->points != NULL) free(c->points);
-	if (c->paths != NULL) free(c->paths);
-	if (c->verts != NULL) free(c->verts);
-	free(c);
+	nvg__free(ctx, c->points);
+	nvg__free(ctx, c->paths);
+	nvg__free(ctx, c->verts);
+	nvg__free(ctx, c);
 }
 
-static NVGpathCache* nvg__allocPathCache(void)
+static NVGpathCache* nvg__allocPathCache(NVGcontext* ctx)
 {
-	NVGpathCache* c = (NVGpathCache*)malloc(sizeof(NVGpathCache));
+	NVGpathCache* c = (NVGpathCache*)nvg__alloc(ctx, sizeof(NVGpathCache));
 	if (c == NULL) goto error;
 	memset(c, 0, sizeof(NVGpathCache));
 
-	c->points = (NVGpoint*)malloc(sizeof(NVGpoint)*NVG_INIT_POINTS_SIZE);
+	c->points = (NVGpoint*)nvg__alloc(ctx, sizeof(NVGpoint)*NVG_INIT_POINTS_SIZE);
 	if (!c->points) goto error;
 	c->npoints = 0;
 	c->cpoints = NVG_INIT_POINTS_SIZE;
 
-	c->paths = (NVGpath*)malloc(sizeof(NVGpath)*NVG_INIT_PATHS_SIZE);
+	c->paths = (NVGpath*)nvg__alloc(ctx, sizeof(NVGpath)*NVG_INIT_PATHS_SIZE);
 	if (!c->paths) goto error;
 	c->npaths = 0;
 	c->cpaths = NVG_INIT_PATHS_SIZE;
 
-	c->verts = (NVGvertex*)malloc(sizeof(NVGvertex)*NVG_INIT_VERTS_SIZE);
+	c->verts = (NVGvertex*)nvg__alloc(ctx, sizeof(NVGvertex)*NVG_INIT_VERTS_SIZE);
 	if (!c->verts) goto error;
 	c->nverts = 0;
 	c->cverts = NVG_INIT_VERTS_SIZE;
 
 	return c;
 error:
-	nvg__deletePathCache(c);
+	nvg__deletePathCache(ctx, c);
 	return NULL;
 }
 
@@ -301,24 +566,45 @@ static NVGstate* nvg__getState(NVGcontext* ctx)
 	return &ctx->states[ctx->nstates-1];
 }
 
-NVGcontext* nvgCreateInternal(NVGparams* params)
+static FONScontext* nvg__createFontStash(FONScontext* other)
 {
 	FONSparams fontParams;
-	NVGcontext* ctx = (NVGcontext*)malloc(sizeof(NVGcontext));
+	memset(&fontParams, 0, sizeof(fontParams));
+	fontParams.width = NVG_INIT_FONTIMAGE_SIZE;
+	fontParams.height = NVG_INIT_FONTIMAGE_SIZE;
+	fontParams.flags = FONS_ZERO_TOPLEFT;
+	fontParams.renderCreate = NULL;
+	fontParams.renderUpdate = NULL;
+	fontParams.renderDraw = NULL;
+	fontParams.renderDelete = NULL;
+	fontParams.userPtr = NULL;
+	return fonsCreateShared(&fontParams, other);
+}
+
+static NVGcontext* nvg__createContext(NVGparams* params, NVGcontext* parent)
+{
+	NVGcontext* ctx = (NVGcontext*)nvgInternalAlloc(&params->allocator, sizeof(NVGcontext));
 	int i;
 	if (ctx == NULL) goto error;
 	memset(ctx, 0, sizeof(NVGcontext));
 
 	ctx->params = *params;
+	ctx->parent = parent;
+	ctx->imageUploadBudget = NVG_IMAGE_UPLOAD_BUDGET;
 	for (i = 0; i < NVG_MAX_FONTIMAGES; i++)
 		ctx->fontImages[i] = 0;
 
-	ctx->commands = (float*)malloc(sizeof(float)*NVG_INIT_COMMANDS_SIZE);
+	ctx->commands = (unsigned char*)nvg__alloc(ctx, NVG_INIT_COMMANDS_SIZE);
 	if (!ctx->commands) goto error;
 	ctx->ncommands = 0;
 	ctx->ccommands = NVG_INIT_COMMANDS_SIZE;
+	ctx->commandPoints = (float*)nvg__alloc(ctx, sizeof(float)*2*NVG_INIT_COMMAND_POINTS_SIZE);
+	if (!ctx->commandPoints) goto error;
+	ctx->ncommandPoints = 0;
+	ctx->ccommandPoints = NVG_INIT_COMMAND_POINTS_SIZE;
+	ctx->shapeCommands = -1;
 
-	ctx->cache = nvg__allocPathCache();
+	ctx->cache = nvg__allocPathCache(ctx);
 	if (ctx->cache == NULL) goto error;
 
 	nvgSave(ctx);
@@ -328,21 +614,19 @@ NVGcontext* nvgCreateInternal(NVGparams* params)
 
 	if (ctx->params.renderCreate(ctx->params.userPtr) == 0) goto error;
 
-	// Init font rendering
-	memset(&fontParams, 0, sizeof(fontParams));
-	fontParams.width = NVG_INIT_FONTIMAGE_SIZE;
-	fontParams.height = NVG_INIT_FONTIMAGE_SIZE;
-	fontParams.flags = FONS_ZERO_TOPLEFT;
-	fontParams.renderCreate = NULL;
-	fontParams.renderUpdate = NULL;
-	fontParams.renderDraw = NULL;
-	fontParams.renderDelete = NULL;
-	fontParams.userPtr = NULL;
-	ctx->fs = fonsCreateInternal(&fontParams);
+	if (ctx->params.deferTessellation && parent == NULL) {
+		ctx->tessPool = nvg__createTessPool(ctx);
+		if (ctx->tessPool == NULL) goto error;
+	}
+
+	// Init font rendering, command lists share the fonts of the parent context.
+	ctx->fs = nvg__createFontStash(parent != NULL ? parent->fs : NULL);
 	if (ctx->fs == NULL) goto error;
+	if (parent != NULL)
+		return ctx;
 
 	// Create font texture
-	ctx->fontImages[0] = ctx->params.renderCreateTexture(ctx->params.userPtr, NVG_TEXTURE_ALPHA, fontParams.width, fontParams.height, 0, NULL);
+	ctx->fontImages[0] = ctx->params.renderCreateTexture(ctx->params.userPtr, NVG_TEXTURE_ALPHA, NVG_INIT_FONTIMAGE_SIZE, NVG_INIT_FONTIMAGE_SIZE, 0, NULL);
 	if (ctx->fontImages[0] == 0) goto error;
 	ctx->fontImageIdx = 0;
 
@@ -353,6 +637,11 @@ error:
 	return 0;
 }
 
+NVGcontext* nvgCreateInternal(NVGparams* params)
+{
+	return nvg__createContext(params, NULL);
+}
+
 NVGparams* nvgInternalParams(NVGcontext* ctx)
 {
     return &ctx->params;
@@ -362,8 +651,17 @@ void nvgDeleteInternal(NVGcontext* ctx)
 {
 	int i;
 	if (ctx == NULL) return;
-	if (ctx->commands != NULL) free(ctx->commands);
-	if (ctx->cache != NULL) nvg__deletePathCache(ctx->cache);
+	nvg__deleteTessPool(ctx->tessPool);
+	nvg__deleteImageLoader(ctx->imageLoader);
+	ctx->imageLoader = NULL;
+	nvg__free(ctx, ctx->commands);
+	nvg__free(ctx, ctx->commandPoints);
+	if (ctx->cache != NULL) nvg__deletePathCache(ctx, ctx->cache);
+	if (ctx->ramps != NULL) {
+		ctx->params.renderDeleteTexture(ctx->params.userPtr, ctx->ramps->image);
+		nvg__free(ctx, ctx->ramps);
+	}
+	nvg__arenaDelete(ctx);
 
 	if (ctx->fs)
 		fonsDeleteInternal(ctx->fs);
@@ -378,7 +676,7 @@ void nvgDeleteInternal(NVGcontext* ctx)
 	if (ctx->params.renderDelete != NULL)
 		ctx->params.renderDelete(ctx->params.userPtr);
 
-	free(ctx);
+	nvg__free(ctx, ctx);
 }
 
 void nvgBeginFrame(NVGcontext* ctx, float windowWidth, float windowHeight, float devicePixelRatio)
@@ -391,9 +689,13 @@ void nvgBeginFrame(NVGcontext* ctx, float windowWidth, float windowHeight, float
 	nvgSave(ctx);
 	nvgReset(ctx);
 
+	nvg__arenaReset(ctx);
+	nvg__clearTessJobs(ctx);
 	nvg__setDevicePixelRatio(ctx, devicePixelRatio);
+	ctx->frameCount++;
 
 	ctx->params.renderViewport(ctx->params.userPtr, windowWidth, windowHeight, devicePixelRatio);
+	nvg__uploadImages(ctx);
 
 	ctx->drawCallCount = 0;
 	ctx->fillTriCount = 0;
@@ -404,11 +706,14 @@ void nvgBeginFrame(NVGcontext* ctx, float windowWidth, float windowHeight, float
 
 void nvgCancelFrame(NVGcontext* ctx)
 {
+	nvg__clearTessJobs(ctx);
 	ctx->params.renderCancel(ctx->params.userPtr);
 }
 
 void nvgEndFrame(NVGcontext* ctx)
 {
+	nvg__flushTessJobs(ctx);
+
 	if(ctx->textTextureDirty != 0) {
 		nvg__flushTextTexture(ctx);
 		ctx->textTextureDirty=0;
@@ -722,6 +1027,29 @@ void nvgLineJoin(NVGcontext* ctx, int join)
 	state->lineJoin = join;
 }
 
+void nvgLineDash(NVGcontext* ctx, const float* pattern, int count, float offset)
+{
+	NVGstate* state = nvg__getState(ctx);
+	float total = 0.0f;
+	int i, n = count & 1 ? count*2 : count;
+
+	state->ndashes = 0;
+	state->dashOffset = 0.0f;
+	if (pattern == NULL || count <= 0 || n > NVG_MAX_DASHES)
+		return;
+	for (i = 0; i < count; i++) {
+		if (pattern[i] < 0.0f) return;
+		total += pattern[i];
+	}
+	if (total <= 0.0f)
+		return;
+
+	for (i = 0; i < n; i++)
+		state->dashes[i] = pattern[i % count];
+	state->ndashes = n;
+	state->dashOffset = offset;
+}
+
 void nvgGlobalAlpha(NVGcontext* ctx, float alpha)
 {
 	NVGstate* state = nvg__getState(ctx);
@@ -864,6 +1192,7 @@ void nvgImageSize(NVGcontext* ctx, int image, int* w, int* h)
 
 void nvgDeleteImage(NVGcontext* ctx, int image)
 {
+	nvg__cancelImageLoad(ctx, image);
 	ctx->params.renderDeleteTexture(ctx->params.userPtr, image);
 }
 
@@ -958,6 +1287,224 @@ NVGpaint nvgBoxGradient(NVGcontext* ctx,
 	return p;
 }
 
+static unsigned int nvg__hashBytes(unsigned int h, const void* data, size_t size)
+{
+	// FNV-1a
+	const unsigned char* p = (const unsigned char*)data;
+	size_t i;
+	for (i = 0; i < size; i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static unsigned int nvg__hashStops(const NVGgradientStops* stops)
+{
+	unsigned int h = 2166136261u;
+	h = nvg__hashBytes(h, &stops->nstops, sizeof(int));
+	h = nvg__hashBytes(h, stops->offsets, sizeof(float) * stops->nstops);
+	h = nvg__hashBytes(h, stops->colors, sizeof(NVGcolor) * stops->nstops);
+	return h;
+}
+
+// Interpolates the stops in premultiplied alpha, as the two color gradients are.
+static void nvg__bakeRamp(unsigned char* dst, const NVGgradientStops* stops)
+{
+	const float* off = stops->offsets;
+	const NVGcolor* col = stops->colors;
+	int n = stops->nstops;
+	int i, j = 0;
+
+	for (i = 0; i < NVG_GRADIENT_RAMP_WIDTH; i++) {
+		float t = i / (float)(NVG_GRADIENT_RAMP_WIDTH-1);
+		NVGcolor c0, c1;
+		float u = 0.0f;
+		if (t <= off[0]) {
+			c0 = c1 = col[0];
+		} else if (t >= off[n-1]) {
+			c0 = c1 = col[n-1];
+		} else {
+			while (off[j+1] < t) j++;
+			c0 = col[j];
+			c1 = col[j+1];
+			u = (t - off[j]) / nvg__maxf(off[j+1] - off[j], 1e-6f);
+		}
+		dst[i*4+0] = (unsigned char)(nvg__clampf(c0.r*c0.a + (c1.r*c1.a - c0.r*c0.a)*u, 0.0f, 1.0f) * 255.0f + 0.5f);
+		dst[i*4+1] = (unsigned char)(nvg__clampf(c0.g*c0.a + (c1.g*c1.a - c0.g*c0.a)*u, 0.0f, 1.0f) * 255.0f + 0.5f);
+		dst[i*4+2] = (unsigned char)(nvg__clampf(c0.b*c0.a + (c1.b*c1.a - c0.b*c0.a)*u, 0.0f, 1.0f) * 255.0f + 0.5f);
+		dst[i*4+3] = (unsigned char)(nvg__clampf(c0.a + (c1.a - c0.a)*u, 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+}
+
+// Returns the row plus one of the ramp texture holding the stops, baking them into the least recently used
+// row if needed. Returns 0 if every row is used in this frame.
+static int nvg__gradientRamp(NVGcontext* ctx, const NVGgradientStops* stops)
+{
+	NVGgradientRamps* ramps = ctx->ramps;
+	unsigned int hash = nvg__hashStops(stops);
+	int i, row = -1;
+
+	if (ramps == NULL) {
+		ramps = (NVGgradientRamps*)nvg__alloc(ctx, sizeof(NVGgradientRamps));
+		if (ramps == NULL) return 0;
+		memset(ramps, 0, sizeof(NVGgradientRamps));
+		for (i = 0; i < NVG_GRADIENT_RAMP_ROWS; i++)
+			ramps->rows[i].lastUse = -1;
+		for (i = 0; i < NVG_GRADIENT_RAMP_HISTORY; i++)
+			ramps->evicted[i].lastUse = -1;
+		ramps->image = ctx->params.renderCreateTexture(ctx->params.userPtr, NVG_TEXTURE_RGBA, NVG_GRADIENT_RAMP_WIDTH,
+													   NVG_GRADIENT_RAMP_ROWS, NVG_IMAGE_PREMULTIPLIED, ramps->data);
+		if (ramps->image == 0) {
+			nvg__free(ctx, ramps);
+			return 0;
+		}
+		ctx->ramps = ramps;
+	}
+
+	for (i = 0; i < NVG_GRADIENT_RAMP_ROWS; i++) {
+		NVGgradientRow* r = &ramps->rows[i];
+		if (r->hash == hash && r->lastUse != -1 && memcmp(&r->stops, stops, sizeof(NVGgradientStops)) == 0) {
+			r->lastUse = ctx->frameCount;
+			return i+1;
+		}
+		// Rows drawn in this frame are kept, the back-end has not rendered them yet.
+		if (r->lastUse != ctx->frameCount && (row == -1 || r->lastUse < ramps->rows[row].lastUse))
+			row = i;
+	}
+	if (row == -1) return 0;
+
+	if (ramps->rows[row].lastUse != -1) {
+		ramps->evicted[ramps->nextEvicted] = ramps->rows[row];
+		ramps->nextEvicted = (ramps->nextEvicted + 1) % NVG_GRADIENT_RAMP_HISTORY;
+	}
+	ramps->rows[row].stops = *stops;
+	ramps->rows[row].hash = hash;
+	ramps->rows[row].lastUse = ctx->frameCount;
+	nvg__bakeRamp(&ramps->data[row * NVG_GRADIENT_RAMP_WIDTH*4], stops);
+	ctx->params.renderUpdateTexture(ctx->params.userPtr, ramps->image, 0, row, NVG_GRADIENT_RAMP_WIDTH, 1, ramps->data);
+
+	return row+1;
+}
+
+// Returns the stops with the hash from the ramp rows or the reused rows, NULL if they are forgotten.
+static const NVGgradientStops* nvg__findStops(NVGgradientRamps* ramps, unsigned int hash)
+{
+	int i;
+	for (i = 0; i < NVG_GRADIENT_RAMP_ROWS; i++) {
+		if (ramps->rows[i].lastUse != -1 && ramps->rows[i].hash == hash)
+			return &ramps->rows[i].stops;
+	}
+	for (i = 0; i < NVG_GRADIENT_RAMP_HISTORY; i++) {
+		if (ramps->evicted[i].lastUse != -1 && ramps->evicted[i].hash == hash)
+			return &ramps->evicted[i].stops;
+	}
+	return NULL;
+}
+
+// Checks that the ramp row of a multi-stop gradient still holds its stops. The row of a paint kept over
+// frames may have been given to other gradients, its stops are then baked again. Falls back to the mean
+// color of the stops if they are forgotten or do not fit.
+static void nvg__validateRamp(NVGcontext* ctx, NVGpaint* paint)
+{
+	NVGgradientRamps* ramps = ctx->ramps;
+	NVGgradientRow* r;
+	const NVGgradientStops* found;
+	NVGgradientStops stops;
+
+	if (paint->ramp <= 0) return;
+	if (ramps != NULL) {
+		r = &ramps->rows[paint->ramp-1];
+		if (r->lastUse != -1 && r->hash == paint->rampHash) {
+			r->lastUse = ctx->frameCount;
+			return;
+		}
+		found = nvg__findStops(ramps, paint->rampHash);
+		if (found != NULL) {
+			// Copied, baking may overwrite the reused row holding them.
+			stops = *found;
+			paint->ramp = nvg__gradientRamp(ctx, &stops);
+			if (paint->ramp != 0) return;
+		}
+	}
+	paint->ramp = 0;
+	paint->image = 0;
+	paint->innerColor = paint->outerColor;
+}
+
+// Replaces the colors of the two color gradient p with the stops. Keeps p if the stops do not fit in the ramp texture.
+static NVGpaint nvg__gradientStops(NVGcontext* ctx, NVGpaint p, const float* offsets, const NVGcolor* colors, int nstops)
+{
+	NVGgradientStops stops;
+	NVGcolor mean = nvgRGBAf(0,0,0,0);
+	float prev = 0.0f;
+	int i;
+
+	if (offsets == NULL || colors == NULL || nstops < 2) return p;
+	nstops = nvg__mini(nstops, NVG_MAX_GRADIENT_STOPS);
+
+	// Cleared so that the stops can be compared as memory.
+	memset(&stops, 0, sizeof(stops));
+	for (i = 0; i < nstops; i++) {
+		prev = nvg__clampf(offsets[i], prev, 1.0f);
+		stops.offsets[i] = prev;
+		stops.colors[i] = colors[i];
+		mean.r += colors[i].r / nstops;
+		mean.g += colors[i].g / nstops;
+		mean.b += colors[i].b / nstops;
+		mean.a += colors[i].a / nstops;
+	}
+	stops.nstops = nstops;
+
+	if (ctx->parent != NULL) {
+		// The ramp is allocated by the parent when the list is submitted.
+		i = nvg__listAddStops(ctx, &stops);
+		if (i == -1) return p;
+		p.ramp = -(i+1);
+	} else {
+		p.ramp = nvg__gradientRamp(ctx, &stops);
+		if (p.ramp == 0) return p;
+		p.image = ctx->ramps->image;
+		p.rampHash = ctx->ramps->rows[p.ramp-1].hash;
+	}
+	// The colors are multiplied by the global alpha when drawn. The ramp is tinted by the inner color,
+	// the outer color is drawn if the ramp is lost.
+	p.innerColor = nvgRGBAf(1,1,1,1);
+	p.outerColor = mean;
+
+	return p;
+}
+
+static NVGcolor nvg__firstStop(const NVGcolor* colors, int nstops)
+{
+	return colors != NULL && nstops > 0 ? colors[0] : nvgRGBAf(0,0,0,0);
+}
+
+static NVGcolor nvg__lastStop(const NVGcolor* colors, int nstops)
+{
+	return colors != NULL && nstops > 0 ? colors[nstops-1] : nvgRGBAf(0,0,0,0);
+}
+
+NVGpaint nvgLinearGradientStops(NVGcontext* ctx, float sx, float sy, float ex, float ey,
+								const float* offsets, const NVGcolor* colors, int nstops)
+{
+	NVGpaint p = nvgLinearGradient(ctx, sx, sy, ex, ey, nvg__firstStop(colors, nstops), nvg__lastStop(colors, nstops));
+	return nvg__gradientStops(ctx, p, offsets, colors, nstops);
+}
+
+NVGpaint nvgBoxGradientStops(NVGcontext* ctx, float x, float y, float w, float h, float r, float f,
+							 const float* offsets, const NVGcolor* colors, int nstops)
+{
+	NVGpaint p = nvgBoxGradient(ctx, x, y, w, h, r, f, nvg__firstStop(colors, nstops), nvg__lastStop(colors, nstops));
+	return nvg__gradientStops(ctx, p, offsets, colors, nstops);
+}
+
+NVGpaint nvgRadialGradientStops(NVGcontext* ctx, float cx, float cy, float inr, float outr,
+								const float* offsets, const NVGcolor* colors, int nstops)
+{
+	NVGpaint p = nvgRadialGradient(ctx, cx, cy, inr, outr, nvg__firstStop(colors, nstops), nvg__lastStop(colors, nstops));
+	return nvg__gradientStops(ctx, p, offsets, colors, nstops);
+}
 
 NVGpaint nvgImagePattern(NVGcontext* ctx,
 								float cx, float cy, float w, float h, float angle,
@@ -1097,61 +1644,54 @@ static float nvg__distPtSeg(float x, float y, float px, float py, float qx, floa
 	return dx*dx + dy*dy;
 }
 
-static void nvg__appendCommands(NVGcontext* ctx, float* vals, int nvals)
+static int nvg__reserveCommands(NVGcontext* ctx, int ncmds, int npts)
 {
-	NVGstate* state = nvg__getState(ctx);
-	int i;
-
-	if (ctx->ncommands+nvals > ctx->ccommands) {
-		float* commands;
-		int ccommands = ctx->ncommands+nvals + ctx->ccommands/2;
-		commands = (float*)realloc(ctx->commands, sizeof(float)*ccommands);
-		if (commands == NULL) return;
+	if (ctx->ncommands+ncmds > ctx->ccommands) {
+		unsigned char* commands;
+		int ccommands = ctx->ncommands+ncmds + ctx->ccommands/2;
+		commands = (unsigned char*)nvg__realloc(ctx, ctx->commands, ccommands);
+		if (commands == NULL) return 0;
 		ctx->commands = commands;
 		ctx->ccommands = ccommands;
 	}
-
-	if ((int)vals[0] != NVG_CLOSE && (int)vals[0] != NVG_WINDING) {
-		ctx->commandx = vals[nvals-2];
-		ctx->commandy = vals[nvals-1];
+	if (ctx->ncommandPoints+npts > ctx->ccommandPoints) {
+		float* points;
+		int cpoints = ctx->ncommandPoints+npts + ctx->ccommandPoints/2;
+		points = (float*)nvg__realloc(ctx, ctx->commandPoints, sizeof(float)*2*cpoints);
+		if (points == NULL) return 0;
+		ctx->commandPoints = points;
+		ctx->ccommandPoints = cpoints;
 	}
+	return 1;
+}
 
-	// transform commands
-	i = 0;
-	while (i < nvals) {
-		int cmd = (int)vals[i];
-		switch (cmd) {
-		case NVG_MOVETO:
-			nvgTransformPoint(&vals[i+1],&vals[i+2], state->xform, vals[i+1],vals[i+2]);
-			i += 3;
-			break;
-		case NVG_LINETO:
-			nvgTransformPoint(&vals[i+1],&vals[i+2], state->xform, vals[i+1],vals[i+2]);
-			i += 3;
-			break;
-		case NVG_BEZIERTO:
-			nvgTransformPoint(&vals[i+1],&vals[i+2], state->xform, vals[i+1],vals[i+2]);
-			nvgTransformPoint(&vals[i+3],&vals[i+4], state->xform, vals[i+3],vals[i+4]);
-			nvgTransformPoint(&vals[i+5],&vals[i+6], state->xform, vals[i+5],vals[i+6]);
-			i += 7;
-			break;
-		case NVG_CLOSE:
-			i++;
-			break;
-		case NVG_WINDING:
-			i += 2;
-			break;
-		default:
-			i++;
-		}
+static void nvg__appendCommands(NVGcontext* ctx, const unsigned char* cmds, int ncmds, const float* pts, int npts)
+{
+	NVGstate* state = nvg__getState(ctx);
+	const float* t = state->xform;
+	float* dst;
+	int i;
+
+	if (nvg__reserveCommands(ctx, ncmds, npts) == 0) return;
+
+	if (npts > 0) {
+		ctx->commandx = pts[npts*2-2];
+		ctx->commandy = pts[npts*2-1];
 	}
 
-	memcpy(&ctx->commands[ctx->ncommands], vals, nvals*sizeof(float));
+	// Transform the points, the opcodes are copied as is.
+	dst = &ctx->commandPoints[ctx->ncommandPoints*2];
+	for (i = 0; i < npts; i++) {
+		float x = pts[i*2], y = pts[i*2+1];
+		dst[i*2] = x*t[0] + y*t[2] + t[4];
+		dst[i*2+1] = x*t[1] + y*t[3] + t[5];
+	}
+	memcpy(&ctx->commands[ctx->ncommands], cmds, ncmds);
 
-	ctx->ncommands += nvals;
+	ctx->ncommands += ncmds;
+	ctx->ncommandPoints += npts;
 }
 
-
 static void nvg__clearPathCache(NVGcontext* ctx)
 {
 	ctx->cache->npoints = 0;
@@ -1171,7 +1711,7 @@ static void nvg__addPath(NVGcontext* ctx)
 	if (ctx->cache->npaths+1 > ctx->cache->cpaths) {
 		NVGpath* paths;
 		int cpaths = ctx->cache->npaths+1 + ctx->cache->cpaths/2;
-		paths = (NVGpath*)realloc(ctx->cache->paths, sizeof(NVGpath)*cpaths);
+		paths = (NVGpath*)nvg__realloc(ctx, ctx->cache->paths, sizeof(NVGpath)*cpaths);
 		if (paths == NULL) return;
 		ctx->cache->paths = paths;
 		ctx->cache->cpaths = cpaths;
@@ -1208,7 +1748,7 @@ static void nvg__addPoint(NVGcontext* ctx, float x, float y, int flags)
 	if (ctx->cache->npoints+1 > ctx->cache->cpoints) {
 		NVGpoint* points;
 		int cpoints = ctx->cache->npoints+1 + ctx->cache->cpoints/2;
-		points = (NVGpoint*)realloc(ctx->cache->points, sizeof(NVGpoint)*cpoints);
+		points = (NVGpoint*)nvg__realloc(ctx, ctx->cache->points, sizeof(NVGpoint)*cpoints);
 		if (points == NULL) return;
 		ctx->cache->points = points;
 		ctx->cache->cpoints = cpoints;
@@ -1250,7 +1790,7 @@ static NVGvertex* nvg__allocTempVerts(NVGcontext* ctx, int nverts)
 	if (nverts > ctx->cache->cverts) {
 		NVGvertex* verts;
 		int cverts = (nverts + 0xff) & ~0xff; // Round up to prevent allocations when things change just slightly.
-		verts = (NVGvertex*)realloc(ctx->cache->verts, sizeof(NVGvertex)*cverts);
+		verts = (NVGvertex*)nvg__realloc(ctx, ctx->cache->verts, sizeof(NVGvertex)*cverts);
 		if (verts == NULL) return NULL;
 		ctx->cache->verts = verts;
 		ctx->cache->cverts = cverts;
@@ -1346,6 +1886,85 @@ static void nvg__tesselateBezier(NVGcontext* ctx,
 	nvg__tesselateBezier(ctx, x1234,y1234, x234,y234, x34,y34, x4,y4, level+1, type);
 }
 
+#ifdef NVG_SSE2
+// Calculates the direction and length of the segments starting at pts[0..n-1] four at a time,
+// returns the number of points done. The points are transposed in registers, four segments share
+// one square root and division.
+static int nvg__segmentDirsSSE2(NVGpoint* pts, int n, float* bounds)
+{
+	__m128 bmin = _mm_set1_ps(bounds[0]), bmax = _mm_set1_ps(bounds[2]);
+	__m128 bminy = _mm_set1_ps(bounds[1]), bmaxy = _mm_set1_ps(bounds[3]);
+	__m128 eps = _mm_set1_ps(1e-6f), one = _mm_set1_ps(1.0f);
+	float b[4];
+	int i;
+
+	for (i = 0; i+4 < n; i += 4) {
+		NVGpoint* p = &pts[i];
+		__m128 a01 = _mm_loadh_pi(_mm_loadl_pi(one, (const __m64*)&p[0].x), (const __m64*)&p[1].x);
+		__m128 a23 = _mm_loadh_pi(_mm_loadl_pi(one, (const __m64*)&p[2].x), (const __m64*)&p[3].x);
+		__m128 b01 = _mm_loadh_pi(_mm_loadl_pi(one, (const __m64*)&p[1].x), (const __m64*)&p[2].x);
+		__m128 b23 = _mm_loadh_pi(_mm_loadl_pi(one, (const __m64*)&p[3].x), (const __m64*)&p[4].x);
+		__m128 x0 = _mm_shuffle_ps(a01, a23, _MM_SHUFFLE(2,0,2,0));
+		__m128 y0 = _mm_shuffle_ps(a01, a23, _MM_SHUFFLE(3,1,3,1));
+		__m128 dx = _mm_sub_ps(_mm_shuffle_ps(b01, b23, _MM_SHUFFLE(2,0,2,0)), x0);
+		__m128 dy = _mm_sub_ps(_mm_shuffle_ps(b01, b23, _MM_SHUFFLE(3,1,3,1)), y0);
+		__m128 d = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+		__m128 mask = _mm_cmpgt_ps(d, eps);
+		__m128 id = _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(one, d)), _mm_andnot_ps(mask, one));
+		__m128 lo, hi;
+		dx = _mm_mul_ps(dx, id);
+		dy = _mm_mul_ps(dy, id);
+		lo = _mm_unpacklo_ps(dx, dy);
+		hi = _mm_unpackhi_ps(dx, dy);
+		_mm_storel_pi((__m64*)&p[0].dx, lo);
+		_mm_storeh_pi((__m64*)&p[1].dx, lo);
+		_mm_storel_pi((__m64*)&p[2].dx, hi);
+		_mm_storeh_pi((__m64*)&p[3].dx, hi);
+		_mm_store_ss(&p[0].len, d);
+		_mm_store_ss(&p[1].len, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1,1,1,1)));
+		_mm_store_ss(&p[2].len, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2,2,2,2)));
+		_mm_store_ss(&p[3].len, _mm_shuffle_ps(d, d, _MM_SHUFFLE(3,3,3,3)));
+		bmin = _mm_min_ps(bmin, x0);
+		bmax = _mm_max_ps(bmax, x0);
+		bminy = _mm_min_ps(bminy, y0);
+		bmaxy = _mm_max_ps(bmaxy, y0);
+	}
+
+	_mm_storeu_ps(b, bmin);
+	bounds[0] = nvg__minf(nvg__minf(b[0], b[1]), nvg__minf(b[2], b[3]));
+	_mm_storeu_ps(b, bminy);
+	bounds[1] = nvg__minf(nvg__minf(b[0], b[1]), nvg__minf(b[2], b[3]));
+	_mm_storeu_ps(b, bmax);
+	bounds[2] = nvg__maxf(nvg__maxf(b[0], b[1]), nvg__maxf(b[2], b[3]));
+	_mm_storeu_ps(b, bmaxy);
+	bounds[3] = nvg__maxf(nvg__maxf(b[0], b[1]), nvg__maxf(b[2], b[3]));
+	return i;
+}
+#endif
+
+// Calculates the direction and length of each segment of a closed loop of points, and extends bounds by the points.
+static void nvg__segmentDirs(NVGpoint* pts, int n, float* bounds)
+{
+	NVGpoint* p0;
+	NVGpoint* p1;
+	int i = 0;
+
+#ifdef NVG_SSE2
+	i = nvg__segmentDirsSSE2(pts, n, bounds);
+#endif
+	for (; i < n; i++) {
+		p0 = &pts[i];
+		p1 = &pts[i+1 < n ? i+1 : 0];
+		p0->dx = p1->x - p0->x;
+		p0->dy = p1->y - p0->y;
+		p0->len = nvg__normalize(&p0->dx, &p0->dy);
+		bounds[0] = nvg__minf(bounds[0], p0->x);
+		bounds[1] = nvg__minf(bounds[1], p0->y);
+		bounds[2] = nvg__maxf(bounds[2], p0->x);
+		bounds[3] = nvg__maxf(bounds[3], p0->y);
+	}
+}
+
 static void nvg__flattenPaths(NVGcontext* ctx)
 {
 	NVGpathCache* cache = ctx->cache;
@@ -1356,50 +1975,37 @@ static void nvg__flattenPaths(NVGcontext* ctx)
 	NVGpoint* pts;
 	NVGpath* path;
 	int i, j;
-	float* cp1;
-	float* cp2;
-	float* p;
+	const float* p;
 	float area;
 
 	if (cache->npaths > 0)
 		return;
 
 	// Flatten
-	i = 0;
-	while (i < ctx->ncommands) {
-		int cmd = (int)ctx->commands[i];
-		switch (cmd) {
+	p = ctx->commandPoints;
+	for (i = 0; i < ctx->ncommands; i++) {
+		switch (ctx->commands[i]) {
 		case NVG_MOVETO:
 			nvg__addPath(ctx);
-			p = &ctx->commands[i+1];
 			nvg__addPoint(ctx, p[0], p[1], NVG_PT_CORNER);
-			i += 3;
+			p += 2;
 			break;
 		case NVG_LINETO:
-			p = &ctx->commands[i+1];
 			nvg__addPoint(ctx, p[0], p[1], NVG_PT_CORNER);
-			i += 3;
+			p += 2;
 			break;
 		case NVG_BEZIERTO:
 			last = nvg__lastPoint(ctx);
-			if (last != NULL) {
-				cp1 = &ctx->commands[i+1];
-				cp2 = &ctx->commands[i+3];
-				p = &ctx->commands[i+5];
-				nvg__tesselateBezier(ctx, last->x,last->y, cp1[0],cp1[1], cp2[0],cp2[1], p[0],p[1], 0, NVG_PT_CORNER);
-			}
-			i += 7;
+			if (last != NULL)
+				nvg__tesselateBezier(ctx, last->x,last->y, p[0],p[1], p[2],p[3], p[4],p[5], 0, NVG_PT_CORNER);
+			p += 6;
 			break;
 		case NVG_CLOSE:
 			nvg__closePath(ctx);
-			i++;
 			break;
 		case NVG_WINDING:
-			nvg__pathWinding(ctx, (int)ctx->commands[i+1]);
-			i += 2;
+			nvg__pathWinding(ctx, ctx->commands[++i]);
 			break;
-		default:
-			i++;
 		}
 	}
 
@@ -1429,19 +2035,98 @@ static void nvg__flattenPaths(NVGcontext* ctx)
 				nvg__polyReverse(pts, path->count);
 		}
 
-		for(i = 0; i < path->count; i++) {
-			// Calculate segment direction and length
-			p0->dx = p1->x - p0->x;
-			p0->dy = p1->y - p0->y;
-			p0->len = nvg__normalize(&p0->dx, &p0->dy);
-			// Update bounds
-			cache->bounds[0] = nvg__minf(cache->bounds[0], p0->x);
-			cache->bounds[1] = nvg__minf(cache->bounds[1], p0->y);
-			cache->bounds[2] = nvg__maxf(cache->bounds[2], p0->x);
-			cache->bounds[3] = nvg__maxf(cache->bounds[3], p0->y);
-			// Advance
-			p0 = p1++;
+		// Calculate segment direction and length, and update bounds.
+		nvg__segmentDirs(pts, path->count, cache->bounds);
+	}
+}
+
+// Splits the flattened paths into one open path per dash, the pattern is in the units of the points.
+static void nvg__dashPaths(NVGcontext* ctx, const float* dashes, int ndashes, float offset)
+{
+	NVGpathCache* cache = ctx->cache;
+	int npaths = cache->npaths;
+	int i, j, k, d, on, first, count, closed, startDash;
+	float total = 0.0f, left;
+	NVGpath* path;
+
+	for (i = 0; i < ndashes; i++)
+		total += dashes[i];
+	if (total <= 0.0f) return;
+
+	for (i = 0; i < npaths; i++) {
+		first = cache->paths[i].first;
+		count = cache->paths[i].count;
+		closed = cache->paths[i].closed;
+		if (count < 2) continue;
+
+		// Find the dash at the start of the path.
+		left = fmodf(offset, total);
+		if (left < 0.0f) left += total;
+		for (d = 0; d < ndashes-1 && left >= dashes[d]; d++)
+			left -= dashes[d];
+		left = dashes[d] - left;
+		on = (d & 1) == 0;
+
+		startDash = -1;
+		if (on) {
+			nvg__addPath(ctx);
+			startDash = cache->npaths-1;
+			nvg__addPoint(ctx, cache->points[first].x, cache->points[first].y, cache->points[first].flags);
+		}
+
+		for (j = 0; j < (closed ? count : count-1); j++) {
+			// The points may move when new points are added.
+			float x0 = cache->points[first+j].x, y0 = cache->points[first+j].y;
+			float dx = cache->points[first+j].dx, dy = cache->points[first+j].dy;
+			float len = cache->points[first+j].len, t = 0.0f;
+			k = first + (j+1) % count;
+			while (len - t > left) {
+				float ext = 0.0f;
+				t += left;
+				if (!on)
+					nvg__addPath(ctx);
+				else if (dashes[d] == 0.0f && cache->paths[cache->npaths-1].count == 1)
+					ext = nvg__minf(ctx->distTol*2.0f, len - t); // Keep the direction of zero length dashes for their caps.
+				nvg__addPoint(ctx, x0 + dx*(t+ext), y0 + dy*(t+ext), 0);
+				on = !on;
+				d = (d+1) % ndashes;
+				left = dashes[d];
+			}
+			left -= len - t;
+			if (on) nvg__addPoint(ctx, cache->points[k].x, cache->points[k].y, cache->points[k].flags);
 		}
+
+		// A dash across the start of a closed path continues into the first dash.
+		if (closed && on && startDash != -1) {
+			path = &cache->paths[cache->npaths-1];
+			if (startDash == cache->npaths-1) {
+				// The whole path is one dash.
+				path->count--;
+				path->closed = 1;
+			} else {
+				int n = cache->paths[startDash].count;
+				int start = cache->paths[startDash].first;
+				for (k = 0; k < n; k++)
+					nvg__addPoint(ctx, cache->points[start+k].x, cache->points[start+k].y, cache->points[start+k].flags);
+				cache->paths[startDash].count = 0;
+			}
+		}
+	}
+
+	// Replace the original paths with the dashes, the points are left in place.
+	j = 0;
+	for (i = npaths; i < cache->npaths; i++) {
+		if (cache->paths[i].count < 2) continue;
+		cache->paths[j++] = cache->paths[i];
+	}
+	cache->npaths = j;
+
+	// Calculate the direction and length of line segments, the bounds do not change.
+	for (j = 0; j < cache->npaths; j++) {
+		float bounds[4];
+		memcpy(bounds, cache->bounds, sizeof(bounds));
+		path = &cache->paths[j];
+		nvg__segmentDirs(&cache->points[path->first], path->count, bounds);
 	}
 }
 
@@ -1675,76 +2360,221 @@ static NVGvertex* nvg__roundCapEnd(NVGvertex* dst, NVGpoint* p,
 }
 
 
-static void nvg__calculateJoins(NVGcontext* ctx, float w, int lineJoin, float miterLimit)
+// Calculates the extrusion of p1, the joint between the segments starting at p0 and p1, and which joins it needs.
+static int nvg__joinPoint(const NVGpoint* p0, NVGpoint* p1, float iw, int lineJoin, float miterLimit)
 {
-	NVGpathCache* cache = ctx->cache;
-	int i, j;
-	float iw = 0.0f;
+	float dlx0, dly0, dlx1, dly1, dmr2, cross, limit;
+	dlx0 = p0->dy;
+	dly0 = -p0->dx;
+	dlx1 = p1->dy;
+	dly1 = -p1->dx;
+	// Calculate extrusions
+	p1->dmx = (dlx0 + dlx1) * 0.5f;
+	p1->dmy = (dly0 + dly1) * 0.5f;
+	dmr2 = p1->dmx*p1->dmx + p1->dmy*p1->dmy;
+	if (dmr2 > 0.000001f) {
+		float scale = 1.0f / dmr2;
+		if (scale > 600.0f) {
+			scale = 600.0f;
+		}
+		p1->dmx *= scale;
+		p1->dmy *= scale;
+	}
 
-	if (w > 0.0f) iw = 1.0f / w;
+	// Clear flags, but keep the corner.
+	p1->flags = (p1->flags & NVG_PT_CORNER) ? NVG_PT_CORNER : 0;
 
-	// Calculate which joins needs extra vertices to append, and gather vertex count.
-	for (i = 0; i < cache->npaths; i++) {
-		NVGpath* path = &cache->paths[i];
-		NVGpoint* pts = &cache->points[path->first];
-		NVGpoint* p0 = &pts[path->count-1];
-		NVGpoint* p1 = &pts[0];
-		int nleft = 0;
-
-		path->nbevel = 0;
-
-		for (j = 0; j < path->count; j++) {
-			float dlx0, dly0, dlx1, dly1, dmr2, cross, limit;
-			dlx0 = p0->dy;
-			dly0 = -p0->dx;
-			dlx1 = p1->dy;
-			dly1 = -p1->dx;
-			// Calculate extrusions
-			p1->dmx = (dlx0 + dlx1) * 0.5f;
-			p1->dmy = (dly0 + dly1) * 0.5f;
-			dmr2 = p1->dmx*p1->dmx + p1->dmy*p1->dmy;
-			if (dmr2 > 0.000001f) {
-				float scale = 1.0f / dmr2;
-				if (scale > 600.0f) {
-					scale = 600.0f;
-				}
-				p1->dmx *= scale;
-				p1->dmy *= scale;
-			}
+	// Keep track of left turns.
+	cross = p1->dx * p0->dy - p0->dx * p1->dy;
+	if (cross > 0.0f)
+		p1->flags |= NVG_PT_LEFT;
 
-			// Clear flags, but keep the corner.
-			p1->flags = (p1->flags & NVG_PT_CORNER) ? NVG_PT_CORNER : 0;
+	// Calculate if we should use bevel or miter for inner join.
+	limit = nvg__maxf(1.01f, nvg__minf(p0->len, p1->len) * iw);
+	if ((dmr2 * limit*limit) < 1.0f)
+		p1->flags |= NVG_PR_INNERBEVEL;
 
-			// Keep track of left turns.
-			cross = p1->dx * p0->dy - p0->dx * p1->dy;
-			if (cross > 0.0f) {
-				nleft++;
-				p1->flags |= NVG_PT_LEFT;
-			}
+	// Check to see if the corner needs to be beveled.
+	if (p1->flags & NVG_PT_CORNER) {
+		if ((dmr2 * miterLimit*miterLimit) < 1.0f || lineJoin == NVG_BEVEL || lineJoin == NVG_ROUND) {
+			p1->flags |= NVG_PT_BEVEL;
+		}
+	}
 
-			// Calculate if we should use bevel or miter for inner join.
-			limit = nvg__maxf(1.01f, nvg__minf(p0->len, p1->len) * iw);
-			if ((dmr2 * limit*limit) < 1.0f)
-				p1->flags |= NVG_PR_INNERBEVEL;
+	return p1->flags;
+}
+
+#ifdef NVG_SSE2
+static int nvg__bitCount4(int m) { return (m & 1) + ((m >> 1) & 1) + ((m >> 2) & 1) + ((m >> 3) & 1); }
+
+// Same as nvg__joinPoint() for the joints pts[1..n-1] four at a time, returns the number of joints done.
+static int nvg__joinPointsSSE2(NVGpoint* pts, int n, float iw, int lineJoin, float miterLimit, int* nleft, int* nbevel)
+{
+	__m128 sign = _mm_set1_ps(-0.0f), half = _mm_set1_ps(0.5f), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+	__m128 eps = _mm_set1_ps(0.000001f), maxScale = _mm_set1_ps(600.0f), minLimit = _mm_set1_ps(1.01f);
+	__m128 viw = _mm_set1_ps(iw), vmiter = _mm_set1_ps(miterLimit);
+	__m128 bevelAll = (lineJoin == NVG_BEVEL || lineJoin == NVG_ROUND) ? _mm_castsi128_ps(_mm_set1_epi32(-1)) : zero;
+	__m128i corner = _mm_set1_epi32(NVG_PT_CORNER);
+	int i, flags[4];
+
+	for (i = 1; i+4 <= n; i += 4) {
+		NVGpoint* p = &pts[i-1];
+		__m128 a01 = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64*)&p[0].dx), (const __m64*)&p[1].dx);
+		__m128 a23 = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64*)&p[2].dx), (const __m64*)&p[3].dx);
+		__m128 b01 = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64*)&p[1].dx), (const __m64*)&p[2].dx);
+		__m128 b23 = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64*)&p[3].dx), (const __m64*)&p[4].dx);
+		__m128 dx0 = _mm_shuffle_ps(a01, a23, _MM_SHUFFLE(2,0,2,0));
+		__m128 dy0 = _mm_shuffle_ps(a01, a23, _MM_SHUFFLE(3,1,3,1));
+		__m128 dx1 = _mm_shuffle_ps(b01, b23, _MM_SHUFFLE(2,0,2,0));
+		__m128 dy1 = _mm_shuffle_ps(b01, b23, _MM_SHUFFLE(3,1,3,1));
+		__m128 len0 = _mm_set_ps(p[3].len, p[2].len, p[1].len, p[0].len);
+		__m128 len1 = _mm_set_ps(p[4].len, p[3].len, p[2].len, p[1].len);
+		__m128i fl = _mm_set_epi32(p[4].flags, p[3].flags, p[2].flags, p[1].flags);
+		__m128 dmx, dmy, dmr2, scale, mask, left, inner, bevel, limit, lo, hi;
+		__m128i isCorner, res;
+
+		// Calculate extrusions
+		dmx = _mm_mul_ps(_mm_add_ps(dy0, dy1), half);
+		dmy = _mm_mul_ps(_mm_add_ps(_mm_xor_ps(dx0, sign), _mm_xor_ps(dx1, sign)), half);
+		dmr2 = _mm_add_ps(_mm_mul_ps(dmx, dmx), _mm_mul_ps(dmy, dmy));
+		mask = _mm_cmpgt_ps(dmr2, eps);
+		scale = _mm_min_ps(_mm_div_ps(one, dmr2), maxScale);
+		scale = _mm_or_ps(_mm_and_ps(mask, scale), _mm_andnot_ps(mask, one));
+		dmx = _mm_mul_ps(dmx, scale);
+		dmy = _mm_mul_ps(dmy, scale);
+		lo = _mm_unpacklo_ps(dmx, dmy);
+		hi = _mm_unpackhi_ps(dmx, dmy);
+		_mm_storel_pi((__m64*)&p[1].dmx, lo);
+		_mm_storeh_pi((__m64*)&p[2].dmx, lo);
+		_mm_storel_pi((__m64*)&p[3].dmx, hi);
+		_mm_storeh_pi((__m64*)&p[4].dmx, hi);
+
+		// Left turns, inner bevels and beveled corners.
+		left = _mm_cmpgt_ps(_mm_sub_ps(_mm_mul_ps(dx1, dy0), _mm_mul_ps(dx0, dy1)), zero);
+		limit = _mm_max_ps(minLimit, _mm_mul_ps(_mm_min_ps(len0, len1), viw));
+		inner = _mm_cmplt_ps(_mm_mul_ps(_mm_mul_ps(dmr2, limit), limit), one);
+		isCorner = _mm_cmpeq_epi32(_mm_and_si128(fl, corner), corner);
+		bevel = _mm_or_ps(_mm_cmplt_ps(_mm_mul_ps(_mm_mul_ps(dmr2, vmiter), vmiter), one), bevelAll);
+		bevel = _mm_and_ps(bevel, _mm_castsi128_ps(isCorner));
+
+		res = _mm_and_si128(isCorner, corner);
+		res = _mm_or_si128(res, _mm_and_si128(_mm_castps_si128(left), _mm_set1_epi32(NVG_PT_LEFT)));
+		res = _mm_or_si128(res, _mm_and_si128(_mm_castps_si128(inner), _mm_set1_epi32(NVG_PR_INNERBEVEL)));
+		res = _mm_or_si128(res, _mm_and_si128(_mm_castps_si128(bevel), _mm_set1_epi32(NVG_PT_BEVEL)));
+		_mm_storeu_si128((__m128i*)flags, res);
+		p[1].flags = (unsigned char)flags[0];
+		p[2].flags = (unsigned char)flags[1];
+		p[3].flags = (unsigned char)flags[2];
+		p[4].flags = (unsigned char)flags[3];
+
+		*nleft += nvg__bitCount4(_mm_movemask_ps(left));
+		*nbevel += nvg__bitCount4(_mm_movemask_ps(_mm_or_ps(inner, bevel)));
+	}
 
-			// Check to see if the corner needs to be beveled.
-			if (p1->flags & NVG_PT_CORNER) {
-				if ((dmr2 * miterLimit*miterLimit) < 1.0f || lineJoin == NVG_BEVEL || lineJoin == NVG_ROUND) {
-					p1->flags |= NVG_PT_BEVEL;
-				}
-			}
+	return i;
+}
+#endif
+
+static void nvg__calculateJoins(NVGcontext* ctx, float w, int lineJoin, float miterLimit)
+{
+	NVGpathCache* cache = ctx->cache;
+	int i, j;
+	float iw = 0.0f;
 
-			if ((p1->flags & (NVG_PT_BEVEL | NVG_PR_INNERBEVEL)) != 0)
-				path->nbevel++;
+	if (w > 0.0f) iw = 1.0f / w;
 
-			p0 = p1++;
+	// Calculate which joins needs extra vertices to append, and gather vertex count.
+	for (i = 0; i < cache->npaths; i++) {
+		NVGpath* path = &cache->paths[i];
+		NVGpoint* pts = &cache->points[path->first];
+		int nleft = 0, nbevel = 0, flags;
+
+		if (path->count < 1) {
+			path->nbevel = 0;
+			path->convex = 1;
+			continue;
 		}
 
+		// The first joint is between the last and the first segment.
+		j = 1;
+		flags = nvg__joinPoint(&pts[path->count-1], &pts[0], iw, lineJoin, miterLimit);
+		if (flags & NVG_PT_LEFT) nleft++;
+		if (flags & (NVG_PT_BEVEL | NVG_PR_INNERBEVEL)) nbevel++;
+#ifdef NVG_SSE2
+		j = nvg__joinPointsSSE2(pts, path->count, iw, lineJoin, miterLimit, &nleft, &nbevel);
+#endif
+		for (; j < path->count; j++) {
+			flags = nvg__joinPoint(&pts[j-1], &pts[j], iw, lineJoin, miterLimit);
+			if (flags & NVG_PT_LEFT) nleft++;
+			if (flags & (NVG_PT_BEVEL | NVG_PR_INNERBEVEL)) nbevel++;
+		}
+
+		path->nbevel = nbevel;
 		path->convex = (nleft == path->count) ? 1 : 0;
 	}
 }
 
 
+// Returns tangent of half the turn between the segments starting at p0 and p1.
+static float nvg__halfTurn(const NVGpoint* p0, const NVGpoint* p1)
+{
+	float c = p0->dx*p1->dx + p0->dy*p1->dy;
+	if (c < -0.99f) return 1e6f;
+	return sqrtf((1.0f - c) / (1.0f + c));
+}
+
+// Returns 1 if the joins of a stroke of half width w never reach past the next joint, so that the pixels
+// of each joint can be split between its two segments along the bisector.
+static int nvg__strokeSegmentsFit(NVGcontext* ctx, float w)
+{
+	NVGpathCache* cache = ctx->cache;
+	int i, j, n;
+
+	for (i = 0; i < cache->npaths; i++) {
+		NVGpath* path = &cache->paths[i];
+		NVGpoint* pts = &cache->points[path->first];
+		n = path->count;
+		for (j = 0; j < (path->closed ? n : n-1); j++) {
+			float t0 = 0.0f, t1 = 0.0f;
+			if (path->closed || j > 0)
+				t0 = nvg__halfTurn(&pts[j > 0 ? j-1 : n-1], &pts[j]);
+			if (path->closed || j < n-2)
+				t1 = nvg__halfTurn(&pts[j], &pts[j+1 < n ? j+1 : 0]);
+			if ((t0 + t1) * w >= pts[j].len) return 0;
+		}
+	}
+
+	return 1;
+}
+
+// Stores the flattened points of each path as its stroke vertices, for back-ends which expand strokes themselves.
+static int nvg__expandStrokeSegments(NVGcontext* ctx)
+{
+	NVGpathCache* cache = ctx->cache;
+	NVGvertex* verts;
+	int cverts, i, j;
+
+	cverts = 0;
+	for (i = 0; i < cache->npaths; i++)
+		cverts += cache->paths[i].count;
+
+	verts = nvg__allocTempVerts(ctx, cverts);
+	if (verts == NULL) return 0;
+
+	for (i = 0; i < cache->npaths; i++) {
+		NVGpath* path = &cache->paths[i];
+		NVGpoint* pts = &cache->points[path->first];
+		path->fill = 0;
+		path->nfill = 0;
+		path->stroke = verts;
+		for (j = 0; j < path->count; j++)
+			nvg__vset(verts++, pts[j].x, pts[j].y, 0, 0);
+		path->nstroke = path->count;
+	}
+
+	return 1;
+}
+
 static int nvg__expandStroke(NVGcontext* ctx, float w, float fringe, int lineCap, int lineJoin, float miterLimit)
 {
 	NVGpathCache* cache = ctx->cache;
@@ -1869,22 +2699,482 @@ static int nvg__expandStroke(NVGcontext* ctx, float w, float fringe, int lineCap
 	return 1;
 }
 
-static int nvg__expandFill(NVGcontext* ctx, float w, int lineJoin, float miterLimit)
+static int nvg__segmentsIntersect(const NVGvertex* a, const NVGvertex* b, const NVGvertex* c, const NVGvertex* d)
+{
+	float o1 = nvg__triarea2(a->x,a->y, b->x,b->y, c->x,c->y);
+	float o2 = nvg__triarea2(a->x,a->y, b->x,b->y, d->x,d->y);
+	float o3 = nvg__triarea2(c->x,c->y, d->x,d->y, a->x,a->y);
+	float o4 = nvg__triarea2(c->x,c->y, d->x,d->y, b->x,b->y);
+	if (o1 == 0.0f && o2 == 0.0f) {
+		// Collinear, check for overlap.
+		return nvg__minf(a->x,b->x) <= nvg__maxf(c->x,d->x) && nvg__minf(c->x,d->x) <= nvg__maxf(a->x,b->x) &&
+			nvg__minf(a->y,b->y) <= nvg__maxf(c->y,d->y) && nvg__minf(c->y,d->y) <= nvg__maxf(a->y,b->y);
+	}
+	return ((o1 <= 0.0f && o2 >= 0.0f) || (o1 >= 0.0f && o2 <= 0.0f)) &&
+		((o3 <= 0.0f && o4 >= 0.0f) || (o3 >= 0.0f && o4 <= 0.0f));
+}
+
+// Polygon triangulation
+//
+// The fill outlines are triangulated by splitting them into y-monotone pieces using a sweep line,
+// and triangulating each piece. The outlines may contain holes, but they must not touch or
+// intersect each other, and the winding must be alternating (counter clockwise solids, clockwise holes).
+// All of these are validated during the sweep, and the triangulation fails otherwise.
+
+enum NVGtessVertexType {
+	NVG_TESS_START,
+	NVG_TESS_SPLIT,
+	NVG_TESS_END,
+	NVG_TESS_MERGE,
+	NVG_TESS_REGULAR,
+};
+
+struct NVGtess {
+	const NVGvertex* pts;
+	int npts;
+	int* vnext;		// Next vertex along the outline.
+	int* vprev;		// Previous vertex along the outline.
+	int* type;
+	int* helper;	// Helper vertex of an edge, edges are indexed by their start vertex.
+	int* status;	// Edges crossing the sweep line, sorted from left to right.
+	int nstatus;
+	int* hedge;		// Half-edges: origin, next, prev, next half-edge around origin.
+	int nhedges;
+	int* vout;		// First outgoing half-edge of a vertex.
+	int* tmp;
+};
+typedef struct NVGtess NVGtess;
+
+#define NVG_HE_ORG(t,h) ((t)->hedge[(h)*4+0])
+#define NVG_HE_NEXT(t,h) ((t)->hedge[(h)*4+1])
+#define NVG_HE_PREV(t,h) ((t)->hedge[(h)*4+2])
+#define NVG_HE_ONEXT(t,h) ((t)->hedge[(h)*4+3])
+
+// Returns 1 if vertex a is processed before b by the sweep.
+static int nvg__tessAbove(const NVGvertex* a, const NVGvertex* b)
+{
+	return a->y < b->y || (a->y == b->y && a->x < b->x);
+}
+
+static float nvg__tessOrient(NVGtess* t, int a, int b, int c)
+{
+	return nvg__triarea2(t->pts[a].x,t->pts[a].y, t->pts[b].x,t->pts[b].y, t->pts[c].x,t->pts[c].y);
+}
+
+static int nvg__tessEdgeUpper(NVGtess* t, int e)
+{
+	return nvg__tessAbove(&t->pts[e], &t->pts[t->vnext[e]]) ? e : t->vnext[e];
+}
+
+static int nvg__tessEdgeLower(NVGtess* t, int e)
+{
+	return nvg__tessAbove(&t->pts[e], &t->pts[t->vnext[e]]) ? t->vnext[e] : e;
+}
+
+// Returns 1 if the edge is left of the vertex, 0 if it is right, and -1 if the vertex touches the edge.
+static int nvg__tessEdgeLeftOf(NVGtess* t, int e, int v)
+{
+	float o = nvg__tessOrient(t, nvg__tessEdgeUpper(t, e), nvg__tessEdgeLower(t, e), v);
+	if (o == 0.0f) return -1;
+	return o > 0.0f ? 1 : 0;
+}
+
+static int nvg__tessEdgesIntersect(NVGtess* t, int e0, int e1)
+{
+	int a = e0, b = t->vnext[e0], c = e1, d = t->vnext[e1];
+	if (a == c || a == d || b == c || b == d) return 0; // Edges sharing a vertex.
+	return nvg__segmentsIntersect(&t->pts[a], &t->pts[b], &t->pts[c], &t->pts[d]);
+}
+
+static void nvg__tessSort(NVGtess* t, int* idx, int n)
+{
+	// Heap sort, vertices above first.
+	int i, start, end, root, child, tmp;
+	for (start = n/2-1, end = n; end > 1; ) {
+		if (start >= 0) {
+			root = start--;
+		} else {
+			end--;
+			tmp = idx[0]; idx[0] = idx[end]; idx[end] = tmp;
+			root = 0;
+		}
+		for (i = root; (child = i*2+1) < end; i = child) {
+			if (child+1 < end && nvg__tessAbove(&t->pts[idx[child]], &t->pts[idx[child+1]]))
+				child++;
+			if (!nvg__tessAbove(&t->pts[idx[i]], &t->pts[idx[child]]))
+				break;
+			tmp = idx[i]; idx[i] = idx[child]; idx[child] = tmp;
+		}
+	}
+}
+
+static int nvg__tessAddHalfEdge(NVGtess* t, int org)
+{
+	int h = t->nhedges++;
+	NVG_HE_ORG(t,h) = org;
+	NVG_HE_ONEXT(t,h) = t->vout[org];
+	t->vout[org] = h;
+	return h;
+}
+
+// Returns 1 if direction (dx,dy) from vertex of half-edge h lies inside the face left of h.
+static int nvg__tessInWedge(NVGtess* t, int h, float dx, float dy)
+{
+	const NVGvertex* v = &t->pts[NVG_HE_ORG(t,h)];
+	const NVGvertex* a = &t->pts[NVG_HE_ORG(t,NVG_HE_NEXT(t,h))];
+	const NVGvertex* b = &t->pts[NVG_HE_ORG(t,NVG_HE_PREV(t,h))];
+	float ax = a->x - v->x, ay = a->y - v->y;
+	float bx = b->x - v->x, by = b->y - v->y;
+	float ad = nvg__triarea2(0,0, ax,ay, dx,dy);
+	float db = nvg__triarea2(0,0, dx,dy, bx,by);
+	if (nvg__triarea2(0,0, ax,ay, bx,by) > 0.0f)
+		return ad > 0.0f && db > 0.0f;
+	return ad > 0.0f || db > 0.0f;
+}
+
+static int nvg__tessFindWedge(NVGtess* t, int v, int u)
+{
+	float dx = t->pts[u].x - t->pts[v].x;
+	float dy = t->pts[u].y - t->pts[v].y;
+	int h;
+	for (h = t->vout[v]; h != -1; h = NVG_HE_ONEXT(t,h))
+		if (nvg__tessInWedge(t, h, dx, dy))
+			return h;
+	return -1;
+}
+
+// Splits a face by adding a diagonal between vertices v and u.
+static int nvg__tessAddDiagonal(NVGtess* t, int v, int u)
+{
+	int a = nvg__tessFindWedge(t, v, u);
+	int b = nvg__tessFindWedge(t, u, v);
+	int h0, h1, pa, pb;
+	if (a == -1 || b == -1) return 0;
+	pa = NVG_HE_PREV(t,a);
+	pb = NVG_HE_PREV(t,b);
+	h0 = nvg__tessAddHalfEdge(t, v);
+	h1 = nvg__tessAddHalfEdge(t, u);
+	NVG_HE_NEXT(t,pa) = h0; NVG_HE_PREV(t,h0) = pa;
+	NVG_HE_NEXT(t,h0) = b; NVG_HE_PREV(t,b) = h0;
+	NVG_HE_NEXT(t,pb) = h1; NVG_HE_PREV(t,h1) = pb;
+	NVG_HE_NEXT(t,h1) = a; NVG_HE_PREV(t,a) = h1;
+	return 1;
+}
+
+static int nvg__tessResolveMerge(NVGtess* t, int e, int v)
+{
+	if (t->type[t->helper[e]] == NVG_TESS_MERGE)
+		return nvg__tessAddDiagonal(t, v, t->helper[e]);
+	return 1;
+}
+
+static int nvg__tessIsDownward(NVGtess* t, int e)
+{
+	return nvg__tessEdgeUpper(t, e) == e;
+}
+
+// Sweeps the vertices, validates the outlines and splits them into monotone pieces.
+static int nvg__tessMonotonize(NVGtess* t, const int* order, int n)
+{
+	int i, j;
+	for (i = 0; i < n; i++) {
+		int v = order[i], p = t->vprev[v];
+		int ins, pos = -1, nremoved = 0, left;
+		int newEdges[2], nnew = 0;
+
+		// Remove edges ending at the vertex.
+		for (j = 0; j < t->nstatus; j++) {
+			int e = t->status[j];
+			if (e != p && e != v) continue;
+			if (nremoved > 0 && j != pos+1) return 0;
+			if (nremoved == 0) pos = j;
+			nremoved++;
+		}
+		if (nremoved > 0) {
+			memmove(&t->status[pos], &t->status[pos+nremoved], sizeof(int)*(t->nstatus - pos - nremoved));
+			t->nstatus -= nremoved;
+		}
+
+		// Find the edges left of the vertex.
+		{
+			int lo = 0, hi = t->nstatus;
+			while (lo < hi) {
+				int mid = (lo + hi) / 2;
+				if (nvg__tessEdgeLeftOf(t, t->status[mid], v) > 0) lo = mid+1;
+				else hi = mid;
+			}
+			ins = lo;
+		}
+		if (pos != -1 && pos != ins) return 0;
+		if (ins > 0 && nvg__tessEdgeLeftOf(t, t->status[ins-1], v) < 0) return 0;
+		if (ins < t->nstatus && nvg__tessEdgeLeftOf(t, t->status[ins], v) != 0) return 0;
+		left = ins > 0 ? t->status[ins-1] : -1;
+
+		switch (t->type[v]) {
+		case NVG_TESS_START:
+			// Start vertex must be outside of the shape.
+			if (left != -1 && nvg__tessIsDownward(t, left)) return 0;
+			newEdges[nnew++] = v;
+			newEdges[nnew++] = p;
+			t->helper[v] = v;
+			break;
+		case NVG_TESS_SPLIT:
+			// Split vertex must be inside of the shape.
+			if (left == -1 || !nvg__tessIsDownward(t, left)) return 0;
+			if (!nvg__tessAddDiagonal(t, v, t->helper[left])) return 0;
+			t->helper[left] = v;
+			newEdges[nnew++] = p;
+			newEdges[nnew++] = v;
+			t->helper[v] = v;
+			break;
+		case NVG_TESS_END:
+			if (!nvg__tessResolveMerge(t, p, v)) return 0;
+			break;
+		case NVG_TESS_MERGE:
+			if (!nvg__tessResolveMerge(t, p, v)) return 0;
+			if (left == -1 || !nvg__tessIsDownward(t, left)) return 0;
+			if (!nvg__tessResolveMerge(t, left, v)) return 0;
+			t->helper[left] = v;
+			break;
+		default:
+			if (nvg__tessAbove(&t->pts[p], &t->pts[v])) {
+				// Interior is right of the vertex.
+				if (!nvg__tessResolveMerge(t, p, v)) return 0;
+				newEdges[nnew++] = v;
+				t->helper[v] = v;
+			} else {
+				if (left == -1 || !nvg__tessIsDownward(t, left)) return 0;
+				if (!nvg__tessResolveMerge(t, left, v)) return 0;
+				t->helper[left] = v;
+				newEdges[nnew++] = p;
+			}
+			break;
+		}
+
+		// Insert edges starting at the vertex.
+		if (nnew > 0) {
+			memmove(&t->status[ins+nnew], &t->status[ins], sizeof(int)*(t->nstatus - ins));
+			for (j = 0; j < nnew; j++)
+				t->status[ins+j] = newEdges[j];
+			t->nstatus += nnew;
+		}
+
+		// Check that the neighbour edges do not intersect.
+		if (ins > 0 && ins < t->nstatus && nvg__tessEdgesIntersect(t, t->status[ins-1], t->status[ins]))
+			return 0;
+		if (nnew > 0 && ins+nnew < t->nstatus && nvg__tessEdgesIntersect(t, t->status[ins+nnew-1], t->status[ins+nnew]))
+			return 0;
+	}
+	return t->nstatus == 0;
+}
+
+static NVGvertex* nvg__tessEmit(NVGtess* t, NVGvertex* dst, int a, int b, int c)
+{
+	float area = nvg__tessOrient(t, a, b, c);
+	if (area == 0.0f) return dst;
+	if (area < 0.0f) { int tmp = b; b = c; c = tmp; }
+	*dst++ = t->pts[a];
+	*dst++ = t->pts[b];
+	*dst++ = t->pts[c];
+	return dst;
+}
+
+// Triangulates monotone polygon, the vertices are in counter clockwise order.
+static NVGvertex* nvg__tessTriangulateMonotone(NVGtess* t, const int* poly, int n, NVGvertex* dst)
+{
+	int* chain = t->tmp;
+	int* sorted = chain + n;
+	int* stack = sorted + n;
+	int i, j, top = 0, bottom = 0, l, r, nstack = 0;
+
+	if (n < 3) return dst;
+	if (n == 3) return nvg__tessEmit(t, dst, poly[0], poly[1], poly[2]);
+
+	for (i = 1; i < n; i++) {
+		if (nvg__tessAbove(&t->pts[poly[i]], &t->pts[poly[top]])) top = i;
+		if (nvg__tessAbove(&t->pts[poly[bottom]], &t->pts[poly[i]])) bottom = i;
+	}
+
+	// Going forward from the top vertex follows the left chain.
+	for (i = top; i != bottom; i = (i+1) % n) chain[i] = 0;
+	for (i = bottom; i != top; i = (i+1) % n) chain[i] = 1;
+
+	// Merge the chains from top to bottom.
+	sorted[0] = top;
+	l = (top+1) % n;
+	r = (top+n-1) % n;
+	for (i = 1; i < n; i++) {
+		if (l == r || nvg__tessAbove(&t->pts[poly[l]], &t->pts[poly[r]])) {
+			sorted[i] = l;
+			l = (l+1) % n;
+		} else {
+			sorted[i] = r;
+			r = (r+n-1) % n;
+		}
+	}
+
+	stack[nstack++] = sorted[0];
+	stack[nstack++] = sorted[1];
+	for (i = 2; i < n-1; i++) {
+		int u = sorted[i];
+		if (chain[u] != chain[stack[nstack-1]]) {
+			// Opposite chain, connect to all stacked vertices.
+			for (j = 0; j < nstack-1; j++)
+				dst = nvg__tessEmit(t, dst, poly[u], poly[stack[j]], poly[stack[j+1]]);
+			stack[0] = sorted[i-1];
+			stack[1] = u;
+			nstack = 2;
+		} else {
+			// Same chain, add triangles as long as the diagonals are inside.
+			int last = stack[--nstack];
+			while (nstack > 0) {
+				int s = stack[nstack-1];
+				float o = chain[u] == 0 ? nvg__tessOrient(t, poly[s], poly[last], poly[u]) : nvg__tessOrient(t, poly[u], poly[last], poly[s]);
+				if (o <= 0.0f) break;
+				dst = nvg__tessEmit(t, dst, poly[u], poly[last], poly[s]);
+				last = stack[--nstack];
+			}
+			stack[nstack++] = last;
+			stack[nstack++] = u;
+		}
+	}
+	for (j = 0; j < nstack-1; j++)
+		dst = nvg__tessEmit(t, dst, poly[sorted[n-1]], poly[stack[j]], poly[stack[j+1]]);
+
+	return dst;
+}
+
+// Triangulates fill outlines of the paths, the outline vertices must be stored one after another.
+// Returns number of vertices written to dst, or 0 if the outlines could not be triangulated.
+static int nvg__triangulate(NVGcontext* ctx, NVGpath* paths, int npaths, NVGvertex* dst)
+{
+	NVGtess tess;
+	NVGtess* t = &tess;
+	NVGvertex* out = dst;
+	int* order;
+	int* poly;
+	char* visited;
+	int i, j, n, norder, first, maxHalfEdges;
+
+	memset(t, 0, sizeof(*t));
+	t->pts = paths[0].fill;
+	n = 0;
+	for (i = 0; i < npaths; i++)
+		n += paths[i].nfill;
+	if (n < 3) return 0;
+	t->npts = n;
+
+	// Each split or merge vertex adds at most one diagonal.
+	maxHalfEdges = n * 3;
+	order = (int*)nvg__arenaAlloc(ctx, sizeof(int) * (n*7 + maxHalfEdges*8 + (maxHalfEdges+3)/4));
+	if (order == NULL) return 0;
+	t->vnext = order + n;
+	t->vprev = t->vnext + n;
+	t->type = t->vprev + n;
+	t->helper = t->type + n;
+	t->status = t->helper + n;
+	t->vout = t->status + n;
+	poly = t->vout + n;
+	t->hedge = poly + maxHalfEdges;
+	t->tmp = t->hedge + maxHalfEdges*4;
+	visited = (char*)(t->tmp + maxHalfEdges*3);
+
+	// Link the outlines, skipping duplicate vertices.
+	norder = 0;
+	first = 0;
+	for (i = 0; i < npaths; i++) {
+		int nfill = paths[i].nfill;
+		int start = norder, prev = -1;
+		for (j = 0; j < nfill; j++) {
+			int v = first + j;
+			if (prev != -1 && t->pts[prev].x == t->pts[v].x && t->pts[prev].y == t->pts[v].y) continue;
+			if (prev != -1) t->vnext[prev] = v;
+			t->vprev[v] = prev;
+			order[norder++] = v;
+			prev = v;
+		}
+		if (norder - start > 1 && t->pts[prev].x == t->pts[order[start]].x && t->pts[prev].y == t->pts[order[start]].y) {
+			prev = t->vprev[prev];
+			norder--;
+		}
+		if (norder - start < 3) {
+			norder = start; // Degenerate outline.
+		} else {
+			t->vnext[prev] = order[start];
+			t->vprev[order[start]] = prev;
+		}
+		first += nfill;
+	}
+	if (norder < 3) return 0;
+
+	// Classify vertices and create half-edges for the outlines.
+	t->nhedges = n;
+	for (i = 0; i < n; i++)
+		t->vout[i] = -1;
+	for (i = 0; i < norder; i++) {
+		int v = order[i], p = t->vprev[v], nx = t->vnext[v];
+		int pBelow = nvg__tessAbove(&t->pts[v], &t->pts[p]);
+		int nBelow = nvg__tessAbove(&t->pts[v], &t->pts[nx]);
+		float o = nvg__tessOrient(t, p, v, nx);
+		if (pBelow == nBelow && o == 0.0f) return 0; // Spike.
+		if (pBelow && nBelow)
+			t->type[v] = o > 0.0f ? NVG_TESS_START : NVG_TESS_SPLIT;
+		else if (!pBelow && !nBelow)
+			t->type[v] = o > 0.0f ? NVG_TESS_END : NVG_TESS_MERGE;
+		else
+			t->type[v] = NVG_TESS_REGULAR;
+		NVG_HE_ORG(t,v) = v;
+		NVG_HE_NEXT(t,v) = nx;
+		NVG_HE_PREV(t,v) = p;
+		NVG_HE_ONEXT(t,v) = -1;
+		t->vout[v] = v;
+	}
+
+	nvg__tessSort(t, order, norder);
+	if (!nvg__tessMonotonize(t, order, norder)) return 0;
+
+	// Triangulate the monotone pieces.
+	memset(visited, 0, t->nhedges);
+	for (i = 0; i < norder; i++) {
+		int h0, h;
+		for (h0 = t->vout[order[i]]; h0 != -1; h0 = NVG_HE_ONEXT(t,h0)) {
+			int npoly = 0;
+			if (visited[h0]) continue;
+			h = h0;
+			do {
+				visited[h] = 1;
+				poly[npoly++] = NVG_HE_ORG(t,h);
+				h = NVG_HE_NEXT(t,h);
+			} while (h != h0 && npoly < maxHalfEdges);
+			out = nvg__tessTriangulateMonotone(t, poly, npoly, out);
+		}
+	}
+
+	return (int)(out - dst);
+}
+
+static int nvg__expandFill(NVGcontext* ctx, float w, int lineJoin, float miterLimit, int triangulate)
 {
 	NVGpathCache* cache = ctx->cache;
 	NVGvertex* verts;
 	NVGvertex* dst;
 	int cverts, convex, i, j;
 	float aa = ctx->fringeWidth;
+	float woff = 0.5f*aa;
 	int fringe = w > 0.0f;
 
 	nvg__calculateJoins(ctx, w, lineJoin, miterLimit);
 
+	convex = cache->npaths == 1 && cache->paths[0].convex;
+	triangulate = triangulate && !convex;
+
 	// Calculate max vertex usage.
 	cverts = 0;
 	for (i = 0; i < cache->npaths; i++) {
 		NVGpath* path = &cache->paths[i];
 		cverts += path->count + path->nbevel + 1;
+		if (triangulate)
+			cverts += (path->count + path->nbevel + 2) * 3;
 		if (fringe)
 			cverts += (path->count + path->nbevel*5 + 1) * 2; // plus one for loop
 	}
@@ -1892,20 +3182,16 @@ static int nvg__expandFill(NVGcontext* ctx, float w, int lineJoin, float miterLi
 	verts = nvg__allocTempVerts(ctx, cverts);
 	if (verts == NULL) return 0;
 
-	convex = cache->npaths == 1 && cache->paths[0].convex;
-
 	for (i = 0; i < cache->npaths; i++) {
 		NVGpath* path = &cache->paths[i];
 		NVGpoint* pts = &cache->points[path->first];
 		NVGpoint* p0;
 		NVGpoint* p1;
-		float rw, lw, woff;
-		float ru, lu;
 
 		// Calculate shape vertices.
-		woff = 0.5f*aa;
 		dst = verts;
 		path->fill = dst;
+		path->triangulated = 0;
 
 		if (fringe) {
 			// Looping
@@ -1943,6 +3229,32 @@ static int nvg__expandFill(NVGcontext* ctx, float w, int lineJoin, float miterLi
 
 		path->nfill = (int)(dst - verts);
 		verts = dst;
+	}
+
+	// Triangulate concave shapes so that they can be rendered without stenciling.
+	// The triangles of all the paths are stored in the first path.
+	if (triangulate && cache->npaths > 0) {
+		NVGarenaMark mark = nvg__arenaMark(ctx);
+		int ntris = nvg__triangulate(ctx, cache->paths, cache->npaths, verts);
+		nvg__arenaRewind(ctx, mark);
+		if (ntris > 0) {
+			for (i = 0; i < cache->npaths; i++) {
+				cache->paths[i].nfill = 0;
+				cache->paths[i].triangulated = 1;
+			}
+			cache->paths[0].fill = verts;
+			cache->paths[0].nfill = ntris;
+			verts += ntris;
+		}
+	}
+
+	for (i = 0; i < cache->npaths; i++) {
+		NVGpath* path = &cache->paths[i];
+		NVGpoint* pts = &cache->points[path->first];
+		NVGpoint* p0;
+		NVGpoint* p1;
+		float rw, lw;
+		float ru, lu;
 
 		// Calculate fringe
 		if (fringe) {
@@ -1953,9 +3265,9 @@ static int nvg__expandFill(NVGcontext* ctx, float w, int lineJoin, float miterLi
 			dst = verts;
 			path->stroke = dst;
 
-			// Create only half a fringe for convex shapes so that
+			// Create only half a fringe for convex and triangulated shapes so that
 			// the shape can be rendered without stenciling.
-			if (convex) {
+			if (convex || path->triangulated) {
 				lw = woff;	// This should generate the same vertex as fill inset above.
 				lu = 0.5f;	// Set outline fade at middle.
 			}
@@ -1994,36 +3306,47 @@ static int nvg__expandFill(NVGcontext* ctx, float w, int lineJoin, float miterLi
 void nvgBeginPath(NVGcontext* ctx)
 {
 	ctx->ncommands = 0;
+	ctx->ncommandPoints = 0;
+	ctx->shapeCommands = -1;
 	nvg__clearPathCache(ctx);
 }
 
+void nvgReservePath(NVGcontext* ctx, int ncommands, int npoints)
+{
+	nvg__reserveCommands(ctx, nvg__maxi(ncommands, 0), nvg__maxi(npoints, 0));
+}
+
 void nvgMoveTo(NVGcontext* ctx, float x, float y)
 {
-	float vals[] = { NVG_MOVETO, x, y };
-	nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+	unsigned char cmd = NVG_MOVETO;
+	float pts[] = { x, y };
+	nvg__appendCommands(ctx, &cmd, 1, pts, 1);
 }
 
 void nvgLineTo(NVGcontext* ctx, float x, float y)
 {
-	float vals[] = { NVG_LINETO, x, y };
-	nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+	unsigned char cmd = NVG_LINETO;
+	float pts[] = { x, y };
+	nvg__appendCommands(ctx, &cmd, 1, pts, 1);
 }
 
 void nvgBezierTo(NVGcontext* ctx, float c1x, float c1y, float c2x, float c2y, float x, float y)
 {
-	float vals[] = { NVG_BEZIERTO, c1x, c1y, c2x, c2y, x, y };
-	nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+	unsigned char cmd = NVG_BEZIERTO;
+	float pts[] = { c1x, c1y, c2x, c2y, x, y };
+	nvg__appendCommands(ctx, &cmd, 1, pts, 3);
 }
 
 void nvgQuadTo(NVGcontext* ctx, float cx, float cy, float x, float y)
 {
     float x0 = ctx->commandx;
     float y0 = ctx->commandy;
-    float vals[] = { NVG_BEZIERTO,
+    unsigned char cmd = NVG_BEZIERTO;
+    float pts[] = {
         x0 + 2.0f/3.0f*(cx - x0), y0 + 2.0f/3.0f*(cy - y0),
         x + 2.0f/3.0f*(cx - x), y + 2.0f/3.0f*(cy - y),
         x, y };
-    nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+    nvg__appendCommands(ctx, &cmd, 1, pts, 3);
 }
 
 void nvgArcTo(NVGcontext* ctx, float x1, float y1, float x2, float y2, float radius)
@@ -2084,14 +3407,14 @@ void nvgArcTo(NVGcontext* ctx, float x1, float y1, float x2, float y2, float rad
 
 void nvgClosePath(NVGcontext* ctx)
 {
-	float vals[] = { NVG_CLOSE };
-	nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+	unsigned char cmd = NVG_CLOSE;
+	nvg__appendCommands(ctx, &cmd, 1, NULL, 0);
 }
 
 void nvgPathWinding(NVGcontext* ctx, int dir)
 {
-	float vals[] = { NVG_WINDING, (float)dir };
-	nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+	unsigned char cmds[] = { NVG_WINDING, (unsigned char)dir };
+	nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), NULL, 0);
 }
 
 void nvgArc(NVGcontext* ctx, float cx, float cy, float r, float a0, float a1, int dir)
@@ -2099,8 +3422,9 @@ void nvgArc(NVGcontext* ctx, float cx, float cy, float r, float a0, float a1, in
 	float a = 0, da = 0, hda = 0, kappa = 0;
 	float dx = 0, dy = 0, x = 0, y = 0, tanx = 0, tany = 0;
 	float px = 0, py = 0, ptanx = 0, ptany = 0;
-	float vals[3 + 5*7 + 100];
-	int i, ndivs, nvals;
+	unsigned char cmds[6];
+	float pts[2 + 5*6];
+	int i, ndivs, npts;
 	int move = ctx->ncommands > 0 ? NVG_LINETO : NVG_MOVETO;
 
 	// Clamp angles
@@ -2127,7 +3451,7 @@ void nvgArc(NVGcontext* ctx, float cx, float cy, float r, float a0, float a1, in
 	if (dir == NVG_CCW)
 		kappa = -kappa;
 
-	nvals = 0;
+	npts = 0;
 	for (i = 0; i <= ndivs; i++) {
 		a = a0 + da * (i/(float)ndivs);
 		dx = nvg__cosf(a);
@@ -2138,17 +3462,17 @@ void nvgArc(NVGcontext* ctx, float cx, float cy, float r, float a0, float a1, in
 		tany = dx*r*kappa;
 
 		if (i == 0) {
-			vals[nvals++] = (float)move;
-			vals[nvals++] = x;
-			vals[nvals++] = y;
+			cmds[i] = (unsigned char)move;
+			pts[npts++] = x;
+			pts[npts++] = y;
 		} else {
-			vals[nvals++] = NVG_BEZIERTO;
-			vals[nvals++] = px+ptanx;
-			vals[nvals++] = py+ptany;
-			vals[nvals++] = x-tanx;
-			vals[nvals++] = y-tany;
-			vals[nvals++] = x;
-			vals[nvals++] = y;
+			cmds[i] = NVG_BEZIERTO;
+			pts[npts++] = px+ptanx;
+			pts[npts++] = py+ptany;
+			pts[npts++] = x-tanx;
+			pts[npts++] = y-tany;
+			pts[npts++] = x;
+			pts[npts++] = y;
 		}
 		px = x;
 		py = y;
@@ -2156,19 +3480,84 @@ void nvgArc(NVGcontext* ctx, float cx, float cy, float r, float a0, float a1, in
 		ptany = tany;
 	}
 
-	nvg__appendCommands(ctx, vals, nvals);
+	nvg__appendCommands(ctx, cmds, ndivs+1, pts, npts/2);
+}
+
+// Remembers the shape if it is the only one in the path, so that it can be drawn without tessellating it.
+static void nvg__setShape(NVGcontext* ctx, int first, int type, float cx, float cy, float ex, float ey, const float* radius)
+{
+	NVGstate* state = nvg__getState(ctx);
+	NVGshape* shape = &ctx->shape;
+
+	if (first != 0 || ctx->ncommands == 0) return;
+
+	shape->type = type;
+	nvgTransformTranslate(shape->xform, cx, cy);
+	nvgTransformMultiply(shape->xform, state->xform);
+	shape->extent[0] = ex;
+	shape->extent[1] = ey;
+	if (radius != NULL)
+		memcpy(shape->radius, radius, sizeof(shape->radius));
+	else
+		memset(shape->radius, 0, sizeof(shape->radius));
+	ctx->shapeCommands = ctx->ncommands;
+}
+
+// Returns the shape of the path if it can be drawn by the back-end, NULL otherwise.
+static NVGshape* nvg__pathShape(NVGcontext* ctx, float fringe, float strokeWidth)
+{
+	NVGstate* state = nvg__getState(ctx);
+	NVGshape* shape = &ctx->shape;
+	const float* t = shape->xform;
+	float sx = t[0]*t[0] + t[1]*t[1], sy = t[2]*t[2] + t[3]*t[3];
+
+	if (ctx->params.renderShape == NULL || fringe <= 0.0f || ctx->shapeCommands != ctx->ncommands ||
+		state->scissor.stencilFlag != NVG_STENCIL_DEFAULT)
+		return NULL;
+	// The distance to the shape has to scale the same in all directions.
+	if (sx < 1e-12f || nvg__absf(sx - sy) > sx*1e-3f || nvg__absf(t[0]*t[2] + t[1]*t[3]) > sx*1e-3f)
+		return NULL;
+
+	shape->strokeWidth = strokeWidth;
+	shape->lineJoin = state->lineJoin;
+	if (strokeWidth > 0.0f) {
+		if (state->ndashes > 0)
+			return NULL;
+		if (shape->type == NVG_SHAPE_ELLIPSE) {
+			// The distance to an ellipse is approximated, which is accurate enough for the strokes of round ellipses only.
+			if (nvg__maxf(shape->extent[0], shape->extent[1]) > 2.0f * nvg__minf(shape->extent[0], shape->extent[1]))
+				return NULL;
+		} else if (shape->radius[0] <= 0.0f || shape->radius[1] <= 0.0f || shape->radius[2] <= 0.0f || shape->radius[3] <= 0.0f) {
+			// Sharp corners are either mitered or rounded.
+			if (state->lineJoin == NVG_BEVEL || (state->lineJoin == NVG_MITER && state->miterLimit*state->miterLimit*0.5f < 1.0f))
+				return NULL;
+			if (state->lineJoin != NVG_ROUND)
+				shape->lineJoin = NVG_MITER;
+		}
+	}
+
+	return shape;
+}
+
+static void nvg__renderShape(NVGcontext* ctx, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor, const NVGshape* shape)
+{
+	ctx->params.renderShape(ctx->params.userPtr, paint, compositeOperation, scissor, ctx->fringeWidth, shape);
+	ctx->fillTriCount += 2;
+	ctx->drawCallCount++;
 }
 
 void nvgRect(NVGcontext* ctx, float x, float y, float w, float h)
 {
-	float vals[] = {
-		NVG_MOVETO, x,y,
-		NVG_LINETO, x,y+h,
-		NVG_LINETO, x+w,y+h,
-		NVG_LINETO, x+w,y,
-		NVG_CLOSE
+	static const unsigned char cmds[] = { NVG_MOVETO, NVG_LINETO, NVG_LINETO, NVG_LINETO, NVG_CLOSE };
+	int first = ctx->ncommands;
+	float pts[] = {
+		x,y,
+		x,y+h,
+		x+w,y+h,
+		x+w,y
 	};
-	nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+	nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), pts, NVG_COUNTOF(pts)/2);
+	nvg__setShape(ctx, first, NVG_SHAPE_RECT, x+w*0.5f, y+h*0.5f, nvg__absf(w)*0.5f, nvg__absf(h)*0.5f, NULL);
 }
 
 void nvgRoundedRect(NVGcontext* ctx, float x, float y, float w, float h, float r)
@@ -2178,99 +3567,1020 @@ void nvgRoundedRect(NVGcontext* ctx, float x, float y, float w, float h, float r
 
 void nvgRoundedRectVarying(NVGcontext* ctx, float x, float y, float w, float h, float radTopLeft, float radTopRight, float radBottomRight, float radBottomLeft)
 {
-	if(radTopLeft < 0.1f && radTopRight < 0.1f && radBottomRight < 0.1f && radBottomLeft < 0.1f) {
-		nvgRect(ctx, x, y, w, h);
-		return;
-	} else {
-		float halfw = nvg__absf(w)*0.5f;
-		float halfh = nvg__absf(h)*0.5f;
-		float rxBL = nvg__minf(radBottomLeft, halfw) * nvg__signf(w), ryBL = nvg__minf(radBottomLeft, halfh) * nvg__signf(h);
-		float rxBR = nvg__minf(radBottomRight, halfw) * nvg__signf(w), ryBR = nvg__minf(radBottomRight, halfh) * nvg__signf(h);
-		float rxTR = nvg__minf(radTopRight, halfw) * nvg__signf(w), ryTR = nvg__minf(radTopRight, halfh) * nvg__signf(h);
-		float rxTL = nvg__minf(radTopLeft, halfw) * nvg__signf(w), ryTL = nvg__minf(radTopLeft, halfh) * nvg__signf(h);
-		float vals[] = {
-			NVG_MOVETO, x, y + ryTL,
-			NVG_LINETO, x, y + h - ryBL,
-			NVG_BEZIERTO, x, y + h - ryBL*(1 - NVG_KAPPA90), x + rxBL*(1 - NVG_KAPPA90), y + h, x + rxBL, y + h,
-			NVG_LINETO, x + w - rxBR, y + h,
-			NVG_BEZIERTO, x + w - rxBR*(1 - NVG_KAPPA90), y + h, x + w, y + h - ryBR*(1 - NVG_KAPPA90), x + w, y + h - ryBR,
-			NVG_LINETO, x + w, y + ryTR,
-			NVG_BEZIERTO, x + w, y + ryTR*(1 - NVG_KAPPA90), x + w - rxTR*(1 - NVG_KAPPA90), y, x + w - rxTR, y,
-			NVG_LINETO, x + rxTL, y,
-			NVG_BEZIERTO, x + rxTL*(1 - NVG_KAPPA90), y, x, y + ryTL*(1 - NVG_KAPPA90), x, y + ryTL,
-			NVG_CLOSE
-		};
-		nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+	if(radTopLeft < 0.1f && radTopRight < 0.1f && radBottomRight < 0.1f && radBottomLeft < 0.1f) {
+		nvgRect(ctx, x, y, w, h);
+		return;
+	} else {
+		float halfw = nvg__absf(w)*0.5f;
+		float halfh = nvg__absf(h)*0.5f;
+		float rxBL = nvg__minf(radBottomLeft, halfw) * nvg__signf(w), ryBL = nvg__minf(radBottomLeft, halfh) * nvg__signf(h);
+		float rxBR = nvg__minf(radBottomRight, halfw) * nvg__signf(w), ryBR = nvg__minf(radBottomRight, halfh) * nvg__signf(h);
+		float rxTR = nvg__minf(radTopRight, halfw) * nvg__signf(w), ryTR = nvg__minf(radTopRight, halfh) * nvg__signf(h);
+		float rxTL = nvg__minf(radTopLeft, halfw) * nvg__signf(w), ryTL = nvg__minf(radTopLeft, halfh) * nvg__signf(h);
+		float radius[4] = { radTopLeft, radTopRight, radBottomRight, radBottomLeft };
+		float rmax = nvg__maxf(nvg__maxf(radTopLeft, radTopRight), nvg__maxf(radBottomRight, radBottomLeft));
+		float rmin = nvg__minf(nvg__minf(radTopLeft, radTopRight), nvg__minf(radBottomRight, radBottomLeft));
+		static const unsigned char cmds[] = {
+			NVG_MOVETO, NVG_LINETO, NVG_BEZIERTO, NVG_LINETO, NVG_BEZIERTO,
+			NVG_LINETO, NVG_BEZIERTO, NVG_LINETO, NVG_BEZIERTO, NVG_CLOSE
+		};
+		int first = ctx->ncommands;
+		float pts[] = {
+			x, y + ryTL,
+			x, y + h - ryBL,
+			x, y + h - ryBL*(1 - NVG_KAPPA90), x + rxBL*(1 - NVG_KAPPA90), y + h, x + rxBL, y + h,
+			x + w - rxBR, y + h,
+			x + w - rxBR*(1 - NVG_KAPPA90), y + h, x + w, y + h - ryBR*(1 - NVG_KAPPA90), x + w, y + h - ryBR,
+			x + w, y + ryTR,
+			x + w, y + ryTR*(1 - NVG_KAPPA90), x + w - rxTR*(1 - NVG_KAPPA90), y, x + w - rxTR, y,
+			x + rxTL, y,
+			x + rxTL*(1 - NVG_KAPPA90), y, x, y + ryTL*(1 - NVG_KAPPA90), x, y + ryTL
+		};
+		nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), pts, NVG_COUNTOF(pts)/2);
+		// Corners which are clamped to elliptic arcs are tessellated.
+		if (rmin >= 0.0f && rmax <= nvg__minf(halfw, halfh)) {
+			// The radii of the shape are in the order of the corners on screen, negative sizes mirror the rectangle.
+			if (w < 0.0f) {
+				radius[0] = radTopRight; radius[1] = radTopLeft;
+				radius[2] = radBottomLeft; radius[3] = radBottomRight;
+			}
+			if (h < 0.0f) {
+				float tl = radius[0], tr = radius[1];
+				radius[0] = radius[3]; radius[1] = radius[2];
+				radius[2] = tr; radius[3] = tl;
+			}
+			nvg__setShape(ctx, first, NVG_SHAPE_RECT, x+w*0.5f, y+h*0.5f, halfw, halfh, radius);
+		}
+	}
+}
+
+void nvgEllipse(NVGcontext* ctx, float cx, float cy, float rx, float ry)
+{
+	static const unsigned char cmds[] = { NVG_MOVETO, NVG_BEZIERTO, NVG_BEZIERTO, NVG_BEZIERTO, NVG_BEZIERTO, NVG_CLOSE };
+	int first = ctx->ncommands;
+	float pts[] = {
+		cx-rx, cy,
+		cx-rx, cy+ry*NVG_KAPPA90, cx-rx*NVG_KAPPA90, cy+ry, cx, cy+ry,
+		cx+rx*NVG_KAPPA90, cy+ry, cx+rx, cy+ry*NVG_KAPPA90, cx+rx, cy,
+		cx+rx, cy-ry*NVG_KAPPA90, cx+rx*NVG_KAPPA90, cy-ry, cx, cy-ry,
+		cx-rx*NVG_KAPPA90, cy-ry, cx-rx, cy-ry*NVG_KAPPA90, cx-rx, cy
+	};
+	nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), pts, NVG_COUNTOF(pts)/2);
+	if (rx > 0.0f && ry > 0.0f)
+		nvg__setShape(ctx, first, NVG_SHAPE_ELLIPSE, cx, cy, rx, ry, NULL);
+}
+
+void nvgCircle(NVGcontext* ctx, float cx, float cy, float r)
+{
+	nvgEllipse(ctx, cx,cy, r,r);
+}
+
+void nvgDebugDumpPathCache(NVGcontext* ctx)
+{
+	const NVGpath* path;
+	int i, j;
+
+	printf("Dumping %d cached paths\n", ctx->cache->npaths);
+	for (i = 0; i < ctx->cache->npaths; i++) {
+		path = &ctx->cache->paths[i];
+		printf(" - Path %d\n", i);
+		if (path->nfill) {
+			printf("   - fill: %d\n", path->nfill);
+			for (j = 0; j < path->nfill; j++)
+				printf("%f\t%f\n", path->fill[j].x, path->fill[j].y);
+		}
+		if (path->nstroke) {
+			printf("   - stroke: %d\n", path->nstroke);
+			for (j = 0; j < path->nstroke; j++)
+				printf("%f\t%f\n", path->stroke[j].x, path->stroke[j].y);
+		}
+	}
+}
+
+static void nvg__renderFillPaths(NVGcontext* ctx, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor,
+								 const float* bounds, const NVGpath* paths, int npaths)
+{
+	int i;
+
+	ctx->params.renderFill(ctx->params.userPtr, paint, compositeOperation, scissor, ctx->fringeWidth, bounds, paths, npaths);
+
+	// Count triangles
+	for (i = 0; i < npaths; i++) {
+		const NVGpath* path = &paths[i];
+		ctx->fillTriCount += path->triangulated ? path->nfill/3 : path->nfill-2;
+		ctx->fillTriCount += path->nstroke-2;
+		ctx->drawCallCount += 2;
+	}
+}
+
+static void nvg__renderStrokePaths(NVGcontext* ctx, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor,
+								   float strokeWidth, const NVGpath* paths, int npaths)
+{
+	int i;
+
+	ctx->params.renderStroke(ctx->params.userPtr, paint, compositeOperation, scissor, ctx->fringeWidth, strokeWidth, paths, npaths);
+
+	// Count triangles
+	for (i = 0; i < npaths; i++) {
+		ctx->strokeTriCount += paths[i].nstroke-2;
+		ctx->drawCallCount++;
+	}
+}
+
+static void nvg__renderStrokeSegments(NVGcontext* ctx, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor,
+									  float strokeWidth, int lineJoin, int lineCap, float miterLimit, const NVGpath* paths, int npaths)
+{
+	int i;
+
+	ctx->params.renderStrokeSegments(ctx->params.userPtr, paint, compositeOperation, scissor, ctx->fringeWidth, strokeWidth,
+									 lineJoin, lineCap, miterLimit, paths, npaths);
+
+	// Count triangles, each segment is drawn as a quad.
+	for (i = 0; i < npaths; i++) {
+		if (paths[i].nstroke < 2) continue;
+		ctx->strokeTriCount += (paths[i].closed ? paths[i].nstroke : paths[i].nstroke-1) * 2;
+		ctx->drawCallCount++;
+	}
+}
+
+//
+// Deferred tessellation
+//
+// With NVGparams.deferTessellation nvgFill() and nvgStroke() only copy the path commands and the
+// render state into a job. The jobs are tessellated in parallel when the next draw call which can not
+// be deferred is made (text, command lists) or at nvgEndFrame(), and then submitted to the back-end
+// in the order they were made. Each worker thread has its own path cache and arena, the results
+// are copied to the worker arena so that they stay valid until the whole batch has been submitted.
+
+#ifndef NVG_NO_THREADS
+#ifdef _WIN32
+typedef HANDLE NVGthread;
+typedef LPTHREAD_START_ROUTINE NVGthreadMain;
+typedef CRITICAL_SECTION NVGmutex;
+typedef CONDITION_VARIABLE NVGcond;
+#else
+typedef pthread_t NVGthread;
+typedef void* (*NVGthreadMain)(void* arg);
+typedef pthread_mutex_t NVGmutex;
+typedef pthread_cond_t NVGcond;
+#endif
+#endif
+
+enum NVGtessJobType {
+	NVG_TESS_FILL,
+	NVG_TESS_STROKE,
+	NVG_TESS_SHAPE,		// Drawn by NVGparams.renderShape, keeps the order of the jobs.
+};
+
+struct NVGtessJob {
+	int type;
+	NVGpaint paint;
+	NVGcompositeOperationState compositeOperation;
+	NVGscissor scissor;
+	float fringe;			// Width of the anti-aliasing fringe, 0 if not anti-aliased.
+	float strokeWidth;
+	int lineCap;
+	int lineJoin;
+	float miterLimit;
+	int segments;			// Stroke is drawn by NVGparams.renderStrokeSegments.
+	NVGshape shape;
+	float dashes[NVG_MAX_DASHES];	// Dash pattern scaled by the transform.
+	int ndashes;
+	float dashOffset;
+	int triangulate;
+	int firstCommand;
+	int ncommands;
+	int firstCommandPoint;
+	int ncommandPoints;
+	// Tessellated paths, valid until the batch has been submitted.
+	NVGpath* paths;
+	int npaths;
+	float bounds[4];
+};
+typedef struct NVGtessJob NVGtessJob;
+
+struct NVGtessWorker {
+	struct NVGtessPool* pool;
+	NVGcontext* tess;		// Only the path cache, arena, params and tolerances are used.
+#ifndef NVG_NO_THREADS
+	NVGthread thread;
+	int generation;			// Last batch started by the worker.
+#endif
+};
+typedef struct NVGtessWorker NVGtessWorker;
+
+struct NVGtessPool {
+	NVGallocator allocator;
+	NVGtessJob* jobs;
+	int cjobs;
+	int njobs;
+	unsigned char* commands;
+	int ccommands;
+	int ncommands;
+	float* commandPoints;
+	int ccommandPoints;
+	int ncommandPoints;
+	NVGtessWorker workers[NVG_MAX_TESS_THREADS];	// The first worker is the thread which flushes the jobs.
+	int nworkers;
+#ifndef NVG_NO_THREADS
+	NVGmutex mutex;
+	NVGcond start;
+	NVGcond done;
+	int nextJob;
+	int jobChunk;
+	int generation;
+	int nbusy;
+	int quit;
+#endif
+};
+typedef struct NVGtessPool NVGtessPool;
+
+static NVGcontext* nvg__createTessContext(NVGcontext* ctx)
+{
+	NVGcontext* tess = (NVGcontext*)nvg__alloc(ctx, sizeof(NVGcontext));
+	if (tess == NULL) return NULL;
+	memset(tess, 0, sizeof(NVGcontext));
+	tess->params = ctx->params;
+	tess->cache = nvg__allocPathCache(tess);
+	if (tess->cache == NULL) {
+		nvg__free(ctx, tess);
+		return NULL;
+	}
+	return tess;
+}
+
+static void nvg__deleteTessContext(NVGcontext* tess)
+{
+	if (tess == NULL) return;
+	nvg__deletePathCache(tess, tess->cache);
+	nvg__arenaDelete(tess);
+	nvg__free(tess, tess);
+}
+
+static void nvg__tessellateJob(NVGtessPool* pool, NVGcontext* tess, NVGtessJob* job)
+{
+	NVGpathCache* cache = tess->cache;
+	NVGvertex* verts;
+	int i, nverts, res;
+
+	job->paths = NULL;
+	job->npaths = 0;
+	if (job->type == NVG_TESS_SHAPE) return;
+
+	nvg__clearPathCache(tess);
+	tess->commands = &pool->commands[job->firstCommand];
+	tess->ncommands = job->ncommands;
+	tess->commandPoints = &pool->commandPoints[job->firstCommandPoint*2];
+	tess->ncommandPoints = job->ncommandPoints;
+	nvg__flattenPaths(tess);
+	if (job->ndashes > 0)
+		nvg__dashPaths(tess, job->dashes, job->ndashes, job->dashOffset);
+	if (job->type == NVG_TESS_FILL)
+		res = nvg__expandFill(tess, job->fringe, NVG_MITER, 2.4f, job->triangulate);
+	else if (job->segments && nvg__strokeSegmentsFit(tess, (job->strokeWidth + job->fringe)*0.5f))
+		res = nvg__expandStrokeSegments(tess);
+	else {
+		job->segments = 0;
+		res = nvg__expandStroke(tess, job->strokeWidth*0.5f, job->fringe, job->lineCap, job->lineJoin, job->miterLimit);
+	}
+	tess->commands = NULL;
+	tess->ncommands = 0;
+	tess->commandPoints = NULL;
+	tess->ncommandPoints = 0;
+	if (res == 0 || cache->npaths == 0) return;
+
+	// Copy the result out of the path cache, the cache is reused by the next job.
+	nverts = 0;
+	for (i = 0; i < cache->npaths; i++) {
+		NVGpath* path = &cache->paths[i];
+		if (path->fill != NULL) nverts = nvg__maxi(nverts, (int)(path->fill - cache->verts) + path->nfill);
+		if (path->stroke != NULL) nverts = nvg__maxi(nverts, (int)(path->stroke - cache->verts) + path->nstroke);
+	}
+	job->paths = (NVGpath*)nvg__arenaAlloc(tess, sizeof(NVGpath)*cache->npaths);
+	verts = (NVGvertex*)nvg__arenaAlloc(tess, sizeof(NVGvertex)*nvg__maxi(nverts, 1));
+	if (job->paths == NULL || verts == NULL) {
+		job->paths = NULL;
+		return;
+	}
+	memcpy(verts, cache->verts, sizeof(NVGvertex)*nverts);
+	for (i = 0; i < cache->npaths; i++) {
+		NVGpath* path = &job->paths[i];
+		*path = cache->paths[i];
+		if (path->fill != NULL) path->fill = verts + (path->fill - cache->verts);
+		if (path->stroke != NULL) path->stroke = verts + (path->stroke - cache->verts);
+	}
+	job->npaths = cache->npaths;
+	memcpy(job->bounds, cache->bounds, sizeof(job->bounds));
+}
+
+#ifndef NVG_NO_THREADS
+#ifdef _WIN32
+static void nvg__mutexInit(NVGmutex* m) { InitializeCriticalSection(m); }
+static void nvg__mutexDelete(NVGmutex* m) { DeleteCriticalSection(m); }
+static void nvg__mutexLock(NVGmutex* m) { EnterCriticalSection(m); }
+static void nvg__mutexUnlock(NVGmutex* m) { LeaveCriticalSection(m); }
+static void nvg__condInit(NVGcond* c) { InitializeConditionVariable(c); }
+static void nvg__condDelete(NVGcond* c) { NVG_NOTUSED(c); }
+static void nvg__condWait(NVGcond* c, NVGmutex* m) { SleepConditionVariableCS(c, m, INFINITE); }
+static void nvg__condBroadcast(NVGcond* c) { WakeAllConditionVariable(c); }
+#else
+static void nvg__mutexInit(NVGmutex* m) { pthread_mutex_init(m, NULL); }
+static void nvg__mutexDelete(NVGmutex* m) { pthread_mutex_destroy(m); }
+static void nvg__mutexLock(NVGmutex* m) { pthread_mutex_lock(m); }
+static void nvg__mutexUnlock(NVGmutex* m) { pthread_mutex_unlock(m); }
+static void nvg__condInit(NVGcond* c) { pthread_cond_init(c, NULL); }
+static void nvg__condDelete(NVGcond* c) { pthread_cond_destroy(c); }
+static void nvg__condWait(NVGcond* c, NVGmutex* m) { pthread_cond_wait(c, m); }
+static void nvg__condBroadcast(NVGcond* c) { pthread_cond_broadcast(c); }
+#endif
+
+// Tessellates jobs until all jobs of the batch have been taken.
+static void nvg__tessWorkerRun(NVGtessWorker* worker)
+{
+	NVGtessPool* pool = worker->pool;
+	int i, first, last;
+	for (;;) {
+		nvg__mutexLock(&pool->mutex);
+		first = pool->nextJob;
+		last = nvg__mini(first + pool->jobChunk, pool->njobs);
+		pool->nextJob = last;
+		nvg__mutexUnlock(&pool->mutex);
+		if (first >= last) break;
+		for (i = first; i < last; i++)
+			nvg__tessellateJob(pool, worker->tess, &pool->jobs[i]);
+	}
+}
+
+static void nvg__tessWorkerLoop(NVGtessWorker* worker)
+{
+	NVGtessPool* pool = worker->pool;
+
+	nvg__mutexLock(&pool->mutex);
+	for (;;) {
+		while (!pool->quit && pool->generation == worker->generation)
+			nvg__condWait(&pool->start, &pool->mutex);
+		if (pool->quit) break;
+		worker->generation = pool->generation;
+		nvg__mutexUnlock(&pool->mutex);
+
+		nvg__tessWorkerRun(worker);
+
+		nvg__mutexLock(&pool->mutex);
+		if (--pool->nbusy == 0)
+			nvg__condBroadcast(&pool->done);
+	}
+	nvg__mutexUnlock(&pool->mutex);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI nvg__tessThreadMain(LPVOID arg)
+{
+	nvg__tessWorkerLoop((NVGtessWorker*)arg);
+	return 0;
+}
+
+static int nvg__threadCreate(NVGthread* thread, NVGthreadMain fn, void* arg)
+{
+	*thread = CreateThread(NULL, 0, fn, arg, 0, NULL);
+	return *thread != NULL;
+}
+
+static void nvg__threadJoin(NVGthread thread)
+{
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+static int nvg__cpuCount(void)
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+}
+#else
+static void* nvg__tessThreadMain(void* arg)
+{
+	nvg__tessWorkerLoop((NVGtessWorker*)arg);
+	return NULL;
+}
+
+static int nvg__threadCreate(NVGthread* thread, NVGthreadMain fn, void* arg)
+{
+	return pthread_create(thread, NULL, fn, arg) == 0;
+}
+
+static void nvg__threadJoin(NVGthread thread)
+{
+	pthread_join(thread, NULL);
+}
+
+static int nvg__cpuCount(void)
+{
+	return (int)sysconf(_SC_NPROCESSORS_ONLN);
+}
+#endif
+#endif // NVG_NO_THREADS
+
+static NVGtessPool* nvg__createTessPool(NVGcontext* ctx)
+{
+	NVGtessPool* pool;
+	int i, nworkers = 1;
+
+#ifndef NVG_NO_THREADS
+	nworkers = nvg__clampi(nvg__cpuCount(), 1, NVG_MAX_TESS_THREADS);
+#endif
+
+	pool = (NVGtessPool*)nvg__alloc(ctx, sizeof(NVGtessPool));
+	if (pool == NULL) return NULL;
+	memset(pool, 0, sizeof(NVGtessPool));
+	pool->allocator = ctx->params.allocator;
+#ifndef NVG_NO_THREADS
+	nvg__mutexInit(&pool->mutex);
+	nvg__condInit(&pool->start);
+	nvg__condInit(&pool->done);
+#endif
+
+	for (i = 0; i < nworkers; i++) {
+		NVGtessWorker* worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->tess = nvg__createTessContext(ctx);
+		if (worker->tess == NULL) break;
+#ifndef NVG_NO_THREADS
+		if (i > 0 && !nvg__threadCreate(&worker->thread, nvg__tessThreadMain, worker)) {
+			nvg__deleteTessContext(worker->tess);
+			worker->tess = NULL;
+			break;
+		}
+#endif
+		pool->nworkers++;
+	}
+	// Run with fewer threads if some could not be created.
+	if (pool->nworkers == 0) {
+		nvg__deleteTessPool(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+static void nvg__deleteTessPool(NVGtessPool* pool)
+{
+	int i;
+	if (pool == NULL) return;
+
+#ifndef NVG_NO_THREADS
+	nvg__mutexLock(&pool->mutex);
+	pool->quit = 1;
+	nvg__condBroadcast(&pool->start);
+	nvg__mutexUnlock(&pool->mutex);
+	for (i = 1; i < pool->nworkers; i++)
+		nvg__threadJoin(pool->workers[i].thread);
+	nvg__condDelete(&pool->done);
+	nvg__condDelete(&pool->start);
+	nvg__mutexDelete(&pool->mutex);
+#endif
+
+	for (i = 0; i < pool->nworkers; i++)
+		nvg__deleteTessContext(pool->workers[i].tess);
+	nvgInternalFree(&pool->allocator, pool->jobs);
+	nvgInternalFree(&pool->allocator, pool->commands);
+	nvgInternalFree(&pool->allocator, pool->commandPoints);
+	nvgInternalFree(&pool->allocator, pool);
+}
+
+// Copies the current path and render state into a new job.
+static NVGtessJob* nvg__allocTessJob(NVGcontext* ctx, int type, NVGpaint* paint)
+{
+	NVGtessPool* pool = ctx->tessPool;
+	NVGstate* state = nvg__getState(ctx);
+	NVGtessJob* job;
+
+	if (pool->njobs+1 > pool->cjobs) {
+		NVGtessJob* jobs;
+		int cjobs = nvg__maxi(pool->njobs+1, 64) + pool->cjobs/2; // 1.5x Overallocate
+		jobs = (NVGtessJob*)nvg__realloc(ctx, pool->jobs, sizeof(NVGtessJob)*cjobs);
+		if (jobs == NULL) return NULL;
+		pool->jobs = jobs;
+		pool->cjobs = cjobs;
+	}
+	if (pool->ncommands+ctx->ncommands > pool->ccommands) {
+		unsigned char* commands;
+		int ccommands = nvg__maxi(pool->ncommands+ctx->ncommands, NVG_INIT_COMMANDS_SIZE) + pool->ccommands/2;
+		commands = (unsigned char*)nvg__realloc(ctx, pool->commands, ccommands);
+		if (commands == NULL) return NULL;
+		pool->commands = commands;
+		pool->ccommands = ccommands;
+	}
+	if (pool->ncommandPoints+ctx->ncommandPoints > pool->ccommandPoints) {
+		float* points;
+		int cpoints = nvg__maxi(pool->ncommandPoints+ctx->ncommandPoints, NVG_INIT_COMMAND_POINTS_SIZE) + pool->ccommandPoints/2;
+		points = (float*)nvg__realloc(ctx, pool->commandPoints, sizeof(float)*2*cpoints);
+		if (points == NULL) return NULL;
+		pool->commandPoints = points;
+		pool->ccommandPoints = cpoints;
+	}
+
+	job = &pool->jobs[pool->njobs++];
+	memset(job, 0, sizeof(*job));
+	job->type = type;
+	job->paint = *paint;
+	job->compositeOperation = state->compositeOperation;
+	job->scissor = state->scissor;
+	job->firstCommand = pool->ncommands;
+	job->ncommands = ctx->ncommands;
+	job->firstCommandPoint = pool->ncommandPoints;
+	job->ncommandPoints = ctx->ncommandPoints;
+	memcpy(&pool->commands[pool->ncommands], ctx->commands, ctx->ncommands);
+	memcpy(&pool->commandPoints[pool->ncommandPoints*2], ctx->commandPoints, sizeof(float)*2*ctx->ncommandPoints);
+	pool->ncommands += ctx->ncommands;
+	pool->ncommandPoints += ctx->ncommandPoints;
+
+	return job;
+}
+
+static void nvg__runTessJobs(NVGtessPool* pool)
+{
+	int i;
+#ifndef NVG_NO_THREADS
+	if (pool->nworkers > 1 && pool->njobs >= NVG_MIN_PARALLEL_JOBS) {
+		nvg__mutexLock(&pool->mutex);
+		pool->nextJob = 0;
+		pool->jobChunk = nvg__maxi(1, pool->njobs / (pool->nworkers*8));
+		pool->nbusy = pool->nworkers-1;
+		pool->generation++;
+		nvg__condBroadcast(&pool->start);
+		nvg__mutexUnlock(&pool->mutex);
+
+		nvg__tessWorkerRun(&pool->workers[0]);
+
+		nvg__mutexLock(&pool->mutex);
+		while (pool->nbusy > 0)
+			nvg__condWait(&pool->done, &pool->mutex);
+		nvg__mutexUnlock(&pool->mutex);
+		return;
+	}
+#endif
+	for (i = 0; i < pool->njobs; i++)
+		nvg__tessellateJob(pool, pool->workers[0].tess, &pool->jobs[i]);
+}
+
+static void nvg__clearTessJobs(NVGcontext* ctx)
+{
+	if (ctx->tessPool == NULL) return;
+	ctx->tessPool->njobs = 0;
+	ctx->tessPool->ncommands = 0;
+	ctx->tessPool->ncommandPoints = 0;
+}
+
+// Tessellates the pending jobs and submits them to the back-end in order.
+static void nvg__flushTessJobs(NVGcontext* ctx)
+{
+	NVGtessPool* pool = ctx->tessPool;
+	int i;
+
+	if (pool == NULL || pool->njobs == 0) return;
+
+	for (i = 0; i < pool->nworkers; i++) {
+		NVGcontext* tess = pool->workers[i].tess;
+		nvg__arenaReset(tess);
+		tess->tessTol = ctx->tessTol;
+		tess->distTol = ctx->distTol;
+		tess->fringeWidth = ctx->fringeWidth;
+	}
+
+	nvg__runTessJobs(pool);
+
+	for (i = 0; i < pool->njobs; i++) {
+		NVGtessJob* job = &pool->jobs[i];
+		if (job->type == NVG_TESS_SHAPE)
+			nvg__renderShape(ctx, &job->paint, job->compositeOperation, &job->scissor, &job->shape);
+		if (job->paths == NULL) continue;
+		if (job->type == NVG_TESS_FILL)
+			nvg__renderFillPaths(ctx, &job->paint, job->compositeOperation, &job->scissor, job->bounds, job->paths, job->npaths);
+		else if (job->segments)
+			nvg__renderStrokeSegments(ctx, &job->paint, job->compositeOperation, &job->scissor, job->strokeWidth,
+									  job->lineJoin, job->lineCap, job->miterLimit, job->paths, job->npaths);
+		else
+			nvg__renderStrokePaths(ctx, &job->paint, job->compositeOperation, &job->scissor, job->strokeWidth, job->paths, job->npaths);
+	}
+
+	nvg__clearTessJobs(ctx);
+}
+
+//
+// Asynchronous image loading
+//
+// nvgCreateImageAsync() creates a 1x1 transparent texture for the handle and queues the file to be
+// decoded on a loader thread. Decoded images are uploaded in nvgBeginFrame() in the order they were
+// queued, using NVGparams.renderResizeTexture, until the upload budget of the frame is used up.
+
+enum NVGimageLoadState {
+	NVG_LOAD_QUEUED,
+	NVG_LOAD_DECODING,
+	NVG_LOAD_DECODED,
+	NVG_LOAD_FAILED,
+};
+
+struct NVGimageLoad {
+	int image;
+	int state;
+	int cancelled;			// Image was deleted while decoding, the load is freed by nvgBeginFrame().
+	char* filename;
+	unsigned char* data;	// Copy of the encoded image if loaded from memory.
+	int ndata;
+	unsigned char* pixels;
+	int width, height;
+	struct NVGimageLoad* next;
+};
+typedef struct NVGimageLoad NVGimageLoad;
+
+struct NVGimageLoader {
+	NVGallocator allocator;
+	NVGimageLoad* loads;	// In the order they were queued.
+	NVGimageLoad* cancelled;	// Cancelled loads which finished decoding, freed on the render thread.
+#ifndef NVG_NO_THREADS
+	NVGthread threads[NVG_MAX_IMAGE_THREADS];
+	int nthreads;
+	NVGmutex mutex;
+	NVGcond wake;
+	int quit;
+#endif
+};
+typedef struct NVGimageLoader NVGimageLoader;
+
+static void nvg__freeImageLoad(NVGimageLoader* loader, NVGimageLoad* load)
+{
+#ifndef NVG_NO_STB
+	if (load->pixels != NULL) stbi_image_free(load->pixels);
+#endif
+	nvgInternalFree(&loader->allocator, load->filename);
+	nvgInternalFree(&loader->allocator, load->data);
+	nvgInternalFree(&loader->allocator, load);
+}
+
+static void nvg__decodeImage(NVGimageLoad* load)
+{
+#ifndef NVG_NO_STB
+	int n;
+	if (load->filename != NULL)
+		load->pixels = stbi_load(load->filename, &load->width, &load->height, &n, 4);
+	else
+		load->pixels = stbi_load_from_memory(load->data, load->ndata, &load->width, &load->height, &n, 4);
+#else
+	NVG_NOTUSED(load);
+#endif
+}
+
+#ifndef NVG_NO_THREADS
+static NVGimageLoad* nvg__nextImageLoad(NVGimageLoader* loader)
+{
+	NVGimageLoad* load;
+	for (load = loader->loads; load != NULL; load = load->next) {
+		if (load->state == NVG_LOAD_QUEUED)
+			return load;
+	}
+	return NULL;
+}
+
+static void nvg__imageLoaderLoop(NVGimageLoader* loader)
+{
+	NVGimageLoad* load;
+
+#if !defined(NVG_NO_STB) && defined(STBI_THREAD_LOCAL)
+	stbi_set_unpremultiply_on_load_thread(1);
+	stbi_convert_iphone_png_to_rgb_thread(1);
+#endif
+
+	nvg__mutexLock(&loader->mutex);
+	while (!loader->quit) {
+		load = nvg__nextImageLoad(loader);
+		if (load == NULL) {
+			nvg__condWait(&loader->wake, &loader->mutex);
+			continue;
+		}
+		load->state = NVG_LOAD_DECODING;
+		nvg__mutexUnlock(&loader->mutex);
+
+		nvg__decodeImage(load);
+
+		nvg__mutexLock(&loader->mutex);
+		if (load->cancelled) {
+			// The allocator is only called from the render thread.
+			load->next = loader->cancelled;
+			loader->cancelled = load;
+		} else
+			load->state = load->pixels != NULL ? NVG_LOAD_DECODED : NVG_LOAD_FAILED;
+	}
+	nvg__mutexUnlock(&loader->mutex);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI nvg__imageThreadMain(LPVOID arg)
+{
+	nvg__imageLoaderLoop((NVGimageLoader*)arg);
+	return 0;
+}
+#else
+static void* nvg__imageThreadMain(void* arg)
+{
+	nvg__imageLoaderLoop((NVGimageLoader*)arg);
+	return NULL;
+}
+#endif
+#endif // NVG_NO_THREADS
+
+static NVGimageLoader* nvg__createImageLoader(NVGcontext* ctx)
+{
+	NVGimageLoader* loader = (NVGimageLoader*)nvg__alloc(ctx, sizeof(NVGimageLoader));
+	if (loader == NULL) return NULL;
+	memset(loader, 0, sizeof(NVGimageLoader));
+	loader->allocator = ctx->params.allocator;
+
+#ifndef NVG_NO_STB
+	stbi_set_unpremultiply_on_load(1);
+	stbi_convert_iphone_png_to_rgb(1);
+#endif
+
+#ifndef NVG_NO_THREADS
+	{
+		// Leave one CPU for the render thread.
+		int i, nthreads = nvg__clampi(nvg__cpuCount()-1, 1, NVG_MAX_IMAGE_THREADS);
+		nvg__mutexInit(&loader->mutex);
+		nvg__condInit(&loader->wake);
+		for (i = 0; i < nthreads; i++) {
+			if (!nvg__threadCreate(&loader->threads[i], nvg__imageThreadMain, loader))
+				break;
+			loader->nthreads++;
+		}
+		// Decode on the render thread if no thread could be created.
+	}
+#endif
+
+	return loader;
+}
+
+static void nvg__deleteImageLoader(NVGimageLoader* loader)
+{
+	NVGimageLoad* load;
+	if (loader == NULL) return;
+
+#ifndef NVG_NO_THREADS
+	{
+		int i;
+		nvg__mutexLock(&loader->mutex);
+		loader->quit = 1;
+		nvg__condBroadcast(&loader->wake);
+		nvg__mutexUnlock(&loader->mutex);
+		for (i = 0; i < loader->nthreads; i++)
+			nvg__threadJoin(loader->threads[i]);
+		nvg__condDelete(&loader->wake);
+		nvg__mutexDelete(&loader->mutex);
+	}
+#endif
+
+	while (loader->loads != NULL) {
+		load = loader->loads;
+		loader->loads = load->next;
+		nvg__freeImageLoad(loader, load);
+	}
+	while (loader->cancelled != NULL) {
+		load = loader->cancelled;
+		loader->cancelled = load->next;
+		nvg__freeImageLoad(loader, load);
+	}
+	nvgInternalFree(&loader->allocator, loader);
+}
+
+static void nvg__lockImageLoader(NVGimageLoader* loader)
+{
+#ifndef NVG_NO_THREADS
+	nvg__mutexLock(&loader->mutex);
+#else
+	NVG_NOTUSED(loader);
+#endif
+}
+
+static void nvg__unlockImageLoader(NVGimageLoader* loader)
+{
+#ifndef NVG_NO_THREADS
+	nvg__mutexUnlock(&loader->mutex);
+#else
+	NVG_NOTUSED(loader);
+#endif
+}
+
+static int nvg__queueImageLoad(NVGcontext* ctx, int imageFlags, const char* filename, const unsigned char* data, int ndata)
+{
+	static const unsigned char transparent[4] = {0, 0, 0, 0};
+	NVGimageLoader* loader;
+	NVGimageLoad* load;
+	NVGimageLoad** tail;
+
+	if (ctx->imageLoader == NULL) {
+		ctx->imageLoader = nvg__createImageLoader(ctx);
+		if (ctx->imageLoader == NULL) return 0;
+	}
+	loader = ctx->imageLoader;
+
+	load = (NVGimageLoad*)nvg__alloc(ctx, sizeof(NVGimageLoad));
+	if (load == NULL) return 0;
+	memset(load, 0, sizeof(NVGimageLoad));
+	if (filename != NULL) {
+		size_t len = strlen(filename);
+		load->filename = (char*)nvg__alloc(ctx, len+1);
+		if (load->filename == NULL) goto error;
+		memcpy(load->filename, filename, len+1);
+	} else {
+		load->data = (unsigned char*)nvg__alloc(ctx, nvg__maxi(ndata, 1));
+		if (load->data == NULL) goto error;
+		memcpy(load->data, data, ndata);
+		load->ndata = ndata;
+	}
+
+	load->image = ctx->params.renderCreateTexture(ctx->params.userPtr, NVG_TEXTURE_RGBA, 1, 1, imageFlags, transparent);
+	if (load->image == 0) goto error;
+	load->state = NVG_LOAD_QUEUED;
+
+	nvg__lockImageLoader(loader);
+	for (tail = &loader->loads; *tail != NULL; tail = &(*tail)->next);
+	*tail = load;
+#ifndef NVG_NO_THREADS
+	nvg__condBroadcast(&loader->wake);
+#endif
+	nvg__unlockImageLoader(loader);
+
+	return load->image;
+
+error:
+	nvg__freeImageLoad(loader, load);
+	return 0;
+}
+
+// Uploads decoded images, at least one per frame, until the upload budget is used.
+static void nvg__uploadImages(NVGcontext* ctx)
+{
+	NVGimageLoader* loader = ctx->imageLoader;
+	NVGimageLoad* ready = NULL;
+	NVGimageLoad** tail = &ready;
+	NVGimageLoad** prev;
+	NVGimageLoad* load;
+	NVGimageLoad* cancelled;
+	int bytes = 0;
+
+	if (loader == NULL) return;
+
+	// Free the loads which were cancelled while decoding.
+	nvg__lockImageLoader(loader);
+	cancelled = loader->cancelled;
+	loader->cancelled = NULL;
+	nvg__unlockImageLoader(loader);
+	while (cancelled != NULL) {
+		load = cancelled;
+		cancelled = load->next;
+		nvg__freeImageLoad(loader, load);
+	}
+
+	if (loader->loads == NULL) return;
+
+#ifndef NVG_NO_THREADS
+	if (loader->nthreads == 0)
+#endif
+	{
+		// Without loader threads decode one image per frame.
+		for (load = loader->loads; load != NULL; load = load->next) {
+			if (load->state != NVG_LOAD_QUEUED) continue;
+			nvg__decodeImage(load);
+			load->state = load->pixels != NULL ? NVG_LOAD_DECODED : NVG_LOAD_FAILED;
+			break;
+		}
+	}
+
+	nvg__lockImageLoader(loader);
+	prev = &loader->loads;
+	while ((load = *prev) != NULL) {
+		if (load->state == NVG_LOAD_DECODED) {
+			int size = load->width * load->height * 4;
+			if (ready != NULL && ctx->imageUploadBudget > 0 && bytes + size > ctx->imageUploadBudget)
+				break;
+			bytes += size;
+			*prev = load->next;
+			load->next = NULL;
+			*tail = load;
+			tail = &load->next;
+		} else {
+			prev = &load->next;
+		}
+	}
+	nvg__unlockImageLoader(loader);
+
+	while (ready != NULL) {
+		load = ready;
+		ready = load->next;
+		ctx->params.renderResizeTexture(ctx->params.userPtr, load->image, load->width, load->height, load->pixels);
+		nvg__freeImageLoad(loader, load);
+	}
+}
+
+// Removes the pending load of a deleted image.
+static void nvg__cancelImageLoad(NVGcontext* ctx, int image)
+{
+	NVGimageLoader* loader = ctx->imageLoader;
+	NVGimageLoad** prev;
+	NVGimageLoad* load;
+
+	if (loader == NULL) return;
+
+	nvg__lockImageLoader(loader);
+	for (prev = &loader->loads; (load = *prev) != NULL; prev = &load->next) {
+		if (load->image != image) continue;
+		*prev = load->next;
+		if (load->state == NVG_LOAD_DECODING)
+			load->cancelled = 1;
+		else
+			nvg__freeImageLoad(loader, load);
+		break;
 	}
+	nvg__unlockImageLoader(loader);
 }
 
-void nvgEllipse(NVGcontext* ctx, float cx, float cy, float rx, float ry)
+#ifndef NVG_NO_STB
+int nvgCreateImageAsync(NVGcontext* ctx, const char* filename, int imageFlags)
 {
-	float vals[] = {
-		NVG_MOVETO, cx-rx, cy,
-		NVG_BEZIERTO, cx-rx, cy+ry*NVG_KAPPA90, cx-rx*NVG_KAPPA90, cy+ry, cx, cy+ry,
-		NVG_BEZIERTO, cx+rx*NVG_KAPPA90, cy+ry, cx+rx, cy+ry*NVG_KAPPA90, cx+rx, cy,
-		NVG_BEZIERTO, cx+rx, cy-ry*NVG_KAPPA90, cx+rx*NVG_KAPPA90, cy-ry, cx, cy-ry,
-		NVG_BEZIERTO, cx-rx*NVG_KAPPA90, cy-ry, cx-rx, cy-ry*NVG_KAPPA90, cx-rx, cy,
-		NVG_CLOSE
-	};
-	nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+	if (ctx->params.renderResizeTexture == NULL)
+		return nvgCreateImage(ctx, filename, imageFlags);
+	return nvg__queueImageLoad(ctx, imageFlags, filename, NULL, 0);
 }
 
-void nvgCircle(NVGcontext* ctx, float cx, float cy, float r)
+int nvgCreateImageMemAsync(NVGcontext* ctx, int imageFlags, const unsigned char* data, int ndata)
 {
-	nvgEllipse(ctx, cx,cy, r,r);
+	if (ctx->params.renderResizeTexture == NULL)
+		return nvgCreateImageMem(ctx, imageFlags, (unsigned char*)data, ndata);
+	return nvg__queueImageLoad(ctx, imageFlags, NULL, data, ndata);
 }
+#endif
 
-void nvgDebugDumpPathCache(NVGcontext* ctx)
+int nvgImageStatus(NVGcontext* ctx, int image)
 {
-	const NVGpath* path;
-	int i, j;
+	NVGimageLoader* loader = ctx->imageLoader;
+	NVGimageLoad* load;
+	int status = NVG_IMAGE_READY;
 
-	printf("Dumping %d cached paths\n", ctx->cache->npaths);
-	for (i = 0; i < ctx->cache->npaths; i++) {
-		path = &ctx->cache->paths[i];
-		printf(" - Path %d\n", i);
-		if (path->nfill) {
-			printf("   - fill: %d\n", path->nfill);
-			for (j = 0; j < path->nfill; j++)
-				printf("%f\t%f\n", path->fill[j].x, path->fill[j].y);
-		}
-		if (path->nstroke) {
-			printf("   - stroke: %d\n", path->nstroke);
-			for (j = 0; j < path->nstroke; j++)
-				printf("%f\t%f\n", path->stroke[j].x, path->stroke[j].y);
+	if (image == 0) return NVG_IMAGE_FAILED;
+	if (loader == NULL) return status;
+
+	nvg__lockImageLoader(loader);
+	for (load = loader->loads; load != NULL; load = load->next) {
+		if (load->image == image) {
+			status = load->state == NVG_LOAD_FAILED ? NVG_IMAGE_FAILED : NVG_IMAGE_LOADING;
+			break;
 		}
 	}
+	nvg__unlockImageLoader(loader);
+
+	return status;
+}
+
+void nvgImageUploadBudget(NVGcontext* ctx, int bytes)
+{
+	ctx->imageUploadBudget = bytes;
 }
 
 void nvgFill(NVGcontext* ctx)
 {
 	NVGstate* state = nvg__getState(ctx);
-	const NVGpath* path;
 	NVGpaint fillPaint = state->fill;
-	int i;
-
-	nvg__flattenPaths(ctx);
-	if (ctx->params.edgeAntiAlias && state->shapeAntiAlias)
-		nvg__expandFill(ctx, ctx->fringeWidth, NVG_MITER, 2.4f);
-	else
-		nvg__expandFill(ctx, 0.0f, NVG_MITER, 2.4f);
+	float fringe = ctx->params.edgeAntiAlias && state->shapeAntiAlias ? ctx->fringeWidth : 0.0f;
+	int triangulate = ctx->params.triangulateFills && state->scissor.stencilFlag == NVG_STENCIL_DEFAULT;
+	NVGshape* shape = nvg__pathShape(ctx, fringe, 0.0f);
 
 	// Apply global alpha
 	fillPaint.innerColor.a *= state->alpha;
 	fillPaint.outerColor.a *= state->alpha;
+	nvg__validateRamp(ctx, &fillPaint);
 
-	ctx->params.renderFill(ctx->params.userPtr, &fillPaint, state->compositeOperation, &state->scissor, ctx->fringeWidth,
-						   ctx->cache->bounds, ctx->cache->paths, ctx->cache->npaths);
+	if (shape != NULL) {
+		if (ctx->tessPool != NULL) {
+			NVGtessJob* job = nvg__allocTessJob(ctx, NVG_TESS_SHAPE, &fillPaint);
+			if (job != NULL) job->shape = *shape;
+			return;
+		}
+		nvg__renderShape(ctx, &fillPaint, state->compositeOperation, &state->scissor, shape);
+		return;
+	}
 
-	// Count triangles
-	for (i = 0; i < ctx->cache->npaths; i++) {
-		path = &ctx->cache->paths[i];
-		ctx->fillTriCount += path->nfill-2;
-		ctx->fillTriCount += path->nstroke-2;
-		ctx->drawCallCount += 2;
+	if (ctx->tessPool != NULL) {
+		NVGtessJob* job = nvg__allocTessJob(ctx, NVG_TESS_FILL, &fillPaint);
+		if (job == NULL) return;
+		job->fringe = fringe;
+		job->triangulate = triangulate;
+		return;
 	}
+
+	nvg__flattenPaths(ctx);
+	nvg__expandFill(ctx, fringe, NVG_MITER, 2.4f, triangulate);
+
+	nvg__renderFillPaths(ctx, &fillPaint, state->compositeOperation, &state->scissor,
+						 ctx->cache->bounds, ctx->cache->paths, ctx->cache->npaths);
 }
 
 void nvgStroke(NVGcontext* ctx)
@@ -2278,10 +4588,15 @@ void nvgStroke(NVGcontext* ctx)
 	NVGstate* state = nvg__getState(ctx);
 	float scale = nvg__getAverageScale(state->xform);
 	float strokeWidth = nvg__clampf(state->strokeWidth * scale, 0.0f, 200.0f);
+	float fringe = ctx->params.edgeAntiAlias && state->shapeAntiAlias ? ctx->fringeWidth : 0.0f;
+	int segments;
 	NVGpaint strokePaint = state->stroke;
-	const NVGpath* path;
+	float dashes[NVG_MAX_DASHES];
+	NVGshape* shape;
 	int i;
 
+	for (i = 0; i < state->ndashes; i++)
+		dashes[i] = state->dashes[i] * scale;
 
 	if (strokeWidth < ctx->fringeWidth) {
 		// If the stroke width is less than pixel size, use alpha to emulate coverage.
@@ -2292,25 +4607,443 @@ void nvgStroke(NVGcontext* ctx)
 		strokeWidth = ctx->fringeWidth;
 	}
 
+	// Aliased strokes, strokes about as thin as the fringe, and strokes with joins too wide for
+	// their segments are expanded on the CPU, where the fringes of the joins and caps match.
+	segments = fringe > 0.0f && strokeWidth >= fringe*2.0f && ctx->params.renderStrokeSegments != NULL;
+
 	// Apply global alpha
 	strokePaint.innerColor.a *= state->alpha;
 	strokePaint.outerColor.a *= state->alpha;
+	nvg__validateRamp(ctx, &strokePaint);
+
+	shape = nvg__pathShape(ctx, fringe, strokeWidth);
+	if (shape != NULL) {
+		if (ctx->tessPool != NULL) {
+			NVGtessJob* job = nvg__allocTessJob(ctx, NVG_TESS_SHAPE, &strokePaint);
+			if (job != NULL) job->shape = *shape;
+			return;
+		}
+		nvg__renderShape(ctx, &strokePaint, state->compositeOperation, &state->scissor, shape);
+		return;
+	}
+
+	if (ctx->tessPool != NULL) {
+		NVGtessJob* job = nvg__allocTessJob(ctx, NVG_TESS_STROKE, &strokePaint);
+		if (job == NULL) return;
+		job->fringe = fringe;
+		job->strokeWidth = strokeWidth;
+		job->lineCap = state->lineCap;
+		job->lineJoin = state->lineJoin;
+		job->miterLimit = state->miterLimit;
+		job->segments = segments;
+		memcpy(job->dashes, dashes, sizeof(float)*state->ndashes);
+		job->ndashes = state->ndashes;
+		job->dashOffset = state->dashOffset * scale;
+		return;
+	}
 
 	nvg__flattenPaths(ctx);
+	if (state->ndashes > 0)
+		nvg__dashPaths(ctx, dashes, state->ndashes, state->dashOffset * scale);
+	if (segments && nvg__strokeSegmentsFit(ctx, (strokeWidth + fringe)*0.5f)) {
+		if (nvg__expandStrokeSegments(ctx) == 0) return;
+		nvg__renderStrokeSegments(ctx, &strokePaint, state->compositeOperation, &state->scissor, strokeWidth,
+								  state->lineJoin, state->lineCap, state->miterLimit, ctx->cache->paths, ctx->cache->npaths);
+		return;
+	}
+	nvg__expandStroke(ctx, strokeWidth*0.5f, fringe, state->lineCap, state->lineJoin, state->miterLimit);
 
-	if (ctx->params.edgeAntiAlias && state->shapeAntiAlias)
-		nvg__expandStroke(ctx, strokeWidth*0.5f, ctx->fringeWidth, state->lineCap, state->lineJoin, state->miterLimit);
-	else
-		nvg__expandStroke(ctx, strokeWidth*0.5f, 0.0f, state->lineCap, state->lineJoin, state->miterLimit);
+	nvg__renderStrokePaths(ctx, &strokePaint, state->compositeOperation, &state->scissor,
+						   strokeWidth, ctx->cache->paths, ctx->cache->npaths);
+}
 
-	ctx->params.renderStroke(ctx->params.userPtr, &strokePaint, state->compositeOperation, &state->scissor, ctx->fringeWidth,
-							 strokeWidth, ctx->cache->paths, ctx->cache->npaths);
+// Command lists
 
-	// Count triangles
-	for (i = 0; i < ctx->cache->npaths; i++) {
-		path = &ctx->cache->paths[i];
-		ctx->strokeTriCount += path->nstroke-2;
-		ctx->drawCallCount++;
+enum NVGlistCallType {
+	NVG_LIST_FILL,
+	NVG_LIST_STROKE,
+	NVG_LIST_TRIANGLES,
+	NVG_LIST_TEXT,
+	NVG_LIST_TEXTBOX,
+};
+
+struct NVGlistPath {
+	NVGpath path;
+	int fillOffset;
+	int strokeOffset;
+};
+typedef struct NVGlistPath NVGlistPath;
+
+struct NVGlistCall {
+	int type;
+	NVGpaint paint;
+	NVGcompositeOperationState compositeOperation;
+	NVGscissor scissor;
+	float fringe;
+	float strokeWidth;
+	float bounds[4];
+	int pathOffset;
+	int pathCount;
+	int vertOffset;
+	int vertCount;
+	// Deferred text
+	int stateIndex;
+	int textOffset;
+	int textCount;
+	float x, y;
+	float breakRowWidth;
+};
+typedef struct NVGlistCall NVGlistCall;
+
+// Render back-end of a command list, stores the render calls so that they can be submitted to the parent context.
+struct NVGcommandList {
+	NVGallocator allocator;
+	NVGlistCall* calls;
+	int ccalls;
+	int ncalls;
+	NVGlistPath* paths;
+	int cpaths;
+	int npaths;
+	NVGvertex* verts;
+	int cverts;
+	int nverts;
+	NVGstate* states;
+	int cstates;
+	int nstates;
+	char* text;
+	int ctext;
+	int ntext;
+	NVGgradientStops* stops;	// Multi-stop gradients, referenced by paints as -(index+1).
+	int cstops;
+	int nstops;
+};
+typedef struct NVGcommandList NVGcommandList;
+
+// Makes room for n more items in an array, returns the array or NULL if out of memory.
+static void* nvg__listReserve(NVGcommandList* list, void* items, int* citems, int nitems, int n, int itemSize)
+{
+	if (nitems + n > *citems) {
+		int c = nvg__maxi(nitems + n, 64) + *citems/2; // 1.5x Overallocate
+		items = nvgInternalRealloc(&list->allocator, items, (size_t)itemSize * c);
+		if (items == NULL) return NULL;
+		*citems = c;
+	}
+	return items;
+}
+
+static NVGlistCall* nvg__listAllocCall(NVGcommandList* list, int type)
+{
+	NVGlistCall* calls = (NVGlistCall*)nvg__listReserve(list, list->calls, &list->ccalls, list->ncalls, 1, sizeof(NVGlistCall));
+	NVGlistCall* call;
+	if (calls == NULL) return NULL;
+	list->calls = calls;
+	call = &list->calls[list->ncalls++];
+	memset(call, 0, sizeof(*call));
+	call->type = type;
+	return call;
+}
+
+static int nvg__listAllocVerts(NVGcommandList* list, const NVGvertex* verts, int n)
+{
+	NVGvertex* dst = (NVGvertex*)nvg__listReserve(list, list->verts, &list->cverts, list->nverts, n, sizeof(NVGvertex));
+	int offset = list->nverts;
+	if (dst == NULL) return -1;
+	list->verts = dst;
+	memcpy(&list->verts[offset], verts, sizeof(NVGvertex) * n);
+	list->nverts += n;
+	return offset;
+}
+
+static int nvg__listAllocPaths(NVGcommandList* list, const NVGpath* paths, int npaths)
+{
+	NVGlistPath* dst = (NVGlistPath*)nvg__listReserve(list, list->paths, &list->cpaths, list->npaths, npaths, sizeof(NVGlistPath));
+	int i, offset = list->npaths;
+	if (dst == NULL) return -1;
+	list->paths = dst;
+	for (i = 0; i < npaths; i++) {
+		NVGlistPath* copy = &list->paths[offset + i];
+		copy->path = paths[i];
+		copy->path.fill = NULL;
+		copy->path.stroke = NULL;
+		copy->fillOffset = nvg__listAllocVerts(list, paths[i].fill, paths[i].nfill);
+		copy->strokeOffset = nvg__listAllocVerts(list, paths[i].stroke, paths[i].nstroke);
+		if (copy->fillOffset == -1 || copy->strokeOffset == -1) return -1;
+	}
+	list->npaths += npaths;
+	return offset;
+}
+
+static void nvg__listClear(NVGcommandList* list)
+{
+	list->ncalls = 0;
+	list->npaths = 0;
+	list->nverts = 0;
+	list->nstates = 0;
+	list->ntext = 0;
+	list->nstops = 0;
+}
+
+static int nvg__listRenderCreate(void* uptr)
+{
+	NVG_NOTUSED(uptr);
+	return 1;
+}
+
+static int nvg__listRenderCreateTexture(void* uptr, int type, int w, int h, int imageFlags, const unsigned char* data)
+{
+	// Images are created using the parent context.
+	NVG_NOTUSED(uptr); NVG_NOTUSED(type); NVG_NOTUSED(w); NVG_NOTUSED(h); NVG_NOTUSED(imageFlags); NVG_NOTUSED(data);
+	return 0;
+}
+
+static int nvg__listRenderDeleteTexture(void* uptr, int image)
+{
+	NVG_NOTUSED(uptr); NVG_NOTUSED(image);
+	return 0;
+}
+
+static int nvg__listRenderUpdateTexture(void* uptr, int image, int x, int y, int w, int h, const unsigned char* data)
+{
+	NVG_NOTUSED(uptr); NVG_NOTUSED(image); NVG_NOTUSED(x); NVG_NOTUSED(y); NVG_NOTUSED(w); NVG_NOTUSED(h); NVG_NOTUSED(data);
+	return 0;
+}
+
+static int nvg__listRenderGetTextureSize(void* uptr, int image, int* w, int* h)
+{
+	NVG_NOTUSED(uptr); NVG_NOTUSED(image); NVG_NOTUSED(w); NVG_NOTUSED(h);
+	return 0;
+}
+
+static void nvg__listRenderViewport(void* uptr, float width, float height, float devicePixelRatio)
+{
+	// Called from nvgBeginFrame(), starts a new recording.
+	NVG_NOTUSED(width); NVG_NOTUSED(height); NVG_NOTUSED(devicePixelRatio);
+	nvg__listClear((NVGcommandList*)uptr);
+}
+
+static void nvg__listRenderCancel(void* uptr)
+{
+	nvg__listClear((NVGcommandList*)uptr);
+}
+
+static void nvg__listRenderFlush(void* uptr)
+{
+	// The calls are kept until submitted.
+	NVG_NOTUSED(uptr);
+}
+
+static void nvg__listRenderFill(void* uptr, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor, float fringe,
+								const float* bounds, const NVGpath* paths, int npaths)
+{
+	NVGcommandList* list = (NVGcommandList*)uptr;
+	NVGlistCall* call = nvg__listAllocCall(list, NVG_LIST_FILL);
+	if (call == NULL) return;
+	call->paint = *paint;
+	call->compositeOperation = compositeOperation;
+	call->scissor = *scissor;
+	call->fringe = fringe;
+	memcpy(call->bounds, bounds, sizeof(call->bounds));
+	call->pathOffset = nvg__listAllocPaths(list, paths, npaths);
+	call->pathCount = npaths;
+	if (call->pathOffset == -1) list->ncalls--;
+}
+
+static void nvg__listRenderStroke(void* uptr, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor, float fringe,
+								  float strokeWidth, const NVGpath* paths, int npaths)
+{
+	NVGcommandList* list = (NVGcommandList*)uptr;
+	NVGlistCall* call = nvg__listAllocCall(list, NVG_LIST_STROKE);
+	if (call == NULL) return;
+	call->paint = *paint;
+	call->compositeOperation = compositeOperation;
+	call->scissor = *scissor;
+	call->fringe = fringe;
+	call->strokeWidth = strokeWidth;
+	call->pathOffset = nvg__listAllocPaths(list, paths, npaths);
+	call->pathCount = npaths;
+	if (call->pathOffset == -1) list->ncalls--;
+}
+
+static void nvg__listRenderTriangles(void* uptr, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor,
+									 const NVGvertex* verts, int nverts, float fringe)
+{
+	NVGcommandList* list = (NVGcommandList*)uptr;
+	NVGlistCall* call = nvg__listAllocCall(list, NVG_LIST_TRIANGLES);
+	if (call == NULL) return;
+	call->paint = *paint;
+	call->compositeOperation = compositeOperation;
+	call->scissor = *scissor;
+	call->fringe = fringe;
+	call->vertOffset = nvg__listAllocVerts(list, verts, nverts);
+	call->vertCount = nverts;
+	if (call->vertOffset == -1) list->ncalls--;
+}
+
+static void nvg__listRenderDelete(void* uptr)
+{
+	NVGcommandList* list = (NVGcommandList*)uptr;
+	NVGallocator allocator;
+	if (list == NULL) return;
+	allocator = list->allocator;
+	nvgInternalFree(&allocator, list->calls);
+	nvgInternalFree(&allocator, list->paths);
+	nvgInternalFree(&allocator, list->verts);
+	nvgInternalFree(&allocator, list->states);
+	nvgInternalFree(&allocator, list->text);
+	nvgInternalFree(&allocator, list->stops);
+	nvgInternalFree(&allocator, list);
+}
+
+// Text is laid out when the list is submitted, since the font atlas belongs to the parent context.
+static void nvg__listText(NVGcontext* ctx, int type, float x, float y, float breakRowWidth, const char* string, const char* end)
+{
+	NVGcommandList* list = (NVGcommandList*)ctx->params.userPtr;
+	NVGlistCall* call;
+	NVGstate* states;
+	char* text;
+	int len;
+
+	if (end == NULL)
+		end = string + strlen(string);
+	len = (int)(end - string);
+
+	states = (NVGstate*)nvg__listReserve(list, list->states, &list->cstates, list->nstates, 1, sizeof(NVGstate));
+	if (states == NULL) return;
+	list->states = states;
+	text = (char*)nvg__listReserve(list, list->text, &list->ctext, list->ntext, len, 1);
+	if (text == NULL) return;
+	list->text = text;
+	call = nvg__listAllocCall(list, type);
+	if (call == NULL) return;
+
+	call->stateIndex = list->nstates;
+	list->states[list->nstates++] = *nvg__getState(ctx);
+	call->textOffset = list->ntext;
+	call->textCount = len;
+	memcpy(&list->text[list->ntext], string, len);
+	list->ntext += len;
+	call->x = x;
+	call->y = y;
+	call->breakRowWidth = breakRowWidth;
+}
+
+// Returns the index of the stops in the list, or -1 if out of memory.
+static int nvg__listAddStops(NVGcontext* ctx, const NVGgradientStops* stops)
+{
+	NVGcommandList* list = (NVGcommandList*)ctx->params.userPtr;
+	NVGgradientStops* dst = (NVGgradientStops*)nvg__listReserve(list, list->stops, &list->cstops, list->nstops, 1, sizeof(NVGgradientStops));
+	if (dst == NULL) return -1;
+	list->stops = dst;
+	list->stops[list->nstops] = *stops;
+	return list->nstops++;
+}
+
+// Allocates the ramp of a multi-stop gradient recorded in the list, or falls back to a two color gradient.
+static void nvg__listResolvePaint(NVGcontext* ctx, NVGcommandList* list, NVGpaint* paint)
+{
+	const NVGgradientStops* stops;
+	float alpha;
+
+	if (paint->ramp >= 0) {
+		nvg__validateRamp(ctx, paint);
+		return;
+	}
+	stops = &list->stops[-paint->ramp - 1];
+	paint->ramp = nvg__gradientRamp(ctx, stops);
+	if (paint->ramp != 0) {
+		paint->image = ctx->ramps->image;
+		paint->rampHash = ctx->ramps->rows[paint->ramp-1].hash;
+		return;
+	}
+	// The alpha of the white tint is the global alpha.
+	alpha = paint->innerColor.a;
+	paint->innerColor = stops->colors[0];
+	paint->outerColor = stops->colors[stops->nstops-1];
+	paint->innerColor.a *= alpha;
+	paint->outerColor.a *= alpha;
+}
+
+NVGcontext* nvgCreateCommandList(NVGcontext* ctx)
+{
+	NVGparams params;
+	NVGcommandList* list = (NVGcommandList*)nvg__alloc(ctx, sizeof(NVGcommandList));
+	if (list == NULL) return NULL;
+	memset(list, 0, sizeof(NVGcommandList));
+	list->allocator = ctx->params.allocator;
+
+	memset(&params, 0, sizeof(params));
+	params.renderCreate = nvg__listRenderCreate;
+	params.renderCreateTexture = nvg__listRenderCreateTexture;
+	params.renderDeleteTexture = nvg__listRenderDeleteTexture;
+	params.renderUpdateTexture = nvg__listRenderUpdateTexture;
+	params.renderGetTextureSize = nvg__listRenderGetTextureSize;
+	params.renderViewport = nvg__listRenderViewport;
+	params.renderCancel = nvg__listRenderCancel;
+	params.renderFlush = nvg__listRenderFlush;
+	params.renderFill = nvg__listRenderFill;
+	params.renderStroke = nvg__listRenderStroke;
+	params.renderTriangles = nvg__listRenderTriangles;
+	params.renderDelete = nvg__listRenderDelete;
+	params.userPtr = list;
+	params.edgeAntiAlias = ctx->params.edgeAntiAlias;
+	params.triangulateFills = ctx->params.triangulateFills;
+	params.allocator = ctx->params.allocator;
+
+	// 'list' is freed by nvgDeleteInternal.
+	return nvg__createContext(&params, ctx);
+}
+
+void nvgDeleteCommandList(NVGcontext* list)
+{
+	if (list == NULL || list->parent == NULL) return;
+	nvgDeleteInternal(list);
+}
+
+void nvgSubmitCommandList(NVGcontext* ctx, NVGcontext* list)
+{
+	NVGcommandList* cl;
+	int i, j;
+
+	if (list == NULL || list->parent != ctx) return;
+	cl = (NVGcommandList*)list->params.userPtr;
+	nvg__flushTessJobs(ctx);
+
+	for (i = 0; i < cl->ncalls; i++) {
+		NVGlistCall* call = &cl->calls[i];
+		NVGpaint paint = call->paint;
+		nvg__listResolvePaint(ctx, cl, &paint);
+		if (call->type == NVG_LIST_FILL || call->type == NVG_LIST_STROKE) {
+			NVGarenaMark mark = nvg__arenaMark(ctx);
+			NVGpath* paths = (NVGpath*)nvg__arenaAlloc(ctx, sizeof(NVGpath) * nvg__maxi(call->pathCount, 1));
+			if (paths == NULL) continue;
+			for (j = 0; j < call->pathCount; j++) {
+				NVGlistPath* src = &cl->paths[call->pathOffset + j];
+				paths[j] = src->path;
+				paths[j].fill = &cl->verts[src->fillOffset];
+				paths[j].stroke = &cl->verts[src->strokeOffset];
+			}
+			if (call->type == NVG_LIST_FILL)
+				ctx->params.renderFill(ctx->params.userPtr, &paint, call->compositeOperation, &call->scissor, call->fringe,
+									   call->bounds, paths, call->pathCount);
+			else
+				ctx->params.renderStroke(ctx->params.userPtr, &paint, call->compositeOperation, &call->scissor, call->fringe,
+										 call->strokeWidth, paths, call->pathCount);
+			nvg__arenaRewind(ctx, mark);
+			ctx->drawCallCount += call->pathCount;
+		} else if (call->type == NVG_LIST_TRIANGLES) {
+			ctx->params.renderTriangles(ctx->params.userPtr, &paint, call->compositeOperation, &call->scissor,
+										&cl->verts[call->vertOffset], call->vertCount, call->fringe);
+			ctx->drawCallCount++;
+		} else {
+			const char* text = &cl->text[call->textOffset];
+			nvgSave(ctx);
+			*nvg__getState(ctx) = cl->states[call->stateIndex];
+			if (call->type == NVG_LIST_TEXT)
+				nvgText(ctx, call->x, call->y, text, text + call->textCount);
+			else
+				nvgTextBox(ctx, call->x, call->y, call->breakRowWidth, text, text + call->textCount);
+			nvgRestore(ctx);
+		}
 	}
 }
 
@@ -2363,6 +5096,32 @@ void nvgResetFallbackFonts(NVGcontext* ctx, const char* baseFont)
 	nvgResetFallbackFontsId(ctx, nvgFindFont(ctx, baseFont));
 }
 
+int nvgShareFonts(NVGcontext* ctx, NVGcontext* other)
+{
+	int i, iw = 0, ih = 0;
+	FONScontext* fs;
+
+	if (ctx->parent != NULL || other == NULL || other == ctx) return 0;
+
+	fs = nvg__createFontStash(other->fs);
+	if (fs == NULL) return 0;
+	fonsDeleteInternal(ctx->fs);
+	ctx->fs = fs;
+
+	// Font images are created per context and sized after the shared atlas.
+	for (i = 0; i < NVG_MAX_FONTIMAGES; i++) {
+		if (ctx->fontImages[i] != 0) {
+			nvgDeleteImage(ctx, ctx->fontImages[i]);
+			ctx->fontImages[i] = 0;
+		}
+	}
+	fonsGetAtlasSize(ctx->fs, &iw, &ih);
+	ctx->fontImages[0] = ctx->params.renderCreateTexture(ctx->params.userPtr, NVG_TEXTURE_ALPHA, iw, ih, 0, NULL);
+	ctx->fontImageIdx = 0;
+
+	return ctx->fontImages[0] != 0;
+}
+
 // State setting
 void nvgFontSize(NVGcontext* ctx, float size)
 {
@@ -2426,6 +5185,8 @@ static void nvg__flushTextTexture(NVGcontext* ctx)
 {
 	int dirty[4];
 
+	// Other contexts sharing the fonts may be adding glyphs while the texture is uploaded.
+	fonsLockTexture(ctx->fs);
 	if (fonsValidateTexture(ctx->fs, dirty)) {
 		int fontImage = ctx->fontImages[ctx->fontImageIdx];
 		// Update texture
@@ -2439,6 +5200,7 @@ static void nvg__flushTextTexture(NVGcontext* ctx)
 			ctx->params.renderUpdateTexture(ctx->params.userPtr, fontImage, x,y, w,h, data);
 		}
 	}
+	fonsUnlockTexture(ctx->fs);
 }
 
 static int nvg__allocTextAtlas(NVGcontext* ctx)
@@ -2447,6 +5209,22 @@ static int nvg__allocTextAtlas(NVGcontext* ctx)
 	nvg__flushTextTexture(ctx);
 	if (ctx->fontImageIdx >= NVG_MAX_FONTIMAGES-1)
 		return 0;
+	// Another context sharing the fonts has reset the atlas, switch to an image of its size.
+	if (fonsSyncAtlas(ctx->fs)) {
+		fonsGetAtlasSize(ctx->fs, &iw, &ih);
+		if (ctx->fontImages[ctx->fontImageIdx+1] != 0) {
+			int w, h;
+			nvgImageSize(ctx, ctx->fontImages[ctx->fontImageIdx+1], &w, &h);
+			if (w != iw || h != ih) {
+				nvgDeleteImage(ctx, ctx->fontImages[ctx->fontImageIdx+1]);
+				ctx->fontImages[ctx->fontImageIdx+1] = 0;
+			}
+		}
+		if (ctx->fontImages[ctx->fontImageIdx+1] == 0)
+			ctx->fontImages[ctx->fontImageIdx+1] = ctx->params.renderCreateTexture(ctx->params.userPtr, NVG_TEXTURE_ALPHA, iw, ih, 0, NULL);
+		++ctx->fontImageIdx;
+		return 1;
+	}
 	// if next fontImage already have a texture
 	if (ctx->fontImages[ctx->fontImageIdx+1] != 0)
 		nvgImageSize(ctx, ctx->fontImages[ctx->fontImageIdx+1], &iw, &ih);
@@ -2470,8 +5248,12 @@ static void nvg__renderText(NVGcontext* ctx, NVGvertex* verts, int nverts)
 	NVGstate* state = nvg__getState(ctx);
 	NVGpaint paint = state->fill;
 
+	// Keep the draw order of deferred paths.
+	nvg__flushTessJobs(ctx);
+
 	// Render triangles.
 	paint.image = ctx->fontImages[ctx->fontImageIdx];
+	paint.ramp = 0;
 
 	// Apply global alpha
 	paint.innerColor.a *= state->alpha;
@@ -2501,6 +5283,20 @@ float nvgText(NVGcontext* ctx, float x, float y, const char* string, const char*
 	int nverts = 0;
 	int isFlipped = nvg__isTransformFlipped(state->xform);
 
+	if (ctx->parent != NULL) {
+		float width;
+		nvg__listText(ctx, NVG_LIST_TEXT, x, y, 0.0f, string, end);
+		// The text is drawn when the list is submitted, measure it to return where it ends.
+		width = nvgTextBounds(ctx, x, y, string, end, NULL);
+		if (state->textAlign & NVG_ALIGN_LEFT)
+			return x + width;
+		else if (state->textAlign & NVG_ALIGN_RIGHT)
+			return x;
+		else if (state->textAlign & NVG_ALIGN_CENTER)
+			return x + width*0.5f;
+		return x + width;
+	}
+
 	if (end == NULL)
 		end = string + strlen(string);
 
@@ -2591,6 +5387,11 @@ void nvgTextBox(NVGcontext* ctx, float x, float y, float breakRowWidth, const ch
 	int valign = state->textAlign & (NVG_ALIGN_TOP | NVG_ALIGN_MIDDLE | NVG_ALIGN_BOTTOM | NVG_ALIGN_BASELINE);
 	float lineh = 0;
 
+	if (ctx->parent != NULL) {
+		nvg__listText(ctx, NVG_LIST_TEXTBOX, x, y, breakRowWidth, string, end);
+		return;
+	}
+
 	if (state->fontId == FONS_INVALID) return;
 
 	nvgTextMetrics(ctx, NULL, NULL, &lineh);
@@ -2640,10 +5441,10 @@ int nvgTextGlyphPositions(NVGcontext* ctx, float x, float y, const char* string,
 
 	fonsTextIterInit(ctx->fs, &iter, x*scale, y*scale, string, end, FONS_GLYPH_BITMAP_OPTIONAL);
 	prevIter = iter;
-	while (fonsTextIterNext(ctx->fs, &iter, &q)) {
+	while (fonsTextIterMeasure(ctx->fs, &iter, &q)) {
 		if (iter.prevGlyphIndex < 0 && nvg__allocTextAtlas(ctx)) { // can not retrieve glyph?
 			iter = prevIter;
-			fonsTextIterNext(ctx->fs, &iter, &q); // try again
+			fonsTextIterMeasure(ctx->fs, &iter, &q); // try again
 		}
 		prevIter = iter;
 		positions[npos].str = iter.str;
@@ -2665,12 +5466,12 @@ enum NVGcodepointType {
 	NVG_CJK_CHAR,
 };
 
-int nvgTextBreakLines(NVGcontext* ctx, const char* string, const char* end, float breakRowWidth, NVGtextRow* rows, int maxRows)
+// Breaks the text of the iterator into rows. Stateless iterators are measured from the font data,
+// without touching the text atlas of ctx.
+static int nvg__breakLines(NVGcontext* ctx, FONStextIter* start, int stateless, const char* end,
+						   float breakRowWidth, float invscale, NVGtextRow* rows, int maxRows)
 {
-	NVGstate* state = nvg__getState(ctx);
-	float scale = nvg__getFontScale(state) * ctx->devicePxRatio;
-	float invscale = 1.0f / scale;
-	FONStextIter iter, prevIter;
+	FONStextIter iter = *start, prevIter = *start;
 	FONSquad q;
 	int nrows = 0;
 	float rowStartX = 0;
@@ -2688,29 +5489,10 @@ int nvgTextBreakLines(NVGcontext* ctx, const char* string, const char* end, floa
 	int type = NVG_SPACE, ptype = NVG_NEWLINE;
 	unsigned int pcodepoint = 0;
 
-	if (maxRows == 0) return 0;
-	if (state->fontId == FONS_INVALID) return 0;
-
-	if (end == NULL)
-		end = string + strlen(string);
-
-	if (string == end) return 0;
-
-	fonsSetSize(ctx->fs, state->fontSize*scale);
-	fonsSetSpacing(ctx->fs, state->letterSpacing*scale);
-	fonsSetBlur(ctx->fs, state->fontBlur*scale);
-	fonsSetDilate(ctx->fs, state->fontDilate);
-	fonsSetAlign(ctx->fs, state->textAlign);
-	fonsSetFont(ctx->fs, state->fontId);
-
-	breakRowWidth *= scale;
-
-	fonsTextIterInit(ctx->fs, &iter, 0, 0, string, end, FONS_GLYPH_BITMAP_OPTIONAL);
-	prevIter = iter;
-	while (fonsTextIterNext(ctx->fs, &iter, &q)) {
-		if (iter.prevGlyphIndex < 0 && nvg__allocTextAtlas(ctx)) { // can not retrieve glyph?
+	while (stateless ? fonsMeasureIterNext(ctx->fs, &iter, &q) : fonsTextIterMeasure(ctx->fs, &iter, &q)) {
+		if (!stateless && iter.prevGlyphIndex < 0 && nvg__allocTextAtlas(ctx)) { // can not retrieve glyph?
 			iter = prevIter;
-			fonsTextIterNext(ctx->fs, &iter, &q); // try again
+			fonsTextIterMeasure(ctx->fs, &iter, &q); // try again
 		}
 		prevIter = iter;
 		switch (iter.codepoint) {
@@ -2878,6 +5660,51 @@ int nvgTextBreakLines(NVGcontext* ctx, const char* string, const char* end, floa
 	return nrows;
 }
 
+int nvgTextBreakLines(NVGcontext* ctx, const char* string, const char* end, float breakRowWidth, NVGtextRow* rows, int maxRows)
+{
+	NVGstate* state = nvg__getState(ctx);
+	float scale = nvg__getFontScale(state) * ctx->devicePxRatio;
+	float invscale = 1.0f / scale;
+	FONStextIter iter;
+
+	if (maxRows == 0) return 0;
+	if (state->fontId == FONS_INVALID) return 0;
+
+	if (end == NULL)
+		end = string + strlen(string);
+
+	if (string == end) return 0;
+
+	fonsSetSize(ctx->fs, state->fontSize*scale);
+	fonsSetSpacing(ctx->fs, state->letterSpacing*scale);
+	fonsSetBlur(ctx->fs, state->fontBlur*scale);
+	fonsSetDilate(ctx->fs, state->fontDilate);
+	fonsSetAlign(ctx->fs, state->textAlign);
+	fonsSetFont(ctx->fs, state->fontId);
+
+	breakRowWidth *= scale;
+
+	fonsTextIterInit(ctx->fs, &iter, 0, 0, string, end, FONS_GLYPH_BITMAP_OPTIONAL);
+	return nvg__breakLines(ctx, &iter, 0, end, breakRowWidth, invscale, rows, maxRows);
+}
+
+int nvgMeasureBreakLines(NVGcontext* ctx, int font, float size, float spacing, const char* string, const char* end,
+						 float breakRowWidth, NVGtextRow* rows, int maxRows)
+{
+	FONStextIter iter;
+
+	if (maxRows == 0) return 0;
+
+	if (end == NULL)
+		end = string + strlen(string);
+
+	if (string == end) return 0;
+
+	if (!fonsMeasureIterInit(ctx->fs, &iter, font, size, spacing, 0, 0, string, end))
+		return 0;
+	return nvg__breakLines(ctx, &iter, 1, end, breakRowWidth, 1.0f, rows, maxRows);
+}
+
 float nvgTextBounds(NVGcontext* ctx, float x, float y, const char* string, const char* end, float* bounds)
 {
 	NVGstate* state = nvg__getState(ctx);
@@ -2906,6 +5733,11 @@ float nvgTextBounds(NVGcontext* ctx, float x, float y, const char* string, const
 	return width * invscale;
 }
 
+float nvgMeasureText(NVGcontext* ctx, int font, float size, float spacing, float x, float y, const char* string, const char* end, float* bounds)
+{
+	return fonsMeasureText(ctx->fs, font, size, spacing, x, y, string, end, bounds);
+}
+
 void nvgTextBoxBounds(NVGcontext* ctx, float x, float y, float breakRowWidth, const char* string, const char* end, float* bounds)
 {
 	NVGstate* state = nvg__getState(ctx);
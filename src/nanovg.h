@@ -19,6 +19,8 @@
 #ifndef NANOVG_H
 #define NANOVG_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -50,6 +52,8 @@ struct NVGpaint {
 	NVGcolor innerColor;
 	NVGcolor outerColor;
 	int image;
+	int ramp;				// Row of the gradient ramp texture plus one, 0 for two color gradients.
+	unsigned int rampHash;	// Hash of the gradient stops, to find them again if the row was reused.
 };
 typedef struct NVGpaint NVGpaint;
 
@@ -142,6 +146,8 @@ enum NVGimageFlags {
 	NVG_IMAGE_FLIPY				= 1<<3,		// Flips (inverses) image in Y direction when rendered.
 	NVG_IMAGE_PREMULTIPLIED		= 1<<4,		// Image data has premultiplied alpha.
 	NVG_IMAGE_NEAREST			= 1<<5,		// Image interpolation is Nearest instead Linear
+	NVG_IMAGE_ATLAS				= 1<<6,		// Small image may share a texture with other images, so that they can be drawn without texture switches.
+};
 
 enum NVGstencilFlags {
 	NVG_STENCIL_DEFAULT	= 0,
@@ -273,6 +279,11 @@ void nvgLineCap(NVGcontext* ctx, int cap);
 // Can be one of NVG_MITER (default), NVG_ROUND, NVG_BEVEL.
 void nvgLineJoin(NVGcontext* ctx, int join);
 
+// Sets the dash pattern of the stroke style, alternating lengths of dashes and gaps starting with a dash.
+// Patterns with an odd number of lengths are repeated twice. Offset is the distance into the pattern at
+// the start of each path. Pass count 0 to draw solid strokes (default).
+void nvgLineDash(NVGcontext* ctx, const float* pattern, int count, float offset);
+
 // Sets the transparency applied to all rendered shapes.
 // Already transparent paths will get proportionally more transparent as well.
 void nvgGlobalAlpha(NVGcontext* ctx, float alpha);
@@ -393,6 +404,31 @@ void nvgImageSize(NVGcontext* ctx, int image, int* w, int* h);
 // Deletes created image.
 void nvgDeleteImage(NVGcontext* ctx, int image);
 
+// Images created with the asynchronous variants are decoded on loader threads and uploaded
+// in nvgBeginFrame(). Until then the image is a 1x1 transparent image. The loader threads do
+// not call the custom allocator, it is only used from the thread which renders the context.
+enum NVGimageStatus {
+	NVG_IMAGE_LOADING,		// Image is being decoded or waits for upload.
+	NVG_IMAGE_READY,		// Image can be used.
+	NVG_IMAGE_FAILED,		// Image could not be decoded, it stays transparent.
+};
+
+// Creates image which is loaded asynchronously from the disk from specified file name.
+// Returns handle to the image.
+int nvgCreateImageAsync(NVGcontext* ctx, const char* filename, int imageFlags);
+
+// Creates image which is loaded asynchronously from the specified chunk of memory.
+// The data is copied, it can be freed after the call.
+// Returns handle to the image.
+int nvgCreateImageMemAsync(NVGcontext* ctx, int imageFlags, const unsigned char* data, int ndata);
+
+// Returns the loading status of an image, see NVGimageStatus.
+int nvgImageStatus(NVGcontext* ctx, int image);
+
+// Sets how many bytes of decoded images are uploaded per frame, at least one image is uploaded
+// per frame. Zero or less uploads all decoded images. Default is NVG_IMAGE_UPLOAD_BUDGET (4MB).
+void nvgImageUploadBudget(NVGcontext* ctx, int bytes);
+
 //
 // Paints
 //
@@ -419,6 +455,21 @@ NVGpaint nvgBoxGradient(NVGcontext* ctx, float x, float y, float w, float h,
 NVGpaint nvgRadialGradient(NVGcontext* ctx, float cx, float cy, float inr, float outr,
 						   NVGcolor icol, NVGcolor ocol);
 
+// Creates and returns a linear gradient with several color stops. Parameter offsets specifies the position
+// of each stop along the gradient in range [0..1] in increasing order, and colors its color. Up to 16 stops
+// are used. The stops are baked into a ramp texture shared by the context, so the gradient is drawn with
+// a single draw call. A paint kept over frames has its stops baked again if its row was given to other gradients.
+NVGpaint nvgLinearGradientStops(NVGcontext* ctx, float sx, float sy, float ex, float ey,
+								const float* offsets, const NVGcolor* colors, int nstops);
+
+// Creates and returns a box gradient with several color stops, see nvgBoxGradient() and nvgLinearGradientStops().
+NVGpaint nvgBoxGradientStops(NVGcontext* ctx, float x, float y, float w, float h, float r, float f,
+							 const float* offsets, const NVGcolor* colors, int nstops);
+
+// Creates and returns a radial gradient with several color stops, see nvgRadialGradient() and nvgLinearGradientStops().
+NVGpaint nvgRadialGradientStops(NVGcontext* ctx, float cx, float cy, float inr, float outr,
+								const float* offsets, const NVGcolor* colors, int nstops);
+
 // Creates and returns an image pattern. Parameters (ox,oy) specify the left-top location of the image pattern,
 // (ex,ey) the size of one image, angle rotation around the top-left corner, image is handle to the image to render.
 // The gradient is transformed by the current transform when it is passed to nvgFillPaint() or nvgStrokePaint().
@@ -466,6 +517,10 @@ void nvgResetScissor(NVGcontext* ctx);
 // Clears the current path and sub-paths.
 void nvgBeginPath(NVGcontext* ctx);
 
+// Reserves room for ncommands more path commands with npoints points in total, so that a path of
+// known size is built without reallocating. Moves and lines have one point, beziers have three.
+void nvgReservePath(NVGcontext* ctx, int ncommands, int npoints);
+
 // Starts new sub-path with specified point as first point.
 void nvgMoveTo(NVGcontext* ctx, float x, float y);
 
@@ -576,6 +631,12 @@ void nvgResetFallbackFontsId(NVGcontext* ctx, int baseFont);
 // Resets fallback fonts by name.
 void nvgResetFallbackFonts(NVGcontext* ctx, const char* baseFont);
 
+// Makes ctx use the fonts, glyphs and font atlas of other, so that glyphs are rasterized only once.
+// The contexts can be used on different threads, but must share GL objects. Fonts previously
+// created in ctx are released. Call it outside of nvgBeginFrame/nvgEndFrame.
+// Returns 1 on success.
+int nvgShareFonts(NVGcontext* ctx, NVGcontext* other);
+
 // Sets the font size of current text style.
 void nvgFontSize(NVGcontext* ctx, float size);
 
@@ -632,6 +693,18 @@ void nvgTextMetrics(NVGcontext* ctx, float* ascender, float* descender, float* l
 // Words longer than the max width are slit at nearest character (i.e. no hyphenation).
 int nvgTextBreakLines(NVGcontext* ctx, const char* string, const char* end, float breakRowWidth, NVGtextRow* rows, int maxRows);
 
+// Thread-safe text measurement. These take the font, size and letter spacing instead of the text style,
+// and measure in local units as if drawn with an identity transform; blur, dilation and alignment are not applied.
+// They read the glyph metrics from the font data without changing ctx or the glyph cache, so layout can run
+// on worker threads while ctx is used for rendering, as long as no fonts or fallback fonts are added at the same time.
+
+// Measures the text like nvgTextBounds(), the bounds are the bounding box of the glyphs [xmin,ymin, xmax,ymax]
+// with x,y on the baseline. Returns the horizontal advance of the measured text.
+float nvgMeasureText(NVGcontext* ctx, int font, float size, float spacing, float x, float y, const char* string, const char* end, float* bounds);
+
+// Breaks the text into lines like nvgTextBreakLines().
+int nvgMeasureBreakLines(NVGcontext* ctx, int font, float size, float spacing, const char* string, const char* end, float breakRowWidth, NVGtextRow* rows, int maxRows);
+
 // The resolution of text rendering
 void nvgFontQuality(NVGcontext* ctx, float quality);
 
@@ -643,6 +716,47 @@ void nvgStencil(NVGcontext* ctx);
 // Clear stencil buffer and disable stencil test.
 void nvgStencilClear(NVGcontext* ctx);
 
+//
+// Command lists
+//
+// A command list is a context which records drawing commands instead of rendering them, so that
+// drawing can be prepared on other threads. Each thread records into its own list and the owning
+// thread submits the lists into the frame of the parent context in the order it wants them drawn.
+// Fonts and images are shared with the parent and must be created using the parent context.
+// Text is laid out when submitted; text measurement functions on a list use the glyph cache of the
+// parent and are safe to call while the parent is used on another thread.
+// If a custom allocator is used, it must be thread-safe.
+
+// Creates a command list which is submitted to ctx.
+NVGcontext* nvgCreateCommandList(NVGcontext* ctx);
+
+// Deletes a command list.
+void nvgDeleteCommandList(NVGcontext* list);
+
+// Draws the commands recorded in the list between nvgBeginFrame() and nvgEndFrame() of the list.
+// Must be called between nvgBeginFrame() and nvgEndFrame() of ctx. The commands are drawn in
+// the coordinates they were recorded in, the current transform of ctx is not applied.
+// A list can be submitted several times until recording is started again using nvgBeginFrame().
+void nvgSubmitCommandList(NVGcontext* ctx, NVGcontext* list);
+
+//
+// Memory
+//
+// All memory of the context and the render back-end is allocated using the allocator passed at creation.
+// If alloc is NULL, the C library malloc(), realloc() and free() are used, otherwise all callbacks must be set.
+// Data which lives only during a frame is allocated from an arena which is reset in nvgBeginFrame(),
+// so after the first few frames drawing does not allocate memory.
+// The allocator must be thread-safe if command lists are recorded on other threads or if tessellation
+// is deferred (NVG_DEFERRED_TESSELLATION), the worker threads allocate their own path caches.
+
+struct NVGallocator {
+	void* userPtr;
+	void* (*alloc)(void* userPtr, size_t size);
+	void* (*realloc)(void* userPtr, void* ptr, size_t size);
+	void (*free)(void* userPtr, void* ptr);
+};
+typedef struct NVGallocator NVGallocator;
+
 //
 // Internal Render API
 //
@@ -674,22 +788,50 @@ struct NVGpath {
 	int nstroke;
 	int winding;
 	int convex;
+	int triangulated;	// Fill vertices are a triangle list instead of a fan, the triangles of all paths are stored in the first path.
 };
 typedef struct NVGpath NVGpath;
 
+enum NVGshapeType {
+	NVG_SHAPE_RECT,		// Rectangle with rounded corners.
+	NVG_SHAPE_ELLIPSE,
+};
+
+struct NVGshape {
+	int type;
+	float xform[6];		// Transform of the shape, only rotates and uniformly scales the shape centered at origin.
+	float extent[2];	// Half width and height.
+	float radius[4];	// Corner radii of rectangles: top-left, top-right, bottom-right, bottom-left.
+	float strokeWidth;	// Stroke width in pixels, 0 if the shape is filled.
+	int lineJoin;		// Join of the sharp corners of stroked rectangles, NVG_MITER or NVG_ROUND.
+};
+typedef struct NVGshape NVGshape;
+
 struct NVGparams {
 	void* userPtr;
 	int edgeAntiAlias;
+	int triangulateFills;	// Concave fills are triangulated so that they can be drawn without stenciling.
+	int deferTessellation;	// Fills and strokes are tessellated on worker threads when the frame ends.
+	NVGallocator allocator;
 	int (*renderCreate)(void* uptr);
 	int (*renderCreateTexture)(void* uptr, int type, int w, int h, int imageFlags, const unsigned char* data);
 	int (*renderDeleteTexture)(void* uptr, int image);
 	int (*renderUpdateTexture)(void* uptr, int image, int x, int y, int w, int h, const unsigned char* data);
+	int (*renderResizeTexture)(void* uptr, int image, int w, int h, const unsigned char* data);	// Optional, needed for asynchronous image loading.
 	int (*renderGetTextureSize)(void* uptr, int image, int* w, int* h);
 	void (*renderViewport)(void* uptr, float width, float height, float devicePixelRatio);
 	void (*renderCancel)(void* uptr);
 	void (*renderFlush)(void* uptr);
 	void (*renderFill)(void* uptr, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor, float fringe, const float* bounds, const NVGpath* paths, int npaths);
 	void (*renderStroke)(void* uptr, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor, float fringe, float strokeWidth, const NVGpath* paths, int npaths);
+	// Optional. Draws anti-aliased strokes from the flattened points of the paths stored in NVGpath.stroke,
+	// the back-end expands the segments, joins and caps itself. Only called when the joins of every path fit within its segments
+	// and the stroke is at least two fringe widths wide.
+	void (*renderStrokeSegments)(void* uptr, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor, float fringe, float strokeWidth,
+								 int lineJoin, int lineCap, float miterLimit, const NVGpath* paths, int npaths);
+	// Optional. Draws an anti-aliased path which consists of just one rectangle, rounded rectangle or ellipse,
+	// without tessellating the shape.
+	void (*renderShape)(void* uptr, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor, float fringe, const NVGshape* shape);
 	void (*renderTriangles)(void* uptr, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor, const NVGvertex* verts, int nverts, float fringe);
 	void (*renderDelete)(void* uptr);
 };
@@ -701,6 +843,11 @@ void nvgDeleteInternal(NVGcontext* ctx);
 
 NVGparams* nvgInternalParams(NVGcontext* ctx);
 
+// Allocation functions used by the render back-ends, allocator can be NULL.
+void* nvgInternalAlloc(const NVGallocator* allocator, size_t size);
+void* nvgInternalRealloc(const NVGallocator* allocator, void* ptr, size_t size);
+void nvgInternalFree(const NVGallocator* allocator, void* ptr);
+
 // Debug function to dump cached path data.
 void nvgDebugDumpPathCache(NVGcontext* ctx);
 
@@ -32,6 +32,18 @@ enum NVGcreateFlags {
 	NVG_STENCIL_STROKES	= 1<<1,
 	// Flag indicating that additional debug checks are done.
 	NVG_DEBUG 			= 1<<2,
+	// Flag indicating if concave fills should be triangulated on the CPU and drawn in a single pass
+	// without the stencil buffer. Paths may have holes, but self-intersecting or overlapping paths are still drawn using stencil.
+	NVG_TRIANGULATE_FILLS	= 1<<3,
+	// Flag indicating if fills and strokes are tessellated in parallel on worker threads at the end of the frame
+	// (or before the next text is drawn) instead of immediately when nvgFill() or nvgStroke() is called.
+	NVG_DEFERRED_TESSELLATION	= 1<<4,
+	// Flag indicating if anti-aliased strokes are expanded on the GPU: only the path points are uploaded and each
+	// segment is drawn as an instanced quad with its joins and caps. Only used by the GL3 and GLES3 back-ends.
+	NVG_SEGMENT_STROKES	= 1<<5,
+	// Flag indicating if anti-aliased paths which consist of one rectangle, rounded rectangle or ellipse are drawn
+	// as one quad, with the coverage computed from the distance to the shape in the fragment shader.
+	NVG_SDF_SHAPES		= 1<<6,
 };
 
 #if defined NANOVG_GL2_IMPLEMENTATION
@@ -41,57 +53,100 @@ enum NVGcreateFlags {
 #  define NANOVG_GL3 1
 #  define NANOVG_GL_IMPLEMENTATION 1
 #  define NANOVG_GL_USE_UNIFORMBUFFER 1
+#  define NANOVG_GL_USE_INSTANCING 1
 #elif defined NANOVG_GLES2_IMPLEMENTATION
 #  define NANOVG_GLES2 1
 #  define NANOVG_GL_IMPLEMENTATION 1
 #elif defined NANOVG_GLES3_IMPLEMENTATION
 #  define NANOVG_GLES3 1
 #  define NANOVG_GL_IMPLEMENTATION 1
+#  define NANOVG_GL_USE_INSTANCING 1
 #endif
 
 #define NANOVG_GL_USE_STATE_FILTER (1)
 
+// Images created with NVG_IMAGE_ATLAS which are at most this many pixels wide and high
+// are packed into shared textures.
+#ifndef NANOVG_GL_ATLAS_MAX_IMAGE_SIZE
+#define NANOVG_GL_ATLAS_MAX_IMAGE_SIZE 256
+#endif
+
+// Width and height of the shared textures of atlased images.
+#ifndef NANOVG_GL_ATLAS_SIZE
+#define NANOVG_GL_ATLAS_SIZE 1024
+#endif
+
+// Called when an evicted image is drawn again. The texture has been re-created, the callback
+// should fill it with nvgUpdateImage().
+typedef void (*NVGLimageReload)(void* userPtr, int image);
+
 // Creates NanoVG contexts for different OpenGL (ES) versions.
 // Flags should be combination of the create flags above.
+//
+// nvglTextureBudget() sets how many bytes of texture memory the images may use, zero for no limit
+// (default). When the budget is exceeded, the least recently drawn images which were registered
+// with nvglImageReloadable() are evicted, images drawn in the current frame are kept. An evicted
+// image keeps its handle and size, and is reloaded when it is drawn again.
+// nvglTextureMemory() returns the number of bytes used by the images.
 
 #if defined NANOVG_GL2
 
 NVGcontext* nvgCreateGL2(int flags);
+NVGcontext* nvgCreateWithAllocatorGL2(int flags, const NVGallocator* allocator);
 void nvgDeleteGL2(NVGcontext* ctx);
 
 int nvglCreateImageFromHandleGL2(NVGcontext* ctx, GLuint textureId, int w, int h, int flags);
 GLuint nvglImageHandleGL2(NVGcontext* ctx, int image);
 
+void nvglTextureBudgetGL2(NVGcontext* ctx, size_t bytes);
+void nvglImageReloadableGL2(NVGcontext* ctx, int image, NVGLimageReload reload, void* userPtr);
+size_t nvglTextureMemoryGL2(NVGcontext* ctx);
+
 #endif
 
 #if defined NANOVG_GL3
 
 NVGcontext* nvgCreateGL3(int flags);
+NVGcontext* nvgCreateWithAllocatorGL3(int flags, const NVGallocator* allocator);
 void nvgDeleteGL3(NVGcontext* ctx);
 
 int nvglCreateImageFromHandleGL3(NVGcontext* ctx, GLuint textureId, int w, int h, int flags);
 GLuint nvglImageHandleGL3(NVGcontext* ctx, int image);
 
+void nvglTextureBudgetGL3(NVGcontext* ctx, size_t bytes);
+void nvglImageReloadableGL3(NVGcontext* ctx, int image, NVGLimageReload reload, void* userPtr);
+size_t nvglTextureMemoryGL3(NVGcontext* ctx);
+
 #endif
 
 #if defined NANOVG_GLES2
 
 NVGcontext* nvgCreateGLES2(int flags);
+NVGcontext* nvgCreateWithAllocatorGLES2(int flags, const NVGallocator* allocator);
 void nvgDeleteGLES2(NVGcontext* ctx);
 
 int nvglCreateImageFromHandleGLES2(NVGcontext* ctx, GLuint textureId, int w, int h, int flags);
 GLuint nvglImageHandleGLES2(NVGcontext* ctx, int image);
 
+void nvglTextureBudgetGLES2(NVGcontext* ctx, size_t bytes);
+void nvglImageReloadableGLES2(NVGcontext* ctx, int image, NVGLimageReload reload, void* userPtr);
+size_t nvglTextureMemoryGLES2(NVGcontext* ctx);
+
 #endif
 
 #if defined NANOVG_GLES3
 
 NVGcontext* nvgCreateGLES3(int flags);
+NVGcontext* nvgCreateWithAllocatorGLES3(int flags, const NVGallocator* allocator);
 void nvgDeleteGLES3(NVGcontext* ctx);
 
 int nvglCreateImageFromHandleGLES3(NVGcontext* ctx, GLuint textureId, int w, int h, int flags);
 GLuint nvglImageHandleGLES3(NVGcontext* ctx, int image);
 
+void nvglTextureBudgetGLES3(NVGcontext* ctx, size_t bytes);
+void nvglImageReloadableGLES3(NVGcontext* ctx, int image, NVGLimageReload reload, void* userPtr);
+size_t nvglTextureMemoryGLES3(NVGcontext* ctx);
+
 #endif
 
 // These are additional flags on top of NVGimageFlags.
@@ -117,6 +172,7 @@ enum GLNVGuniformLoc {
 	GLNVG_LOC_VIEWSIZE,
 	GLNVG_LOC_TEX,
 	GLNVG_LOC_FRAG,
+	GLNVG_LOC_STROKE,
 	GLNVG_MAX_LOCS
 };
 
@@ -124,7 +180,20 @@ enum GLNVGshaderType {
 	NSVG_SHADER_FILLGRAD,
 	NSVG_SHADER_FILLIMG,
 	NSVG_SHADER_SIMPLE,
-	NSVG_SHADER_IMG
+	NSVG_SHADER_IMG,
+	NSVG_SHADER_FILLCOLOR,
+	NSVG_SHADER_COUNT
+};
+
+// Each shader type is compiled into separate programs with and without scissoring,
+// with and without the stroke threshold test, for strokes drawn as instanced segments
+// and for shapes drawn with their distance.
+enum GLNVGshaderVariant {
+	GLNVG_VARIANT_SCISSOR		= 1<<0,
+	GLNVG_VARIANT_STROKETHR		= 1<<1,
+	GLNVG_VARIANT_SEGMENTS		= 1<<2,
+	GLNVG_VARIANT_SHAPE			= 1<<3,
+	GLNVG_VARIANT_COUNT			= 16,
 };
 
 #if NANOVG_GL_USE_UNIFORMBUFFER
@@ -138,6 +207,12 @@ struct GLNVGshader {
 	GLuint frag;
 	GLuint vert;
 	GLint loc[GLNVG_MAX_LOCS];
+	float view[2];
+	int fragCount;		// Number of leading vec4s of the uniforms used by the shader.
+	int fragOffset;		// Uniforms currently uploaded to the shader.
+#if NANOVG_GL_USE_INSTANCING
+	float strokeParams[4];
+#endif
 };
 typedef struct GLNVGshader GLNVGshader;
 
@@ -147,9 +222,35 @@ struct GLNVGtexture {
 	int width, height;
 	int type;
 	int flags;
+	int atlas;		// Index+1 of the atlas page the image is packed into, 0 if it has a texture of its own.
+	int x, y;		// Position of the image in the atlas page.
+	int generation;	// Incremented when the slot is freed, so that old handles do not match.
+	int nextFree;	// Index+1 of the next free slot.
+	size_t bytes;
+	NVGLimageReload reload;
+	void* reloadUserPtr;
+	int evicted;
+	int lastUse;	// Frame the image was last drawn in.
+	int lruPrev, lruNext;	// Index+1 of the neighbours in the list of reloadable images.
 };
 typedef struct GLNVGtexture GLNVGtexture;
 
+struct GLNVGatlasNode {
+	short x, y, width;
+};
+typedef struct GLNVGatlasNode GLNVGatlasNode;
+
+// Texture shared by small images, packed using a skyline like the font atlas.
+struct GLNVGatlasPage {
+	GLuint tex;
+	int flags;
+	int nimages;	// The space is reused when all images of the page are deleted.
+	GLNVGatlasNode* nodes;
+	int nnodes;
+	int cnodes;
+};
+typedef struct GLNVGatlasPage GLNVGatlasPage;
+
 struct GLNVGblend
 {
 	GLenum srcRGB;
@@ -167,6 +268,8 @@ enum GLNVGcallType {
 	GLNVG_TRIANGLES,
 	GLNVG_CONVEXFILL_STENCIL,
 	GLNVG_CONVEXFILL_STENCIL_CLEAR,
+	GLNVG_TRIANGULATEDFILL,
+	GLNVG_SHAPE,
 };
 
 struct GLNVGcall {
@@ -178,6 +281,10 @@ struct GLNVGcall {
 	int triangleCount;
 	int uniformOffset;
 	GLNVGblend blendFunc;
+#if NANOVG_GL_USE_INSTANCING
+	int segments;			// Paths are drawn as instanced segments, strokeCount is the number of segments.
+	float strokeParams[4];	// Half width, fringe, miter limit and line join*4 + line cap.
+#endif
 };
 typedef struct GLNVGcall GLNVGcall;
 
@@ -189,40 +296,55 @@ struct GLNVGpath {
 };
 typedef struct GLNVGpath GLNVGpath;
 
+// The uniforms are ordered so that simpler shaders use only the beginning of the struct,
+// see glnvg__fragUniformCount(). Image paints store the sub-rectangle of an atlased image
+// in outerCol, and whether it repeats in x and y in radius and feather. Multi-stop gradients
+// store the coordinates of their row of the ramp texture in outerCol. The shape uniforms
+// are only used by the shape variant, see glnvg__renderShape().
 struct GLNVGfragUniforms {
 	#if NANOVG_GL_USE_UNIFORMBUFFER
-		float scissorMat[12]; // matrices are actually 3 vec4s
-		float paintMat[12];
 		struct NVGcolor innerCol;
-		struct NVGcolor outerCol;
+		float strokeMult;
+		float strokeThr;
+		int texType;
+		int type;
+		float scissorMat[12]; // matrices are actually 3 vec4s
 		float scissorExt[2];
 		float scissorScale[2];
+		float paintMat[12];
 		float extent[2];
 		float radius;
 		float feather;
-		float strokeMult;
-		float strokeThr;
-		int texType;
-		int type;
+		struct NVGcolor outerCol;
+		float shapeMat[8];
+		float shapeExtent[2];
+		float shapeType;
+		float shapeJoin;
+		float shapeRadius[4];
 	#else
 		// note: after modifying layout or size of uniform array,
 		// don't forget to also update the fragment shader source!
-		#define NANOVG_GL_UNIFORMARRAY_SIZE 11
+		#define NANOVG_GL_UNIFORMARRAY_SIZE 15
 		union {
 			struct {
-				float scissorMat[12]; // matrices are actually 3 vec4s
-				float paintMat[12];
 				struct NVGcolor innerCol;
-				struct NVGcolor outerCol;
+				float strokeMult;
+				float strokeThr;
+				float texType;
+				float type;
+				float scissorMat[12]; // matrices are actually 3 vec4s
 				float scissorExt[2];
 				float scissorScale[2];
+				float paintMat[12];
 				float extent[2];
 				float radius;
 				float feather;
-				float strokeMult;
-				float strokeThr;
-				float texType;
-				float type;
+				struct NVGcolor outerCol;
+				float shapeMat[8];
+				float shapeExtent[2];
+				float shapeType;
+				float shapeJoin;
+				float shapeRadius[4];
 			};
 			float uniformArray[NANOVG_GL_UNIFORMARRAY_SIZE][4];
 		};
@@ -230,13 +352,28 @@ struct GLNVGfragUniforms {
 };
 typedef struct GLNVGfragUniforms GLNVGfragUniforms;
 
+struct GLNVGuniformEntry {
+	unsigned int hash;
+	int offset;
+	int count;
+};
+typedef struct GLNVGuniformEntry GLNVGuniformEntry;
+
 struct GLNVGcontext {
-	GLNVGshader shader;
+	NVGallocator allocator;
+	GLNVGshader shaders[NSVG_SHADER_COUNT * GLNVG_VARIANT_COUNT];
 	GLNVGtexture* textures;
 	float view[2];
 	int ntextures;
 	int ctextures;
-	int textureId;
+	int freeTexture;	// Index+1 of the first free slot in textures.
+	size_t textureBytes;
+	size_t textureBudget;
+	int lruHead, lruTail;	// Reloadable images, most recently drawn first.
+	int frame;
+	GLNVGatlasPage* atlasPages;
+	int natlasPages;
+	int catlasPages;
 	GLuint vertBuf;
 #if defined NANOVG_GL3
 	GLuint vertArr;
@@ -260,9 +397,14 @@ struct GLNVGcontext {
 	unsigned char* uniforms;
 	int cuniforms;
 	int nuniforms;
+	GLNVGuniformEntry* uniformHash;	// Hash of the uniforms for sharing identical paints.
+	int cuniformHash;
+	int nuniformHash;
 
 	// cached state
 	#if NANOVG_GL_USE_STATE_FILTER
+	GLuint currentProgram;
+	int boundFragOffset;
 	GLuint boundTexture;
 	GLuint stencilMask;
 	GLenum stencilFunc;
@@ -303,6 +445,18 @@ static void glnvg__bindTexture(GLNVGcontext* gl, GLuint tex)
 #endif
 }
 
+static void glnvg__useProgram(GLNVGcontext* gl, GLuint prog)
+{
+#if NANOVG_GL_USE_STATE_FILTER
+	if (gl->currentProgram != prog) {
+		gl->currentProgram = prog;
+		glUseProgram(prog);
+	}
+#else
+	glUseProgram(prog);
+#endif
+}
+
 static void glnvg__stencilMask(GLNVGcontext* gl, GLuint mask)
 {
 #if NANOVG_GL_USE_STATE_FILTER
@@ -347,56 +501,370 @@ static void glnvg__blendFuncSeparate(GLNVGcontext* gl, const GLNVGblend* blend)
 #endif
 }
 
+// Image handles store the index of the texture slot in the low bits and the generation of the slot above.
+#define GLNVG_HANDLE_INDEX_BITS 16
+#define GLNVG_HANDLE_INDEX_MASK ((1 << GLNVG_HANDLE_INDEX_BITS) - 1)
+#define GLNVG_HANDLE_GENERATION_MASK ((1 << (31 - GLNVG_HANDLE_INDEX_BITS)) - 1)
+
 static GLNVGtexture* glnvg__allocTexture(GLNVGcontext* gl)
 {
-	GLNVGtexture* tex = NULL;
-	int i;
+	GLNVGtexture* tex;
+	int i, generation;
 
-	for (i = 0; i < gl->ntextures; i++) {
-		if (gl->textures[i].id == 0) {
-			tex = &gl->textures[i];
-			break;
-		}
-	}
-	if (tex == NULL) {
+	if (gl->freeTexture != 0) {
+		i = gl->freeTexture - 1;
+		gl->freeTexture = gl->textures[i].nextFree;
+	} else {
+		if (gl->ntextures+1 > GLNVG_HANDLE_INDEX_MASK) return NULL;
 		if (gl->ntextures+1 > gl->ctextures) {
 			GLNVGtexture* textures;
 			int ctextures = glnvg__maxi(gl->ntextures+1, 4) +  gl->ctextures/2; // 1.5x Overallocate
-			textures = (GLNVGtexture*)realloc(gl->textures, sizeof(GLNVGtexture)*ctextures);
+			textures = (GLNVGtexture*)nvgInternalRealloc(&gl->allocator, gl->textures, sizeof(GLNVGtexture)*ctextures);
 			if (textures == NULL) return NULL;
 			gl->textures = textures;
 			gl->ctextures = ctextures;
 		}
-		tex = &gl->textures[gl->ntextures++];
+		i = gl->ntextures++;
+		gl->textures[i].generation = 0;
 	}
 
+	tex = &gl->textures[i];
+	generation = tex->generation;
 	memset(tex, 0, sizeof(*tex));
-	tex->id = ++gl->textureId;
+	tex->generation = generation;
+	tex->id = (generation << GLNVG_HANDLE_INDEX_BITS) | (i+1);
+	tex->lastUse = gl->frame;
 
 	return tex;
 }
 
 static GLNVGtexture* glnvg__findTexture(GLNVGcontext* gl, int id)
+{
+	int i = (id & GLNVG_HANDLE_INDEX_MASK) - 1;
+	if (id <= 0 || i < 0 || i >= gl->ntextures || gl->textures[i].id != id)
+		return NULL;
+	return &gl->textures[i];
+}
+
+static size_t glnvg__textureBytes(GLNVGtexture* tex)
+{
+	size_t bytes;
+	if (tex->atlas != 0)
+		return (size_t)(tex->width+2) * (tex->height+2) * 4;
+	bytes = (size_t)tex->width * tex->height * (tex->type == NVG_TEXTURE_RGBA ? 4 : 1);
+	if (tex->flags & NVG_IMAGE_GENERATE_MIPMAPS)
+		bytes += bytes / 3;
+	return bytes;
+}
+
+static void glnvg__setTextureBytes(GLNVGcontext* gl, GLNVGtexture* tex, size_t bytes)
+{
+	gl->textureBytes = gl->textureBytes - tex->bytes + bytes;
+	tex->bytes = bytes;
+}
+
+static void glnvg__lruRemove(GLNVGcontext* gl, GLNVGtexture* tex)
+{
+	int idx = (int)(tex - gl->textures) + 1;
+	if (tex->lruPrev != 0)
+		gl->textures[tex->lruPrev-1].lruNext = tex->lruNext;
+	else if (gl->lruHead == idx)
+		gl->lruHead = tex->lruNext;
+	if (tex->lruNext != 0)
+		gl->textures[tex->lruNext-1].lruPrev = tex->lruPrev;
+	else if (gl->lruTail == idx)
+		gl->lruTail = tex->lruPrev;
+	tex->lruPrev = tex->lruNext = 0;
+}
+
+static void glnvg__lruPushFront(GLNVGcontext* gl, GLNVGtexture* tex)
+{
+	int idx = (int)(tex - gl->textures) + 1;
+	tex->lruPrev = 0;
+	tex->lruNext = gl->lruHead;
+	if (gl->lruHead != 0)
+		gl->textures[gl->lruHead-1].lruPrev = idx;
+	gl->lruHead = idx;
+	if (gl->lruTail == 0)
+		gl->lruTail = idx;
+}
+
+static int glnvg__atlasInsertNode(GLNVGcontext* gl, GLNVGatlasPage* page, int idx, int x, int y, int w)
 {
 	int i;
-	for (i = 0; i < gl->ntextures; i++)
-		if (gl->textures[i].id == id)
-			return &gl->textures[i];
-	return NULL;
+	// Insert node
+	if (page->nnodes+1 > page->cnodes) {
+		int cnodes = page->cnodes == 0 ? 8 : page->cnodes * 2;
+		GLNVGatlasNode* nodes = (GLNVGatlasNode*)nvgInternalRealloc(&gl->allocator, page->nodes, sizeof(GLNVGatlasNode) * cnodes);
+		if (nodes == NULL) return 0;
+		page->nodes = nodes;
+		page->cnodes = cnodes;
+	}
+	for (i = page->nnodes; i > idx; i--)
+		page->nodes[i] = page->nodes[i-1];
+	page->nodes[idx].x = (short)x;
+	page->nodes[idx].y = (short)y;
+	page->nodes[idx].width = (short)w;
+	page->nnodes++;
+
+	return 1;
 }
 
-static int glnvg__deleteTexture(GLNVGcontext* gl, int id)
+static void glnvg__atlasRemoveNode(GLNVGatlasPage* page, int idx)
 {
 	int i;
-	for (i = 0; i < gl->ntextures; i++) {
-		if (gl->textures[i].id == id) {
-			if (gl->textures[i].tex != 0 && (gl->textures[i].flags & NVG_IMAGE_NODELETE) == 0)
-				glDeleteTextures(1, &gl->textures[i].tex);
-			memset(&gl->textures[i], 0, sizeof(gl->textures[i]));
-			return 1;
+	if (page->nnodes == 0) return;
+	for (i = idx; i < page->nnodes-1; i++)
+		page->nodes[i] = page->nodes[i+1];
+	page->nnodes--;
+}
+
+static void glnvg__atlasReset(GLNVGatlasPage* page)
+{
+	// Root node is allocated when the page is created.
+	page->nnodes = 1;
+	page->nodes[0].x = 0;
+	page->nodes[0].y = 0;
+	page->nodes[0].width = (short)NANOVG_GL_ATLAS_SIZE;
+}
+
+static int glnvg__atlasAddSkylineLevel(GLNVGcontext* gl, GLNVGatlasPage* page, int idx, int x, int y, int w, int h)
+{
+	int i;
+
+	// Insert new node
+	if (glnvg__atlasInsertNode(gl, page, idx, x, y+h, w) == 0)
+		return 0;
+
+	// Delete skyline segments that fall under the shadow of the new segment.
+	for (i = idx+1; i < page->nnodes; i++) {
+		if (page->nodes[i].x < page->nodes[i-1].x + page->nodes[i-1].width) {
+			int shrink = page->nodes[i-1].x + page->nodes[i-1].width - page->nodes[i].x;
+			page->nodes[i].x += (short)shrink;
+			page->nodes[i].width -= (short)shrink;
+			if (page->nodes[i].width <= 0) {
+				glnvg__atlasRemoveNode(page, i);
+				i--;
+			} else {
+				break;
+			}
+		} else {
+			break;
+		}
+	}
+
+	// Merge same height skyline segments that are next to each other.
+	for (i = 0; i < page->nnodes-1; i++) {
+		if (page->nodes[i].y == page->nodes[i+1].y) {
+			page->nodes[i].width += page->nodes[i+1].width;
+			glnvg__atlasRemoveNode(page, i+1);
+			i--;
+		}
+	}
+
+	return 1;
+}
+
+// Returns the height at which a rect fits at skyline span 'i', or -1 if it does not fit.
+static int glnvg__atlasRectFits(GLNVGatlasPage* page, int i, int w, int h)
+{
+	int x = page->nodes[i].x;
+	int y = page->nodes[i].y;
+	int spaceLeft;
+	if (x + w > NANOVG_GL_ATLAS_SIZE)
+		return -1;
+	spaceLeft = w;
+	while (spaceLeft > 0) {
+		if (i == page->nnodes) return -1;
+		y = glnvg__maxi(y, page->nodes[i].y);
+		if (y + h > NANOVG_GL_ATLAS_SIZE) return -1;
+		spaceLeft -= page->nodes[i].width;
+		++i;
+	}
+	return y;
+}
+
+static int glnvg__atlasAddRect(GLNVGcontext* gl, GLNVGatlasPage* page, int rw, int rh, int* rx, int* ry)
+{
+	int besth = NANOVG_GL_ATLAS_SIZE, bestw = NANOVG_GL_ATLAS_SIZE, besti = -1;
+	int bestx = -1, besty = -1, i;
+
+	// Bottom left fit heuristic.
+	for (i = 0; i < page->nnodes; i++) {
+		int y = glnvg__atlasRectFits(page, i, rw, rh);
+		if (y != -1) {
+			if (y + rh < besth || (y + rh == besth && page->nodes[i].width < bestw)) {
+				besti = i;
+				bestw = page->nodes[i].width;
+				besth = y + rh;
+				bestx = page->nodes[i].x;
+				besty = y;
+			}
+		}
+	}
+
+	if (besti == -1)
+		return 0;
+
+	// Perform the actual packing.
+	if (glnvg__atlasAddSkylineLevel(gl, page, besti, bestx, besty, rw, rh) == 0)
+		return 0;
+
+	*rx = bestx;
+	*ry = besty;
+
+	return 1;
+}
+
+static GLNVGatlasPage* glnvg__allocAtlasPage(GLNVGcontext* gl, int flags)
+{
+	GLNVGatlasPage* page;
+	GLint filter = (flags & NVG_IMAGE_NEAREST) ? GL_NEAREST : GL_LINEAR;
+
+	if (gl->natlasPages+1 > gl->catlasPages) {
+		int cpages = glnvg__maxi(gl->natlasPages+1, 4) + gl->catlasPages/2;
+		GLNVGatlasPage* pages = (GLNVGatlasPage*)nvgInternalRealloc(&gl->allocator, gl->atlasPages, sizeof(GLNVGatlasPage)*cpages);
+		if (pages == NULL) return NULL;
+		gl->atlasPages = pages;
+		gl->catlasPages = cpages;
+	}
+	page = &gl->atlasPages[gl->natlasPages];
+	memset(page, 0, sizeof(*page));
+	page->flags = flags;
+	if (glnvg__atlasInsertNode(gl, page, 0, 0, 0, NANOVG_GL_ATLAS_SIZE) == 0)
+		return NULL;
+
+	glGenTextures(1, &page->tex);
+	glnvg__bindTexture(gl, page->tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, NANOVG_GL_ATLAS_SIZE, NANOVG_GL_ATLAS_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glnvg__bindTexture(gl, 0);
+
+	gl->natlasPages++;
+	return page;
+}
+
+static int glnvg__wrapCoord(int i, int n, int repeat)
+{
+	if (repeat)
+		return (i + n) % n;
+	return i < 0 ? 0 : (i >= n ? n-1 : i);
+}
+
+// Uploads an atlased image with a one pixel border around it. The border repeats the opposite
+// edge of the image if it repeats, or the nearest edge if not, so that the image is filtered
+// as if it had a texture of its own.
+static int glnvg__atlasUpload(GLNVGcontext* gl, GLNVGtexture* tex, const unsigned char* data)
+{
+	int w = tex->width + 2, h = tex->height + 2;
+	int i, j;
+	unsigned char* pixels = (unsigned char*)nvgInternalAlloc(&gl->allocator, w*h*4);
+	if (pixels == NULL) return 0;
+
+	for (j = 0; j < h; j++) {
+		int sy = glnvg__wrapCoord(j-1, tex->height, tex->flags & NVG_IMAGE_REPEATY);
+		unsigned char* dst = &pixels[j*w*4];
+		for (i = 0; i < w; i++) {
+			int sx = glnvg__wrapCoord(i-1, tex->width, tex->flags & NVG_IMAGE_REPEATX);
+			if (data != NULL)
+				memcpy(&dst[i*4], &data[(sy*tex->width + sx)*4], 4);
+			else
+				memset(&dst[i*4], 0, 4);
+		}
+	}
+
+	glnvg__bindTexture(gl, tex->tex);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, tex->x-1, tex->y-1, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	glnvg__bindTexture(gl, 0);
+
+	nvgInternalFree(&gl->allocator, pixels);
+	return 1;
+}
+
+static void glnvg__atlasFree(GLNVGcontext* gl, GLNVGtexture* tex)
+{
+	GLNVGatlasPage* page = &gl->atlasPages[tex->atlas-1];
+	if (--page->nimages == 0)
+		glnvg__atlasReset(page);
+	glnvg__setTextureBytes(gl, tex, 0);
+	tex->atlas = 0;
+	tex->tex = 0;
+}
+
+// Packs the image into an atlas page if it was created with NVG_IMAGE_ATLAS and is small enough.
+static int glnvg__atlasAlloc(GLNVGcontext* gl, GLNVGtexture* tex, int type, int w, int h, int imageFlags, const unsigned char* data)
+{
+	GLNVGatlasPage* page = NULL;
+	int i, x = 0, y = 0;
+
+	if (type != NVG_TEXTURE_RGBA || (imageFlags & NVG_IMAGE_ATLAS) == 0 || (imageFlags & NVG_IMAGE_GENERATE_MIPMAPS) != 0)
+		return 0;
+	if (w <= 0 || h <= 0 || w > NANOVG_GL_ATLAS_MAX_IMAGE_SIZE || h > NANOVG_GL_ATLAS_MAX_IMAGE_SIZE)
+		return 0;
+
+	for (i = 0; i < gl->natlasPages; i++) {
+		GLNVGatlasPage* p = &gl->atlasPages[i];
+		if ((p->flags & NVG_IMAGE_NEAREST) != (imageFlags & NVG_IMAGE_NEAREST)) continue;
+		if (glnvg__atlasAddRect(gl, p, w+2, h+2, &x, &y)) {
+			page = p;
+			break;
 		}
 	}
-	return 0;
+	if (page == NULL) {
+		page = glnvg__allocAtlasPage(gl, imageFlags & NVG_IMAGE_NEAREST);
+		if (page == NULL) return 0;
+		if (glnvg__atlasAddRect(gl, page, w+2, h+2, &x, &y) == 0) return 0;
+	}
+
+	page->nimages++;
+	tex->tex = page->tex;
+	tex->atlas = (int)(page - gl->atlasPages) + 1;
+	tex->x = x+1;
+	tex->y = y+1;
+	tex->width = w;
+	tex->height = h;
+	tex->type = type;
+	tex->flags = imageFlags;
+
+	if (glnvg__atlasUpload(gl, tex, data) == 0) {
+		glnvg__atlasFree(gl, tex);
+		return 0;
+	}
+	glnvg__setTextureBytes(gl, tex, glnvg__textureBytes(tex));
+	return 1;
+}
+
+// Releases the memory of the image, but keeps the handle.
+static void glnvg__releaseTexture(GLNVGcontext* gl, GLNVGtexture* tex)
+{
+	if (tex->atlas != 0)
+		glnvg__atlasFree(gl, tex);
+	else if (tex->tex != 0 && (tex->flags & NVG_IMAGE_NODELETE) == 0)
+		glDeleteTextures(1, &tex->tex);
+	tex->tex = 0;
+	glnvg__setTextureBytes(gl, tex, 0);
+}
+
+static int glnvg__deleteTexture(GLNVGcontext* gl, int id)
+{
+	GLNVGtexture* tex = glnvg__findTexture(gl, id);
+	int generation;
+	if (tex == NULL) return 0;
+
+	glnvg__releaseTexture(gl, tex);
+	if (tex->reload != NULL)
+		glnvg__lruRemove(gl, tex);
+
+	generation = (tex->generation + 1) & GLNVG_HANDLE_GENERATION_MASK;
+	memset(tex, 0, sizeof(*tex));
+	tex->generation = generation;
+	tex->nextFree = gl->freeTexture;
+	gl->freeTexture = (int)(tex - gl->textures) + 1;
+
+	return 1;
 }
 
 static void glnvg__dumpShaderError(GLuint shader, const char* name, const char* type)
@@ -467,6 +935,10 @@ static int glnvg__createShader(GLNVGshader* shader, const char* name, const char
 
 	glBindAttribLocation(prog, 0, "vertex");
 	glBindAttribLocation(prog, 1, "tcoord");
+	glBindAttribLocation(prog, 2, "p0");
+	glBindAttribLocation(prog, 3, "p1");
+	glBindAttribLocation(prog, 4, "p2");
+	glBindAttribLocation(prog, 5, "p3");
 
 	glLinkProgram(prog);
 	glGetProgramiv(prog, GL_LINK_STATUS, &status);
@@ -496,6 +968,7 @@ static void glnvg__getUniforms(GLNVGshader* shader)
 {
 	shader->loc[GLNVG_LOC_VIEWSIZE] = glGetUniformLocation(shader->prog, "viewSize");
 	shader->loc[GLNVG_LOC_TEX] = glGetUniformLocation(shader->prog, "tex");
+	shader->loc[GLNVG_LOC_STROKE] = glGetUniformLocation(shader->prog, "strokeParams");
 
 #if NANOVG_GL_USE_UNIFORMBUFFER
 	shader->loc[GLNVG_LOC_FRAG] = glGetUniformBlockIndex(shader->prog, "frag");
@@ -504,12 +977,49 @@ static void glnvg__getUniforms(GLNVGshader* shader)
 #endif
 }
 
+// Returns index of the program used to draw given shader type, unused variants are mapped to the ones that are compiled.
+static int glnvg__shaderIndex(GLNVGcontext* gl, int type, int variant)
+{
+	if (type == NSVG_SHADER_SIMPLE)
+		variant = 0;
+	if (type == NSVG_SHADER_IMG || (gl->flags & NVG_ANTIALIAS) == 0 || (gl->flags & NVG_STENCIL_STROKES) == 0)
+		variant &= ~GLNVG_VARIANT_STROKETHR;
+#if NANOVG_GL_USE_INSTANCING
+	if (type == NSVG_SHADER_IMG || (gl->flags & NVG_ANTIALIAS) == 0 || (gl->flags & NVG_SEGMENT_STROKES) == 0)
+		variant &= ~GLNVG_VARIANT_SEGMENTS;
+#else
+	variant &= ~GLNVG_VARIANT_SEGMENTS;
+#endif
+	if (type == NSVG_SHADER_SIMPLE || type == NSVG_SHADER_IMG || (gl->flags & NVG_ANTIALIAS) == 0 || (gl->flags & NVG_SDF_SHAPES) == 0)
+		variant &= ~GLNVG_VARIANT_SHAPE;
+	if (variant & GLNVG_VARIANT_SHAPE)
+		variant &= ~(GLNVG_VARIANT_STROKETHR | GLNVG_VARIANT_SEGMENTS);
+	return type * GLNVG_VARIANT_COUNT + variant;
+}
+
+// Returns number of vec4s at the start of GLNVGfragUniforms used by given shader type.
+static int glnvg__fragUniformCount(int type, int variant)
+{
+	if (variant & GLNVG_VARIANT_SHAPE)
+		return 15;
+	switch (type) {
+	case NSVG_SHADER_SIMPLE:
+		return 0;
+	case NSVG_SHADER_FILLCOLOR:
+	case NSVG_SHADER_IMG:
+		return (variant & GLNVG_VARIANT_SCISSOR) ? 6 : 2;
+	default:
+		return 11;
+	}
+}
+
 static int glnvg__renderCreateTexture(void* uptr, int type, int w, int h, int imageFlags, const unsigned char* data);
 
 static int glnvg__renderCreate(void* uptr)
 {
 	GLNVGcontext* gl = (GLNVGcontext*)uptr;
-	int align = 4;
+	int align = 4, i;
+	char opts[128];
 
 	// TODO: mediump float may not be enough for GLES2 in iOS.
 	// see the following discussion: https://github.com/memononen/nanovg/issues/46
@@ -530,7 +1040,7 @@ static int glnvg__renderCreate(void* uptr)
 #if NANOVG_GL_USE_UNIFORMBUFFER
 	"#define USE_UNIFORMBUFFER 1\n"
 #else
-	"#define UNIFORMARRAY_SIZE 11\n"
+	"#define UNIFORMARRAY_SIZE 15\n"
 #endif
 	"\n";
 
@@ -554,6 +1064,55 @@ static int glnvg__renderCreate(void* uptr)
 		"	gl_Position = vec4(2.0*vertex.x/viewSize.x - 1.0, 1.0 - 2.0*vertex.y/viewSize.y, 0, 1);\n"
 		"}\n";
 
+#if NANOVG_GL_USE_INSTANCING
+	// Expands the stroke segment p1-p2 into a quad which covers it, its half of the joins and the caps.
+	// p0 and p3 are the neighbouring points, equal to p1 and p2 at the ends of open paths.
+	static const char* segmentVertShader =
+		"	uniform vec2 viewSize;\n"
+		"	uniform vec4 strokeParams;\n"
+		"	in vec4 p0;\n"
+		"	in vec4 p1;\n"
+		"	in vec4 p2;\n"
+		"	in vec4 p3;\n"
+		"	out vec2 ftcoord;\n"
+		"	out vec2 fpos;\n"
+		"	flat out vec4 fseg0;\n"
+		"	flat out vec4 fseg1;\n"
+		"	flat out vec4 fjoint;\n"
+		"// Returns the outer corner of the join at b relative to b, the miter tip or the middle of the bevel.\n"
+		"vec2 jointip(vec2 a, vec2 b, vec2 c, int join) {\n"
+		"	vec2 d0 = normalize(b - a), d1 = normalize(c - b);\n"
+		"	vec2 dm = (vec2(-d0.y, d0.x) + vec2(-d1.y, d1.x)) * 0.5;\n"
+		"	float dmr2 = max(dot(dm, dm), 1e-6);\n"
+		"	if (d0.x*d1.y - d0.y*d1.x > 0.0) dm = -dm;\n"
+		"	if (join == 4 && dmr2*strokeParams.z*strokeParams.z >= 1.0) return strokeParams.x * dm / dmr2;\n"
+		"	return strokeParams.x * dm;\n"
+		"}\n"
+		"void main(void) {\n"
+		"	float hw = strokeParams.x, aa = strokeParams.y;\n"
+		"	int join = int(strokeParams.w) / 4;\n"
+		"	int cap = int(strokeParams.w) - join*4;\n"
+		"	float len = max(length(p2.xy - p1.xy), 1e-5);\n"
+		"	vec2 dir = (p2.xy - p1.xy) / len;\n"
+		"	vec2 nrm = vec2(-dir.y, dir.x);\n"
+		"	float back = 0.0, front = len;\n"
+		"	if (p0.xy == p1.xy) back = cap != 0 ? hw : 0.0;\n"
+		"	else if (join == 1) back = hw;\n"
+		"	else back = max(0.0, -dot(jointip(p0.xy, p1.xy, p2.xy, join), dir));\n"
+		"	if (p3.xy == p2.xy) front += cap != 0 ? hw : 0.0;\n"
+		"	else if (join == 1) front += hw;\n"
+		"	else front += max(0.0, dot(jointip(p1.xy, p2.xy, p3.xy, join), dir));\n"
+		"	vec2 pos = p1.xy + dir * ((gl_VertexID & 1) != 0 ? front + aa : -back - aa)\n"
+		"		- nrm * ((gl_VertexID & 2) != 0 ? hw + aa : -hw - aa);\n"
+		"	ftcoord = vec2(0.0, 0.0);\n"
+		"	fpos = pos;\n"
+		"	fseg0 = vec4(p0.xy, p1.xy);\n"
+		"	fseg1 = vec4(p2.xy, p3.xy);\n"
+		"	fjoint = vec4(p1.zw, p2.zw);\n"
+		"	gl_Position = vec4(2.0*pos.x/viewSize.x - 1.0, 1.0 - 2.0*pos.y/viewSize.y, 0, 1);\n"
+		"}\n";
+#endif
+
 	static const char* fillFragShader =
 		"#ifdef GL_ES\n"
 		"#if defined(GL_FRAGMENT_PRECISION_HIGH) || defined(NANOVG_GL3)\n"
@@ -565,19 +1124,25 @@ static int glnvg__renderCreate(void* uptr)
 		"#ifdef NANOVG_GL3\n"
 		"#ifdef USE_UNIFORMBUFFER\n"
 		"	layout(std140) uniform frag {\n"
-		"		mat3 scissorMat;\n"
-		"		mat3 paintMat;\n"
 		"		vec4 innerCol;\n"
-		"		vec4 outerCol;\n"
+		"		float strokeMult;\n"
+		"		float strokeThr;\n"
+		"		int texType;\n"
+		"		int type;\n"
+		"		mat3 scissorMat;\n"
 		"		vec2 scissorExt;\n"
 		"		vec2 scissorScale;\n"
+		"		mat3 paintMat;\n"
 		"		vec2 extent;\n"
 		"		float radius;\n"
 		"		float feather;\n"
-		"		float strokeMult;\n"
-		"		float strokeThr;\n"
-		"		int texType;\n"
-		"		int type;\n"
+		"		vec4 outerCol;\n"
+		"		vec4 shapeMatX;\n"
+		"		vec4 shapeMatY;\n"
+		"		vec2 shapeExtent;\n"
+		"		float shapeType;\n"
+		"		float shapeJoin;\n"
+		"		vec4 shapeRadius;\n"
 		"	};\n"
 		"#else\n" // NANOVG_GL3 && !USE_UNIFORMBUFFER
 		"	uniform vec4 frag[UNIFORMARRAY_SIZE];\n"
@@ -586,6 +1151,12 @@ static int glnvg__renderCreate(void* uptr)
 		"	in vec2 ftcoord;\n"
 		"	in vec2 fpos;\n"
 		"	out vec4 outColor;\n"
+		"#ifdef SEGMENTS\n"
+		"	uniform vec4 strokeParams;\n"
+		"	flat in vec4 fseg0;\n"
+		"	flat in vec4 fseg1;\n"
+		"	flat in vec4 fjoint;\n"
+		"#endif\n"
 		"#else\n" // !NANOVG_GL3
 		"	uniform vec4 frag[UNIFORMARRAY_SIZE];\n"
 		"	uniform sampler2D tex;\n"
@@ -593,20 +1164,29 @@ static int glnvg__renderCreate(void* uptr)
 		"	varying vec2 fpos;\n"
 		"#endif\n"
 		"#ifndef USE_UNIFORMBUFFER\n"
-		"	#define scissorMat mat3(frag[0].xyz, frag[1].xyz, frag[2].xyz)\n"
-		"	#define paintMat mat3(frag[3].xyz, frag[4].xyz, frag[5].xyz)\n"
-		"	#define innerCol frag[6]\n"
-		"	#define outerCol frag[7]\n"
-		"	#define scissorExt frag[8].xy\n"
-		"	#define scissorScale frag[8].zw\n"
+		"	#define innerCol frag[0]\n"
+		"	#define strokeMult frag[1].x\n"
+		"	#define strokeThr frag[1].y\n"
+		"	#define texType int(frag[1].z)\n"
+		"	#define type int(frag[1].w)\n"
+		"	#define scissorMat mat3(frag[2].xyz, frag[3].xyz, frag[4].xyz)\n"
+		"	#define scissorExt frag[5].xy\n"
+		"	#define scissorScale frag[5].zw\n"
+		"	#define paintMat mat3(frag[6].xyz, frag[7].xyz, frag[8].xyz)\n"
 		"	#define extent frag[9].xy\n"
 		"	#define radius frag[9].z\n"
 		"	#define feather frag[9].w\n"
-		"	#define strokeMult frag[10].x\n"
-		"	#define strokeThr frag[10].y\n"
-		"	#define texType int(frag[10].z)\n"
-		"	#define type int(frag[10].w)\n"
+		"	#define outerCol frag[10]\n"
+		"	#define shapeMatX frag[11]\n"
+		"	#define shapeMatY frag[12]\n"
+		"	#define shapeExtent frag[13].xy\n"
+		"	#define shapeType frag[13].z\n"
+		"	#define shapeJoin frag[13].w\n"
+		"	#define shapeRadius frag[14]\n"
 		"#endif\n"
+		"#define atlasRect outerCol\n"
+		"#define rampCoord outerCol\n"
+		"#define atlasRepeat vec2(radius, feather)\n"
 		"\n"
 		"float sdroundrect(vec2 pt, vec2 ext, float rad) {\n"
 		"	vec2 ext2 = ext - vec2(rad,rad);\n"
@@ -621,58 +1201,154 @@ static int glnvg__renderCreate(void* uptr)
 		"	return clamp(sc.x,0.0,1.0) * clamp(sc.y,0.0,1.0);\n"
 		"}\n"
 		"#ifdef EDGE_AA\n"
+		"#ifdef SHAPE\n"
+		"// Distance to a rounded rectangle with a different radius at each corner.\n"
+		"float sdcorners(vec2 pt, vec2 ext, vec4 rad) {\n"
+		"	float r = pt.x > 0.0 ? (pt.y > 0.0 ? rad.z : rad.y) : (pt.y > 0.0 ? rad.w : rad.x);\n"
+		"	vec2 d = abs(pt) - ext + vec2(r,r);\n"
+		"	return min(max(d.x,d.y),0.0) + length(max(d,0.0)) - r;\n"
+		"}\n"
+		"// Approximate distance to an ellipse, exact for circles.\n"
+		"float sdellipse(vec2 pt, vec2 ext) {\n"
+		"	float k0 = length(pt / ext);\n"
+		"	float k1 = length(pt / (ext*ext));\n"
+		"	return k0 * (k0 - 1.0) / max(k1, 1e-6);\n"
+		"}\n"
+		"// Shape - coverage of the filled or stroked shape, from the distance in the shape space scaled to pixels.\n"
+		"float strokeMask() {\n"
+		"	vec2 pt = vec2(dot(shapeMatX.xyz, vec3(fpos,1.0)), dot(shapeMatY.xyz, vec3(fpos,1.0)));\n"
+		"	float hw = shapeMatX.w;\n"
+		"	float d;\n"
+		"	if (shapeType != 0.0) {\n"
+		"		d = sdellipse(pt, shapeExtent);\n"
+		"		if (hw > 0.0) d = abs(d) - hw;\n"
+		"	} else if (hw > 0.0) {\n"
+		"		// Sharp corners stay sharp with miter joins.\n"
+		"		vec4 outer = shapeRadius + vec4(hw) * sign(shapeRadius + vec4(shapeJoin));\n"
+		"		vec2 inner = shapeExtent - vec2(hw);\n"
+		"		d = sdcorners(pt, shapeExtent + vec2(hw), outer);\n"
+		"		if (min(inner.x, inner.y) > 0.0) d = max(d, -sdcorners(pt, inner, max(shapeRadius - vec4(hw), 0.0)));\n"
+		"	} else {\n"
+		"		d = sdcorners(pt, shapeExtent, shapeRadius);\n"
+		"	}\n"
+		"	return clamp(0.5 - d * shapeMatY.w, 0.0, 1.0);\n"
+		"}\n"
+		"#elif defined(SEGMENTS)\n"
+		"// Distance beyond the bevel of the join at b, or a negative value when the miter is within the limit.\n"
+		"float joincut(vec2 p, vec2 a, vec2 b, vec2 c, int join) {\n"
+		"	vec2 d0 = normalize(b - a), d1 = normalize(c - b);\n"
+		"	vec2 dm = (vec2(-d0.y, d0.x) + vec2(-d1.y, d1.x)) * 0.5;\n"
+		"	float dmr2 = max(dot(dm, dm), 1e-6);\n"
+		"	if (d0.x*d1.y - d0.y*d1.x > 0.0) dm = -dm;\n"
+		"	if (join == 4 && dmr2*strokeParams.z*strokeParams.z >= 1.0) return -1e6;\n"
+		"	return (dot(p - b, dm) - strokeParams.x*dmr2) / sqrt(dmr2);\n"
+		"}\n"
+		"// Stroke - coverage of the segment up to the lines bisecting its joints, the pixels of a joint are split with\n"
+		"// the neighbouring segment. The position is snapped so that both make the same decision.\n"
+		"float strokeMask() {\n"
+		"	vec2 p0 = fseg0.xy, p1 = fseg0.zw, p2 = fseg1.xy, p3 = fseg1.zw;\n"
+		"	vec2 pos = floor(fpos * 256.0 + 0.5) / 256.0;\n"
+		"	float hw = strokeParams.x;\n"
+		"	int join = int(strokeParams.w) / 4;\n"
+		"	int cap = int(strokeParams.w) - join*4;\n"
+		"	float len = max(length(p2 - p1), 1e-5);\n"
+		"	vec2 dir = (p2 - p1) / len;\n"
+		"	float t = dot(fpos - p1, dir);\n"
+		"	float d = abs(dot(fpos - p1, vec2(-dir.y, dir.x))) - hw;\n"
+		"	float e = -1e6;\n"	// Distance beyond the butt or square caps and the cut joins.
+		"	if (p0 == p1) {\n"
+		"		if (cap == 1) d = t < 0.0 ? length(fpos - p1) - hw : d;\n"
+		"		else e = max(e, -t - (cap == 2 ? hw : 0.0));\n"
+		"	} else {\n"
+		"		if (dot(pos - p1, fjoint.xy) < 0.0) discard;\n"
+		"		if (join == 1) d = t < 0.0 ? length(fpos - p1) - hw : d;\n"
+		"		else e = max(e, joincut(fpos, p0, p1, p2, join));\n"
+		"	}\n"
+		"	if (p3 == p2) {\n"
+		"		if (cap == 1) d = t > len ? length(fpos - p2) - hw : d;\n"
+		"		else e = max(e, t - len - (cap == 2 ? hw : 0.0));\n"
+		"	} else {\n"
+		"		if (dot(pos - p2, fjoint.zw) >= 0.0) discard;\n"
+		"		if (join == 1) d = t > len ? length(fpos - p2) - hw : d;\n"
+		"		else e = max(e, joincut(fpos, p1, p2, p3, join));\n"
+		"	}\n"
+		"	// The side and end ramps are multiplied like the fringes of the CPU expansion.\n"
+		"	return clamp(0.5 - d / strokeParams.y, 0.0, 1.0) * clamp(0.5 - e / strokeParams.y, 0.0, 1.0);\n"
+		"}\n"
+		"#else\n"
 		"// Stroke - from [0..1] to clipped pyramid, where the slope is 1px.\n"
 		"float strokeMask() {\n"
 		"	return min(1.0, (1.0-abs(ftcoord.x*2.0-1.0))*strokeMult) * min(1.0, ftcoord.y);\n"
 		"}\n"
 		"#endif\n"
+		"#endif\n"
 		"\n"
 		"void main(void) {\n"
 		"   vec4 result;\n"
+		"#if SHADER_TYPE == 2\n"		// Stencil fill
+		"	result = vec4(1,1,1,1);\n"
+		"#else\n"
+		"#ifdef SCISSOR\n"
 		"	float scissor = scissorMask(fpos);\n"
+		"#else\n"
+		"	float scissor = 1.0;\n"
+		"#endif\n"
 		"#ifdef EDGE_AA\n"
 		"	float strokeAlpha = strokeMask();\n"
+		"#ifdef STROKE_THR\n"
 		"	if (strokeAlpha < strokeThr) discard;\n"
+		"#endif\n"
 		"#else\n"
 		"	float strokeAlpha = 1.0;\n"
 		"#endif\n"
-		"	if (type == 0) {			// Gradient\n"
-		"		// Calculate gradient color using box gradient\n"
-		"		vec2 pt = (paintMat * vec3(fpos,1.0)).xy;\n"
-		"		float d = clamp((sdroundrect(pt, extent, radius) + feather*0.5) / feather, 0.0, 1.0);\n"
-		"		vec4 color = mix(innerCol,outerCol,d);\n"
-		"		// Combine alpha\n"
-		"		color *= strokeAlpha * scissor;\n"
-		"		result = color;\n"
-		"	} else if (type == 1) {		// Image\n"
-		"		// Calculate color fron texture\n"
-		"		vec2 pt = (paintMat * vec3(fpos,1.0)).xy / extent;\n"
+		"#if SHADER_TYPE == 0\n"		// Gradient
+		"	// Calculate gradient color using box gradient\n"
+		"	vec2 pt = (paintMat * vec3(fpos,1.0)).xy;\n"
+		"	float d = clamp((sdroundrect(pt, extent, radius) + feather*0.5) / feather, 0.0, 1.0);\n"
+		"	vec4 color = mix(innerCol,outerCol,d);\n"
+		"	// Multi-stop gradient, sample the row of the ramp texture\n"
+		"	if (texType != 0) {\n"
 		"#ifdef NANOVG_GL3\n"
-		"		vec4 color = texture(tex, pt);\n"
+		"		color = texture(tex, vec2(rampCoord.x + d*rampCoord.y, rampCoord.z)) * innerCol;\n"
 		"#else\n"
-		"		vec4 color = texture2D(tex, pt);\n"
+		"		color = texture2D(tex, vec2(rampCoord.x + d*rampCoord.y, rampCoord.z)) * innerCol;\n"
 		"#endif\n"
-		"		if (texType == 1) color = vec4(color.xyz*color.w,color.w);"
-		"		if (texType == 2) color = vec4(color.x);"
-		"		if (texType == 3 && color.a == 0.0) discard;"
-		"		// Apply color tint and alpha.\n"
-		"		color *= innerCol;\n"
-		"		// Combine alpha\n"
-		"		color *= strokeAlpha * scissor;\n"
-		"		result = color;\n"
-		"	} else if (type == 2) {		// Stencil fill\n"
-		"		result = vec4(1,1,1,1);\n"
-		"	} else if (type == 3) {		// Textured tris\n"
+		"	}\n"
+		"	// Combine alpha\n"
+		"	color *= strokeAlpha * scissor;\n"
+		"	result = color;\n"
+		"#elif SHADER_TYPE == 1\n"	// Image
+		"	// Calculate color fron texture\n"
+		"	vec2 pt = (paintMat * vec3(fpos,1.0)).xy / extent;\n"
+		"	// Wrap to the sub-rectangle of an atlased image\n"
+		"	if (atlasRect.z > 0.0) pt = atlasRect.xy + mix(clamp(pt, 0.0, 1.0), fract(pt), atlasRepeat) * atlasRect.zw;\n"
 		"#ifdef NANOVG_GL3\n"
-		"		vec4 color = texture(tex, ftcoord);\n"
+		"	vec4 color = texture(tex, pt);\n"
 		"#else\n"
-		"		vec4 color = texture2D(tex, ftcoord);\n"
+		"	vec4 color = texture2D(tex, pt);\n"
+		"#endif\n"
+		"	if (texType == 1) color = vec4(color.xyz*color.w,color.w);"
+		"	if (texType == 2) color = vec4(color.x);"
+		"	if (texType == 3 && color.a == 0.0) discard;"
+		"	// Apply color tint and alpha.\n"
+		"	color *= innerCol;\n"
+		"	// Combine alpha\n"
+		"	color *= strokeAlpha * scissor;\n"
+		"	result = color;\n"
+		"#elif SHADER_TYPE == 3\n"	// Textured tris
+		"#ifdef NANOVG_GL3\n"
+		"	vec4 color = texture(tex, ftcoord);\n"
+		"#else\n"
+		"	vec4 color = texture2D(tex, ftcoord);\n"
+		"#endif\n"
+		"	if (texType == 1) color = vec4(color.xyz*color.w,color.w);"
+		"	if (texType == 2) color = vec4(color.x);"
+		"	color *= scissor;\n"
+		"	result = color * innerCol;\n"
+		"#else\n"					// Solid color
+		"	result = innerCol * (strokeAlpha * scissor);\n"
+		"#endif\n"
 		"#endif\n"
-		"		if (texType == 1) color = vec4(color.xyz*color.w,color.w);"
-		"		if (texType == 2) color = vec4(color.x);"
-		"		color *= scissor;\n"
-		"		result = color * innerCol;\n"
-		"	}\n"
 		"#ifdef NANOVG_GL3\n"
 		"	outColor = result;\n"
 		"#else\n"
@@ -682,16 +1358,39 @@ static int glnvg__renderCreate(void* uptr)
 
 	glnvg__checkError(gl, "init");
 
-	if (gl->flags & NVG_ANTIALIAS) {
-		if (glnvg__createShader(&gl->shader, "shader", shaderHeader, "#define EDGE_AA 1\n", fillVertShader, fillFragShader) == 0)
-			return 0;
-	} else {
-		if (glnvg__createShader(&gl->shader, "shader", shaderHeader, NULL, fillVertShader, fillFragShader) == 0)
+	// Compile specialized program for each shader type and variant.
+	for (i = 0; i < NSVG_SHADER_COUNT * GLNVG_VARIANT_COUNT; i++) {
+		GLNVGshader* shader = &gl->shaders[i];
+		const char* vertShader = fillVertShader;
+		int type = i / GLNVG_VARIANT_COUNT, variant = i % GLNVG_VARIANT_COUNT;
+		if (glnvg__shaderIndex(gl, type, variant) != i) continue;
+#if NANOVG_GL_USE_INSTANCING
+		if (variant & GLNVG_VARIANT_SEGMENTS)
+			vertShader = segmentVertShader;
+#endif
+		snprintf(opts, sizeof(opts), "#define SHADER_TYPE %d\n%s%s%s%s%s", type,
+			(gl->flags & NVG_ANTIALIAS) ? "#define EDGE_AA 1\n" : "",
+			(variant & GLNVG_VARIANT_SCISSOR) ? "#define SCISSOR 1\n" : "",
+			(variant & GLNVG_VARIANT_STROKETHR) ? "#define STROKE_THR 1\n" : "",
+			(variant & GLNVG_VARIANT_SEGMENTS) ? "#define SEGMENTS 1\n" : "",
+			(variant & GLNVG_VARIANT_SHAPE) ? "#define SHAPE 1\n" : "");
+		if (glnvg__createShader(shader, "shader", shaderHeader, opts, vertShader, fillFragShader) == 0)
 			return 0;
-	}
 
-	glnvg__checkError(gl, "uniform locations");
-	glnvg__getUniforms(&gl->shader);
+		glnvg__checkError(gl, "uniform locations");
+		glnvg__getUniforms(shader);
+		shader->fragCount = glnvg__fragUniformCount(type, variant);
+
+		// Texture unit is the same for all draws.
+		glUseProgram(shader->prog);
+		glUniform1i(shader->loc[GLNVG_LOC_TEX], 0);
+		glUseProgram(0);
+
+#if NANOVG_GL_USE_UNIFORMBUFFER
+		if (shader->loc[GLNVG_LOC_FRAG] != (GLint)GL_INVALID_INDEX)
+			glUniformBlockBinding(shader->prog, shader->loc[GLNVG_LOC_FRAG], GLNVG_FRAG_BINDING);
+#endif
+	}
 
 	// Create dynamic vertex array
 #if defined NANOVG_GL3
@@ -701,7 +1400,6 @@ static int glnvg__renderCreate(void* uptr)
 
 #if NANOVG_GL_USE_UNIFORMBUFFER
 	// Create UBOs
-	glUniformBlockBinding(gl->shader.prog, gl->shader.loc[GLNVG_LOC_FRAG], GLNVG_FRAG_BINDING);
 	glGenBuffers(1, &gl->fragBuf);
 	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
 #endif
@@ -718,13 +1416,9 @@ static int glnvg__renderCreate(void* uptr)
 	return 1;
 }
 
-static int glnvg__renderCreateTexture(void* uptr, int type, int w, int h, int imageFlags, const unsigned char* data)
+// Specifies the size, contents and sampling of a texture.
+static void glnvg__initTexture(GLNVGcontext* gl, GLNVGtexture* tex, int type, int w, int h, int imageFlags, const unsigned char* data)
 {
-	GLNVGcontext* gl = (GLNVGcontext*)uptr;
-	GLNVGtexture* tex = glnvg__allocTexture(gl);
-
-	if (tex == NULL) return 0;
-
 #ifdef NANOVG_GLES2
 	// Check for non-power of 2.
 	if (glnvg__nearestPow2(w) != (unsigned int)w || glnvg__nearestPow2(h) != (unsigned int)h) {
@@ -741,7 +1435,6 @@ static int glnvg__renderCreateTexture(void* uptr, int type, int w, int h, int im
 	}
 #endif
 
-	glGenTextures(1, &tex->tex);
 	tex->width = w;
 	tex->height = h;
 	tex->type = type;
@@ -817,10 +1510,98 @@ static int glnvg__renderCreateTexture(void* uptr, int type, int w, int h, int im
 	}
 #endif
 
-	glnvg__checkError(gl, "create tex");
-	glnvg__bindTexture(gl, 0);
+	glnvg__checkError(gl, "create tex");
+	glnvg__bindTexture(gl, 0);
+
+	glnvg__setTextureBytes(gl, tex, glnvg__textureBytes(tex));
+}
+
+// Evicts least recently drawn reloadable images until the images fit in the budget.
+// Images drawn in the current frame are not evicted.
+static void glnvg__evictTextures(GLNVGcontext* gl)
+{
+	if (gl->textureBudget == 0) return;
+	while (gl->textureBytes > gl->textureBudget && gl->lruTail != 0) {
+		GLNVGtexture* tex = &gl->textures[gl->lruTail-1];
+		if (tex->lastUse == gl->frame) break;
+		glnvg__lruRemove(gl, tex);
+		glnvg__releaseTexture(gl, tex);
+		tex->evicted = 1;
+	}
+}
+
+// Allocates the texture of an evicted image again, its contents are undefined.
+static void glnvg__restoreTexture(GLNVGcontext* gl, GLNVGtexture* tex)
+{
+	if (glnvg__atlasAlloc(gl, tex, tex->type, tex->width, tex->height, tex->flags, NULL) == 0) {
+		glGenTextures(1, &tex->tex);
+		glnvg__initTexture(gl, tex, tex->type, tex->width, tex->height, tex->flags, NULL);
+	}
+	tex->evicted = 0;
+	tex->lastUse = gl->frame;
+	glnvg__lruPushFront(gl, tex);
+}
+
+// Marks the image as drawn in the current frame, reloading it if it was evicted.
+// Returns the texture, which may have moved if the reload callback created images.
+static GLNVGtexture* glnvg__useTexture(GLNVGcontext* gl, GLNVGtexture* tex)
+{
+	int id = tex->id;
+	tex->lastUse = gl->frame;
+	if (tex->reload == NULL)
+		return tex;
+	if (tex->evicted) {
+		glnvg__restoreTexture(gl, tex);
+		tex->reload(tex->reloadUserPtr, id);
+		glnvg__evictTextures(gl);
+		return glnvg__findTexture(gl, id);
+	}
+	glnvg__lruRemove(gl, tex);
+	glnvg__lruPushFront(gl, tex);
+	return tex;
+}
+
+static int glnvg__renderCreateTexture(void* uptr, int type, int w, int h, int imageFlags, const unsigned char* data)
+{
+	GLNVGcontext* gl = (GLNVGcontext*)uptr;
+	GLNVGtexture* tex = glnvg__allocTexture(gl);
+
+	if (tex == NULL) return 0;
+
+	if (glnvg__atlasAlloc(gl, tex, type, w, h, imageFlags, data) == 0) {
+		glGenTextures(1, &tex->tex);
+		glnvg__initTexture(gl, tex, type, w, h, imageFlags, data);
+	}
+	glnvg__evictTextures(gl);
+
+	return tex->id;
+}
+
+static int glnvg__renderResizeTexture(void* uptr, int image, int w, int h, const unsigned char* data)
+{
+	GLNVGcontext* gl = (GLNVGcontext*)uptr;
+	GLNVGtexture* tex = glnvg__findTexture(gl, image);
+
+	if (tex == NULL) return 0;
 
-	return tex->id;
+	if (tex->evicted) {
+		tex->evicted = 0;
+		tex->lastUse = gl->frame;
+		glnvg__lruPushFront(gl, tex);
+	}
+	if (tex->atlas != 0 || tex->tex == 0) {
+		if (tex->atlas != 0)
+			glnvg__atlasFree(gl, tex);
+		if (glnvg__atlasAlloc(gl, tex, tex->type, w, h, tex->flags, data) == 0) {
+			glGenTextures(1, &tex->tex);
+			glnvg__initTexture(gl, tex, tex->type, w, h, tex->flags, data);
+		}
+	} else {
+		glnvg__initTexture(gl, tex, tex->type, w, h, tex->flags, data);
+	}
+	glnvg__evictTextures(gl);
+
+	return 1;
 }
 
 
@@ -836,6 +1617,13 @@ static int glnvg__renderUpdateTexture(void* uptr, int image, int x, int y, int w
 	GLNVGtexture* tex = glnvg__findTexture(gl, image);
 
 	if (tex == NULL) return 0;
+	if (tex->evicted) {
+		glnvg__restoreTexture(gl, tex);
+		glnvg__evictTextures(gl);
+	}
+	// The data is the whole image, the border of an atlased image is updated with it.
+	if (tex->atlas != 0)
+		return glnvg__atlasUpload(gl, tex, data);
 	glnvg__bindTexture(gl, tex->tex);
 
 	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
@@ -939,9 +1727,23 @@ static int glnvg__convertPaint(GLNVGcontext* gl, GLNVGfragUniforms* frag, NVGpai
 	frag->strokeMult = (width*0.5f + fringe*0.5f) / fringe;
 	frag->strokeThr = strokeThr;
 
-	if (paint->image != 0) {
+	if (paint->ramp > 0) {
+		// Multi-stop gradient, the colors are sampled from a row of the ramp texture.
+		tex = glnvg__findTexture(gl, paint->image);
+		if (tex == NULL) return 0;
+		tex = glnvg__useTexture(gl, tex);
+		if (tex == NULL) return 0;
+		frag->type = NSVG_SHADER_FILLGRAD;
+		frag->texType = 1;
+		frag->radius = paint->radius;
+		frag->feather = paint->feather;
+		frag->outerCol = nvgRGBAf(0.5f / tex->width, (tex->width - 1.0f) / tex->width, (paint->ramp - 0.5f) / tex->height, 0.0f);
+		nvgTransformInverse(invxform, paint->xform);
+	} else if (paint->image != 0) {
 		tex = glnvg__findTexture(gl, paint->image);
 		if (tex == NULL) return 0;
+		tex = glnvg__useTexture(gl, tex);
+		if (tex == NULL) return 0;
 		if ((tex->flags & NVG_IMAGE_FLIPY) != 0) {
 			float m1[6], m2[6];
 			nvgTransformTranslate(m1, 0.0f, frag->extent[1] * 0.5f);
@@ -974,6 +1776,17 @@ static int glnvg__convertPaint(GLNVGcontext* gl, GLNVGfragUniforms* frag, NVGpai
 			frag->texType = 2.0f;
 		#endif
 //		printf("frag->texType = %d\n", frag->texType);
+		if (tex->atlas != 0) {
+			float s = 1.0f / NANOVG_GL_ATLAS_SIZE;
+			frag->outerCol = nvgRGBAf(tex->x*s, tex->y*s, tex->width*s, tex->height*s);
+			frag->radius = (tex->flags & NVG_IMAGE_REPEATX) ? 1.0f : 0.0f;
+			frag->feather = (tex->flags & NVG_IMAGE_REPEATY) ? 1.0f : 0.0f;
+		} else {
+			memset(&frag->outerCol, 0, sizeof(frag->outerCol));
+		}
+	} else if (memcmp(&frag->innerCol, &frag->outerCol, sizeof(frag->innerCol)) == 0) {
+		frag->type = NSVG_SHADER_FILLCOLOR;
+		nvgTransformInverse(invxform, paint->xform);
 	} else {
 		frag->type = NSVG_SHADER_FILLGRAD;
 		frag->radius = paint->radius;
@@ -988,14 +1801,47 @@ static int glnvg__convertPaint(GLNVGcontext* gl, GLNVGfragUniforms* frag, NVGpai
 
 static GLNVGfragUniforms* nvg__fragUniformPtr(GLNVGcontext* gl, int i);
 
-static void glnvg__setUniforms(GLNVGcontext* gl, int uniformOffset, int image)
+static GLNVGshader* glnvg__selectShader(GLNVGcontext* gl, const GLNVGfragUniforms* frag, int variant)
+{
+	GLNVGshader* shader;
+	// Scissor matrix is all zeros when scissoring is disabled.
+	if (frag->scissorMat[10] != 0.0f)
+		variant |= GLNVG_VARIANT_SCISSOR;
+	if (frag->strokeThr >= 0.0f)
+		variant |= GLNVG_VARIANT_STROKETHR;
+	shader = &gl->shaders[glnvg__shaderIndex(gl, (int)frag->type, variant)];
+
+	glnvg__useProgram(gl, shader->prog);
+	if (shader->view[0] != gl->view[0] || shader->view[1] != gl->view[1]) {
+		shader->view[0] = gl->view[0];
+		shader->view[1] = gl->view[1];
+		glUniform2fv(shader->loc[GLNVG_LOC_VIEWSIZE], 1, gl->view);
+	}
+	return shader;
+}
+
+static GLNVGshader* glnvg__setUniforms(GLNVGcontext* gl, int uniformOffset, int image, int variant)
 {
 	GLNVGtexture* tex = NULL;
+	GLNVGfragUniforms* frag = nvg__fragUniformPtr(gl, uniformOffset);
+	GLNVGshader* shader = glnvg__selectShader(gl, frag, variant);
 #if NANOVG_GL_USE_UNIFORMBUFFER
-	glBindBufferRange(GL_UNIFORM_BUFFER, GLNVG_FRAG_BINDING, gl->fragBuf, uniformOffset, sizeof(GLNVGfragUniforms));
+	if (shader->fragCount > 0) {
+#if NANOVG_GL_USE_STATE_FILTER
+		if (gl->boundFragOffset != uniformOffset) {
+			gl->boundFragOffset = uniformOffset;
+			glBindBufferRange(GL_UNIFORM_BUFFER, GLNVG_FRAG_BINDING, gl->fragBuf, uniformOffset, sizeof(GLNVGfragUniforms));
+		}
 #else
-	GLNVGfragUniforms* frag = nvg__fragUniformPtr(gl, uniformOffset);
-	glUniform4fv(gl->shader.loc[GLNVG_LOC_FRAG], NANOVG_GL_UNIFORMARRAY_SIZE, &(frag->uniformArray[0][0]));
+		glBindBufferRange(GL_UNIFORM_BUFFER, GLNVG_FRAG_BINDING, gl->fragBuf, uniformOffset, sizeof(GLNVGfragUniforms));
+#endif
+	}
+#else
+	// Upload only the part of the uniforms used by the shader, and only when they have changed.
+	if (shader->fragCount > 0 && shader->fragOffset != uniformOffset) {
+		shader->fragOffset = uniformOffset;
+		glUniform4fv(shader->loc[GLNVG_LOC_FRAG], shader->fragCount, &(frag->uniformArray[0][0]));
+	}
 #endif
 
 	if (image != 0) {
@@ -1007,6 +1853,7 @@ static void glnvg__setUniforms(GLNVGcontext* gl, int uniformOffset, int image)
 	}
 	glnvg__bindTexture(gl, tex != NULL ? tex->tex : 0);
 	glnvg__checkError(gl, "tex paint tex");
+	return shader;
 }
 
 static void glnvg__renderViewport(void* uptr, float width, float height, float devicePixelRatio)
@@ -1029,7 +1876,7 @@ static void glnvg__fill(GLNVGcontext* gl, GLNVGcall* call)
 	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
 	// set bindpoint for solid loc
-	glnvg__setUniforms(gl, call->uniformOffset, 0);
+	glnvg__setUniforms(gl, call->uniformOffset, 0, 0);
 	glnvg__checkError(gl, "fill simple");
 
 	glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
@@ -1042,7 +1889,7 @@ static void glnvg__fill(GLNVGcontext* gl, GLNVGcall* call)
 	// Draw anti-aliased pixels
 	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
-	glnvg__setUniforms(gl, call->uniformOffset + gl->fragSize, call->image);
+	glnvg__setUniforms(gl, call->uniformOffset + gl->fragSize, call->image, 0);
 	glnvg__checkError(gl, "fill fill");
 
 	if (gl->flags & NVG_ANTIALIAS) {
@@ -1066,7 +1913,7 @@ static void glnvg__convexFill(GLNVGcontext* gl, GLNVGcall* call)
 	GLNVGpath* paths = &gl->paths[call->pathOffset];
 	int i, npaths = call->pathCount;
 
-	glnvg__setUniforms(gl, call->uniformOffset, call->image);
+	glnvg__setUniforms(gl, call->uniformOffset, call->image, 0);
 	glnvg__checkError(gl, "convex fill");
 
 	for (i = 0; i < npaths; i++) {
@@ -1078,6 +1925,23 @@ static void glnvg__convexFill(GLNVGcontext* gl, GLNVGcall* call)
 	}
 }
 
+static void glnvg__triangulatedFill(GLNVGcontext* gl, GLNVGcall* call)
+{
+	GLNVGpath* paths = &gl->paths[call->pathOffset];
+	int i, npaths = call->pathCount;
+
+	glnvg__setUniforms(gl, call->uniformOffset, call->image, 0);
+	glnvg__checkError(gl, "triangulated fill");
+
+	for (i = 0; i < npaths; i++) {
+		if (paths[i].fillCount > 0)
+			glDrawArrays(GL_TRIANGLES, paths[i].fillOffset, paths[i].fillCount);
+		// Draw fringes
+		if (paths[i].strokeCount > 0)
+			glDrawArrays(GL_TRIANGLE_STRIP, paths[i].strokeOffset, paths[i].strokeCount);
+	}
+}
+
 static void glnvg__convexFillStencil(GLNVGcontext* gl, GLNVGcall* call)
 {
 	glEnable(GL_STENCIL_TEST);
@@ -1097,11 +1961,52 @@ static void glnvg__convexFillStencilClear(GLNVGcontext* gl, GLNVGcall* call)
 	glDisable(GL_STENCIL_TEST);
 }
 
-static void glnvg__stroke(GLNVGcontext* gl, GLNVGcall* call)
+static void glnvg__drawStrokes(GLNVGcontext* gl, GLNVGcall* call, GLNVGshader* shader)
 {
 	GLNVGpath* paths = &gl->paths[call->pathOffset];
 	int npaths = call->pathCount, i;
 
+#if NANOVG_GL_USE_INSTANCING
+	if (call->segments) {
+		int j;
+		if (memcmp(shader->strokeParams, call->strokeParams, sizeof(call->strokeParams)) != 0) {
+			memcpy(shader->strokeParams, call->strokeParams, sizeof(call->strokeParams));
+			glUniform4fv(shader->loc[GLNVG_LOC_STROKE], 1, call->strokeParams);
+		}
+		// Each instance reads the end points of its segment and the points before and after it,
+		// the texture coordinates hold the directions bisecting the joints.
+		for (j = 0; j < 4; j++) {
+			glEnableVertexAttribArray(2+j);
+			glVertexAttribDivisor(2+j, 1);
+		}
+		for (i = 0; i < npaths; i++) {
+			if (paths[i].strokeCount == 0) continue;
+			for (j = 0; j < 4; j++)
+				glVertexAttribPointer(2+j, 4, GL_FLOAT, GL_FALSE, sizeof(NVGvertex), (const GLvoid*)((size_t)(paths[i].strokeOffset+j) * sizeof(NVGvertex)));
+			glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, paths[i].strokeCount);
+		}
+		for (j = 0; j < 4; j++) {
+			glVertexAttribDivisor(2+j, 0);
+			glDisableVertexAttribArray(2+j);
+		}
+		return;
+	}
+#else
+	NVG_NOTUSED(shader);
+#endif
+	for (i = 0; i < npaths; i++)
+		glDrawArrays(GL_TRIANGLE_STRIP, paths[i].strokeOffset, paths[i].strokeCount);
+}
+
+static void glnvg__stroke(GLNVGcontext* gl, GLNVGcall* call)
+{
+	GLNVGshader* shader;
+#if NANOVG_GL_USE_INSTANCING
+	int variant = call->segments ? GLNVG_VARIANT_SEGMENTS : 0;
+#else
+	int variant = 0;
+#endif
+
 	if (gl->flags & NVG_STENCIL_STROKES) {
 
 		glEnable(GL_STENCIL_TEST);
@@ -1110,25 +2015,22 @@ static void glnvg__stroke(GLNVGcontext* gl, GLNVGcall* call)
 		// Fill the stroke base without overlap
 		glnvg__stencilFunc(gl, GL_EQUAL, 0x0, 0xff);
 		glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
-		glnvg__setUniforms(gl, call->uniformOffset + gl->fragSize, call->image);
+		shader = glnvg__setUniforms(gl, call->uniformOffset + gl->fragSize, call->image, variant);
 		glnvg__checkError(gl, "stroke fill 0");
-		for (i = 0; i < npaths; i++)
-			glDrawArrays(GL_TRIANGLE_STRIP, paths[i].strokeOffset, paths[i].strokeCount);
+		glnvg__drawStrokes(gl, call, shader);
 
 		// Draw anti-aliased pixels.
-		glnvg__setUniforms(gl, call->uniformOffset, call->image);
+		shader = glnvg__setUniforms(gl, call->uniformOffset, call->image, variant);
 		glnvg__stencilFunc(gl, GL_EQUAL, 0x00, 0xff);
 		glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-		for (i = 0; i < npaths; i++)
-			glDrawArrays(GL_TRIANGLE_STRIP, paths[i].strokeOffset, paths[i].strokeCount);
+		glnvg__drawStrokes(gl, call, shader);
 
 		// Clear stencil buffer.
 		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 		glnvg__stencilFunc(gl, GL_ALWAYS, 0x0, 0xff);
 		glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
 		glnvg__checkError(gl, "stroke fill 1");
-		for (i = 0; i < npaths; i++)
-			glDrawArrays(GL_TRIANGLE_STRIP, paths[i].strokeOffset, paths[i].strokeCount);
+		glnvg__drawStrokes(gl, call, shader);
 		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
 		glDisable(GL_STENCIL_TEST);
@@ -1136,28 +2038,43 @@ static void glnvg__stroke(GLNVGcontext* gl, GLNVGcall* call)
 //		glnvg__convertPaint(gl, nvg__fragUniformPtr(gl, call->uniformOffset + gl->fragSize), paint, scissor, strokeWidth, fringe, 1.0f - 0.5f/255.0f);
 
 	} else {
-		glnvg__setUniforms(gl, call->uniformOffset, call->image);
+		shader = glnvg__setUniforms(gl, call->uniformOffset, call->image, variant);
 		glnvg__checkError(gl, "stroke fill");
 		// Draw Strokes
-		for (i = 0; i < npaths; i++)
-			glDrawArrays(GL_TRIANGLE_STRIP, paths[i].strokeOffset, paths[i].strokeCount);
+		glnvg__drawStrokes(gl, call, shader);
 	}
 }
 
+static void glnvg__shape(GLNVGcontext* gl, GLNVGcall* call)
+{
+	glnvg__setUniforms(gl, call->uniformOffset, call->image, GLNVG_VARIANT_SHAPE);
+	glnvg__checkError(gl, "shape fill");
+
+	glDrawArrays(GL_TRIANGLE_STRIP, call->triangleOffset, call->triangleCount);
+}
+
 static void glnvg__triangles(GLNVGcontext* gl, GLNVGcall* call)
 {
-	glnvg__setUniforms(gl, call->uniformOffset, call->image);
+	glnvg__setUniforms(gl, call->uniformOffset, call->image, 0);
 	glnvg__checkError(gl, "triangles fill");
 
 	glDrawArrays(GL_TRIANGLES, call->triangleOffset, call->triangleCount);
 }
 
+static void glnvg__resetFragUniformHash(GLNVGcontext* gl)
+{
+	if (gl->nuniformHash > 0)
+		memset(gl->uniformHash, 0xff, sizeof(GLNVGuniformEntry) * gl->cuniformHash);
+	gl->nuniformHash = 0;
+}
+
 static void glnvg__renderCancel(void* uptr) {
 	GLNVGcontext* gl = (GLNVGcontext*)uptr;
 	gl->nverts = 0;
 	gl->npaths = 0;
 	gl->ncalls = 0;
 	gl->nuniforms = 0;
+	glnvg__resetFragUniformHash(gl);
 }
 
 static GLenum glnvg_convertBlendFuncFactor(int factor)
@@ -1212,8 +2129,6 @@ static void glnvg__renderFlush(void* uptr)
 	if (gl->ncalls > 0) {
 
 		// Setup require GL state.
-		glUseProgram(gl->shader.prog);
-
 		glEnable(GL_CULL_FACE);
 		glCullFace(GL_BACK);
 		glFrontFace(GL_CCW);
@@ -1226,7 +2141,12 @@ static void glnvg__renderFlush(void* uptr)
 		glStencilFunc(GL_ALWAYS, 0, 0xffffffff);
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, 0);
+		glUseProgram(0);
+		for (i = 0; i < NSVG_SHADER_COUNT * GLNVG_VARIANT_COUNT; i++)
+			gl->shaders[i].fragOffset = -1;
 		#if NANOVG_GL_USE_STATE_FILTER
+		gl->currentProgram = 0;
+		gl->boundFragOffset = -1;
 		gl->boundTexture = 0;
 		gl->stencilMask = 0xffffffff;
 		gl->stencilFunc = GL_ALWAYS;
@@ -1255,10 +2175,6 @@ static void glnvg__renderFlush(void* uptr)
 		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(NVGvertex), (const GLvoid*)(size_t)0);
 		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(NVGvertex), (const GLvoid*)(0 + 2*sizeof(float)));
 
-		// Set view and texture just once per frame.
-		glUniform1i(gl->shader.loc[GLNVG_LOC_TEX], 0);
-		glUniform2fv(gl->shader.loc[GLNVG_LOC_VIEWSIZE], 1, gl->view);
-
 #if NANOVG_GL_USE_UNIFORMBUFFER
 		glBindBuffer(GL_UNIFORM_BUFFER, gl->fragBuf);
 #endif
@@ -1278,6 +2194,10 @@ static void glnvg__renderFlush(void* uptr)
 				glnvg__convexFillStencil(gl, call);
 			else if (call->type == GLNVG_CONVEXFILL_STENCIL_CLEAR)
 				glnvg__convexFillStencilClear(gl, call);
+			else if (call->type == GLNVG_TRIANGULATEDFILL)
+				glnvg__triangulatedFill(gl, call);
+			else if (call->type == GLNVG_SHAPE)
+				glnvg__shape(gl, call);
 		}
 
 		glDisableVertexAttribArray(0);
@@ -1287,7 +2207,7 @@ static void glnvg__renderFlush(void* uptr)
 #endif
 		glDisable(GL_CULL_FACE);
 			glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glUseProgram(0);
+		glnvg__useProgram(gl, 0);
 		glnvg__bindTexture(gl, 0);
 	}
 
@@ -1296,6 +2216,10 @@ static void glnvg__renderFlush(void* uptr)
 	gl->npaths = 0;
 	gl->ncalls = 0;
 	gl->nuniforms = 0;
+	glnvg__resetFragUniformHash(gl);
+
+	glnvg__evictTextures(gl);
+	gl->frame++;
 }
 
 static int glnvg__maxVertCount(const NVGpath* paths, int npaths)
@@ -1314,7 +2238,7 @@ static GLNVGcall* glnvg__allocCall(GLNVGcontext* gl)
 	if (gl->ncalls+1 > gl->ccalls) {
 		GLNVGcall* calls;
 		int ccalls = glnvg__maxi(gl->ncalls+1, 128) + gl->ccalls/2; // 1.5x Overallocate
-		calls = (GLNVGcall*)realloc(gl->calls, sizeof(GLNVGcall) * ccalls);
+		calls = (GLNVGcall*)nvgInternalRealloc(&gl->allocator, gl->calls, sizeof(GLNVGcall) * ccalls);
 		if (calls == NULL) return NULL;
 		gl->calls = calls;
 		gl->ccalls = ccalls;
@@ -1330,7 +2254,7 @@ static int glnvg__allocPaths(GLNVGcontext* gl, int n)
 	if (gl->npaths+n > gl->cpaths) {
 		GLNVGpath* paths;
 		int cpaths = glnvg__maxi(gl->npaths + n, 128) + gl->cpaths/2; // 1.5x Overallocate
-		paths = (GLNVGpath*)realloc(gl->paths, sizeof(GLNVGpath) * cpaths);
+		paths = (GLNVGpath*)nvgInternalRealloc(&gl->allocator, gl->paths, sizeof(GLNVGpath) * cpaths);
 		if (paths == NULL) return -1;
 		gl->paths = paths;
 		gl->cpaths = cpaths;
@@ -1346,7 +2270,7 @@ static int glnvg__allocVerts(GLNVGcontext* gl, int n)
 	if (gl->nverts+n > gl->cverts) {
 		NVGvertex* verts;
 		int cverts = glnvg__maxi(gl->nverts + n, 4096) + gl->cverts/2; // 1.5x Overallocate
-		verts = (NVGvertex*)realloc(gl->verts, sizeof(NVGvertex) * cverts);
+		verts = (NVGvertex*)nvgInternalRealloc(&gl->allocator, gl->verts, sizeof(NVGvertex) * cverts);
 		if (verts == NULL) return -1;
 		gl->verts = verts;
 		gl->cverts = cverts;
@@ -1362,7 +2286,7 @@ static int glnvg__allocFragUniforms(GLNVGcontext* gl, int n)
 	if (gl->nuniforms+n > gl->cuniforms) {
 		unsigned char* uniforms;
 		int cuniforms = glnvg__maxi(gl->nuniforms+n, 128) + gl->cuniforms/2; // 1.5x Overallocate
-		uniforms = (unsigned char*)realloc(gl->uniforms, structSize * cuniforms);
+		uniforms = (unsigned char*)nvgInternalRealloc(&gl->allocator, gl->uniforms, structSize * cuniforms);
 		if (uniforms == NULL) return -1;
 		gl->uniforms = uniforms;
 		gl->cuniforms = cuniforms;
@@ -1377,6 +2301,80 @@ static GLNVGfragUniforms* nvg__fragUniformPtr(GLNVGcontext* gl, int i)
 	return (GLNVGfragUniforms*)&gl->uniforms[i];
 }
 
+static unsigned int glnvg__hashFragUniforms(GLNVGcontext* gl, int offset, int n)
+{
+	// FNV-1a
+	unsigned int h = 2166136261u;
+	int i, j;
+	for (i = 0; i < n; i++) {
+		const unsigned char* data = &gl->uniforms[offset + i * gl->fragSize];
+		for (j = 0; j < (int)sizeof(GLNVGfragUniforms); j++)
+			h = (h ^ data[j]) * 16777619u;
+	}
+	return h;
+}
+
+static int glnvg__equalFragUniforms(GLNVGcontext* gl, int a, int b, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		if (memcmp(&gl->uniforms[a + i * gl->fragSize], &gl->uniforms[b + i * gl->fragSize], sizeof(GLNVGfragUniforms)) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+static void glnvg__insertFragUniformHash(GLNVGcontext* gl, unsigned int hash, int offset, int n)
+{
+	int mask = gl->cuniformHash - 1;
+	int idx = (int)(hash & (unsigned int)mask);
+	while (gl->uniformHash[idx].offset != -1)
+		idx = (idx + 1) & mask;
+	gl->uniformHash[idx].hash = hash;
+	gl->uniformHash[idx].offset = offset;
+	gl->uniformHash[idx].count = n;
+	gl->nuniformHash++;
+}
+
+// Shares the last n allocated uniforms with an identical earlier allocation within the frame.
+// Returns offset of the uniforms to use.
+static int glnvg__shareFragUniforms(GLNVGcontext* gl, int offset, int n)
+{
+	unsigned int hash = glnvg__hashFragUniforms(gl, offset, n);
+	int i, mask;
+
+	if ((gl->nuniformHash+1) * 2 > gl->cuniformHash) {
+		// Grow and rehash, keep load factor below 0.5.
+		GLNVGuniformEntry* old = gl->uniformHash;
+		int cold = gl->cuniformHash;
+		int chash = glnvg__maxi(cold * 2, 256);
+		GLNVGuniformEntry* entries = (GLNVGuniformEntry*)nvgInternalAlloc(&gl->allocator, sizeof(GLNVGuniformEntry) * chash);
+		if (entries == NULL) return offset;
+		memset(entries, 0xff, sizeof(GLNVGuniformEntry) * chash);
+		gl->uniformHash = entries;
+		gl->cuniformHash = chash;
+		gl->nuniformHash = 0;
+		for (i = 0; i < cold; i++) {
+			if (old[i].offset != -1)
+				glnvg__insertFragUniformHash(gl, old[i].hash, old[i].offset, old[i].count);
+		}
+		nvgInternalFree(&gl->allocator, old);
+	}
+
+	mask = gl->cuniformHash - 1;
+	for (i = (int)(hash & (unsigned int)mask); gl->uniformHash[i].offset != -1; i = (i + 1) & mask) {
+		GLNVGuniformEntry* e = &gl->uniformHash[i];
+		if (e->hash == hash && e->count == n && glnvg__equalFragUniforms(gl, e->offset, offset, n)) {
+			// Release the new copy.
+			gl->nuniforms -= n;
+			return e->offset;
+		}
+	}
+
+	glnvg__insertFragUniformHash(gl, hash, offset, n);
+	return offset;
+}
+
 static void glnvg__vset(NVGvertex* vtx, float x, float y, float u, float v)
 {
 	vtx->x = x;
@@ -1414,6 +2412,11 @@ static void glnvg__renderFill(void* uptr, NVGpaint* paint, NVGcompositeOperation
 			call->type = GLNVG_CONVEXFILL_STENCIL_CLEAR;
 		call->triangleCount = 0;	// Bounding box fill quad not needed for convex fill
 	}
+	else if (paths[0].triangulated)
+	{
+		call->type = GLNVG_TRIANGULATEDFILL;
+		call->triangleCount = 0;
+	}
 
 	// Allocate vertices for all the paths.
 	maxverts = glnvg__maxVertCount(paths, npaths) + call->triangleCount;
@@ -1457,11 +2460,13 @@ static void glnvg__renderFill(void* uptr, NVGpaint* paint, NVGcompositeOperation
 		frag->type = NSVG_SHADER_SIMPLE;
 		// Fill shader
 		glnvg__convertPaint(gl, nvg__fragUniformPtr(gl, call->uniformOffset + gl->fragSize), paint, scissor, fringe, fringe, -1.0f);
+		call->uniformOffset = glnvg__shareFragUniforms(gl, call->uniformOffset, 2);
 	} else {
 		call->uniformOffset = glnvg__allocFragUniforms(gl, 1);
 		if (call->uniformOffset == -1) goto error;
 		// Fill shader
 		glnvg__convertPaint(gl, nvg__fragUniformPtr(gl, call->uniformOffset), paint, scissor, fringe, fringe, -1.0f);
+		call->uniformOffset = glnvg__shareFragUniforms(gl, call->uniformOffset, 1);
 	}
 
 	return;
@@ -1472,12 +2477,115 @@ error:
 	if (gl->ncalls > 0) gl->ncalls--;
 }
 
+static int glnvg__strokeUniforms(GLNVGcontext* gl, GLNVGcall* call, NVGpaint* paint, NVGscissor* scissor, float fringe, float strokeWidth)
+{
+	if (gl->flags & NVG_STENCIL_STROKES) {
+		// Fill shader
+		call->uniformOffset = glnvg__allocFragUniforms(gl, 2);
+		if (call->uniformOffset == -1) return 0;
+
+		glnvg__convertPaint(gl, nvg__fragUniformPtr(gl, call->uniformOffset), paint, scissor, strokeWidth, fringe, -1.0f);
+		glnvg__convertPaint(gl, nvg__fragUniformPtr(gl, call->uniformOffset + gl->fragSize), paint, scissor, strokeWidth, fringe, 1.0f - 0.5f/255.0f);
+		call->uniformOffset = glnvg__shareFragUniforms(gl, call->uniformOffset, 2);
+
+	} else {
+		// Fill shader
+		call->uniformOffset = glnvg__allocFragUniforms(gl, 1);
+		if (call->uniformOffset == -1) return 0;
+		glnvg__convertPaint(gl, nvg__fragUniformPtr(gl, call->uniformOffset), paint, scissor, strokeWidth, fringe, -1.0f);
+		call->uniformOffset = glnvg__shareFragUniforms(gl, call->uniformOffset, 1);
+	}
+	return 1;
+}
+
 static void glnvg__renderStroke(void* uptr, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor, float fringe,
 								float strokeWidth, const NVGpath* paths, int npaths)
 {
 	GLNVGcontext* gl = (GLNVGcontext*)uptr;
 	GLNVGcall* call = glnvg__allocCall(gl);
-	int i, maxverts, offset;
+	GLNVGpath* copy;
+	NVGvertex* dst;
+	int i, n, maxverts, offset;
+
+	if (call == NULL) return;
+
+	call->type = GLNVG_STROKE;
+	call->pathOffset = glnvg__allocPaths(gl, 1);
+	if (call->pathOffset == -1) goto error;
+	call->pathCount = 1;
+	call->image = paint->image;
+	call->blendFunc = glnvg__blendCompositeOperation(compositeOperation);
+
+	// Allocate vertices for all the paths, and for the degenerate triangles joining them.
+	maxverts = 0;
+	for (i = 0; i < npaths; i++)
+		maxverts += paths[i].nstroke + 3;
+	offset = glnvg__allocVerts(gl, maxverts);
+	if (offset == -1) goto error;
+
+	// Join the strips of all paths into one, so that dashes and other many path strokes are drawn at once.
+	copy = &gl->paths[call->pathOffset];
+	memset(copy, 0, sizeof(GLNVGpath));
+	copy->strokeOffset = offset;
+	dst = &gl->verts[offset];
+	n = 0;
+	for (i = 0; i < npaths; i++) {
+		const NVGpath* path = &paths[i];
+		if (path->nstroke == 0) continue;
+		if (n > 0) {
+			dst[n] = dst[n-1]; n++;
+			dst[n++] = path->stroke[0];
+			// Keep the winding of the next strip.
+			if (n & 1) dst[n++] = path->stroke[0];
+		}
+		memcpy(&dst[n], path->stroke, sizeof(NVGvertex) * path->nstroke);
+		n += path->nstroke;
+	}
+	copy->strokeCount = n;
+
+	if (glnvg__strokeUniforms(gl, call, paint, scissor, fringe, strokeWidth) == 0) goto error;
+
+	return;
+
+error:
+	// We get here if call alloc was ok, but something else is not.
+	// Roll back the last call to prevent drawing it.
+	if (gl->ncalls > 0) gl->ncalls--;
+}
+
+#if NANOVG_GL_USE_INSTANCING
+// Stores the direction bisecting the joint at each point between first and last in its texture coordinates.
+// The neighbouring segments of a joint split its pixels along the bisector, computing it once for both
+// makes sure that they agree on every pixel.
+static void glnvg__bisectJoints(NVGvertex* pts, int first, int last)
+{
+	int i;
+	for (i = first; i <= last; i++) {
+		float dx0 = pts[i].x - pts[i-1].x, dy0 = pts[i].y - pts[i-1].y;
+		float dx1 = pts[i+1].x - pts[i].x, dy1 = pts[i+1].y - pts[i].y;
+		float d0 = sqrtf(dx0*dx0 + dy0*dy0), d1 = sqrtf(dx1*dx1 + dy1*dy1), tx, ty, d;
+		if (d0 > 1e-6f) { dx0 /= d0; dy0 /= d0; }
+		if (d1 > 1e-6f) { dx1 /= d1; dy1 /= d1; }
+		tx = dx0 + dx1;
+		ty = dy0 + dy1;
+		d = sqrtf(tx*tx + ty*ty);
+		if (d < 1e-3f) {
+			// The path turns back, split along the segment.
+			tx = -dy0;
+			ty = dx0;
+			d = 1.0f;
+		}
+		pts[i].u = tx / d;
+		pts[i].v = ty / d;
+	}
+}
+
+static void glnvg__renderStrokeSegments(void* uptr, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor, float fringe,
+										float strokeWidth, int lineJoin, int lineCap, float miterLimit, const NVGpath* paths, int npaths)
+{
+	GLNVGcontext* gl = (GLNVGcontext*)uptr;
+	GLNVGcall* call = glnvg__allocCall(gl);
+	int i, n, maxverts, offset;
 
 	if (call == NULL) return;
 
@@ -1487,39 +2595,118 @@ static void glnvg__renderStroke(void* uptr, NVGpaint* paint, NVGcompositeOperati
 	call->pathCount = npaths;
 	call->image = paint->image;
 	call->blendFunc = glnvg__blendCompositeOperation(compositeOperation);
-
-	// Allocate vertices for all the paths.
-	maxverts = glnvg__maxVertCount(paths, npaths);
+	call->segments = 1;
+	call->strokeParams[0] = strokeWidth*0.5f;
+	call->strokeParams[1] = fringe;
+	call->strokeParams[2] = miterLimit;
+	call->strokeParams[3] = (float)(lineJoin*4 + lineCap);
+
+	// Allocate vertices for the points of all the paths and the neighbours of the first and last segment.
+	maxverts = 0;
+	for (i = 0; i < npaths; i++)
+		maxverts += paths[i].nstroke + 3;
 	offset = glnvg__allocVerts(gl, maxverts);
 	if (offset == -1) goto error;
 
 	for (i = 0; i < npaths; i++) {
 		GLNVGpath* copy = &gl->paths[call->pathOffset + i];
 		const NVGpath* path = &paths[i];
+		NVGvertex* dst = &gl->verts[offset];
 		memset(copy, 0, sizeof(GLNVGpath));
-		if (path->nstroke) {
-			copy->strokeOffset = offset;
-			copy->strokeCount = path->nstroke;
-			memcpy(&gl->verts[offset], path->stroke, sizeof(NVGvertex) * path->nstroke);
-			offset += path->nstroke;
+		n = path->nstroke;
+		if (n < 2) continue;
+		copy->strokeOffset = offset;
+		memcpy(&dst[1], path->stroke, sizeof(NVGvertex) * n);
+		if (path->closed) {
+			// Wrap around, the last segment goes back to the first point.
+			dst[0] = path->stroke[n-1];
+			dst[n+1] = path->stroke[0];
+			glnvg__bisectJoints(dst, 1, n);
+			dst[0] = dst[n];
+			dst[n+1] = dst[1];
+			dst[n+2] = dst[2];
+			copy->strokeCount = n;
+			offset += n+3;
+		} else {
+			// Repeated end points mark the caps.
+			dst[0] = path->stroke[0];
+			dst[n+1] = path->stroke[n-1];
+			glnvg__bisectJoints(dst, 2, n-1);
+			copy->strokeCount = n-1;
+			offset += n+2;
 		}
 	}
 
-	if (gl->flags & NVG_STENCIL_STROKES) {
-		// Fill shader
-		call->uniformOffset = glnvg__allocFragUniforms(gl, 2);
-		if (call->uniformOffset == -1) goto error;
+	if (glnvg__strokeUniforms(gl, call, paint, scissor, fringe, strokeWidth) == 0) goto error;
 
-		glnvg__convertPaint(gl, nvg__fragUniformPtr(gl, call->uniformOffset), paint, scissor, strokeWidth, fringe, -1.0f);
-		glnvg__convertPaint(gl, nvg__fragUniformPtr(gl, call->uniformOffset + gl->fragSize), paint, scissor, strokeWidth, fringe, 1.0f - 0.5f/255.0f);
+	return;
 
-	} else {
-		// Fill shader
-		call->uniformOffset = glnvg__allocFragUniforms(gl, 1);
-		if (call->uniformOffset == -1) goto error;
-		glnvg__convertPaint(gl, nvg__fragUniformPtr(gl, call->uniformOffset), paint, scissor, strokeWidth, fringe, -1.0f);
+error:
+	// We get here if call alloc was ok, but something else is not.
+	// Roll back the last call to prevent drawing it.
+	if (gl->ncalls > 0) gl->ncalls--;
+}
+#endif
+
+// Draws the shape as one quad covering it and its anti-aliased edge. The fragment shader maps the pixels
+// to the shape space with the inverse transform, where the distance to the shape is scaled to pixels.
+static void glnvg__renderShape(void* uptr, NVGpaint* paint, NVGcompositeOperationState compositeOperation, NVGscissor* scissor,
+							   float fringe, const NVGshape* shape)
+{
+	static const float corners[2][4][2] = {
+		{ {-1,-1}, {-1,1}, {1,-1}, {1,1} },
+		{ {-1,-1}, {1,-1}, {-1,1}, {1,1} },
+	};
+	GLNVGcontext* gl = (GLNVGcontext*)uptr;
+	GLNVGcall* call = glnvg__allocCall(gl);
+	GLNVGfragUniforms* frag;
+	NVGvertex* quad;
+	const float* t = shape->xform;
+	float scale = sqrtf(t[0]*t[0] + t[1]*t[1]);
+	float hw = shape->strokeWidth * 0.5f / scale;
+	float ex = shape->extent[0] + hw + fringe / scale;
+	float ey = shape->extent[1] + hw + fringe / scale;
+	float invxform[6];
+	int i, mirror = t[0]*t[3] - t[1]*t[2] < 0.0f;
+
+	if (call == NULL) return;
+
+	call->type = GLNVG_SHAPE;
+	call->image = paint->image;
+	call->blendFunc = glnvg__blendCompositeOperation(compositeOperation);
+
+	call->triangleOffset = glnvg__allocVerts(gl, 4);
+	if (call->triangleOffset == -1) goto error;
+	call->triangleCount = 4;
+
+	// Keep the winding of the strip when the transform mirrors the shape.
+	quad = &gl->verts[call->triangleOffset];
+	for (i = 0; i < 4; i++) {
+		nvgTransformPoint(&quad[i].x, &quad[i].y, t, corners[mirror][i][0] * ex, corners[mirror][i][1] * ey);
+		quad[i].u = 0.0f;
+		quad[i].v = 0.0f;
 	}
 
+	call->uniformOffset = glnvg__allocFragUniforms(gl, 1);
+	if (call->uniformOffset == -1) goto error;
+	frag = nvg__fragUniformPtr(gl, call->uniformOffset);
+	if (glnvg__convertPaint(gl, frag, paint, scissor, fringe, fringe, -1.0f) == 0) goto error;
+	nvgTransformInverse(invxform, t);
+	frag->shapeMat[0] = invxform[0];
+	frag->shapeMat[1] = invxform[2];
+	frag->shapeMat[2] = invxform[4];
+	frag->shapeMat[3] = hw;
+	frag->shapeMat[4] = invxform[1];
+	frag->shapeMat[5] = invxform[3];
+	frag->shapeMat[6] = invxform[5];
+	frag->shapeMat[7] = scale / fringe;
+	frag->shapeExtent[0] = shape->extent[0];
+	frag->shapeExtent[1] = shape->extent[1];
+	frag->shapeType = shape->type == NVG_SHAPE_ELLIPSE ? 1.0f : 0.0f;
+	frag->shapeJoin = shape->lineJoin == NVG_ROUND ? 1.0f : 0.0f;
+	memcpy(frag->shapeRadius, shape->radius, sizeof(frag->shapeRadius));
+	call->uniformOffset = glnvg__shareFragUniforms(gl, call->uniformOffset, 1);
+
 	return;
 
 error:
@@ -1547,6 +2734,19 @@ static void glnvg__renderTriangles(void* uptr, NVGpaint* paint, NVGcompositeOper
 	call->triangleCount = nverts;
 
 	memcpy(&gl->verts[call->triangleOffset], verts, sizeof(NVGvertex) * nverts);
+	if (paint->image != 0) {
+		GLNVGtexture* tex = glnvg__findTexture(gl, paint->image);
+		if (tex != NULL && tex->atlas != 0) {
+			// Map texture coordinates to the atlas page.
+			float s = 1.0f / NANOVG_GL_ATLAS_SIZE;
+			NVGvertex* v = &gl->verts[call->triangleOffset];
+			int i;
+			for (i = 0; i < nverts; i++) {
+				v[i].u = (tex->x + v[i].u * tex->width) * s;
+				v[i].v = (tex->y + v[i].v * tex->height) * s;
+			}
+		}
+	}
 
 	// Fill shader
 	call->uniformOffset = glnvg__allocFragUniforms(gl, 1);
@@ -1554,6 +2754,7 @@ static void glnvg__renderTriangles(void* uptr, NVGpaint* paint, NVGcompositeOper
 	frag = nvg__fragUniformPtr(gl, call->uniformOffset);
 	glnvg__convertPaint(gl, frag, paint, scissor, 1.0f, fringe, -1.0f);
 	frag->type = NSVG_SHADER_IMG;
+	call->uniformOffset = glnvg__shareFragUniforms(gl, call->uniformOffset, 1);
 
 	return;
 
@@ -1569,7 +2770,8 @@ static void glnvg__renderDelete(void* uptr)
 	int i;
 	if (gl == NULL) return;
 
-	glnvg__deleteShader(&gl->shader);
+	for (i = 0; i < NSVG_SHADER_COUNT * GLNVG_VARIANT_COUNT; i++)
+		glnvg__deleteShader(&gl->shaders[i]);
 
 #if NANOVG_GL3
 #if NANOVG_GL_USE_UNIFORMBUFFER
@@ -1583,51 +2785,93 @@ static void glnvg__renderDelete(void* uptr)
 		glDeleteBuffers(1, &gl->vertBuf);
 
 	for (i = 0; i < gl->ntextures; i++) {
-		if (gl->textures[i].tex != 0 && (gl->textures[i].flags & NVG_IMAGE_NODELETE) == 0)
+		if (gl->textures[i].atlas == 0 && gl->textures[i].tex != 0 && (gl->textures[i].flags & NVG_IMAGE_NODELETE) == 0)
 			glDeleteTextures(1, &gl->textures[i].tex);
 	}
-	free(gl->textures);
+	nvgInternalFree(&gl->allocator, gl->textures);
+
+	for (i = 0; i < gl->natlasPages; i++) {
+		if (gl->atlasPages[i].tex != 0)
+			glDeleteTextures(1, &gl->atlasPages[i].tex);
+		nvgInternalFree(&gl->allocator, gl->atlasPages[i].nodes);
+	}
+	nvgInternalFree(&gl->allocator, gl->atlasPages);
 
-	free(gl->paths);
-	free(gl->verts);
-	free(gl->uniforms);
-	free(gl->calls);
+	nvgInternalFree(&gl->allocator, gl->paths);
+	nvgInternalFree(&gl->allocator, gl->verts);
+	nvgInternalFree(&gl->allocator, gl->uniforms);
+	nvgInternalFree(&gl->allocator, gl->uniformHash);
+	nvgInternalFree(&gl->allocator, gl->calls);
 
-	free(gl);
+	nvgInternalFree(&gl->allocator, gl);
 }
 
 
 #if defined NANOVG_GL2
 NVGcontext* nvgCreateGL2(int flags)
+{
+	return nvgCreateWithAllocatorGL2(flags, NULL);
+}
 #elif defined NANOVG_GL3
 NVGcontext* nvgCreateGL3(int flags)
+{
+	return nvgCreateWithAllocatorGL3(flags, NULL);
+}
 #elif defined NANOVG_GLES2
 NVGcontext* nvgCreateGLES2(int flags)
+{
+	return nvgCreateWithAllocatorGLES2(flags, NULL);
+}
 #elif defined NANOVG_GLES3
 NVGcontext* nvgCreateGLES3(int flags)
+{
+	return nvgCreateWithAllocatorGLES3(flags, NULL);
+}
+#endif
+
+#if defined NANOVG_GL2
+NVGcontext* nvgCreateWithAllocatorGL2(int flags, const NVGallocator* allocator)
+#elif defined NANOVG_GL3
+NVGcontext* nvgCreateWithAllocatorGL3(int flags, const NVGallocator* allocator)
+#elif defined NANOVG_GLES2
+NVGcontext* nvgCreateWithAllocatorGLES2(int flags, const NVGallocator* allocator)
+#elif defined NANOVG_GLES3
+NVGcontext* nvgCreateWithAllocatorGLES3(int flags, const NVGallocator* allocator)
 #endif
 {
 	NVGparams params;
 	NVGcontext* ctx = NULL;
-	GLNVGcontext* gl = (GLNVGcontext*)malloc(sizeof(GLNVGcontext));
+	GLNVGcontext* gl = (GLNVGcontext*)nvgInternalAlloc(allocator, sizeof(GLNVGcontext));
 	if (gl == NULL) goto error;
 	memset(gl, 0, sizeof(GLNVGcontext));
+	if (allocator != NULL)
+		gl->allocator = *allocator;
 
 	memset(&params, 0, sizeof(params));
+	params.allocator = gl->allocator;
 	params.renderCreate = glnvg__renderCreate;
 	params.renderCreateTexture = glnvg__renderCreateTexture;
 	params.renderDeleteTexture = glnvg__renderDeleteTexture;
 	params.renderUpdateTexture = glnvg__renderUpdateTexture;
+	params.renderResizeTexture = glnvg__renderResizeTexture;
 	params.renderGetTextureSize = glnvg__renderGetTextureSize;
 	params.renderViewport = glnvg__renderViewport;
 	params.renderCancel = glnvg__renderCancel;
 	params.renderFlush = glnvg__renderFlush;
 	params.renderFill = glnvg__renderFill;
 	params.renderStroke = glnvg__renderStroke;
+#if NANOVG_GL_USE_INSTANCING
+	if ((flags & NVG_SEGMENT_STROKES) && (flags & NVG_ANTIALIAS))
+		params.renderStrokeSegments = glnvg__renderStrokeSegments;
+#endif
+	if ((flags & NVG_SDF_SHAPES) && (flags & NVG_ANTIALIAS))
+		params.renderShape = glnvg__renderShape;
 	params.renderTriangles = glnvg__renderTriangles;
 	params.renderDelete = glnvg__renderDelete;
 	params.userPtr = gl;
 	params.edgeAntiAlias = flags & NVG_ANTIALIAS ? 1 : 0;
+	params.triangulateFills = flags & NVG_TRIANGULATE_FILLS ? 1 : 0;
+	params.deferTessellation = flags & NVG_DEFERRED_TESSELLATION ? 1 : 0;
 
 	gl->flags = flags;
 
@@ -1691,7 +2935,63 @@ GLuint nvglImageHandleGLES3(NVGcontext* ctx, int image)
 {
 	GLNVGcontext* gl = (GLNVGcontext*)nvgInternalParams(ctx)->userPtr;
 	GLNVGtexture* tex = glnvg__findTexture(gl, image);
-	return tex->tex;
+	return tex != NULL ? tex->tex : 0;
+}
+
+#if defined NANOVG_GL2
+void nvglTextureBudgetGL2(NVGcontext* ctx, size_t bytes)
+#elif defined NANOVG_GL3
+void nvglTextureBudgetGL3(NVGcontext* ctx, size_t bytes)
+#elif defined NANOVG_GLES2
+void nvglTextureBudgetGLES2(NVGcontext* ctx, size_t bytes)
+#elif defined NANOVG_GLES3
+void nvglTextureBudgetGLES3(NVGcontext* ctx, size_t bytes)
+#endif
+{
+	GLNVGcontext* gl = (GLNVGcontext*)nvgInternalParams(ctx)->userPtr;
+	gl->textureBudget = bytes;
+	glnvg__evictTextures(gl);
+}
+
+#if defined NANOVG_GL2
+void nvglImageReloadableGL2(NVGcontext* ctx, int image, NVGLimageReload reload, void* userPtr)
+#elif defined NANOVG_GL3
+void nvglImageReloadableGL3(NVGcontext* ctx, int image, NVGLimageReload reload, void* userPtr)
+#elif defined NANOVG_GLES2
+void nvglImageReloadableGLES2(NVGcontext* ctx, int image, NVGLimageReload reload, void* userPtr)
+#elif defined NANOVG_GLES3
+void nvglImageReloadableGLES3(NVGcontext* ctx, int image, NVGLimageReload reload, void* userPtr)
+#endif
+{
+	GLNVGcontext* gl = (GLNVGcontext*)nvgInternalParams(ctx)->userPtr;
+	GLNVGtexture* tex = glnvg__findTexture(gl, image);
+
+	// Textures created from handles are owned by the application.
+	if (tex == NULL || (tex->flags & NVG_IMAGE_NODELETE) != 0) return;
+
+	if (tex->evicted && reload == NULL)
+		glnvg__restoreTexture(gl, tex);
+	if (tex->reload != NULL)
+		glnvg__lruRemove(gl, tex);
+	tex->reload = reload;
+	tex->reloadUserPtr = userPtr;
+	if (reload != NULL)
+		glnvg__lruPushFront(gl, tex);
+	glnvg__evictTextures(gl);
+}
+
+#if defined NANOVG_GL2
+size_t nvglTextureMemoryGL2(NVGcontext* ctx)
+#elif defined NANOVG_GL3
+size_t nvglTextureMemoryGL3(NVGcontext* ctx)
+#elif defined NANOVG_GLES2
+size_t nvglTextureMemoryGLES2(NVGcontext* ctx)
+#elif defined NANOVG_GLES3
+size_t nvglTextureMemoryGLES3(NVGcontext* ctx)
+#endif
+{
+	GLNVGcontext* gl = (GLNVGcontext*)nvgInternalParams(ctx)->userPtr;
+	return gl->textureBytes;
 }
 
 #endif /* NANOVG_GL_IMPLEMENTATION */
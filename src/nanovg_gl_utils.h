@@ -32,6 +32,90 @@ void nvgluBindFramebuffer(NVGLUframebuffer* fb);
 NVGLUframebuffer* nvgluCreateFramebuffer(NVGcontext* ctx, int w, int h, int imageFlags);
 void nvgluDeleteFramebuffer(NVGLUframebuffer* fb);
 
+// Layers
+//
+// A layer caches the result of a group of draw commands (e.g. a static gauge or map panel)
+// in an offscreen framebuffer, so that it can be redrawn as a single textured quad until
+// it is invalidated. Layers are identified by an user supplied id and are owned by a layer cache.
+// The cache keeps the total size of the layer framebuffers below a memory budget by evicting
+// the least recently drawn layers. When the largest scale a layer was drawn at differs more than
+// NVGLU_LAYER_SCALE_TOLERANCE from the scale it was rasterized at, the layer is re-rasterized
+// at the new scale on next nvgluBeginLayer().
+//
+// Layer contents are rendered outside of nvgBeginFrame()/nvgEndFrame(), and drawn inside:
+//
+//		if (nvgluBeginLayer(layers, GAUGE, 200, 200, pxRatio)) {
+//			drawGauge(vg);
+//			nvgluEndLayer(layers);
+//		}
+//		nvgBeginFrame(vg, winWidth, winHeight, pxRatio);
+//		...
+//		if (!nvgluDrawLayer(layers, GAUGE, x, y))
+//			drawGauge(vg); // Layer could not be allocated, draw directly.
+
+typedef struct NVGLUlayerCache NVGLUlayerCache;
+
+// Creates layer cache which keeps the layer framebuffers under budget bytes.
+NVGLUlayerCache* nvgluCreateLayerCache(NVGcontext* ctx, int budget);
+
+// Deletes layer cache and all of its layers.
+void nvgluDeleteLayerCache(NVGLUlayerCache* cache);
+
+// Begins rendering the contents of the layer of size (w,h) in local units.
+// Returns 1 if the layer needs to be rendered, in which case the layer framebuffer is bound,
+// a frame is started, and the contents should be drawn followed by nvgluEndLayer().
+// Returns 0 if the cached contents are still valid, or if the layer could not be allocated.
+int nvgluBeginLayer(NVGLUlayerCache* cache, int id, float w, float h, float devicePixelRatio);
+
+// Ends rendering the layer, and restores previous framebuffer and viewport.
+void nvgluEndLayer(NVGLUlayerCache* cache);
+
+// Draws the layer with top-left corner at (x,y) using current transform, composite operation and global alpha.
+// Returns 0 if the layer has no valid contents.
+int nvgluDrawLayer(NVGLUlayerCache* cache, int id, float x, float y);
+
+// Sets paint to an image pattern of the layer with top-left corner at (x,y), so that the layer can fill
+// any path, e.g. a rounded panel over a blurred backdrop. Returns 0 if the layer has no valid contents.
+int nvgluLayerPaint(NVGLUlayerCache* cache, int id, float x, float y, float alpha, NVGpaint* paint);
+
+// Marks the layer dirty so that it gets re-rendered on next nvgluBeginLayer().
+void nvgluInvalidateLayer(NVGLUlayerCache* cache, int id);
+
+// Deletes the layer and frees its framebuffer.
+void nvgluDeleteLayer(NVGLUlayerCache* cache, int id);
+
+// Returns number of bytes currently used by the layer framebuffers.
+int nvgluLayerCacheSize(NVGLUlayerCache* cache);
+
+// Blur
+//
+// Layers can be blurred with a Gaussian on the GPU, e.g. for soft drop shadows, and a blurred copy of
+// a region of the framebuffer can be captured into a layer as the backdrop of frosted glass panels.
+// The region is downsampled by halves until the blur is at most NVGLU_BLUR_MAX_SIGMA pixels wide,
+// and then blurred with separable horizontal and vertical passes, so the cost depends on the size of
+// the region and not on the blur radius. The intermediate framebuffers are pooled in the layer cache.
+//
+//		nvgBeginFrame(vg, winWidth, winHeight, pxRatio);
+//		drawBackground(vg);
+//		nvgEndFrame(vg);
+//		nvgluBackdropLayer(layers, PANEL, x, y, w, h, 8.0f, pxRatio);
+//		nvgBeginFrame(vg, winWidth, winHeight, pxRatio);
+//		if (nvgluLayerPaint(layers, PANEL, x, y, 1.0f, &paint)) {
+//			nvgBeginPath(vg);
+//			nvgRoundedRect(vg, x, y, w, h, 6.0f);
+//			nvgFillPaint(vg, paint);
+//			nvgFill(vg);
+//		}
+
+// Sets the standard deviation in local units of the blur applied to the layer when it is rendered,
+// 0 for none. The contents are blurred in nvgluEndLayer(), and are clamped at the border of the layer.
+void nvgluLayerBlur(NVGLUlayerCache* cache, int id, float sigma);
+
+// Captures the region (x,y,w,h) in local units of the currently bound framebuffer into the layer,
+// blurred with standard deviation sigma in local units. The layer is stored at the reduced resolution
+// of the blur. Must be called outside of nvgBeginFrame()/nvgEndFrame(). Returns 0 on failure.
+int nvgluBackdropLayer(NVGLUlayerCache* cache, int id, float x, float y, float w, float h, float sigma, float devicePixelRatio);
+
 #endif // NANOVG_GL_UTILS_H
 
 #ifdef NANOVG_GL_IMPLEMENTATION
@@ -59,7 +143,7 @@ NVGLUframebuffer* nvgluCreateFramebuffer(NVGcontext* ctx, int w, int h, int imag
 	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &defaultFBO);
 	glGetIntegerv(GL_RENDERBUFFER_BINDING, &defaultRBO);
 
-	fb = (NVGLUframebuffer*)malloc(sizeof(NVGLUframebuffer));
+	fb = (NVGLUframebuffer*)nvgInternalAlloc(&nvgInternalParams(ctx)->allocator, sizeof(NVGLUframebuffer));
 	if (fb == NULL) goto error;
 	memset(fb, 0, sizeof(NVGLUframebuffer));
 
@@ -133,7 +217,9 @@ void nvgluBindFramebuffer(NVGLUframebuffer* fb)
 void nvgluDeleteFramebuffer(NVGLUframebuffer* fb)
 {
 #ifdef NANOVG_FBO_VALID
+	NVGcontext* ctx;
 	if (fb == NULL) return;
+	ctx = fb->ctx;
 	if (fb->fbo != 0)
 		glDeleteFramebuffers(1, &fb->fbo);
 	if (fb->rbo != 0)
@@ -145,10 +231,719 @@ void nvgluDeleteFramebuffer(NVGLUframebuffer* fb)
 	fb->rbo = 0;
 	fb->texture = 0;
 	fb->image = -1;
-	free(fb);
+	nvgInternalFree(&nvgInternalParams(ctx)->allocator, fb);
 #else
 	NVG_NOTUSED(fb);
 #endif
 }
 
+#ifndef NVGLU_LAYER_SCALE_TOLERANCE
+#	define NVGLU_LAYER_SCALE_TOLERANCE 0.2f
+#endif
+
+// Largest standard deviation in pixels blurred without downsampling, the kernel reaches 3 sigma.
+#ifndef NVGLU_BLUR_MAX_SIGMA
+#	define NVGLU_BLUR_MAX_SIGMA 2.0f
+#endif
+
+#ifndef NVGLU_BLUR_MAX_LEVELS
+#	define NVGLU_BLUR_MAX_LEVELS 6
+#endif
+
+// Max number of pooled intermediate framebuffers, their size is rounded up to NVGLU_BLUR_TARGET_ALIGN.
+#ifndef NVGLU_BLUR_POOL_SIZE
+#	define NVGLU_BLUR_POOL_SIZE 8
+#endif
+#ifndef NVGLU_BLUR_TARGET_ALIGN
+#	define NVGLU_BLUR_TARGET_ALIGN 64
+#endif
+
+// Center tap and linearly filtered pairs of texels on each side.
+#define NVGLU_BLUR_TAPS 4
+
+struct NVGLUlayer {
+	int id;
+	float width, height;
+	float scale;			// Scale the contents were rasterized at.
+	float drawScale;		// Largest scale the layer was drawn at since rasterized.
+	int dirty;
+	int lastUsed;
+	int bytes;
+	float blur;				// Standard deviation of the blur in local units.
+	NVGLUframebuffer* fb;
+};
+typedef struct NVGLUlayer NVGLUlayer;
+
+struct NVGLUtarget {
+	NVGLUframebuffer* fb;
+	int width, height;
+	int inUse;
+	int lastUsed;
+};
+typedef struct NVGLUtarget NVGLUtarget;
+
+struct NVGLUblur {
+	GLNVGshader shader;
+	GLint locTex;
+	GLint locTaps;
+	GLint locDir;
+	GLint locMaxCoord;
+	GLuint vertBuf;
+#if defined NANOVG_GL3
+	GLuint vertArr;
+#endif
+	NVGLUtarget pool[NVGLU_BLUR_POOL_SIZE];
+	int npool;
+	GLint prevFBO;
+	GLint prevViewport[4];
+	GLboolean prevBlend;
+};
+typedef struct NVGLUblur NVGLUblur;
+
+struct NVGLUlayerCache {
+	NVGcontext* ctx;
+	NVGLUlayer* layers;
+	int nlayers;
+	int clayers;
+	int budget;
+	int bytes;
+	int clock;
+	NVGLUlayer* current;
+	GLint prevFBO;
+	GLint prevViewport[4];
+	NVGLUblur* blur;		// Created by the first blur.
+};
+
+NVGLUlayerCache* nvgluCreateLayerCache(NVGcontext* ctx, int budget)
+{
+	NVGLUlayerCache* cache = (NVGLUlayerCache*)nvgInternalAlloc(&nvgInternalParams(ctx)->allocator, sizeof(NVGLUlayerCache));
+	if (cache == NULL) return NULL;
+	memset(cache, 0, sizeof(NVGLUlayerCache));
+	cache->ctx = ctx;
+	cache->budget = budget;
+	return cache;
+}
+
+static void nvglu__freeLayer(NVGLUlayerCache* cache, NVGLUlayer* layer)
+{
+	if (layer->fb != NULL) {
+		nvgluDeleteFramebuffer(layer->fb);
+		cache->bytes -= layer->bytes;
+	}
+	layer->fb = NULL;
+	layer->bytes = 0;
+	layer->dirty = 1;
+}
+
+static void nvglu__deleteBlur(NVGLUlayerCache* cache);
+
+void nvgluDeleteLayerCache(NVGLUlayerCache* cache)
+{
+	int i;
+	if (cache == NULL) return;
+	for (i = 0; i < cache->nlayers; i++)
+		nvglu__freeLayer(cache, &cache->layers[i]);
+	nvglu__deleteBlur(cache);
+	nvgInternalFree(&nvgInternalParams(cache->ctx)->allocator, cache->layers);
+	nvgInternalFree(&nvgInternalParams(cache->ctx)->allocator, cache);
+}
+
+static NVGLUlayer* nvglu__findLayer(NVGLUlayerCache* cache, int id)
+{
+	int i;
+	for (i = 0; i < cache->nlayers; i++)
+		if (cache->layers[i].id == id)
+			return &cache->layers[i];
+	return NULL;
+}
+
+static NVGLUlayer* nvglu__allocLayer(NVGLUlayerCache* cache, int id)
+{
+	NVGLUlayer* layer = NULL;
+	if (cache->nlayers+1 > cache->clayers) {
+		NVGLUlayer* layers;
+		int clayers = cache->nlayers+1 + cache->clayers/2;
+		layers = (NVGLUlayer*)nvgInternalRealloc(&nvgInternalParams(cache->ctx)->allocator, cache->layers, sizeof(NVGLUlayer)*clayers);
+		if (layers == NULL) return NULL;
+		cache->layers = layers;
+		cache->clayers = clayers;
+	}
+	layer = &cache->layers[cache->nlayers++];
+	memset(layer, 0, sizeof(*layer));
+	layer->id = id;
+	layer->scale = 1.0f;
+	layer->drawScale = 0.0f;
+	layer->dirty = 1;
+	return layer;
+}
+
+static void nvglu__deleteBlur(NVGLUlayerCache* cache)
+{
+#ifdef NANOVG_FBO_VALID
+	NVGLUblur* blur = cache->blur;
+	int i;
+	if (blur == NULL) return;
+	for (i = 0; i < blur->npool; i++)
+		nvgluDeleteFramebuffer(blur->pool[i].fb);
+	glnvg__deleteShader(&blur->shader);
+	if (blur->vertBuf != 0)
+		glDeleteBuffers(1, &blur->vertBuf);
+#if defined NANOVG_GL3
+	if (blur->vertArr != 0)
+		glDeleteVertexArrays(1, &blur->vertArr);
+#endif
+	nvgInternalFree(&nvgInternalParams(cache->ctx)->allocator, blur);
+	cache->blur = NULL;
+#else
+	NVG_NOTUSED(cache);
+#endif
+}
+
+#ifdef NANOVG_FBO_VALID
+static NVGLUblur* nvglu__createBlur(NVGLUlayerCache* cache)
+{
+	static const char* blurHeader =
+#if defined NANOVG_GL2
+		"#define NANOVG_GL2 1\n"
+#elif defined NANOVG_GL3
+		"#version 150 core\n"
+		"#define NANOVG_GL3 1\n"
+#elif defined NANOVG_GLES2
+		"#version 100\n"
+		"#define NANOVG_GL2 1\n"
+#elif defined NANOVG_GLES3
+		"#version 300 es\n"
+		"#define NANOVG_GL3 1\n"
+#endif
+		"\n";
+
+	static const char* blurVertShader =
+		"#ifdef NANOVG_GL3\n"
+		"	in vec2 vertex;\n"
+		"	in vec2 tcoord;\n"
+		"	out vec2 uv;\n"
+		"#else\n"
+		"	attribute vec2 vertex;\n"
+		"	attribute vec2 tcoord;\n"
+		"	varying vec2 uv;\n"
+		"#endif\n"
+		"void main(void) {\n"
+		"	uv = tcoord;\n"
+		"	gl_Position = vec4(vertex, 0.0, 1.0);\n"
+		"}\n";
+
+	static const char* blurFragShader =
+		"#ifdef GL_ES\n"
+		"#if defined(GL_FRAGMENT_PRECISION_HIGH) || defined(NANOVG_GL3)\n"
+		" precision highp float;\n"
+		"#else\n"
+		" precision mediump float;\n"
+		"#endif\n"
+		"#endif\n"
+		"#ifdef NANOVG_GL3\n"
+		"	in vec2 uv;\n"
+		"	out vec4 outColor;\n"
+		"#else\n"
+		"	varying vec2 uv;\n"
+		"#endif\n"
+		"uniform sampler2D tex;\n"
+		"uniform vec2 taps[4];\n"		// Offset in texels along dir and weight.
+		"uniform vec2 dir;\n"
+		"uniform vec2 maxCoord;\n"		// Last valid texel center, the texture may be larger than the blurred region.
+		"vec4 tap(vec2 pt) {\n"
+		"#ifdef NANOVG_GL3\n"
+		"	return texture(tex, min(pt, maxCoord));\n"
+		"#else\n"
+		"	return texture2D(tex, min(pt, maxCoord));\n"
+		"#endif\n"
+		"}\n"
+		"void main(void) {\n"
+		"	vec4 color = tap(uv) * taps[0].y;\n"
+		"	for (int i = 1; i < 4; i++) {\n"
+		"		vec2 d = dir * taps[i].x;\n"
+		"		color += (tap(uv + d) + tap(uv - d)) * taps[i].y;\n"
+		"	}\n"
+		"#ifdef NANOVG_GL3\n"
+		"	outColor = color;\n"
+		"#else\n"
+		"	gl_FragColor = color;\n"
+		"#endif\n"
+		"}\n";
+
+	NVGLUblur* blur = (NVGLUblur*)nvgInternalAlloc(&nvgInternalParams(cache->ctx)->allocator, sizeof(NVGLUblur));
+	if (blur == NULL) return NULL;
+	memset(blur, 0, sizeof(NVGLUblur));
+	cache->blur = blur;
+
+	if (glnvg__createShader(&blur->shader, "blur", blurHeader, NULL, blurVertShader, blurFragShader) == 0) goto error;
+	blur->locTex = glGetUniformLocation(blur->shader.prog, "tex");
+	blur->locTaps = glGetUniformLocation(blur->shader.prog, "taps");
+	blur->locDir = glGetUniformLocation(blur->shader.prog, "dir");
+	blur->locMaxCoord = glGetUniformLocation(blur->shader.prog, "maxCoord");
+
+#if defined NANOVG_GL3
+	glGenVertexArrays(1, &blur->vertArr);
+#endif
+	glGenBuffers(1, &blur->vertBuf);
+
+	return blur;
+error:
+	nvglu__deleteBlur(cache);
+	return NULL;
+}
+
+// Returns an unused pooled framebuffer of at least w x h pixels, or NULL if all are in use.
+static NVGLUtarget* nvglu__acquireTarget(NVGLUlayerCache* cache, int w, int h)
+{
+	NVGLUblur* blur = cache->blur;
+	NVGLUtarget* target = NULL;
+	int i;
+
+	for (i = 0; i < blur->npool; i++) {
+		NVGLUtarget* t = &blur->pool[i];
+		if (t->inUse || t->width < w || t->height < h) continue;
+		if (target == NULL || t->width * t->height < target->width * target->height)
+			target = t;
+	}
+	if (target == NULL) {
+		// Replace the least recently used framebuffer when the pool is full.
+		if (blur->npool < NVGLU_BLUR_POOL_SIZE) {
+			target = &blur->pool[blur->npool++];
+		} else {
+			for (i = 0; i < blur->npool; i++) {
+				NVGLUtarget* t = &blur->pool[i];
+				if (!t->inUse && (target == NULL || t->lastUsed < target->lastUsed))
+					target = t;
+			}
+			if (target == NULL) return NULL;
+			nvgluDeleteFramebuffer(target->fb);
+		}
+		memset(target, 0, sizeof(*target));
+		target->width = (w + NVGLU_BLUR_TARGET_ALIGN-1) / NVGLU_BLUR_TARGET_ALIGN * NVGLU_BLUR_TARGET_ALIGN;
+		target->height = (h + NVGLU_BLUR_TARGET_ALIGN-1) / NVGLU_BLUR_TARGET_ALIGN * NVGLU_BLUR_TARGET_ALIGN;
+		target->fb = nvgluCreateFramebuffer(cache->ctx, target->width, target->height, 0);
+		if (target->fb == NULL) {
+			*target = blur->pool[--blur->npool];
+			return NULL;
+		}
+	}
+	target->inUse = 1;
+	target->lastUsed = ++cache->clock;
+	return target;
+}
+
+// Computes the taps of a Gaussian reaching 3 sigma, pairs of texels are sampled at once with linear filtering.
+static void nvglu__blurTaps(float* taps, float sigma)
+{
+	float w[NVGLU_BLUR_TAPS*2-1], sum = 0.0f;
+	int i;
+	for (i = 0; i < NVGLU_BLUR_TAPS*2-1; i++) {
+		w[i] = sigma > 0.01f ? expf(-(float)(i*i) / (2.0f*sigma*sigma)) : (i == 0 ? 1.0f : 0.0f);
+		sum += i == 0 ? w[i] : w[i]*2.0f;
+	}
+	taps[0] = 0.0f;
+	taps[1] = w[0] / sum;
+	for (i = 1; i < NVGLU_BLUR_TAPS; i++) {
+		float a = w[i*2-1], b = w[i*2];
+		taps[i*2+0] = a + b > 0.0f ? ((i*2-1)*a + i*2*b) / (a + b) : 0.0f;
+		taps[i*2+1] = (a + b) / sum;
+	}
+}
+
+// Draws the rectangle rect (x0,y0,x1,y1) in texels of the texture src of size (tw,th) into the framebuffer fbo of
+// size (dw,dh), blurred along the direction (dx,dy). Only the texels (0,0)-(aw,ah) of the texture are sampled.
+static void nvglu__blurPass(NVGLUblur* blur, GLuint src, int tw, int th, int aw, int ah, const float* rect,
+							GLuint fbo, int dw, int dh, float dx, float dy, float sigma)
+{
+	float u0 = rect[0] / tw, v0 = rect[1] / th, u1 = rect[2] / tw, v1 = rect[3] / th;
+	float verts[16] = {
+		-1.0f, -1.0f, u0, v0,
+		 1.0f, -1.0f, u1, v0,
+		-1.0f,  1.0f, u0, v1,
+		 1.0f,  1.0f, u1, v1,
+	};
+	float taps[NVGLU_BLUR_TAPS*2];
+
+	nvglu__blurTaps(taps, sigma);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, dw, dh);
+	glBindTexture(GL_TEXTURE_2D, src);
+	glUniform2fv(blur->locTaps, NVGLU_BLUR_TAPS, taps);
+	glUniform2f(blur->locDir, dx / tw, dy / th);
+	glUniform2f(blur->locMaxCoord, (aw - 0.5f) / tw, (ah - 0.5f) / th);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STREAM_DRAW);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+// Returns the scale the blur is computed at, halved until sigma in pixels is at most NVGLU_BLUR_MAX_SIGMA.
+static float nvglu__blurScale(float sigma, int* levels)
+{
+	float scale = 1.0f;
+	*levels = 0;
+	while (sigma * scale > NVGLU_BLUR_MAX_SIGMA && *levels < NVGLU_BLUR_MAX_LEVELS) {
+		scale *= 0.5f;
+		(*levels)++;
+	}
+	return scale;
+}
+
+// Blurs the texels (0,0)-(aw,ah) of the texture src of size (tw,th) with standard deviation sigma in texels,
+// and draws the rectangle rect (x0,y0,x1,y1) in texels of the result into the framebuffer fbo of size (dw,dh).
+// Restores the framebuffer, viewport and blending. Returns 0 if the intermediate framebuffers could not be allocated.
+static int nvglu__blur(NVGLUlayerCache* cache, GLuint src, int tw, int th, int aw, int ah, const float* rect,
+					   GLuint fbo, int dw, int dh, float sigma)
+{
+	NVGLUblur* blur = cache->blur;
+	NVGLUtarget* level = NULL;
+	NVGLUtarget* target = NULL;
+	float r[4], scale;
+	int i, levels, ret = 0;
+
+	if (blur == NULL) blur = nvglu__createBlur(cache);
+	if (blur == NULL) return 0;
+	scale = nvglu__blurScale(sigma, &levels);
+	sigma *= scale;
+	// The averaging of the downsampling and the bilinear upsampling add about a quarter texel of variance.
+	if (levels > 0)
+		sigma = sqrtf(sigma*sigma - 0.25f);
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &blur->prevFBO);
+	glGetIntegerv(GL_VIEWPORT, blur->prevViewport);
+	blur->prevBlend = glIsEnabled(GL_BLEND);
+	glDisable(GL_BLEND);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_STENCIL_TEST);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glActiveTexture(GL_TEXTURE0);
+	glUseProgram(blur->shader.prog);
+	glUniform1i(blur->locTex, 0);
+#if defined NANOVG_GL3
+	glBindVertexArray(blur->vertArr);
+#endif
+	glBindBuffer(GL_ARRAY_BUFFER, blur->vertBuf);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (const GLvoid*)(size_t)0);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (const GLvoid*)(2*sizeof(float)));
+
+	// Downsample by halves, a texel of the next level is the average of 2x2 texels.
+	for (i = 0; i < levels; i++) {
+		int w = (aw+1) / 2, h = (ah+1) / 2;
+		target = nvglu__acquireTarget(cache, w, h);
+		if (target == NULL) goto error;
+		r[0] = 0.0f; r[1] = 0.0f; r[2] = (float)(w*2); r[3] = (float)(h*2);
+		nvglu__blurPass(blur, src, tw, th, aw, ah, r, target->fb->fbo, w, h, 0.0f, 0.0f, 0.0f);
+		if (level != NULL) level->inUse = 0;
+		level = target;
+		src = level->fb->texture;
+		tw = level->width;
+		th = level->height;
+		aw = w;
+		ah = h;
+	}
+
+	// Horizontal pass into a temporary framebuffer, vertical pass into the destination.
+	target = nvglu__acquireTarget(cache, aw, ah);
+	if (target == NULL) goto error;
+	r[0] = 0.0f; r[1] = 0.0f; r[2] = (float)aw; r[3] = (float)ah;
+	nvglu__blurPass(blur, src, tw, th, aw, ah, r, target->fb->fbo, aw, ah, 1.0f, 0.0f, sigma);
+	for (i = 0; i < 4; i++)
+		r[i] = rect[i] * scale;
+	nvglu__blurPass(blur, target->fb->texture, target->width, target->height, aw, ah, r, fbo, dw, dh, 0.0f, 1.0f, sigma);
+	target->inUse = 0;
+	ret = 1;
+
+error:
+	if (level != NULL) level->inUse = 0;
+	glDisableVertexAttribArray(0);
+	glDisableVertexAttribArray(1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+#if defined NANOVG_GL3
+	glBindVertexArray(0);
+#endif
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+	if (blur->prevBlend) glEnable(GL_BLEND);
+	glBindFramebuffer(GL_FRAMEBUFFER, blur->prevFBO);
+	glViewport(blur->prevViewport[0], blur->prevViewport[1], blur->prevViewport[2], blur->prevViewport[3]);
+	return ret;
+}
+
+// Evicts least recently used layers until bytes fit in the budget.
+static int nvglu__evictLayers(NVGLUlayerCache* cache, NVGLUlayer* keep, int bytes)
+{
+	while (cache->bytes + bytes > cache->budget) {
+		NVGLUlayer* lru = NULL;
+		int i;
+		for (i = 0; i < cache->nlayers; i++) {
+			NVGLUlayer* layer = &cache->layers[i];
+			if (layer == keep || layer->fb == NULL) continue;
+			if (lru == NULL || layer->lastUsed < lru->lastUsed)
+				lru = layer;
+		}
+		if (lru == NULL) return 0;
+		nvglu__freeLayer(cache, lru);
+	}
+	return 1;
+}
+
+// Makes sure that the framebuffer of the layer is fboWidth x fboHeight pixels.
+static int nvglu__allocFramebuffer(NVGLUlayerCache* cache, NVGLUlayer* layer, int fboWidth, int fboHeight)
+{
+	int bytes, iw = 0, ih = 0;
+
+	if (fboWidth < 1 || fboHeight < 1) return 0;
+	bytes = fboWidth * fboHeight * 5; // RGBA color + stencil.
+
+	if (layer->fb != NULL) {
+		nvgImageSize(cache->ctx, layer->fb->image, &iw, &ih);
+		if (iw != fboWidth || ih != fboHeight)
+			nvglu__freeLayer(cache, layer);
+	}
+	if (layer->fb == NULL) {
+		if (!nvglu__evictLayers(cache, layer, bytes)) return 0;
+		layer->fb = nvgluCreateFramebuffer(cache->ctx, fboWidth, fboHeight, 0);
+		if (layer->fb == NULL) return 0;
+		layer->bytes = bytes;
+		cache->bytes += bytes;
+	}
+	return 1;
+}
+#endif
+
+int nvgluBeginLayer(NVGLUlayerCache* cache, int id, float w, float h, float devicePixelRatio)
+{
+#ifdef NANOVG_FBO_VALID
+	NVGLUlayer* layer;
+	float scale;
+	int fboWidth, fboHeight;
+
+	if (cache == NULL || cache->current != NULL) return 0;
+
+	layer = nvglu__findLayer(cache, id);
+	if (layer == NULL) {
+		layer = nvglu__allocLayer(cache, id);
+		if (layer == NULL) return 0;
+	}
+	if (layer->width != w || layer->height != h) {
+		layer->width = w;
+		layer->height = h;
+		layer->dirty = 1;
+	}
+	if (layer->drawScale > 0.0f) {
+		float ratio = layer->drawScale / layer->scale;
+		if (ratio > 1.0f + NVGLU_LAYER_SCALE_TOLERANCE || ratio < 1.0f / (1.0f + NVGLU_LAYER_SCALE_TOLERANCE)) {
+			layer->scale = layer->drawScale;
+			layer->dirty = 1;
+		}
+	}
+	if (!layer->dirty && layer->fb != NULL)
+		return 0;
+
+	scale = layer->scale * devicePixelRatio;
+	fboWidth = (int)ceilf(w * scale);
+	fboHeight = (int)ceilf(h * scale);
+	if (!nvglu__allocFramebuffer(cache, layer, fboWidth, fboHeight)) return 0;
+	layer->drawScale = 0.0f;
+	layer->dirty = 0;
+	cache->current = layer;
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &cache->prevFBO);
+	glGetIntegerv(GL_VIEWPORT, cache->prevViewport);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, layer->fb->fbo);
+	glViewport(0, 0, fboWidth, fboHeight);
+	glClearColor(0, 0, 0, 0);
+	glClearStencil(0);
+	glClear(GL_COLOR_BUFFER_BIT|GL_STENCIL_BUFFER_BIT);
+	nvgBeginFrame(cache->ctx, w, h, scale);
+
+	return 1;
+#else
+	NVG_NOTUSED(cache);
+	NVG_NOTUSED(id);
+	NVG_NOTUSED(w);
+	NVG_NOTUSED(h);
+	NVG_NOTUSED(devicePixelRatio);
+	return 0;
+#endif
+}
+
+void nvgluEndLayer(NVGLUlayerCache* cache)
+{
+#ifdef NANOVG_FBO_VALID
+	NVGLUlayer* layer;
+	if (cache == NULL || cache->current == NULL) return;
+	layer = cache->current;
+	nvgEndFrame(cache->ctx);
+	if (layer->blur > 0.0f) {
+		int w = 0, h = 0;
+		float rect[4];
+		nvgImageSize(cache->ctx, layer->fb->image, &w, &h);
+		rect[0] = 0.0f; rect[1] = 0.0f; rect[2] = (float)w; rect[3] = (float)h;
+		nvglu__blur(cache, layer->fb->texture, w, h, w, h, rect, layer->fb->fbo, w, h, layer->blur * w / layer->width);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, cache->prevFBO);
+	glViewport(cache->prevViewport[0], cache->prevViewport[1], cache->prevViewport[2], cache->prevViewport[3]);
+	cache->current = NULL;
+#else
+	NVG_NOTUSED(cache);
+#endif
+}
+
+static NVGLUlayer* nvglu__layerPaint(NVGLUlayerCache* cache, int id, float x, float y, float alpha, NVGpaint* paint)
+{
+	NVGcontext* ctx;
+	NVGLUlayer* layer;
+	float xform[6], scale;
+
+	if (cache == NULL) return NULL;
+	layer = nvglu__findLayer(cache, id);
+	if (layer == NULL || layer->fb == NULL) return NULL;
+	ctx = cache->ctx;
+
+	layer->lastUsed = ++cache->clock;
+
+	// Track the largest scale the layer is drawn at, nvgluBeginLayer() re-rasterizes
+	// the layer if it differs too much from the scale the layer was rasterized at.
+	nvgCurrentTransform(ctx, xform);
+	scale = (sqrtf(xform[0]*xform[0] + xform[2]*xform[2]) + sqrtf(xform[1]*xform[1] + xform[3]*xform[3])) * 0.5f;
+	if (scale > layer->drawScale)
+		layer->drawScale = scale;
+
+	*paint = nvgImagePattern(ctx, x, y, layer->width, layer->height, 0.0f, layer->fb->image, alpha);
+	return layer;
+}
+
+int nvgluDrawLayer(NVGLUlayerCache* cache, int id, float x, float y)
+{
+	NVGpaint paint;
+	NVGLUlayer* layer = nvglu__layerPaint(cache, id, x, y, 1.0f, &paint);
+	if (layer == NULL) return 0;
+
+	nvgBeginPath(cache->ctx);
+	nvgRect(cache->ctx, x, y, layer->width, layer->height);
+	nvgFillPaint(cache->ctx, paint);
+	nvgFill(cache->ctx);
+
+	return 1;
+}
+
+int nvgluLayerPaint(NVGLUlayerCache* cache, int id, float x, float y, float alpha, NVGpaint* paint)
+{
+	return nvglu__layerPaint(cache, id, x, y, alpha, paint) != NULL;
+}
+
+void nvgluInvalidateLayer(NVGLUlayerCache* cache, int id)
+{
+	NVGLUlayer* layer;
+	if (cache == NULL) return;
+	layer = nvglu__findLayer(cache, id);
+	if (layer != NULL)
+		layer->dirty = 1;
+}
+
+void nvgluDeleteLayer(NVGLUlayerCache* cache, int id)
+{
+	NVGLUlayer* layer;
+	if (cache == NULL) return;
+	layer = nvglu__findLayer(cache, id);
+	if (cache->current != NULL || layer == NULL) return;
+	nvglu__freeLayer(cache, layer);
+	*layer = cache->layers[--cache->nlayers];
+}
+
+int nvgluLayerCacheSize(NVGLUlayerCache* cache)
+{
+	return cache != NULL ? cache->bytes : 0;
+}
+
+void nvgluLayerBlur(NVGLUlayerCache* cache, int id, float sigma)
+{
+	NVGLUlayer* layer;
+	if (cache == NULL) return;
+	layer = nvglu__findLayer(cache, id);
+	if (layer == NULL && cache->current == NULL)
+		layer = nvglu__allocLayer(cache, id);
+	if (layer == NULL) return;
+	sigma = sigma > 0.0f ? sigma : 0.0f;
+	if (layer->blur != sigma) {
+		layer->blur = sigma;
+		layer->dirty = 1;
+	}
+}
+
+int nvgluBackdropLayer(NVGLUlayerCache* cache, int id, float x, float y, float w, float h, float sigma, float devicePixelRatio)
+{
+#ifdef NANOVG_FBO_VALID
+	NVGLUlayer* layer;
+	NVGLUtarget* capture;
+	GLint viewport[4];
+	float rect[4], scale;
+	int x0, y0, x1, y1, cx0, cy0, cx1, cy1, pad, levels, fboWidth, fboHeight, ret;
+
+	if (cache == NULL || cache->current != NULL) return 0;
+	layer = nvglu__findLayer(cache, id);
+	if (layer == NULL) {
+		layer = nvglu__allocLayer(cache, id);
+		if (layer == NULL) return 0;
+	}
+	layer->width = w;
+	layer->height = h;
+	layer->dirty = 1;
+	if (cache->blur == NULL && nvglu__createBlur(cache) == NULL) return 0;
+
+	// Region in framebuffer pixels, which are bottom-up.
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	x0 = viewport[0] + (int)floorf(x * devicePixelRatio);
+	x1 = viewport[0] + (int)ceilf((x + w) * devicePixelRatio);
+	y0 = viewport[1] + viewport[3] - (int)ceilf((y + h) * devicePixelRatio);
+	y1 = viewport[1] + viewport[3] - (int)floorf(y * devicePixelRatio);
+	sigma *= devicePixelRatio;
+
+	// Capture the surroundings the blur reaches too, clamped to the viewport.
+	pad = (int)ceilf(sigma * 3.0f);
+	cx0 = x0 - pad > viewport[0] ? x0 - pad : viewport[0];
+	cy0 = y0 - pad > viewport[1] ? y0 - pad : viewport[1];
+	cx1 = x1 + pad < viewport[0] + viewport[2] ? x1 + pad : viewport[0] + viewport[2];
+	cy1 = y1 + pad < viewport[1] + viewport[3] ? y1 + pad : viewport[1] + viewport[3];
+	if (x1 <= x0 || y1 <= y0 || cx1 <= cx0 || cy1 <= cy0) return 0;
+
+	// The layer is stored at the resolution the blur is computed at.
+	scale = nvglu__blurScale(sigma, &levels);
+	fboWidth = (int)ceilf((x1 - x0) * scale);
+	fboHeight = (int)ceilf((y1 - y0) * scale);
+	if (!nvglu__allocFramebuffer(cache, layer, fboWidth, fboHeight)) return 0;
+
+	capture = nvglu__acquireTarget(cache, cx1 - cx0, cy1 - cy0);
+	if (capture == NULL) return 0;
+	glBindTexture(GL_TEXTURE_2D, capture->fb->texture);
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, cx0, cy0, cx1 - cx0, cy1 - cy0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	rect[0] = (float)(x0 - cx0);
+	rect[1] = (float)(y0 - cy0);
+	rect[2] = rect[0] + fboWidth / scale;
+	rect[3] = rect[1] + fboHeight / scale;
+	ret = nvglu__blur(cache, capture->fb->texture, capture->width, capture->height, cx1 - cx0, cy1 - cy0, rect,
+					  layer->fb->fbo, fboWidth, fboHeight, sigma);
+	capture->inUse = 0;
+	layer->dirty = ret == 0;
+
+	return ret;
+#else
+	NVG_NOTUSED(cache);
+	NVG_NOTUSED(id);
+	NVG_NOTUSED(x);
+	NVG_NOTUSED(y);
+	NVG_NOTUSED(w);
+	NVG_NOTUSED(h);
+	NVG_NOTUSED(sigma);
+	NVG_NOTUSED(devicePixelRatio);
+	return 0;
+#endif
+}
+
 #endif // NANOVG_GL_IMPLEMENTATION